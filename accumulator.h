@@ -3,6 +3,8 @@
 
 #include <stdlib.h>
 #include "timing.h"
+#include "log.h"
+#include "arena.h"
 
 // ---------------------------------------------------------------------------
 //
@@ -10,18 +12,55 @@
 //
 // Class that encapsulates a spectrum and some ancillary information.  It is
 // intended to facilitate accumulating spectra in place through the "add" 
-// member function. 
+// member function.  Optionally, a parallel sum of the power squared in each
+// channel can be kept so that the per-channel variance and spectral kurtosis 
+// can be derived for each accumulation.
+//
+// Optionally, the accumulation can also be split into a series of shorter 
+// sub-accumulations (see initSubs).  In that case each spectrum is added only
+// to the current sub-accumulation and the full spectrum is formed by calling
+// combineSubs() once the accumulation is complete.  The sub-accumulations are
+// slots in a single ring of spectra that starts over with each accumulation,
+// so a thousand of them cost a thousand spectra and not a thousand 
+// accumulators.
+//
+// When the channelizer only outputs a range of its channels, the position of 
+// that range within the full channelizer output can be recorded with 
+// setChannelRange() so that writers can treat channels by absolute index.
+//
+// Coarser resolutions can also be derived from the same spectra (see 
+// addBinning).  Each added spectrum is binned by summing neighboring pairs
+// of channels, then pairs of those sums and so on, and each resolution 
+// takes the spectrum at its binning factor into its own series of 
+// accumulations (split like the sub-accumulations above, so each resolution
+// has its own accumulation length).  Only the power is binned.
+//
+// With initWeights(), each channel also keeps the sum of the weights it was
+// added with (see ChannelizerData::pWeights), i.e. the number of spectra in
+// which it wasn't masked by RFI flagging.  normalizeWeights() then scales
+// each channel so that its average over getNumAccums() spectra is its 
+// average over the spectra it was kept in.  With initFlags(), each channel
+// also counts the spectra it was flagged in (see addFlags), including 
+// spectra the flagger skipped and that were never added.
 //
 // ---------------------------------------------------------------------------
 
 #define ACCUM_DATA_TYPE double
+#define ACCUM_MAX_BINNED 4
 
 class Accumulator {
 
   private:
 
+    struct SubInfo {
+      unsigned int  uNumAccums;
+      double        dStartTime;       // Seconds since 1970 (see combineSubs)
+      double        dStopTime;
+    };
+
     // Member variables
     ACCUM_DATA_TYPE*     m_pSpectrum;
+    ACCUM_DATA_TYPE*     m_pSpectrum2;
     unsigned int    m_uDataLength;
     unsigned int    m_uNumAccums;
     double          m_dADCmin;
@@ -31,25 +70,219 @@ class Accumulator {
     double          m_dChannelFactor;
     double          m_dTemperature;
     unsigned long   m_uDrops;
+    unsigned long   m_uSkips;         // Skipped on purpose (see OverloadController)
     unsigned int    m_uId;
     TimeKeeper      m_startTime;
     TimeKeeper      m_stopTime;
+    ACCUM_DATA_TYPE* m_pSubRing;      // m_uNumSubs slots of m_uSubStride values (NULL if off)
+    SubInfo*        m_pSubInfo;       // One per slot
+    unsigned int    m_uSubStride;     // Sum, then power squared and weights if kept
+    unsigned int    m_uNumSubs;
+    unsigned int    m_uSpectraPerSub;
+    unsigned int    m_uCurrentSub;
+    unsigned int    m_uFirstChannel;
+    unsigned int    m_uTotalChannels;
+    Accumulator*    m_pBinned[ACCUM_MAX_BINNED];
+    unsigned int    m_uBinFactor[ACCUM_MAX_BINNED];
+    unsigned int    m_uNumBinned;
+    ACCUM_DATA_TYPE* m_pBinScratch;   // Every binning pass, one after another
+    ACCUM_DATA_TYPE* m_pWeights;      // Sum of weights per channel (NULL if not kept)
+    ACCUM_DATA_TYPE* m_pFlags;        // Times each channel was flagged (NULL if not kept)
+
+    // Sum, power squared and weights of sub-accumulation i (NULL if not kept)
+    ACCUM_DATA_TYPE* subSum(unsigned int i) const 
+    { 
+      return m_pSubRing + (size_t) i * m_uSubStride; 
+    }
+
+    ACCUM_DATA_TYPE* subSum2(unsigned int i) const 
+    { 
+      return m_pSpectrum2 ? subSum(i) + m_uDataLength : NULL; 
+    }
+
+    ACCUM_DATA_TYPE* subWeights(unsigned int i) const 
+    { 
+      return m_pWeights ? subSum(i) + (m_pSpectrum2 ? 2 : 1) * m_uDataLength : NULL; 
+    }
+
+    // (Re)allocates the ring of sub-accumulations for the current length, 
+    // second moment and weights.  Leaves it to the caller to clear it.
+    bool allocSubs()
+    {
+      if (m_pSubRing) {
+        Arena::free(m_pSubRing);
+        m_pSubRing = NULL;
+      }
+
+      if (m_uNumSubs == 0) {
+        return true;
+      }
+
+      m_uSubStride = m_uDataLength * (1 + (m_pSpectrum2 ? 1 : 0) + (m_pWeights ? 1 : 0));
+      m_pSubRing = (ACCUM_DATA_TYPE*) Arena::allocate((size_t) m_uNumSubs * m_uSubStride * sizeof(ACCUM_DATA_TYPE), 
+                                                      "accumulators");
+      if (m_pSubRing == NULL) {
+        printf("Failed to allocate sub-accumulations.\n");
+        return false;
+      }
+
+      return true;
+    }
+
+    // Adds a spectrum to the current sub-accumulation and moves on to the 
+    // next once it is full.  The last one absorbs any extra spectra.
+    template<typename T>
+    void addSub(const T* pSpectrum, const T* pSpectrum2, const T* pWeights)
+    {
+      ACCUM_DATA_TYPE* pSum = subSum(m_uCurrentSub);
+      ACCUM_DATA_TYPE* pSum2 = subSum2(m_uCurrentSub);
+      ACCUM_DATA_TYPE* pWeightSum = subWeights(m_uCurrentSub);
+
+      for (unsigned int n=0; n<m_uDataLength; n++) {
+        pSum[n] += pSpectrum[n];
+      }
+
+      if (pSum2 && pSpectrum2) {
+        for (unsigned int n=0; n<m_uDataLength; n++) {
+          pSum2[n] += pSpectrum2[n];
+        }
+      }
+
+      if (pWeightSum && pWeights) {
+        for (unsigned int n=0; n<m_uDataLength; n++) {
+          pWeightSum[n] += pWeights[n];
+        }
+      } else if (pWeightSum) {
+        for (unsigned int n=0; n<m_uDataLength; n++) {
+          pWeightSum[n] += 1;
+        }
+      }
+
+      if ((++m_pSubInfo[m_uCurrentSub].uNumAccums >= m_uSpectraPerSub) && 
+          (m_uCurrentSub+1 < m_uNumSubs)) {
+        m_uCurrentSub++;
+      }
+    }
+
+    // Initializes binned resolution i for the current configuration
+    void initBinned(unsigned int i)
+    {
+      unsigned int uLength = m_uDataLength / m_uBinFactor[i];
+      double dStopFreq = m_dStartFreq + (m_dStopFreq - m_dStartFreq) 
+                         * uLength * m_uBinFactor[i] / m_uDataLength;
+
+      m_pBinned[i]->setId(m_uBinFactor[i]);
+      m_pBinned[i]->init(uLength, m_dStartFreq, dStopFreq, m_dChannelFactor);
+    }
+
+    // Bins the spectrum for each coarser resolution and adds it.  The first
+    // pass sums pairs of channels of the spectrum, and each later pass sums
+    // pairs of the pass before it, so a factor of 16 takes four passes over
+    // ever shorter spectra.  Each pass writes after the one it reads so the
+    // loops are simple strided sums the compiler vectorizes.  Weights are
+    // averaged the same way in the second half of the scratch, so a bin's 
+    // weight is the fraction of its channels that were kept.
+    template<typename T>
+    void addBinned(const T* pSpectrum, const T* pWeights, double dADCmin, double dADCmax)
+    {
+      unsigned int uLength = m_uDataLength / 2;
+      unsigned int uFactor = 2;
+      ACCUM_DATA_TYPE* pIn = m_pBinScratch;
+      ACCUM_DATA_TYPE* pOut = NULL;
+      ACCUM_DATA_TYPE* pWeightIn = (m_pWeights && pWeights) ? m_pBinScratch + m_uDataLength : NULL;
+      ACCUM_DATA_TYPE* pWeightOut = NULL;
+
+      for (unsigned int n=0; n<uLength; n++) {
+        pIn[n] = (ACCUM_DATA_TYPE) pSpectrum[2*n] + (ACCUM_DATA_TYPE) pSpectrum[2*n+1];
+      }
+
+      if (pWeightIn) {
+        for (unsigned int n=0; n<uLength; n++) {
+          pWeightIn[n] = 0.5 * ((ACCUM_DATA_TYPE) pWeights[2*n] + (ACCUM_DATA_TYPE) pWeights[2*n+1]);
+        }
+      }
+
+      for (unsigned int i=0; i<m_uNumBinned; i++) {
+
+        while (uFactor < m_uBinFactor[i]) {
+          pOut = pIn + uLength;
+          for (unsigned int n=0; n<uLength/2; n++) {
+            pOut[n] = pIn[2*n] + pIn[2*n+1];
+          }
+          pIn = pOut;
+
+          if (pWeightIn) {
+            pWeightOut = pWeightIn + uLength;
+            for (unsigned int n=0; n<uLength/2; n++) {
+              pWeightOut[n] = 0.5 * (pWeightIn[2*n] + pWeightIn[2*n+1]);
+            }
+            pWeightIn = pWeightOut;
+          }
+
+          uLength /= 2;
+          uFactor *= 2;
+        }
+
+        m_pBinned[i]->add(pIn, (const ACCUM_DATA_TYPE*) NULL, uLength, dADCmin, dADCmax, pWeightIn);
+      }
+    }
 
   public:
 
     // Constructor and destructor
     
-    Accumulator() : m_pSpectrum(NULL), m_uDataLength(0), m_uNumAccums(0), 
+    Accumulator() : m_pSpectrum(NULL), m_pSpectrum2(NULL), 
+                    m_uDataLength(0), m_uNumAccums(0), 
                     m_dADCmin(0), m_dADCmax(0), m_dStartFreq(0), m_dStopFreq(0), 
-                    m_dChannelFactor(0), m_dTemperature(0), m_uDrops(0),
-                    m_uId(0) { }
+                    m_dChannelFactor(0), m_dTemperature(0), m_uDrops(0), m_uSkips(0),
+                    m_uId(0), m_pSubRing(NULL), m_pSubInfo(NULL), 
+                    m_uSubStride(0), m_uNumSubs(0), 
+                    m_uSpectraPerSub(0), m_uCurrentSub(0), 
+                    m_uFirstChannel(0), m_uTotalChannels(0), 
+                    m_uNumBinned(0), m_pBinScratch(NULL), m_pWeights(NULL), 
+                    m_pFlags(NULL) { }
     
     ~Accumulator()
     {
       if (m_pSpectrum) {
-        free(m_pSpectrum);
+        Arena::free(m_pSpectrum);
         m_pSpectrum = NULL;
       }
+
+      if (m_pSpectrum2) {
+        Arena::free(m_pSpectrum2);
+        m_pSpectrum2 = NULL;
+      }
+
+      if (m_pSubRing) {
+        Arena::free(m_pSubRing);
+        m_pSubRing = NULL;
+      }
+
+      if (m_pSubInfo) {
+        delete[] m_pSubInfo;
+        m_pSubInfo = NULL;
+      }
+
+      for (unsigned int i=0; i<m_uNumBinned; i++) {
+        delete m_pBinned[i];
+      }
+      m_uNumBinned = 0;
+
+      if (m_pBinScratch) {
+        Arena::free(m_pBinScratch);
+        m_pBinScratch = NULL;
+      }
+
+      if (m_pWeights) {
+        Arena::free(m_pWeights);
+        m_pWeights = NULL;
+      }
+
+      if (m_pFlags) {
+        Arena::free(m_pFlags);
+        m_pFlags = NULL;
+      }
     }
 
 
@@ -65,11 +298,24 @@ class Accumulator {
 
     template<typename T>
     unsigned int add(const T* pSpectrum, unsigned int uLength, double dADCmin, double dADCmax) 
+    {
+      return add(pSpectrum, (const T*) NULL, uLength, dADCmin, dADCmax);
+    }
+
+
+
+    // Adds a spectrum and (if both are available) its power squared to the
+    // accumulation.  The second moment is ignored if this accumulator was
+    // not initialized to keep it.  If weights are kept, pWeights gives the
+    // weight of each channel (NULL for all 1).
+    template<typename T>
+    unsigned int add(const T* pSpectrum, const T* pSpectrum2, unsigned int uLength, 
+                     double dADCmin, double dADCmax, const T* pWeights = NULL) 
     {
 
       // Abort if there isn't valid data to include
       if ((pSpectrum == NULL) || (uLength != m_uDataLength)) {
-        printf("Failed to add spectrum to accumulation.\n");
+        Log::warn("Failed to add spectrum to accumulation.\n");
         return false;
       }
 
@@ -77,15 +323,60 @@ class Accumulator {
       m_dADCmin = (dADCmin < m_dADCmin) ? dADCmin : m_dADCmin;
       m_dADCmax = (dADCmax > m_dADCmax) ? dADCmax : m_dADCmax;
 
+      // Derive the coarser resolutions
+      if (m_uNumBinned > 0) {
+        addBinned(pSpectrum, pWeights, dADCmin, dADCmax);
+      }
+
+      // If sub-accumulations are enabled, the spectrum goes only into the 
+      // current sub-accumulation
+      if (m_pSubRing) {
+        addSub(pSpectrum, pSpectrum2, pWeights);
+        return ++m_uNumAccums;
+      }
+
       // Add the new spectrum to the accumulation 
-      for (unsigned int n=0; n<uLength; n++) {
-        m_pSpectrum[n] += pSpectrum[n];
+      if (m_pSpectrum2 && pSpectrum2) {
+        for (unsigned int n=0; n<uLength; n++) {
+          m_pSpectrum[n] += pSpectrum[n];
+          m_pSpectrum2[n] += pSpectrum2[n];
+        }
+      } else {
+        for (unsigned int n=0; n<uLength; n++) {
+          m_pSpectrum[n] += pSpectrum[n];
+        }
+      }
+
+      if (m_pWeights && pWeights) {
+        for (unsigned int n=0; n<uLength; n++) {
+          m_pWeights[n] += pWeights[n];
+        }
+      } else if (m_pWeights) {
+        for (unsigned int n=0; n<uLength; n++) {
+          m_pWeights[n] += 1;
+        }
       }
 
       return ++m_uNumAccums;
     }
     
+    // Counts each channel with a weight of 0 as flagged (see initFlags).  
+    // Called for every flagged spectrum, whether or not it is added.
+    template<typename T>
+    void addFlags(const T* pWeights, unsigned int uLength)
+    {
+      if ((m_pFlags == NULL) || (pWeights == NULL) || (uLength != m_uDataLength)) {
+        return;
+      }
+
+      for (unsigned int n=0; n<uLength; n++) {
+        m_pFlags[n] += (ACCUM_DATA_TYPE) (1 - pWeights[n]);
+      }
+    }
+
     void addDrops(unsigned long uDrops) { m_uDrops += uDrops; }
+
+    void addSkips(unsigned long uSkips) { m_uSkips += uSkips; }
     
     void clear() 
     {
@@ -94,6 +385,24 @@ class Accumulator {
         m_pSpectrum[i] = 0;
       }
 
+      if (m_pSpectrum2) {
+        for (unsigned int i=0; i<m_uDataLength; i++) {
+          m_pSpectrum2[i] = 0;
+        }
+      }
+
+      if (m_pWeights) {
+        for (unsigned int i=0; i<m_uDataLength; i++) {
+          m_pWeights[i] = 0;
+        }
+      }
+
+      if (m_pFlags) {
+        for (unsigned int i=0; i<m_uDataLength; i++) {
+          m_pFlags[i] = 0;
+        }
+      }
+
       // Set the supporting spectrum info parameters to zeros
       m_uNumAccums = 0;
       m_dADCmin = 0;
@@ -102,6 +411,26 @@ class Accumulator {
       m_stopTime.set(0);
       m_dTemperature = 0;
       m_uDrops = 0;
+      m_uSkips = 0;
+
+      // Reset the sub-accumulations
+      if (m_pSubRing) {
+        size_t uRingLength = (size_t) m_uNumSubs * m_uSubStride;
+        for (size_t i=0; i<uRingLength; i++) {
+          m_pSubRing[i] = 0;
+        }
+      }
+
+      for (unsigned int i=0; (m_pSubInfo != NULL) && (i<m_uNumSubs); i++) {
+        m_pSubInfo[i].uNumAccums = 0;
+        m_pSubInfo[i].dStartTime = 0;
+        m_pSubInfo[i].dStopTime = 0;
+      }
+      m_uCurrentSub = 0;
+
+      for (unsigned int i=0; i<m_uNumBinned; i++) {
+        m_pBinned[i]->clear();
+      }
     }
 
     bool combine(const Accumulator* pAccum) 
@@ -133,12 +462,169 @@ class Accumulator {
         m_pSpectrum[n] += pAccum->m_pSpectrum[n];
       }
 
+      if (m_pSpectrum2 && pAccum->m_pSpectrum2) {
+        for (unsigned int n=0; n<m_uDataLength; n++) {
+          m_pSpectrum2[n] += pAccum->m_pSpectrum2[n];
+        }
+      }
+
+      if (m_pWeights && pAccum->m_pWeights) {
+        for (unsigned int n=0; n<m_uDataLength; n++) {
+          m_pWeights[n] += pAccum->m_pWeights[n];
+        }
+      }
+
+      if (m_pFlags && pAccum->m_pFlags) {
+        for (unsigned int n=0; n<m_uDataLength; n++) {
+          m_pFlags[n] += pAccum->m_pFlags[n];
+        }
+      }
+
       // Add together the number of data drops
       m_uDrops += pAccum->m_uDrops;
+      m_uSkips += pAccum->m_uSkips;
 
       return true;
     }
 
+    // Forms the full accumulation from the sub-accumulations.  Call once 
+    // after the last spectrum has been added (and the stop time set).  Does
+    // nothing if sub-accumulations are not enabled.
+    bool combineSubs()
+    {
+      if (m_pSubRing == NULL) {
+        return true;
+      }
+
+      // The spectra were only added to the subs, but the block counter was 
+      // kept here too, so reset it before combining.  The ADC records and 
+      // times already cover the whole accumulation.
+      unsigned int uNumAccums = m_uNumAccums;
+      m_uNumAccums = 0;
+
+      for (unsigned int n=0; n<m_uDataLength; n++) {
+        m_pSpectrum[n] = 0;
+      }
+
+      if (m_pSpectrum2) {
+        for (unsigned int n=0; n<m_uDataLength; n++) {
+          m_pSpectrum2[n] = 0;
+        }
+      }
+
+      if (m_pWeights) {
+        for (unsigned int n=0; n<m_uDataLength; n++) {
+          m_pWeights[n] = 0;
+        }
+      }
+
+      // Spectra arrive at a steady rate, so the start and stop times of 
+      // each sub are spread across the accumulation by its share of spectra
+      double dStart = m_startTime.secondsSince1970();
+      double dPerSpectrum = (uNumAccums > 0) ? (m_stopTime - m_startTime) / uNumAccums : 0;
+      unsigned int uSoFar = 0;
+
+      for (unsigned int i=0; i<=m_uCurrentSub; i++) {
+
+        m_pSubInfo[i].dStartTime = dStart + uSoFar * dPerSpectrum;
+        uSoFar += m_pSubInfo[i].uNumAccums;
+        m_pSubInfo[i].dStopTime = dStart + uSoFar * dPerSpectrum;
+        m_uNumAccums += m_pSubInfo[i].uNumAccums;
+
+        const ACCUM_DATA_TYPE* pSum = subSum(i);
+        for (unsigned int n=0; n<m_uDataLength; n++) {
+          m_pSpectrum[n] += pSum[n];
+        }
+
+        const ACCUM_DATA_TYPE* pSum2 = subSum2(i);
+        if (pSum2) {
+          for (unsigned int n=0; n<m_uDataLength; n++) {
+            m_pSpectrum2[n] += pSum2[n];
+          }
+        }
+
+        const ACCUM_DATA_TYPE* pWeightSum = subWeights(i);
+        if (pWeightSum) {
+          for (unsigned int n=0; n<m_uDataLength; n++) {
+            m_pWeights[n] += pWeightSum[n];
+          }
+        }
+      }
+
+      if (m_uNumAccums != uNumAccums) {
+        printf("Sub-accumulations hold %u spectra but %u were added.\n",
+          m_uNumAccums, uNumAccums);
+      }
+
+      return true;
+    }
+
+    // Gives the binned resolutions this accumulation's start and stop times
+    // and spreads them over their accumulations.  Call once after the last
+    // spectrum has been added (and the stop time set).
+    bool combineBinned()
+    {
+      bool bResult = true;
+
+      for (unsigned int i=0; i<m_uNumBinned; i++) {
+        m_pBinned[i]->setStartTime(m_startTime);
+        m_pBinned[i]->setStopTime(m_stopTime);
+        bResult = m_pBinned[i]->combineSubs() && bResult;
+      }
+
+      return bResult;
+    }
+
+    // Scales the sum (and power squared) of each channel by the number of
+    // spectra over the channel's weight, so that dividing by getNumAccums()
+    // gives the average over the spectra the channel was kept in.  Channels
+    // masked in every spectrum are zeroed.  The weights are left as they 
+    // are.  Does the same for the sub-accumulations and binned resolutions.
+    // Call once after combineSubs() and combineBinned().
+    void normalizeWeights()
+    {
+      if (m_pWeights == NULL) {
+        return;
+      }
+
+      double dNumAccums = (double) m_uNumAccums;
+
+      for (unsigned int n=0; n<m_uDataLength; n++) {
+        ACCUM_DATA_TYPE dScale = (m_pWeights[n] > 0) ? dNumAccums / m_pWeights[n] : 0;
+        m_pSpectrum[n] *= dScale;
+      }
+
+      if (m_pSpectrum2) {
+        for (unsigned int n=0; n<m_uDataLength; n++) {
+          ACCUM_DATA_TYPE dScale = (m_pWeights[n] > 0) ? dNumAccums / m_pWeights[n] : 0;
+          m_pSpectrum2[n] *= dScale;
+        }
+      }
+
+      for (unsigned int i=0; (m_pSubRing != NULL) && (i<m_uNumSubs); i++) {
+        ACCUM_DATA_TYPE* pSum = subSum(i);
+        ACCUM_DATA_TYPE* pSum2 = subSum2(i);
+        const ACCUM_DATA_TYPE* pWeightSum = subWeights(i);
+        double dSubAccums = (double) m_pSubInfo[i].uNumAccums;
+
+        for (unsigned int n=0; n<m_uDataLength; n++) {
+          ACCUM_DATA_TYPE dScale = (pWeightSum[n] > 0) ? dSubAccums / pWeightSum[n] : 0;
+          pSum[n] *= dScale;
+        }
+
+        if (pSum2) {
+          for (unsigned int n=0; n<m_uDataLength; n++) {
+            ACCUM_DATA_TYPE dScale = (pWeightSum[n] > 0) ? dSubAccums / pWeightSum[n] : 0;
+            pSum2[n] *= dScale;
+          }
+        }
+      }
+
+      for (unsigned int i=0; i<m_uNumBinned; i++) {
+        m_pBinned[i]->normalizeWeights();
+      }
+    }
+
     ACCUM_DATA_TYPE get(unsigned int iIndex) const
     { 
       if (m_pSpectrum) {
@@ -167,6 +653,34 @@ class Accumulator {
       return true;
     }
 
+    // Sum of the weights of each channel (see initWeights)
+    bool getCopyOfWeights(ACCUM_DATA_TYPE* pOut, unsigned int uLength) const
+    { 
+      if ((pOut == NULL) || (uLength != m_uDataLength) || (m_pWeights == NULL)) {
+        return false;
+      }
+
+      for (unsigned int i=0; i<m_uDataLength; i++) {
+        pOut[i] = m_pWeights[i];
+      }
+
+      return true;
+    }
+
+    // Number of spectra each channel was flagged in (see initFlags)
+    bool getCopyOfFlags(ACCUM_DATA_TYPE* pOut, unsigned int uLength) const
+    { 
+      if ((pOut == NULL) || (uLength != m_uDataLength) || (m_pFlags == NULL)) {
+        return false;
+      }
+
+      for (unsigned int i=0; i<m_uDataLength; i++) {
+        pOut[i] = m_pFlags[i];
+      }
+
+      return true;
+    }
+
     bool getCopyOfAverage(ACCUM_DATA_TYPE* pOut, unsigned int uLength) const
     { 
       double dNormalize = 0;
@@ -186,12 +700,172 @@ class Accumulator {
       return true;
     }
     
+    // Spectral kurtosis estimator for each channel (Nita & Gary 2010):
+    //
+    //   SK = (M+1)/(M-1) * (M*S2/S1^2 - 1)
+    //
+    // where M is the number of accumulated spectra, S1 is the sum of the 
+    // power, and S2 is the sum of the power squared.  SK is ~1 for Gaussian
+    // noise.  Returns false if the second moment is not being kept.
+    //
+    // With weights (after normalizeWeights), S1 and S2 are scaled to all 
+    // M spectra, so M*S2/S1^2 is unchanged and the bias correction uses the
+    // channel's weight instead of M.  Channels with a weight of 1 or less
+    // are 0.
+    bool getCopyOfKurtosis(ACCUM_DATA_TYPE* pOut, unsigned int uLength) const
+    {
+      if ((pOut == NULL) || (uLength != m_uDataLength) || (m_pSpectrum2 == NULL)) {
+        return false;
+      }
+
+      double dM = (double) m_uNumAccums;
+      double dFactor = (m_uNumAccums > 1) ? (dM + 1.0) / (dM - 1.0) : 0;
+
+      for (unsigned int i=0; i<m_uDataLength; i++) {
+        if (m_pWeights) {
+          double dW = m_pWeights[i];
+          dFactor = (dW > 1) ? (dW + 1.0) / (dW - 1.0) : 0;
+        }
+        if (m_pSpectrum[i] > 0) {
+          pOut[i] = dFactor * (dM * m_pSpectrum2[i] / (m_pSpectrum[i] * m_pSpectrum[i]) - 1.0);
+        } else {
+          pOut[i] = 0;
+        }
+      }
+
+      return true;
+    }
+
+    // Variance of the power in each channel over the accumulated spectra.
+    // Returns false if the second moment is not being kept.
+    bool getCopyOfVariance(ACCUM_DATA_TYPE* pOut, unsigned int uLength) const
+    {
+      if ((pOut == NULL) || (uLength != m_uDataLength) || (m_pSpectrum2 == NULL)) {
+        return false;
+      }
+
+      double dNormalize = 0;
+      if (m_uNumAccums > 0) {
+        dNormalize = 1.0 / (double) m_uNumAccums;
+      }
+
+      for (unsigned int i=0; i<m_uDataLength; i++) {
+        pOut[i] = m_pSpectrum2[i] * dNormalize 
+                  - (m_pSpectrum[i] * dNormalize) * (m_pSpectrum[i] * dNormalize);
+      }
+
+      return true;
+    }
+    
     unsigned int getDataLength() const { return m_uDataLength; }
     
     unsigned int getId() const { return m_uId; }
 
+    // Absolute channelizer index of the first channel in the spectrum
+    unsigned int getFirstChannel() const { return m_uFirstChannel; }
+
+    // Number of channels in the full channelizer output
+    unsigned int getTotalChannels() const 
+    { 
+      return (m_uTotalChannels > 0) ? m_uTotalChannels : m_uDataLength; 
+    }
+
     unsigned int getNumAccums() const { return m_uNumAccums; }
 
+    // Number of coarser resolutions (see addBinning)
+    unsigned int getNumBinned() const { return m_uNumBinned; }
+
+    // Resolution uIndex, which has one channel per getId() channels of this
+    // accumulation
+    const Accumulator* getBinned(unsigned int uIndex) const
+    {
+      if (uIndex >= m_uNumBinned) {
+        return NULL;
+      }
+      return m_pBinned[uIndex];
+    }
+
+    // Number of sub-accumulations holding data (0 if they are not enabled)
+    unsigned int getNumSubs() const 
+    { 
+      if ((m_pSubRing == NULL) || (m_pSubInfo[0].uNumAccums == 0)) {
+        return 0;
+      }
+      return m_uCurrentSub + 1; 
+    }
+
+    unsigned int getSpectraPerSub() const { return m_uSpectraPerSub; }
+
+    unsigned int getSubNumAccums(unsigned int uIndex) const
+    {
+      return (uIndex < m_uNumSubs) ? m_pSubInfo[uIndex].uNumAccums : 0;
+    }
+
+    // Times of sub-accumulation uIndex, set by combineSubs()
+    TimeKeeper getSubStartTime(unsigned int uIndex) const
+    {
+      TimeKeeper tk;
+      tk.set((uIndex < m_uNumSubs) ? m_pSubInfo[uIndex].dStartTime : 0);
+      return tk;
+    }
+
+    TimeKeeper getSubStopTime(unsigned int uIndex) const
+    {
+      TimeKeeper tk;
+      tk.set((uIndex < m_uNumSubs) ? m_pSubInfo[uIndex].dStopTime : 0);
+      return tk;
+    }
+
+    // Copies sub-accumulation uIndex into pAccum (of the same length) as a 
+    // whole accumulation, scaled by its weights if they are kept, so that it
+    // can be used before combineSubs().  The ADC records are the ones so far.
+    bool copySub(unsigned int uIndex, Accumulator* pAccum) const
+    {
+      if ((pAccum == NULL) || (pAccum->m_uDataLength != m_uDataLength) || (uIndex >= m_uNumSubs)) {
+        return false;
+      }
+
+      const ACCUM_DATA_TYPE* pSum = subSum(uIndex);
+      const ACCUM_DATA_TYPE* pWeightSum = subWeights(uIndex);
+      double dSubAccums = (double) m_pSubInfo[uIndex].uNumAccums;
+
+      if (pWeightSum) {
+        for (unsigned int n=0; n<m_uDataLength; n++) {
+          pAccum->m_pSpectrum[n] = (pWeightSum[n] > 0) ? pSum[n] * dSubAccums / pWeightSum[n] : 0;
+        }
+      } else {
+        for (unsigned int n=0; n<m_uDataLength; n++) {
+          pAccum->m_pSpectrum[n] = pSum[n];
+        }
+      }
+
+      pAccum->m_uNumAccums = m_pSubInfo[uIndex].uNumAccums;
+      pAccum->m_dADCmin = m_dADCmin;
+      pAccum->m_dADCmax = m_dADCmax;
+
+      return true;
+    }
+
+    bool getCopyOfSubAverage(unsigned int uIndex, ACCUM_DATA_TYPE* pOut, unsigned int uLength) const
+    {
+      if ((pOut == NULL) || (uLength != m_uDataLength) || (uIndex >= m_uNumSubs)) {
+        return false;
+      }
+
+      const ACCUM_DATA_TYPE* pSum = subSum(uIndex);
+      double dNormalize = 0;
+
+      if (m_pSubInfo[uIndex].uNumAccums > 0) {
+        dNormalize = 1.0 / (double) m_pSubInfo[uIndex].uNumAccums;
+      }
+
+      for (unsigned int i=0; i<m_uDataLength; i++) {
+        pOut[i] = pSum[i] * dNormalize;
+      }
+
+      return true;
+    }
+
     double getStartFreq() const { return m_dStartFreq; }
     
     double getStopFreq() const { return m_dStopFreq; }
@@ -202,21 +876,169 @@ class Accumulator {
     
     ACCUM_DATA_TYPE* getSum() { return m_pSpectrum; }
 
+    ACCUM_DATA_TYPE* getSum2() { return m_pSpectrum2; }
+
+    bool hasSecondMoment() const { return (m_pSpectrum2 != NULL); }
+
+    bool hasWeights() const { return (m_pWeights != NULL); }
+
+    bool hasFlags() const { return (m_pFlags != NULL); }
+
     ACCUM_DATA_TYPE getTemperature() const { return m_dTemperature; }
 
     unsigned long getDrops() const {return m_uDrops; }
 
+    unsigned long getSkips() const {return m_uSkips; }
+
     void init(unsigned int uDataLength, double dStartFreq, double dStopFreq, 
-              double dChannelFactor) 
+              double dChannelFactor, bool bSecondMoment = false) 
     { 
       if (m_pSpectrum) {
-        free(m_pSpectrum);
+        Arena::free(m_pSpectrum);
+      }
+      if (m_pSpectrum2) {
+        Arena::free(m_pSpectrum2);
+        m_pSpectrum2 = NULL;
+      }
+      m_pSpectrum = (ACCUM_DATA_TYPE*) Arena::allocate(uDataLength * sizeof(ACCUM_DATA_TYPE), "accumulators");
+      if (bSecondMoment) {
+        m_pSpectrum2 = (ACCUM_DATA_TYPE*) Arena::allocate(uDataLength * sizeof(ACCUM_DATA_TYPE), "accumulators");
       }
-      m_pSpectrum = (ACCUM_DATA_TYPE*) malloc(uDataLength * sizeof(ACCUM_DATA_TYPE));
       m_uDataLength = uDataLength;
       m_dStartFreq = dStartFreq;
       m_dStopFreq = dStopFreq;
       m_dChannelFactor = dChannelFactor;
+
+      // Keep any binned resolutions consistent with the new configuration
+      for (unsigned int i=0; i<m_uNumBinned; i++) {
+        initBinned(i);
+      }
+
+      if (m_pBinScratch) {
+        Arena::free(m_pBinScratch);
+        m_pBinScratch = (ACCUM_DATA_TYPE*) Arena::allocate(2 * uDataLength * sizeof(ACCUM_DATA_TYPE), "accumulators");
+      }
+
+      if (m_pWeights) {
+        Arena::free(m_pWeights);
+        m_pWeights = (ACCUM_DATA_TYPE*) Arena::allocate(uDataLength * sizeof(ACCUM_DATA_TYPE), "accumulators");
+      }
+
+      if (m_pFlags) {
+        Arena::free(m_pFlags);
+        m_pFlags = (ACCUM_DATA_TYPE*) Arena::allocate(uDataLength * sizeof(ACCUM_DATA_TYPE), "accumulators");
+      }
+
+      // And the sub-accumulations, once the weights are settled
+      allocSubs();
+
+      clear();
+    }
+
+    // Splits each accumulation into (up to) uNumSubs sub-accumulations of 
+    // uSpectraPerSub spectra each.  Must be called after init().  Passing 
+    // zero for either argument disables the sub-accumulations.
+    bool initSubs(unsigned int uNumSubs, unsigned int uSpectraPerSub)
+    {
+      if (m_pSubInfo) {
+        delete[] m_pSubInfo;
+        m_pSubInfo = NULL;
+      }
+      m_uNumSubs = 0;
+      m_uSpectraPerSub = 0;
+
+      if ((uNumSubs == 0) || (uSpectraPerSub == 0)) {
+        allocSubs();
+        clear();
+        return true;
+      }
+
+      m_uNumSubs = uNumSubs;
+      m_uSpectraPerSub = uSpectraPerSub;
+      m_pSubInfo = new SubInfo[uNumSubs];
+
+      if (!allocSubs()) {
+        delete[] m_pSubInfo;
+        m_pSubInfo = NULL;
+        m_uNumSubs = 0;
+        m_uSpectraPerSub = 0;
+        return false;
+      }
+
+      clear();
+
+      return true;
+    }
+
+    // Adds a coarser resolution with one channel per uFactor channels (a 
+    // power of 2, larger than the factor of any resolution added before).
+    // Its accumulation is split into (up to) uNumSubs accumulations of 
+    // uSpectraPerSub spectra each (see initSubs).  Channels left over at the
+    // top of the band are dropped.  Must be called after init().
+    bool addBinning(unsigned int uFactor, unsigned int uNumSubs, unsigned int uSpectraPerSub)
+    {
+      if ((uFactor < 2) || ((uFactor & (uFactor - 1)) != 0) || 
+          (m_uDataLength / uFactor == 0)) {
+        printf("Can't bin %u channels by %u (use a power of 2 up to the number "
+               "of channels).\n", m_uDataLength, uFactor);
+        return false;
+      }
+
+      if ((m_uNumBinned > 0) && (uFactor <= m_uBinFactor[m_uNumBinned-1])) {
+        printf("Binning factors must be added in increasing order.\n");
+        return false;
+      }
+
+      if (m_uNumBinned == ACCUM_MAX_BINNED) {
+        printf("Can't keep more than %u binned resolutions.\n", ACCUM_MAX_BINNED);
+        return false;
+      }
+
+      if (m_pBinScratch == NULL) {
+        m_pBinScratch = (ACCUM_DATA_TYPE*) Arena::allocate(2 * m_uDataLength * sizeof(ACCUM_DATA_TYPE), "accumulators");
+      }
+
+      m_uBinFactor[m_uNumBinned] = uFactor;
+      m_pBinned[m_uNumBinned] = new Accumulator;
+      initBinned(m_uNumBinned);
+      if (m_pWeights) {
+        m_pBinned[m_uNumBinned]->initWeights();
+      }
+      if (!m_pBinned[m_uNumBinned]->initSubs(uNumSubs, uSpectraPerSub)) {
+        delete m_pBinned[m_uNumBinned];
+        return false;
+      }
+      m_uNumBinned++;
+
+      return true;
+    }
+
+    // Keeps the sum of the weights of each channel (see add), in the 
+    // sub-accumulations and binned resolutions too.  Must be called after
+    // init().
+    void initWeights()
+    {
+      if (m_pWeights == NULL) {
+        m_pWeights = (ACCUM_DATA_TYPE*) Arena::allocate(m_uDataLength * sizeof(ACCUM_DATA_TYPE), "accumulators");
+      }
+
+      allocSubs();
+
+      for (unsigned int i=0; i<m_uNumBinned; i++) {
+        m_pBinned[i]->initWeights();
+      }
+
+      clear();
+    }
+
+    // Keeps the number of spectra each channel was flagged in (see addFlags).
+    // Only the full accumulation counts flags.  Must be called after init().
+    void initFlags()
+    {
+      if (m_pFlags == NULL) {
+        m_pFlags = (ACCUM_DATA_TYPE*) Arena::allocate(m_uDataLength * sizeof(ACCUM_DATA_TYPE), "accumulators");
+      }
+
       clear();
     }
 
@@ -224,6 +1046,12 @@ class Accumulator {
       for (unsigned int i=0; i<m_uDataLength; i++) {
         m_pSpectrum[i] *= dValue;
       }
+
+      if (m_pSpectrum2) {
+        for (unsigned int i=0; i<m_uDataLength; i++) {
+          m_pSpectrum2[i] *= dValue * dValue;
+        }
+      }
     }
 
     void setADCmin(double dMin) {m_dADCmin = dMin;}
@@ -241,9 +1069,18 @@ class Accumulator {
     void setTemperature(double dTemperature) { m_dTemperature = dTemperature; }
 
     void setDrops(unsigned long uDrops) { m_uDrops = uDrops; }
+
+    void setSkips(unsigned long uSkips) { m_uSkips = uSkips; }
     
     void setId(unsigned int uId) { m_uId = uId; };
 
+    // Not changed by init()
+    void setChannelRange(unsigned int uFirstChannel, unsigned int uTotalChannels) 
+    { 
+      m_uFirstChannel = uFirstChannel; 
+      m_uTotalChannels = uTotalChannels; 
+    }
+
 
 };
 
@@ -0,0 +1,342 @@
+#include "arena.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>       // posix_memalign
+#include <string.h>       // memset, strerror
+#include <errno.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+using namespace std;
+
+#ifndef MAP_HUGE_SHIFT
+  #define MAP_HUGE_SHIFT  26
+#endif
+
+#define ARENA_2MB         (2UL*1024*1024)
+#define ARENA_1GB         (1024UL*1024*1024)
+#define ARENA_THP_PATH    "/sys/kernel/mm/transparent_hugepage/enabled"
+
+pthread_mutex_t             Arena::s_mutex = PTHREAD_MUTEX_INITIALIZER;
+unsigned int                Arena::s_uPageMB = 0;
+std::vector<Arena::Chunk>   Arena::s_chunks;
+std::vector<Arena::Block>   Arena::s_blocks;
+std::vector<Arena::Owner>   Arena::s_owners;
+
+
+
+// ----------------------------------------------------------------------------
+// setPageSize()
+// ----------------------------------------------------------------------------
+bool Arena::setPageSize(unsigned int uMB)
+{
+  if ((uMB != 0) && (uMB != 2) && (uMB != 1024)) {
+    printf("Arena: Invalid huge page size %u MB (use 0, 2, or 1024)\n", uMB);
+    return false;
+  }
+
+  pthread_mutex_lock(&s_mutex);
+  s_uPageMB = uMB;
+  pthread_mutex_unlock(&s_mutex);
+
+  return true;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// kindName()
+// ----------------------------------------------------------------------------
+const char* Arena::kindName(Kind kind)
+{
+  switch (kind) {
+    case HUGE_1GB:    return "1 GB huge pages";
+    case HUGE_2MB:    return "2 MB huge pages";
+    case TRANSPARENT: return "transparent huge pages";
+    case NORMAL:      return "normal pages";
+    default:          return "heap";
+  }
+}
+
+
+
+// ----------------------------------------------------------------------------
+// owner() -- Index of an owner, added if new.  Called with the mutex held.
+// ----------------------------------------------------------------------------
+unsigned int Arena::owner(const string& sOwner)
+{
+  for (unsigned int i=0; i<s_owners.size(); i++) {
+    if (s_owners[i].sName == sOwner) {
+      return i;
+    }
+  }
+
+  Owner o;
+  o.sName = sOwner;
+  o.uBytes = 0;
+  o.uBlocks = 0;
+  s_owners.push_back(o);
+
+  return s_owners.size() - 1;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// newChunk() -- Maps and pre-faults a chunk of at least uBytes, trying the
+//               kinds of pages in order.  Called with the mutex held.
+//               Returns NULL if nothing could be mapped.
+// ----------------------------------------------------------------------------
+Arena::Chunk* Arena::newChunk(size_t uBytes, int iNode)
+{
+  static bool bWarned = false;
+  Chunk chunk;
+  chunk.pBase = NULL;
+  chunk.uUsed = 0;
+  chunk.iNode = iNode;
+  chunk.kind = NORMAL;
+
+  // Explicit huge pages (1 GB pages fall back to 2 MB pages first)
+  Kind tries[2] = { (s_uPageMB == 1024) ? HUGE_1GB : HUGE_2MB, HUGE_2MB };
+  unsigned int uTries = (s_uPageMB == 1024) ? 2 : 1;
+  for (unsigned int t=0; (t < uTries) && !chunk.pBase; t++) {
+
+    size_t uPage = (tries[t] == HUGE_1GB) ? ARENA_1GB : ARENA_2MB;
+    int iFlags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+                 (((tries[t] == HUGE_1GB) ? 30 : 21) << MAP_HUGE_SHIFT);
+
+    chunk.uSize = ((max(uBytes, ARENA_CHUNK_BYTES) + uPage - 1) / uPage) * uPage;
+    void* p = mmap(NULL, chunk.uSize, PROT_READ | PROT_WRITE, iFlags, -1, 0);
+
+    if (p != MAP_FAILED) {
+      chunk.pBase = (char*) p;
+      chunk.kind = tries[t];
+    } else if (!bWarned) {
+      printf("Arena: No %s available for %zu MB (%s)\n", kindName(tries[t]),
+        chunk.uSize / 1024 / 1024, strerror(errno));
+    }
+  }
+
+  // Transparent huge pages, or normal pages if they are disabled.  The
+  // mapping is padded so the chunk can start on a 2 MB boundary.
+  if (!chunk.pBase) {
+
+    chunk.uSize = ((max(uBytes, ARENA_CHUNK_BYTES) + ARENA_2MB - 1) / ARENA_2MB) * ARENA_2MB;
+    size_t uMapped = chunk.uSize + ARENA_2MB;
+    void* p = mmap(NULL, uMapped, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+      printf("Arena: Failed to map %zu MB: %s\n", chunk.uSize / 1024 / 1024, strerror(errno));
+      return NULL;
+    }
+
+    char* pStart = (char*) ((((uintptr_t) p) + ARENA_2MB - 1) & ~(ARENA_2MB - 1));
+    size_t uHead = pStart - (char*) p;
+    if (uHead > 0) {
+      munmap(p, uHead);
+    }
+    munmap(pStart + chunk.uSize, ARENA_2MB - uHead);
+    chunk.pBase = pStart;
+
+    bool bTransparent = false;
+    FILE* pFile = fopen(ARENA_THP_PATH, "r");
+    if (pFile) {
+      char sLine[128] = "";
+      if (fgets(sLine, sizeof(sLine), pFile)) {
+        bTransparent = (strstr(sLine, "[never]") == NULL);
+      }
+      fclose(pFile);
+    }
+
+    if (bTransparent && (madvise(chunk.pBase, chunk.uSize, MADV_HUGEPAGE) == 0)) {
+      chunk.kind = TRANSPARENT;
+    }
+
+    if (!bWarned) {
+      printf("Arena: Falling back to %s\n", kindName(chunk.kind));
+    }
+  }
+
+  // Only explain the fallback for the first chunk
+  if (chunk.kind != tries[0]) {
+    bWarned = true;
+  }
+
+  // Pre-fault every page from this (possibly node bound) thread
+  memset(chunk.pBase, 0, chunk.uSize);
+
+  s_chunks.push_back(chunk);
+  return &s_chunks.back();
+}
+
+
+
+// ----------------------------------------------------------------------------
+// allocate()
+// ----------------------------------------------------------------------------
+void* Arena::allocate(size_t uBytes, const string& sOwner, int iNode)
+{
+  Block block;
+  block.p = NULL;
+  block.uSize = ((uBytes + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT) * ARENA_ALIGNMENT;
+  block.iNode = iNode;
+  block.bFree = false;
+
+  if (block.uSize == 0) {
+    return NULL;
+  }
+
+  pthread_mutex_lock(&s_mutex);
+
+  block.uOwner = owner(sOwner);
+
+  if (s_uPageMB == 0) {
+
+    // Heap
+    if (posix_memalign(&block.p, ARENA_ALIGNMENT, block.uSize) != 0) {
+      block.p = NULL;
+    }
+
+  } else {
+
+    // Reuse a freed block of the same size from the same node
+    for (unsigned int i=0; i<s_blocks.size(); i++) {
+      if (s_blocks[i].bFree && (s_blocks[i].uSize == block.uSize) &&
+          (s_blocks[i].iNode == iNode)) {
+        s_blocks[i].bFree = false;
+        s_blocks[i].uOwner = block.uOwner;
+        block.p = s_blocks[i].p;
+        break;
+      }
+    }
+
+    // Otherwise carve it from the newest chunk of the node with room
+    if (!block.p) {
+
+      Chunk* pChunk = NULL;
+      for (unsigned int i=s_chunks.size(); i>0; i--) {
+        if ((s_chunks[i-1].iNode == iNode) &&
+            (s_chunks[i-1].uSize - s_chunks[i-1].uUsed >= block.uSize)) {
+          pChunk = &s_chunks[i-1];
+          break;
+        }
+      }
+
+      if (!pChunk) {
+        pChunk = newChunk(block.uSize, iNode);
+      }
+
+      if (pChunk) {
+        block.p = pChunk->pBase + pChunk->uUsed;
+        pChunk->uUsed += block.uSize;
+        s_blocks.push_back(block);
+      }
+    }
+  }
+
+  if (block.p) {
+    if (s_uPageMB == 0) {
+      s_blocks.push_back(block);
+    }
+    s_owners[block.uOwner].uBytes += block.uSize;
+    s_owners[block.uOwner].uBlocks++;
+    Metrics::gauge("fastspec_memory_reserved_bytes",
+      "Memory reserved for large blocks, by owner",
+      "owner=\"" + sOwner + "\"")->set(s_owners[block.uOwner].uBytes);
+  }
+
+  pthread_mutex_unlock(&s_mutex);
+
+  return block.p;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// free()
+// ----------------------------------------------------------------------------
+void Arena::free(void* p)
+{
+  if (!p) {
+    return;
+  }
+
+  pthread_mutex_lock(&s_mutex);
+
+  unsigned int i = 0;
+  while ((i < s_blocks.size()) && !((s_blocks[i].p == p) && !s_blocks[i].bFree)) {
+    i++;
+  }
+
+  if (i == s_blocks.size()) {
+    pthread_mutex_unlock(&s_mutex);
+    printf("Arena: Freeing unknown block %p\n", p);
+    return;
+  }
+
+  Owner& o = s_owners[s_blocks[i].uOwner];
+  o.uBytes -= s_blocks[i].uSize;
+  o.uBlocks--;
+
+  // Heap blocks go back to the heap.  Arena blocks stay mapped for reuse.
+  bool bHeap = true;
+  for (unsigned int c=0; c<s_chunks.size(); c++) {
+    if (((char*) p >= s_chunks[c].pBase) &&
+        ((char*) p < s_chunks[c].pBase + s_chunks[c].uSize)) {
+      bHeap = false;
+      break;
+    }
+  }
+
+  if (bHeap) {
+    ::free(p);
+    s_blocks.erase(s_blocks.begin() + i);
+  } else {
+    s_blocks[i].bFree = true;
+  }
+
+  pthread_mutex_unlock(&s_mutex);
+}
+
+
+
+// ----------------------------------------------------------------------------
+// report()
+// ----------------------------------------------------------------------------
+void Arena::report()
+{
+  size_t uTotal = 0;
+
+  pthread_mutex_lock(&s_mutex);
+
+  printf("Arena: Memory reserved for large blocks:\n");
+  for (unsigned int i=0; i<s_owners.size(); i++) {
+    printf("Arena:   %-22s %8lu blocks %10.1f MB\n", s_owners[i].sName.c_str(),
+      s_owners[i].uBlocks, s_owners[i].uBytes / 1024.0 / 1024.0);
+    uTotal += s_owners[i].uBytes;
+  }
+  printf("Arena:   %-22s %8s        %10.1f MB\n", "total", "", uTotal / 1024.0 / 1024.0);
+
+  if (s_uPageMB == 0) {
+    printf("Arena: Blocks are on the heap (huge pages are off)\n");
+  } else {
+    for (unsigned int k=HUGE_1GB; k<NUM_KINDS; k++) {
+      size_t uMapped = 0;
+      size_t uUsed = 0;
+      unsigned int uChunks = 0;
+      for (unsigned int c=0; c<s_chunks.size(); c++) {
+        if (s_chunks[c].kind == (Kind) k) {
+          uMapped += s_chunks[c].uSize;
+          uUsed += s_chunks[c].uUsed;
+          uChunks++;
+        }
+      }
+      if (uChunks > 0) {
+        printf("Arena: %u chunk(s) of %s, %.1f MB mapped, %.1f MB used\n", uChunks,
+          kindName((Kind) k), uMapped / 1024.0 / 1024.0, uUsed / 1024.0 / 1024.0);
+      }
+    }
+  }
+
+  pthread_mutex_unlock(&s_mutex);
+}
@@ -0,0 +1,100 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <pthread.h>
+
+// ---------------------------------------------------------------------------
+//
+// ARENA
+//
+// Allocator for the large, long-lived blocks of the pipeline (buffer items,
+// FFT arrays, accumulators).  Blocks are carved out of big chunks mapped
+// with huge pages to cut TLB misses in the tap loops, and each chunk is
+// written (pre-faulted) when it is mapped so no page faults happen while
+// taking data.
+//
+// Chunks try, in order:
+//
+//   1. Explicit huge pages of the configured size (2 MB or 1 GB), which
+//      must be reserved in /proc/sys/vm/nr_hugepages or the sysfs
+//      equivalent
+//   2. Explicit 2 MB pages, when 1 GB pages were asked for
+//   3. Transparent huge pages (madvise), if the kernel allows them
+//   4. Normal pages
+//
+// Chunks are kept per NUMA node.  A block for a node comes from a chunk
+// that was first touched by a thread bound to that node (the caller must
+// already be bound, see Buffer::allocate).
+//
+// Freed blocks are kept for reuse by allocations of the same size on the
+// same node.  Chunks are only unmapped when the process exits.  With the
+// page size set to 0 (the default), blocks come from the heap as before
+// and are only counted for the report.
+//
+// Every block is ARENA_ALIGNMENT byte aligned and charged to an owner
+// (e.g. "dump buffers") for report() and the fastspec_memory_reserved_bytes
+// metric.
+//
+// ---------------------------------------------------------------------------
+
+#define ARENA_ALIGNMENT     64
+#define ARENA_CHUNK_BYTES   (64UL*1024*1024)
+
+class Arena {
+
+  public:
+
+    // Page size in MB for new chunks: 0 (heap), 2, or 1024.  Returns false
+    // for other sizes.  Should be set before anything is allocated.
+    static bool     setPageSize(unsigned int uMB);
+
+    // Returns an aligned block of uBytes charged to sOwner, or NULL
+    static void*    allocate(size_t uBytes, const std::string& sOwner, int iNode = -1);
+
+    // Returns a block to the arena (or the heap).  NULL is ignored.
+    static void     free(void* p);
+
+    // Print the memory reserved by each owner and the kind of pages used
+    static void     report();
+
+  private:
+
+    enum Kind { HEAP = 0, HUGE_1GB, HUGE_2MB, TRANSPARENT, NORMAL, NUM_KINDS };
+
+    struct Chunk {
+      char*         pBase;
+      size_t        uSize;
+      size_t        uUsed;
+      int           iNode;
+      Kind          kind;
+    };
+
+    struct Block {
+      void*         p;
+      size_t        uSize;
+      int           iNode;
+      unsigned int  uOwner;
+      bool          bFree;
+    };
+
+    struct Owner {
+      std::string   sName;
+      size_t        uBytes;
+      unsigned long uBlocks;
+    };
+
+    static pthread_mutex_t        s_mutex;
+    static unsigned int           s_uPageMB;
+    static std::vector<Chunk>     s_chunks;
+    static std::vector<Block>     s_blocks;
+    static std::vector<Owner>     s_owners;
+
+    static Chunk*         newChunk(size_t, int);
+    static unsigned int   owner(const std::string&);
+    static const char*    kindName(Kind);
+};
+
+#endif // _ARENA_H_
@@ -1,18 +1,36 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "buffer.h"
+#include "trace.h"
+#include "numa.h"
+#include "arena.h"
 
 
 // ----------------------------------------------------------------------------
 // Constructor
 // ----------------------------------------------------------------------------
-Buffer::Buffer() { 
+template<typename T>
+Buffer<T>::Buffer() { 
 
-  m_pos = m_full.begin();
+  m_pos.push_back(m_full.begin());
+  m_pending.push_back(0);
+  m_maxPending.push_back(0);
+  m_uItemLength = 0;
+  m_uNumItems = 0;
   m_uHolds = 0;
   m_uMaxFullSize = 0;
 	pthread_mutex_init(&m_mutex, NULL);
 	m_uIndex = 0;
+  m_uSegment = 0;
+  m_uLag = 0;
+  m_bRaw = false;
+  m_uInputs = 1;
+  m_pPushes = NULL;
+  m_pPushFailures = NULL;
+  m_pSkips = NULL;
+  m_pUsed = NULL;
+  m_pMaxUsed = NULL;
 
 }
 
@@ -20,20 +38,23 @@ Buffer::Buffer() {
 // ----------------------------------------------------------------------------
 // Denstructor
 // ----------------------------------------------------------------------------
-Buffer::~Buffer() { 
+template<typename T>
+Buffer<T>::~Buffer() { 
 
-  printf("Buffer: Maximum number of buffers used: %d of %d blocks (%.3g%%)\n", 
-    m_uMaxFullSize, m_uNumItems, 100.0*m_uMaxFullSize/m_uNumItems);
+  if (m_uNumItems > 0) {
+    printf("Buffer: Maximum number of buffers used: %d of %d blocks (%.3g%%)\n", 
+      m_uMaxFullSize, m_uNumItems, 100.0*m_uMaxFullSize/m_uNumItems);
+  }
   
 	// Free buffer items
-	list<Buffer::item>::iterator it;
+	typename list<Buffer::item>::iterator it;
 
 	for (it = m_empty.begin(); it != m_empty.end(); it++) {
-		free(it->pData);
+		Arena::free(it->pData);
 	}
 
 	for (it = m_full.begin(); it != m_full.end(); it++) {
-		free(it->pData);
+		Arena::free(it->pData);
 	}
 
 	pthread_mutex_destroy(&m_mutex);
@@ -43,32 +64,50 @@ Buffer::~Buffer() {
 // ----------------------------------------------------------------------------
 // allocate
 // ----------------------------------------------------------------------------
-// Create the buffers that will be used
-void Buffer::allocate(unsigned int uNumItems, unsigned int uItemLength) { 
+// Create the buffers that will be used.  To place them on a NUMA node, the 
+// calling thread moves to the node's CPUs while it writes every page of the
+// items (the kernel puts each page on the node that touches it first).
+template<typename T>
+void Buffer<T>::allocate(unsigned int uNumItems, unsigned int uItemLength, int iNode) { 
 	
 	m_uNumItems = uNumItems;
 	m_uItemLength = uItemLength;
 
 	Buffer::item item;
+  cpu_set_t affinity;
+
+  if (iNode >= 0) {
+    CPU_ZERO(&affinity);
+    pthread_getaffinity_np(pthread_self(), sizeof(affinity), &affinity);
+    Numa::bind((unsigned int) iNode);
+  }
 
 	// Allocate the buffer items
 	for (unsigned int i=0; i<uNumItems; i++) {
-		item.pData = (BUFFER_DATA_TYPE*) malloc(uItemLength*sizeof(BUFFER_DATA_TYPE));
+		item.pData = (T*) Arena::allocate(uItemLength*sizeof(T), 
+		                                  "channelizer buffers", iNode);
 		item.uHolds = 0;
 		item.uIndex = 0;
 
 		if (item.pData !=NULL) {
+      if (iNode >= 0) {
+        memset(item.pData, 0, uItemLength*sizeof(T));
+      }
 			m_empty.push_front(item);
 		} else {
 			printf("Buffer::Allocate -- Failed to allocate buffer item %d\n", i);
 		}
 	}	
 
+  if (iNode >= 0) {
+    pthread_setaffinity_np(pthread_self(), sizeof(affinity), &affinity);
+  }
+
   // Exercise the buffer to make sure delays from first time use don't occur
   // during operation
   SAMPLE_DATA_TYPE* pTemp = (SAMPLE_DATA_TYPE*) malloc(m_uItemLength*sizeof(SAMPLE_DATA_TYPE));
   if (pTemp) {
-    push(pTemp, m_uItemLength, 1.0, 0.0); 
+    push(pTemp, m_uItemLength, 1.0, 0.0, 0); 
     free(pTemp); 
   }
 
@@ -79,11 +118,104 @@ void Buffer::allocate(unsigned int uNumItems, unsigned int uItemLength) {
 }
 
 
+// ----------------------------------------------------------------------------
+// setName
+// ----------------------------------------------------------------------------
+// Register the buffer's metrics.  Buffers without a name don't publish any.
+template<typename T>
+void Buffer<T>::setName(const std::string& sName) {
+
+  std::string sLabels = "buffer=\"" + sName + "\"";
+
+  m_pPushes = Metrics::counter("fastspec_buffer_pushes_total", 
+    "Blocks pushed into the buffer", sLabels);
+  m_pPushFailures = Metrics::counter("fastspec_buffer_push_failures_total", 
+    "Blocks that could not be pushed because the buffer was full", sLabels);
+  m_pSkips = Metrics::counter("fastspec_buffer_reader_skips_total", 
+    "Blocks skipped by readers that fell too far behind", sLabels);
+  m_pUsed = Metrics::gauge("fastspec_buffer_used_blocks", 
+    "Blocks in use at the last push", sLabels);
+  m_pMaxUsed = Metrics::gauge("fastspec_buffer_max_used_blocks", 
+    "Most blocks in use at once", sLabels);
+  Metrics::gauge("fastspec_buffer_capacity_blocks", 
+    "Blocks allocated", sLabels)->set(m_uNumItems);
+}
+
+
+// ----------------------------------------------------------------------------
+// updatePushMetrics
+// ----------------------------------------------------------------------------
+// Called with the mutex held at the end of each push
+template<typename T>
+void Buffer<T>::updatePushMetrics(bool bSuccess) {
+
+  if (!m_pPushes) {
+    return;
+  }
+
+  if (bSuccess) {
+    m_pPushes->add();
+    m_pUsed->set(m_full.size());
+    m_pMaxUsed->setMax(m_full.size());
+  } else {
+    m_pPushFailures->add();
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// addToReaders
+// ----------------------------------------------------------------------------
+// Called with the mutex held for each pushed item.  A reader that had caught 
+// up now points to the new item.  A reader over its limit of pending items
+// skips its oldest one, which can then be recycled once no thread holds it.
+template<typename T>
+void Buffer<T>::addToReaders(typename list<Buffer::item>::iterator itNew) {
+
+  for (unsigned int r=0; r<m_pos.size(); r++) {
+    if (m_pos[r] == m_full.end()) { 
+      m_pos[r] = itNew;
+    }
+    m_pending[r]++;
+
+    if ((m_maxPending[r] > 0) && (m_pending[r] > m_maxPending[r])) {
+      m_pos[r]++;
+      m_pending[r]--;
+      if (m_pSkips) {
+        m_pSkips->add();
+      }
+    }
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// addReader
+// ----------------------------------------------------------------------------
+// Add a reader with its own head marker.  The new reader will see items 
+// pushed after it is added.
+template<typename T>
+unsigned int Buffer<T>::addReader(unsigned int uMaxPending) {
+
+	pthread_mutex_lock(&m_mutex);
+
+  m_pos.push_back(m_full.end());
+  m_pending.push_back(0);
+  m_maxPending.push_back(uMaxPending);
+  unsigned int uReader = m_pos.size() - 1;
+
+	pthread_mutex_unlock(&m_mutex);
+
+  return uReader;
+}
+
+
 // ----------------------------------------------------------------------------
 // copy
 // ----------------------------------------------------------------------------
 // 
-void Buffer::copy(const Buffer::iterator& iterOrig, Buffer::iterator& iterCopy) {
+template<typename T>
+void Buffer<T>::copy(const Buffer::iterator& iterOrig, Buffer::iterator& iterCopy) {
 
 	pthread_mutex_lock(&m_mutex);
 	
@@ -102,16 +234,19 @@ void Buffer::copy(const Buffer::iterator& iterOrig, Buffer::iterator& iterCopy)
 // Get the iterator of the next available item.  Fails and returns false if 
 // fewer than uNumAvailable items remain in the queue.  Adds a hold to the next
 // available item, but not to any beyond that (even if uNumAvailable > 1).  
-// Advances the buffer iterator head marker (m_pos) one step (even if 
+// Advances the reader's iterator head marker (m_pos) one step (even if 
 // uNumAvailable > 1).
-bool Buffer::request(Buffer::iterator& iter, unsigned int uNumAvailable) {
+template<typename T>
+bool Buffer<T>::request(Buffer::iterator& iter, unsigned int uNumAvailable, 
+                        unsigned int uReader) {
 
   bool bReturn = true;
 
 	pthread_mutex_lock(&m_mutex);
 
-  // Check that not at end of list
-	if (m_pos == m_full.end()) {
+  // Check that there are enough items ahead of the reader's head marker
+	if ((uReader >= m_pos.size()) || (m_pending[uReader] == 0) || 
+      (m_pending[uReader] < uNumAvailable)) {
 
     iter.it = m_full.end();
     iter.pBuffer = NULL;
@@ -119,33 +254,19 @@ bool Buffer::request(Buffer::iterator& iter, unsigned int uNumAvailable) {
 
   } else {
 
-    // Check that there are enough items ahead in the list
-    list<Buffer::item>::iterator it = m_pos;
-    unsigned int i = 1;
-    while ((i++ < uNumAvailable) && bReturn) {
-      if (++it == m_full.end()) {
-        iter.it = m_full.end();
-        iter.pBuffer = NULL;        
-        bReturn = false;
-      }
-    }  
-
-    // If enough items, assign the iter
-    if (bReturn) {
+    // Set the output to the next position
+    iter.it = m_pos[uReader];
+    iter.pBuffer = this;
 
-      // Set the output to the next position
-      iter.it = m_pos;
-      iter.pBuffer = this;
+    // Add a hold to the item
+    (iter.it)->uHolds++;
 
-    	// Add a hold to the item
-    	(iter.it)->uHolds++;
+    // Increment the reader's iterator head marker (m_pos)
+    m_pos[uReader]++;
+    m_pending[uReader]--;
 
-      // Increment the buffer iterator head marker (m_pos)
-      m_pos++;
-
-      // Increment the current total holds counter
-      m_uHolds++;
-    } 
+    // Increment the current total holds counter
+    m_uHolds++;
   }
 
 	pthread_mutex_unlock(&m_mutex);
@@ -160,7 +281,8 @@ bool Buffer::request(Buffer::iterator& iter, unsigned int uNumAvailable) {
 // ----------------------------------------------------------------------------
 // Returns false if there are fewer than uNumAvailable items available 
 // including the current item in the iterator.
-bool Buffer::available(Buffer::iterator& iter, unsigned int uNumAvailable) {
+template<typename T>
+bool Buffer<T>::available(Buffer::iterator& iter, unsigned int uNumAvailable) {
 
   bool bReturn = true;
 
@@ -172,7 +294,7 @@ bool Buffer::available(Buffer::iterator& iter, unsigned int uNumAvailable) {
   } else {
 
     // Check that there are enough items ahead in the list
-    list<Buffer::item>::iterator it = iter.it;
+    typename list<Buffer::item>::iterator it = iter.it;
     unsigned int i = 1;
     while ((i++ < uNumAvailable) && bReturn) {
       if (++it == m_full.end()) {
@@ -194,7 +316,8 @@ bool Buffer::available(Buffer::iterator& iter, unsigned int uNumAvailable) {
 // false if no more items in buffer.  Does not advance the buffer's iterator  
 // head marker (m_pos).  Use Buffer::request to increment the iterator and 
 // advance the buffer iterator head marker.
-bool Buffer::next(Buffer::iterator& iter) {
+template<typename T>
+bool Buffer<T>::next(Buffer::iterator& iter) {
 	
   bool bReturn = true;
 
@@ -206,7 +329,7 @@ bool Buffer::next(Buffer::iterator& iter) {
   } else {
 
   	// Test increment and check if end of buffer
-    list<Buffer::item>::iterator it = iter.it;
+    typename list<Buffer::item>::iterator it = iter.it;
 	  if (++it == m_full.end()) {
       bReturn = false;
     } else {
@@ -229,7 +352,8 @@ bool Buffer::next(Buffer::iterator& iter) {
 // release
 // ----------------------------------------------------------------------------
 // Release the iterator and move any finished full buffers back to empty queue
-void Buffer::release(Buffer::iterator& iter) {
+template<typename T>
+void Buffer<T>::release(Buffer::iterator& iter) {
 	
   pthread_mutex_lock(&m_mutex);
 
@@ -258,7 +382,8 @@ void Buffer::release(Buffer::iterator& iter) {
 // data
 // ----------------------------------------------------------------------------
 // Get pointer to data block in iterator's current item
-BUFFER_DATA_TYPE* Buffer::data(Buffer::iterator& iter) {
+template<typename T>
+T* Buffer<T>::data(Buffer::iterator& iter) {
   
   // Make sure is a valid iterator
   if ((iter.pBuffer != this) || (iter.it == m_full.end())) {
@@ -273,7 +398,8 @@ BUFFER_DATA_TYPE* Buffer::data(Buffer::iterator& iter) {
 // index
 // ----------------------------------------------------------------------------
 // Get pointer to data block in iterator's current item
-unsigned long long Buffer::index(Buffer::iterator& iter) {
+template<typename T>
+unsigned long long Buffer<T>::index(Buffer::iterator& iter) {
   
   // Make sure is a valid iterator
   if ((iter.pBuffer != this) || (iter.it == m_full.end())) {
@@ -284,20 +410,150 @@ unsigned long long Buffer::index(Buffer::iterator& iter) {
 }
 
 
+// ----------------------------------------------------------------------------
+// segment
+// ----------------------------------------------------------------------------
+// Get the segment of the iterator's current item
+template<typename T>
+unsigned long long Buffer<T>::segment(Buffer::iterator& iter) {
+  
+  // Make sure is a valid iterator
+  if ((iter.pBuffer != this) || (iter.it == m_full.end())) {
+    return 0;  
+  } else {
+    return (iter.it)->uSegment; 
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// lag
+// ----------------------------------------------------------------------------
+// Get the lag of the iterator's current item
+template<typename T>
+unsigned int Buffer<T>::lag(Buffer::iterator& iter) {
+  
+  // Make sure is a valid iterator
+  if ((iter.pBuffer != this) || (iter.it == m_full.end())) {
+    return 0;  
+  } else {
+    return (iter.it)->uLag; 
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// scale, offset
+// ----------------------------------------------------------------------------
+// Get the scale and offset of the raw codes in the iterator's current item
+template<typename T>
+double Buffer<T>::scale(Buffer::iterator& iter) {
+  
+  // Make sure is a valid iterator
+  if ((iter.pBuffer != this) || (iter.it == m_full.end())) {
+    return 1;  
+  } else {
+    return (iter.it)->dScale; 
+  }
+}
+
+template<typename T>
+double Buffer<T>::offset(Buffer::iterator& iter) {
+  
+  // Make sure is a valid iterator
+  if ((iter.pBuffer != this) || (iter.it == m_full.end())) {
+    return 0;  
+  } else {
+    return (iter.it)->dOffset; 
+  }
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setRaw
+// ----------------------------------------------------------------------------
+template<typename T>
+bool Buffer<T>::setRaw(bool bRaw) {
+
+  if (bRaw && (sizeof(SAMPLE_DATA_TYPE) != sizeof(int16_t))) {
+    printf("Buffer: Raw mode needs 16 bit samples\n");
+    return false;
+  }
+
+  m_bRaw = bRaw;
+  return true;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setInputs
+// ----------------------------------------------------------------------------
+template<typename T>
+bool Buffer<T>::setInputs(unsigned int uInputs) {
+
+  if ((uInputs != 1) && (uInputs != 2)) {
+    printf("Buffer: Can't split pushes into %u inputs (use 1 or 2)\n", uInputs);
+    return false;
+  }
+
+  if (m_uItemLength % uInputs != 0) {
+    printf("Buffer: Item length %u can't be split into %u inputs\n", m_uItemLength, uInputs);
+    return false;
+  }
+
+  m_uInputs = uInputs;
+  return true;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// sample
+// ----------------------------------------------------------------------------
+// Get the sample index of the first sample in the iterator's current item
+template<typename T>
+unsigned long long Buffer<T>::sample(Buffer::iterator& iter) {
+  
+  // Make sure is a valid iterator
+  if ((iter.pBuffer != this) || (iter.it == m_full.end())) {
+    return 0;  
+  } else {
+    return (iter.it)->uSample; 
+  }
+}
+
+
 
 
 // ----------------------------------------------------------------------------
 // cleanup
 // ----------------------------------------------------------------------------
 // Return finished buffers to the empty queue
-void Buffer::cleanup() {
+template<typename T>
+void Buffer<T>::cleanup() {
 
-	list<Buffer::item>::iterator it;
+	typename list<Buffer::item>::iterator it;
 	Buffer::item item;
 
 	pthread_mutex_lock(&m_mutex);
 
-	while ( ((it = m_full.begin()) != m_full.end()) && (it != m_pos) && ((*it).uHolds==0) ) {
+	while ( ((it = m_full.begin()) != m_full.end()) && ((*it).uHolds==0) ) {
+
+    // Stop at the first item that any reader hasn't reached yet
+    bool bReached = true;
+    for (unsigned int r=0; r<m_pos.size(); r++) {
+      if (it == m_pos[r]) {
+        bReached = false;
+        break;
+      }
+    }
+
+    if (!bReached) {
+      break;
+    }
+
 		item = m_full.front();
 		m_full.pop_front();
 		m_empty.push_front(item);
@@ -311,7 +567,8 @@ void Buffer::cleanup() {
 // cleanup
 // ----------------------------------------------------------------------------
 // Returns true if the specified iterator is the oldest in the buffer
-bool Buffer::oldest(const Buffer::iterator& iter) {
+template<typename T>
+bool Buffer<T>::oldest(const Buffer::iterator& iter) {
 
 	if (iter.pBuffer != this)
 		return false;
@@ -323,15 +580,81 @@ bool Buffer::oldest(const Buffer::iterator& iter) {
 
 
 
+// ----------------------------------------------------------------------------
+// push
+// ----------------------------------------------------------------------------
+// Push a copy of data that is already in the buffer data type (e.g. output of
+// an earlier processing stage) into the buffer
+template<typename T>
+bool Buffer<T>::push(T* pIn, unsigned int uLength, 
+                     unsigned long long uSample) {
+
+  Buffer::item item;
+  bool bReturn = false;
+  TraceSpan span("buffer push");
+
+  // Make sure input data has same length as buffer item block
+  if (uLength == m_uItemLength) {
+    
+    pthread_mutex_lock(&m_mutex);
+
+    // Try to get an empty buffer item for use
+    if (!m_empty.empty()) {
+  		
+    	item = m_empty.front();
+    	m_empty.pop_front();
+
+      // No need to stay locked while we copy the data (see below)
+    	pthread_mutex_unlock(&m_mutex);
+
+      // Copy the incoming data into our buffer
+      for (unsigned int i=0; i<uLength; i++) {
+        item.pData[i] = pIn[i];
+      }
+      
+      // Make sure holds are cleared
+      item.uHolds = 0;
+      
+      // Tell the item its index and increment the main index
+      item.uIndex = m_uIndex++;
+      item.uSegment = m_uSegment;
+      item.uLag = m_uLag;
+      item.uSample = uSample;
+      
+      // Need to relock to finish list management
+    	pthread_mutex_lock(&m_mutex);
+
+      // Put the item at the end of the buffer
+      m_full.push_back(item);
+
+      // Hand the new item to the readers
+      addToReaders(--m_full.end());
+
+      // Keep track of the maximum size of the full list
+      m_uMaxFullSize = (m_uMaxFullSize < m_full.size()) ? m_full.size() : m_uMaxFullSize;
+
+      bReturn = true;
+    }
+
+    updatePushMetrics(bReturn);
+    pthread_mutex_unlock(&m_mutex);
+  }
+
+	return bReturn;
+}
+
+
 // ----------------------------------------------------------------------------
 // push
 // ----------------------------------------------------------------------------
 // Push a copy of the input data into the buffer
-bool Buffer::push(SAMPLE_DATA_TYPE* pIn, unsigned int uLength, double dScale, 
-                  double dOffset) {
+template<typename T>
+bool Buffer<T>::push(SAMPLE_DATA_TYPE* pIn, unsigned int uLength, double dScale, 
+                     double dOffset, unsigned long long uSample) {
 
   Buffer::item item;
   bool bReturn = false;
+  TraceSpan span("buffer push");
 
   // Make sure input data has same length as buffer item block
   if (uLength == m_uItemLength) {
@@ -349,14 +672,48 @@ bool Buffer::push(SAMPLE_DATA_TYPE* pIn, unsigned int uLength, double dScale,
       // in the buffer)
     	pthread_mutex_unlock(&m_mutex);
 
-      // Do the casting of the scale and offset ahead of time so it doesn't
-      // happen for every entry in the loop
-      BUFFER_DATA_TYPE scale = (BUFFER_DATA_TYPE) dScale;
-      BUFFER_DATA_TYPE offset = (BUFFER_DATA_TYPE) dOffset;
-      
-      // Copy the incoming data into our buffer
-      for (unsigned int i=0; i<uLength; i++) {
-        item.pData[i] = ((BUFFER_DATA_TYPE) pIn[i]) * scale + offset;
+      // With two inputs, each half of the item gets one input.  The loops
+      // read the pairs and write both halves in the same pass, which the
+      // compiler turns into SIMD loads and shuffles.
+      unsigned int uHalf = uLength / 2;
+
+      if (m_bRaw) {
+
+        // Keep the codes, centered on zero, and how to scale them
+        int16_t* pRaw = (int16_t*) item.pData;
+        if (m_uInputs == 2) {
+          int16_t* pRawB = pRaw + uHalf;
+          for (unsigned int i=0; i<uHalf; i++) {
+            pRaw[i] = (int16_t) (pIn[2*i] - BUFFER_RAW_BIAS);
+            pRawB[i] = (int16_t) (pIn[2*i+1] - BUFFER_RAW_BIAS);
+          }
+        } else {
+          for (unsigned int i=0; i<uLength; i++) {
+            pRaw[i] = (int16_t) (pIn[i] - BUFFER_RAW_BIAS);
+          }
+        }
+        item.dScale = dScale;
+        item.dOffset = dOffset + BUFFER_RAW_BIAS * dScale;
+
+      } else {
+
+        // Do the casting of the scale and offset ahead of time so it doesn't
+        // happen for every entry in the loop
+        T scale = (T) dScale;
+        T offset = (T) dOffset;
+        
+        // Copy the incoming data into our buffer
+        if (m_uInputs == 2) {
+          T* pDataB = item.pData + uHalf;
+          for (unsigned int i=0; i<uHalf; i++) {
+            item.pData[i] = ((T) pIn[2*i]) * scale + offset;
+            pDataB[i] = ((T) pIn[2*i+1]) * scale + offset;
+          }
+        } else {
+          for (unsigned int i=0; i<uLength; i++) {
+            item.pData[i] = ((T) pIn[i]) * scale + offset;
+          }
+        }
       }
       
       // Make sure holds are cleared
@@ -365,6 +722,9 @@ bool Buffer::push(SAMPLE_DATA_TYPE* pIn, unsigned int uLength, double dScale,
       // Tell the item its index and increment the main index to be ready for 
       // next push.     
       item.uIndex = m_uIndex++;
+      item.uSegment = m_uSegment;
+      item.uLag = m_uLag;
+      item.uSample = uSample;
       
       // Need to relock to finish list management (see unlock above copy)
     	pthread_mutex_lock(&m_mutex);
@@ -372,10 +732,8 @@ bool Buffer::push(SAMPLE_DATA_TYPE* pIn, unsigned int uLength, double dScale,
       // Put the item at the end of the buffer
       m_full.push_back(item);
 
-      // If the list was empty, update m_pos to the new beginning
-      if (m_pos == m_full.end()) { 
-      	m_pos = m_full.begin();
-      }
+      // Hand the new item to the readers
+      addToReaders(--m_full.end());
 
       // Keep track of the maximum size of the full list
       m_uMaxFullSize = (m_uMaxFullSize < m_full.size()) ? m_full.size() : m_uMaxFullSize;
@@ -383,6 +741,7 @@ bool Buffer::push(SAMPLE_DATA_TYPE* pIn, unsigned int uLength, double dScale,
       bReturn = true;
     }
 
+    updatePushMetrics(bReturn);
     pthread_mutex_unlock(&m_mutex);
   }
 
@@ -394,7 +753,8 @@ bool Buffer::push(SAMPLE_DATA_TYPE* pIn, unsigned int uLength, double dScale,
 // size
 // ----------------------------------------------------------------------------
 // Return number of holds on items in the buffer
-unsigned int Buffer::holds() {
+template<typename T>
+unsigned int Buffer<T>::holds() {
 
   return m_uHolds;
 }
@@ -404,7 +764,8 @@ unsigned int Buffer::holds() {
 // size
 // ----------------------------------------------------------------------------
 // Return number of items in the full list (includes all items)
-unsigned int Buffer::size() {
+template<typename T>
+unsigned int Buffer<T>::size() {
 
 	pthread_mutex_lock(&m_mutex);
 	unsigned int uSize = m_full.size();
@@ -413,11 +774,26 @@ unsigned int Buffer::size() {
 	return uSize;
 }
 
+// ----------------------------------------------------------------------------
+// pending
+// ----------------------------------------------------------------------------
+// Return number of items the reader has not requested yet
+template<typename T>
+unsigned int Buffer<T>::pending(unsigned int uReader) {
+
+  pthread_mutex_lock(&m_mutex);
+  unsigned int uPending = (uReader < m_pending.size()) ? m_pending[uReader] : 0;
+  pthread_mutex_unlock(&m_mutex);
+
+  return uPending;
+}
+
 // ----------------------------------------------------------------------------
 // empty
 // ----------------------------------------------------------------------------
 // Return true if there are no items in the full list
-bool Buffer::empty() {
+template<typename T>
+bool Buffer<T>::empty() {
 
   pthread_mutex_lock(&m_mutex);
   bool bEmpty = (m_full.size() == 0);
@@ -431,9 +807,10 @@ bool Buffer::empty() {
 // ----------------------------------------------------------------------------
 // Empties the buffer by moving any items in the full list to the empty list.
 // Any items in use and with holds become invalid.
-void Buffer::clear() {
+template<typename T>
+void Buffer<T>::clear() {
 
-  list<Buffer::item>::iterator it;
+  typename list<Buffer::item>::iterator it;
   Buffer::item item;
 
   pthread_mutex_lock(&m_mutex);
@@ -446,7 +823,10 @@ void Buffer::clear() {
     m_empty.push_front(item);
   }  
 
-  m_pos = m_full.begin();
+  for (unsigned int r=0; r<m_pos.size(); r++) {
+    m_pos[r] = m_full.end();
+    m_pending[r] = 0;
+  }
   m_uHolds = 0;
   m_uIndex = 0;
 
@@ -454,3 +834,6 @@ void Buffer::clear() {
 }
 
 
+
+template class Buffer<float>;
+template class Buffer<double>;
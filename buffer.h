@@ -3,7 +3,11 @@
 
 
 #include <pthread.h>
+#include <stdint.h>
 #include <list>
+#include <vector>
+#include <string>
+#include "metrics.h"
 
 using namespace std;
 
@@ -11,15 +15,48 @@ using namespace std;
   #error Aborted in buffer.h because SAMPLE_DATA_TYPE was not defined.
 #endif
 
-#ifndef BUFFER_DATA_TYPE
-  #error Aborted in buffer.h because BUFFER_DATA_TYPE was not defined.
-#endif
-
 // A circular buffer based on an iterator architecture and implemented
 // using Standard Template Library <list> class.  Each item in the
 // buffer is a pointer to a block of data.  Multiple access is 
 // supported, with the tail of the buffer advancing only when all
 // open iterators have moved beyond an item.
+//
+// Multiple independent readers are also supported.  Each reader has its 
+// own head marker, so every reader sees every item pushed into the buffer
+// exactly once.  Reader 0 always exists; more can be added with addReader.
+// Items are only returned to the empty queue once all readers have moved 
+// beyond them.  An added reader can be given a limit on its pending items,
+// so that it can't hold up the recycling for the others if it is slow.  
+// When it falls further behind, each push skips it past its oldest pending
+// item, which it then sees as a gap in the sample indices.
+//
+// Each item can also carry a segment number and a lag set by the pusher 
+// with setSegment (both 0 by default).  They let a pusher that splits one
+// stream across several buffers mark which items are contiguous and which
+// are repeated history from another buffer (see PFBBank).
+//
+// Each item also carries the absolute sample index of its first sample, 
+// given by the pusher.  Unlike the item index, which counts pushes since 
+// the last clear(), it shows a reader where blocks are missing (e.g. after
+// a failed push) so it never treats samples on either side of a gap as
+// contiguous.
+//
+// The items hold samples of type T, the compute type of the channelizers
+// reading them (float or double, see ChannelizerBank).
+//
+// In raw mode (setRaw), samples pushed as SAMPLE_DATA_TYPE are not scaled
+// into T.  The start of each item holds them as int16_t codes centered on
+// zero (BUFFER_RAW_BIAS is subtracted), and the item keeps the scale and
+// offset that turn a code back into a sample value: code * scale(iter) +
+// offset(iter).  Only for 16 bit sample types.
+//
+// With two inputs (setInputs), samples pushed as SAMPLE_DATA_TYPE hold both
+// inputs interleaved (A, B, A, B, ...), as a dual channel digitizer 
+// transfers them.  The push de-interleaves them so the first half of each 
+// item holds input A and the second half input B, each contiguous in time.
+// The item's sample index is then the sample time of its first pair.
+#define BUFFER_RAW_BIAS   ((((SAMPLE_DATA_TYPE) -1) > 0) ? 32768 : 0)
+template<typename T>
 class Buffer {
 
 	public:
@@ -32,14 +69,17 @@ class Buffer {
 		public:
 
 			// Constructor
-			item( BUFFER_DATA_TYPE* p = NULL, 
+			item( T* p = NULL, 
 			      unsigned int u = 0, 
 			      unsigned long long l = 0) 
-				: pData(p), uHolds(u), uIndex(l) {}
+				: pData(p), uHolds(u), uIndex(l), uSegment(0), uLag(0), uSample(0),
+				  dScale(1), dOffset(0) {}
 
 			// Copy Constructor
 			item(const Buffer::item& item2) 
-				: pData(item2.pData), uHolds(item2.uHolds), uIndex(item2.uIndex) {}		
+				: pData(item2.pData), uHolds(item2.uHolds), uIndex(item2.uIndex),
+				  uSegment(item2.uSegment), uLag(item2.uLag), uSample(item2.uSample),
+				  dScale(item2.dScale), dOffset(item2.dOffset) {}		
 
 			// Destructor
 			~item() {}
@@ -50,9 +90,14 @@ class Buffer {
 			}
 			
 			// Member variables
-			BUFFER_DATA_TYPE*		  pData;
+			T*								pData;
 			unsigned int 					uHolds;
 			unsigned long long    uIndex;
+			unsigned long long    uSegment;
+			unsigned int          uLag;
+			unsigned long long    uSample;
+			double                dScale;     // Raw mode only
+			double                dOffset;
 	};
 
 	// Nested class for the external iterator exposed by the buffer.
@@ -76,7 +121,7 @@ class Buffer {
 		private: 
 
 			// Member variables
-			list<Buffer::item>::iterator 		it;
+			typename list<Buffer::item>::iterator it;
 			Buffer*													pBuffer;
 
 		friend Buffer;
@@ -90,14 +135,20 @@ class Buffer {
 
 
 	  // Allocate the buffer items that will be used.  This defines the size of 
-	  // the buffer and must be called before the before can be used.
-	  void allocate(unsigned int, unsigned int);
+	  // the buffer and must be called before the before can be used.  If a
+	  // NUMA node is given, the items are placed in its memory.
+	  void allocate(unsigned int, unsigned int, int iNode = -1);
+
+	  // Add an independent reader with its own head marker and at most 
+	  // uMaxPending pending items (0 for no limit).  Returns the reader id to
+	  // use in calls to request and pending.
+	  unsigned int addReader(unsigned int uMaxPending = 0);
 	  
 	  // Get a copy of an iterator, incrementing the hold on its item
 	  void copy(const Buffer::iterator&, Buffer::iterator&);
 
-	  // Get the iterator of the next available item
-		bool request(Buffer::iterator&, unsigned int);
+	  // Get the iterator of the next available item for a reader
+		bool request(Buffer::iterator&, unsigned int, unsigned int uReader = 0);
 
 		// Returns false if there are fewer than uNumAvailable items available in 
 		// the list starting at iterator's current position
@@ -111,16 +162,49 @@ class Buffer {
 	  void release(Buffer::iterator&);
 
 	  // Returns pointer to the buffer block in the current item in the iterator
-	  BUFFER_DATA_TYPE* data(Buffer::iterator&);
+	  T* data(Buffer::iterator&);
 	  
 	  // Returns index of the buffer block in the current item in the iterator
 	  unsigned long long index(Buffer::iterator&);
 
-	  // Push data into the buffer.  Returns false if buffer is full.
-	  bool push(BUFFER_DATA_TYPE*, unsigned int);
-
-	  // Push data into the buffer.  Returns false if buffer is full.
-	  bool push(SAMPLE_DATA_TYPE*, unsigned int, double, double);
+	  // Returns the segment and lag of the current item in the iterator
+	  unsigned long long segment(Buffer::iterator&);
+	  unsigned int lag(Buffer::iterator&);
+
+	  // Returns the sample index of the first sample in the current item
+	  unsigned long long sample(Buffer::iterator&);
+
+	  // Returns the scale and offset of the codes in the current item (raw 
+	  // mode only)
+	  double scale(Buffer::iterator&);
+	  double offset(Buffer::iterator&);
+
+	  // Keep pushed samples as 16 bit codes instead of scaling them (see 
+	  // above).  Returns false if the sample type isn't 16 bits.  Should be
+	  // set before the first push.
+	  bool setRaw(bool);
+	  bool raw() const { return m_bRaw; }
+
+	  // Number of inputs interleaved in pushed samples (1 or 2, see above).
+	  // Returns false for any other number.  Should be set before the first
+	  // push.
+	  bool setInputs(unsigned int);
+	  unsigned int inputs() const { return m_uInputs; }
+
+	  // Segment and lag given to the items of following pushes.  Should only
+	  // be called by the thread that pushes.
+	  void setSegment(unsigned long long uSegment, unsigned int uLag) { 
+	    m_uSegment = uSegment; 
+	    m_uLag = uLag; 
+	  }
+
+	  // Push data into the buffer with the sample index of its first sample.
+	  // Returns false if buffer is full.
+	  bool push(T*, unsigned int, unsigned long long);
+
+	  // Push data into the buffer with the sample index of its first sample.
+	  // Returns false if buffer is full.
+	  bool push(SAMPLE_DATA_TYPE*, unsigned int, double, double, unsigned long long);
 	  
 	  // Returns number of holds on items currently in buffer
 	  unsigned int holds();
@@ -128,6 +212,19 @@ class Buffer {
 	  // Returns number of items currently in buffer
 	  unsigned int size();
 
+	  // Returns number of items not yet requested by a reader
+	  unsigned int pending(unsigned int uReader = 0);
+
+	  // Returns the length of each buffer item
+	  unsigned int itemLength() const { return m_uItemLength; }
+
+	  // Number of items allocated
+	  unsigned int capacity() const { return m_uNumItems; }
+
+	  // Name the buffer to publish its pushes, failed pushes, and occupancy
+	  // as metrics labelled buffer="<name>"
+	  void setName(const std::string&);
+
 	  // Returns true if buffer is empty
 	  bool empty();
 
@@ -142,10 +239,18 @@ class Buffer {
 	  // Advances the tail of the circular buffer if possible
 	  void cleanup();
 
+	  // Updates the metrics after a push (called with the mutex held)
+	  void updatePushMetrics(bool);
+
+	  // Points the readers at a newly pushed item (called with the mutex held)
+	  void addToReaders(typename list<Buffer::item>::iterator);
+
 	  // Member variables
 		list<Buffer::item>							m_empty;
 		list<Buffer::item>							m_full;
-		list<Buffer::item>::iterator		m_pos;
+		vector<typename list<Buffer::item>::iterator>	m_pos;
+		vector<unsigned int>						m_pending;
+		vector<unsigned int>						m_maxPending;   // Per reader, 0 for no limit
 		unsigned int 										m_uItemLength;
 		unsigned int										m_uNumItems;
 		unsigned int 										m_uHolds;
@@ -153,6 +258,16 @@ class Buffer {
 		pthread_mutex_t        					m_mutex;
 		
 		unsigned long long              m_uIndex;
+		unsigned long long              m_uSegment;
+		unsigned int                    m_uLag;
+		bool                            m_bRaw;
+		unsigned int                    m_uInputs;
+
+		MetricCounter*                  m_pPushes;
+		MetricCounter*                  m_pPushFailures;
+		MetricCounter*                  m_pSkips;
+		MetricGauge*                    m_pUsed;
+		MetricGauge*                    m_pMaxUsed;
 
 };
 
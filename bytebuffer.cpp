@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <cstring>
 #include "bytebuffer.h"
+#include "arena.h"
 
 
 // ----------------------------------------------------------------------------
@@ -13,6 +14,10 @@ ByteBuffer::ByteBuffer() {
   m_uHolds = 0;
   m_uMaxFullSize = 0;
 	pthread_mutex_init(&m_mutex, NULL);
+  m_pPushes = NULL;
+  m_pPushFailures = NULL;
+  m_pUsed = NULL;
+  m_pMaxUsed = NULL;
 
 }
 
@@ -29,17 +34,38 @@ ByteBuffer::~ByteBuffer() {
 	list<ByteBuffer::item>::iterator it;
 
 	for (it = m_empty.begin(); it != m_empty.end(); it++) {
-		free(it->pData);
+		Arena::free(it->pData);
 	}
 
 	for (it = m_full.begin(); it != m_full.end(); it++) {
-		free(it->pData);
+		Arena::free(it->pData);
 	}
 
 	pthread_mutex_destroy(&m_mutex);
 }
 
 
+// ----------------------------------------------------------------------------
+// setName
+// ----------------------------------------------------------------------------
+// Register the buffer's metrics.  Buffers without a name don't publish any.
+void ByteBuffer::setName(const std::string& sName) {
+
+  std::string sLabels = "buffer=\"" + sName + "\"";
+
+  m_pPushes = Metrics::counter("fastspec_buffer_pushes_total", 
+    "Blocks pushed into the buffer", sLabels);
+  m_pPushFailures = Metrics::counter("fastspec_buffer_push_failures_total", 
+    "Blocks that could not be pushed because the buffer was full", sLabels);
+  m_pUsed = Metrics::gauge("fastspec_buffer_used_blocks", 
+    "Blocks in use at the last push", sLabels);
+  m_pMaxUsed = Metrics::gauge("fastspec_buffer_max_used_blocks", 
+    "Most blocks in use at once", sLabels);
+  Metrics::gauge("fastspec_buffer_capacity_blocks", 
+    "Blocks allocated", sLabels)->set(m_uNumItems);
+}
+
+
 // ----------------------------------------------------------------------------
 // allocate
 // uNumItems - number of items in the buffer
@@ -55,7 +81,7 @@ void ByteBuffer::allocate(unsigned int uNumItems, unsigned int uItemLength) {
 
 	// Allocate the buffer items
 	for (unsigned int i=0; i<uNumItems; i++) {
-		item.pData = malloc(uItemLength);
+		item.pData = Arena::allocate(uItemLength, "dump buffers");
 		item.uHolds = 0;
 
 		if (item.pData !=NULL) {
@@ -322,7 +348,16 @@ bool ByteBuffer::push(void* pIn, unsigned int uByteLength) {
       // Keep track of the maximum size of the full list
       m_uMaxFullSize = (m_uMaxFullSize < m_full.size()) ? m_full.size() : m_uMaxFullSize;
 
+      if (m_pPushes) {
+        m_pPushes->add();
+        m_pUsed->set(m_full.size());
+        m_pMaxUsed->setMax(m_full.size());
+      }
+
       bReturn = true;
+
+    } else if (m_pPushFailures) {
+      m_pPushFailures->add();
     }
 
     pthread_mutex_unlock(&m_mutex);
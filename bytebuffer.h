@@ -4,6 +4,8 @@
 
 #include <pthread.h>
 #include <list>
+#include <string>
+#include "metrics.h"
 
 using namespace std;
 
@@ -109,6 +111,10 @@ class ByteBuffer {
 
 	  // Empties the buffer
 	  void clear();
+
+	  // Name the buffer to publish its pushes, failed pushes, and occupancy
+	  // as metrics labelled buffer="<name>"
+	  void setName(const std::string&);
 	
 	private:
 
@@ -125,6 +131,11 @@ class ByteBuffer {
 		unsigned int 										    m_uMaxFullSize;
 		pthread_mutex_t        					    m_mutex;
 
+		MetricCounter*                      m_pPushes;
+		MetricCounter*                      m_pPushFailures;
+		MetricGauge*                        m_pUsed;
+		MetricGauge*                        m_pMaxUsed;
+
 };
 
 
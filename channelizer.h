@@ -5,15 +5,49 @@
   #error Aborted in channelizer.h because SAMPLE_DATA_TYPE was not defined.
 #endif
 
-#ifndef BUFFER_DATA_TYPE
-  #error Aborted in channelizer.h because BUFFER_DATA_TYPE was not defined.
-#endif
+#include <vector>
 
+// Spectra are passed on in the channelizer's compute type T (float or 
+// double, chosen at run time, see ChannelizerBank)
+template<typename T>
 struct ChannelizerData {
-  BUFFER_DATA_TYPE* pData;
+  T* pData;
+  T* pData2;                    // Power squared (NULL if not computed)
   unsigned int uNumChannels;
   double dADCmin;
   double dADCmax;
+  unsigned int uId;             // Which channelizer produced the spectrum
+  unsigned long long uSample;   // Index of the first input sample of the frame
+
+  // Complex spectrum of the same channels (see PFB::setVoltageOutput), with
+  // the real and imaginary parts of each channel interleaved.  NULL if not
+  // requested.  Only valid during the callback.
+  void* pVoltage;
+  unsigned int uVoltageBits;    // Per part: 8 or 16 (int8_t, int16_t), 32 or 64 (float, double)
+  const float* pVoltageGains;   // Gain of each channel before requantizing to integers
+
+  // Second input of a dual input channelizer (see PFB).  pData and pData2
+  // above are then the power of input A.  NULL with a single input.
+  T* pDataB;                    // Power of input B
+  T* pCross;                    // A x conj(B): uNumChannels real parts, then uNumChannels imaginary parts
+  double dADCminB;
+  double dADCmaxB;
+
+  // Weight of each channel after RFI flagging (see PFB::setFlagger): 0 if
+  // the channel was flagged (and, unless skipped, zeroed in pData and 
+  // pData2), else 1.  NULL if the spectrum wasn't flagged.
+  T* pWeights;
+
+  // The flagger skipped the spectrum.  Only pWeights is meant to be used, to
+  // count the flags; the spectrum must not be accumulated.
+  bool bSkipped;
+};
+
+struct ChannelizerStatus {
+  unsigned int uBuffersUsed;
+  unsigned int uBuffersTotal;
+  unsigned long uLostSpectra;             // Dropped at gaps in the samples
+  std::vector<double> threadUtilization;  // Busy fraction of each thread
 };
 
 
@@ -22,14 +56,17 @@ struct ChannelizerData {
 //
 // ChannelizerReceiver
 //
-// Virtual Interface for class that can receive channelizer data
+// Virtual Interface for class that can receive channelizer data.  A 
+// receiver takes spectra of either precision, so it works with whichever 
+// the channelizer was created with.
 //
 // ---------------------------------------------------------------------------
 class ChannelizerReceiver {
 
   public:  
 
-    virtual void  onChannelizerData(ChannelizerData*) = 0;
+    virtual void  onChannelizerData(ChannelizerData<float>*) = 0;
+    virtual void  onChannelizerData(ChannelizerData<double>*) = 0;
 };
 
 
@@ -46,10 +83,22 @@ class Channelizer {
 
   public:
 
-    virtual bool    push(SAMPLE_DATA_TYPE*, unsigned int, double, double) = 0;
+    virtual         ~Channelizer() {}
+    // Push a block of samples with the sample index of its first sample.  The
+    // index only needs to increase by the block length between contiguous
+    // blocks, so a jump marks a gap.
+    virtual bool    push(SAMPLE_DATA_TYPE*, unsigned int, double, double, unsigned long long) = 0;
     virtual void    setCallback(ChannelizerReceiver*) = 0;
     virtual void		waitForEmpty() = 0;
 
+    // Adds buffer occupancy and the fraction of time each worker thread was
+    // busy since the previous call.  Channelizers without status do nothing.
+    virtual void    getStatus(ChannelizerStatus&) {}
+
+    // Fraction (0 to 1) of the fullest input buffer holding blocks that are
+    // waiting to be processed.  Channelizers that can't tell return 0.
+    virtual double  fill() { return 0; }
+
 };
 
 #endif // _CHANNELIZER_H_
@@ -1,11 +1,18 @@
 #include <cstdio>       // remove
 #include <fstream>      // ifstream, ofstream
 #include <signal.h>     // sigaction
+#include <stdlib.h>     // strtoul
 #include <sys/types.h>  
+#include <sys/socket.h> // control socket
+#include <sys/un.h>
+#include <poll.h>
+#include <string.h>     // strncpy
 #include <sstream>
 #include <limits>       // numeric_limits<int>::max();
 #include "utility.h"    // font colors
 #include "controller.h"
+#include "metrics.h"
+#include "trace.h"
 
 
 
@@ -23,7 +30,14 @@ Controller::Controller() {
   m_bDump = false;
   m_pSpawn = NULL;
   m_uPlotBin = 1;
+  m_dPlotRefresh = PLOT_REFRESH;
   m_bAutoName = true;
+  m_pReceiver = NULL;
+  m_iServerSocket = -1;
+  m_bServerRunning = false;
+
+  pthread_mutex_init(&m_mutex, NULL);
+  pthread_mutex_init(&m_mutexPlot, NULL);
 }
 
 
@@ -32,8 +46,11 @@ Controller::Controller() {
 // ----------------------------------------------------------------------------
 Controller::~Controller() {
 
+  // Stop answering requests
+  stopServer();
+
   // Stop any plotting
-  setPlot(false, m_uPlotBin);
+  setPlot(false, m_uPlotBin, m_dPlotRefresh);
 
   // Close out as needed for the execution modes
   switch (m_iMode) {
@@ -41,13 +58,15 @@ Controller::~Controller() {
     case CTRL_MODE_START:
       printf("Controller: Removing PID file\n");
       deletePID();
-      deleteMsg();
       break;
   }
 
   if (m_pIni) {
     delete m_pIni;
   }
+
+  pthread_mutex_destroy(&m_mutex);
+  pthread_mutex_destroy(&m_mutexPlot);
 }
 
 
@@ -59,22 +78,6 @@ void Controller::deletePID() {
 }
 
 
-// ----------------------------------------------------------------------------
-// deletePlot - Delete existing PID file
-// ----------------------------------------------------------------------------
-void Controller::deletePlot() {
-  std::remove(PLOT_FILE);
-}
-
-
-// ----------------------------------------------------------------------------
-// deleteMsg - Deletes any existing message file
-// ----------------------------------------------------------------------------
-void Controller::deleteMsg() {
-  std::remove(MSG_FILE);
-}
-
-
 // ----------------------------------------------------------------------------
 // getConfigStr - Returns a string listing all of the configuration options
 //                that have been queried using getOption*() and the value
@@ -324,55 +327,10 @@ void Controller::onSignal(int iSignalNumber) {
       // Set the stop flag
       m_bStopSignal = true;
       break; // SIGINT
-
-    case SIGUSR1:
-    
-      int iMsg = 0;
-      if (readMsg(iMsg)) {
-
-        switch (iMsg) {
-        
-          case CTRL_MODE_SHOW:
-            printf(BLU "----------------------------------------------------------------------\n" RESET);
-            printf(BLU "*** SHOW PLOT signal received ***\n" RESET);
-            printf(BLU "----------------------------------------------------------------------\n" RESET);         
-            setPlot(true, m_uPlotBin);
-            break;
-
-          case CTRL_MODE_HIDE:
-            printf(BLU "----------------------------------------------------------------------\n" RESET);
-            printf(BLU "*** HIDE PLOT signal received ***\n" RESET);
-            printf(BLU "----------------------------------------------------------------------\n" RESET);         
-            setPlot(false, m_uPlotBin);
-            break;
-
-          case CTRL_MODE_DUMP_START:
-            printf(BLU "----------------------------------------------------------------------\n" RESET);
-            printf(BLU "*** BEGIN RAW DATA DUMP signal received ***\n" RESET);
-            printf(BLU "----------------------------------------------------------------------\n" RESET);         
-            setDump(true);
-            break;
-            
-          case CTRL_MODE_DUMP_STOP:
-            printf(BLU "----------------------------------------------------------------------\n" RESET);
-            printf(BLU "*** END RAW DATA DUMP signal received ***\n" RESET);
-            printf(BLU "----------------------------------------------------------------------\n" RESET);         
-            setDump(false);
-            break;   
-        }       
-      } else {
-        printf("\n\n*** Received new message signal, but failed to read message***\n\n");
-      }
-      
-      break; // SIGUSR1
   }
 }
 
 
-std::string Controller::getPlotFilePath() {
-  return std::string(PLOT_FILE);
-}
-
 std::string Controller::getDumpFilePath(const TimeKeeper& tk) {
   return updateOutputBase(tk) + "__" + tk.getFileString(5) + ".dmp";
 }
@@ -430,25 +388,111 @@ bool Controller::readPID(pid_t& pid, unsigned long long& tm) {
 }
 
 // ----------------------------------------------------------------------------
-// readMsg - Read existing message file. Returns false if can't open the file
+// onRequest - Handle one request received on the control socket and return 
+//             the reply.  Called from the server thread.
 // ----------------------------------------------------------------------------
-bool Controller::readMsg(int& iMsg) {
+std::string Controller::onRequest(const std::string& sRequest) {
+
+  std::string sCommand;
+  std::string sArg;
+  std::string sArg2;
+  unsigned int uBin = 1;
+  std::string sReply;
+
+  std::istringstream ss(sRequest);
+  ss >> sCommand >> sArg >> sArg2;
+  if (!sArg.empty()) {
+    uBin = strtoul(sArg.c_str(), NULL, 10);
+  }
 
-  iMsg = 0;
+  pthread_mutex_lock(&m_mutex);
 
-  std::ifstream fs;
-  fs.open(MSG_FILE);
-  if (!fs.is_open()) {
-    return false;
-  } 
+  if (sCommand == "stop") {
 
-  fs >> iMsg;
+    printf("\n");
+    printf(BLU "----------------------------------------------------------------------\n" RESET);
+    printf(BLU "*** STOP request received ***\n" RESET);
+    printf(BLU "----------------------------------------------------------------------\n" RESET);
+    m_bStopSignal = true;
+    sReply = "OK\n";
 
-  fs.close();
-  
-  deleteMsg();
-  
-  return true;
+  } else if (sCommand == "show") {
+
+    printf(BLU "----------------------------------------------------------------------\n" RESET);
+    printf(BLU "*** SHOW PLOT request received ***\n" RESET);
+    printf(BLU "----------------------------------------------------------------------\n" RESET);         
+    setPlot(true, m_uPlotBin, m_dPlotRefresh);
+    sReply = "OK\n";
+
+  } else if (sCommand == "hide") {
+
+    printf(BLU "----------------------------------------------------------------------\n" RESET);
+    printf(BLU "*** HIDE PLOT request received ***\n" RESET);
+    printf(BLU "----------------------------------------------------------------------\n" RESET);         
+    setPlot(false, m_uPlotBin, m_dPlotRefresh);
+    sReply = "OK\n";
+
+  } else if (sCommand == "dump") {
+
+    printf(BLU "----------------------------------------------------------------------\n" RESET);
+    printf(BLU "*** BEGIN RAW DATA DUMP request received ***\n" RESET);
+    printf(BLU "----------------------------------------------------------------------\n" RESET);         
+    setDump(true);
+    sReply = "OK\n";
+
+  } else if (sCommand == "nodump") {
+
+    printf(BLU "----------------------------------------------------------------------\n" RESET);
+    printf(BLU "*** END RAW DATA DUMP request received ***\n" RESET);
+    printf(BLU "----------------------------------------------------------------------\n" RESET);         
+    setDump(false);
+    sReply = "OK\n";
+
+  } else if (sCommand == "status") {
+
+    sReply = "OK\n";
+    sReply += "pid: " + std::to_string(getpid()) + "\n";
+    sReply += "stopping: " + std::to_string(m_bStopSignal) + "\n";
+    sReply += "plot: " + std::to_string(m_bPlot) + "\n";
+    sReply += "dump: " + std::to_string(m_bDump) + "\n";
+    if (m_pReceiver) {
+      sReply += m_pReceiver->onStatusRequest();
+    }
+
+  } else if (sCommand == "spectrum") {
+
+    if (m_pReceiver) {
+      sReply = m_pReceiver->onSpectrumRequest((uBin < 1) ? 1 : uBin);
+    } else {
+      sReply = "ERROR no spectrometer is running\n";
+    }
+
+  } else if (sCommand == "metrics") {
+
+    sReply = "OK\n" + Metrics::expose();
+
+  } else if ((sCommand == "trace") && ((sArg == "on") || (sArg == "off"))) {
+
+    Trace::enable(sArg == "on");
+    sReply = "OK\n";
+
+  } else if ((sCommand == "trace") && (sArg == "write")) {
+
+    std::string sFilePath = sArg2.empty() ? TRACE_FILE : sArg2;
+    long iCount = Trace::writeJSON(sFilePath);
+    if (iCount >= 0) {
+      sReply = "OK\nfile: " + sFilePath + "\nevents: " + std::to_string(iCount) + "\n";
+    } else {
+      sReply = "ERROR failed to write " + sFilePath + "\n";
+    }
+
+  } else {
+    sReply = "ERROR unknown request '" + sCommand + "'\n";
+  }
+
+  pthread_mutex_unlock(&m_mutex);
+
+  return sReply;
 }
 
 // ----------------------------------------------------------------------------
@@ -464,7 +508,6 @@ void Controller::registerHandler(void (*handler)(int)) {
   sAction.sa_flags = SA_RESTART;
   sigemptyset(&sAction.sa_mask);
   sigaction(SIGINT,&sAction, NULL);
-  sigaction(SIGUSR1,&sAction, NULL);
 }  
 
 
@@ -510,6 +553,7 @@ bool Controller::run(int iMode) {
     
     printf("Controller: Writing this PID (%d) to " PID_FILE "\n", getpid());
     writePID();
+    startServer();
     return true;   
   } 
   
@@ -525,8 +569,11 @@ bool Controller::run(int iMode) {
     case CTRL_MODE_STOP:
 
       if (bExistingProc) {
-        printf("Controller: Sending stop signal to previous PID (%d)\n", oldpid);
-        kill(oldpid, SIGINT);
+        printf("Controller: Sending stop request to previous PID (%d)\n", oldpid);
+        if (!sendRequest("stop")) {
+          printf("Controller: Sending stop signal instead\n");
+          kill(oldpid, SIGINT);
+        }
         return false;
       }
       
@@ -543,8 +590,8 @@ bool Controller::run(int iMode) {
     case CTRL_MODE_SHOW:
 
       if (bExistingProc) {
-        printf("Controller: Sending show plot signal to previous PID (%d)\n", oldpid);
-        sendMsg(oldpid, iMode);
+        printf("Controller: Sending show plot request to previous PID (%d)\n", oldpid);
+        sendRequest("show");
         return false;
       }
       
@@ -552,8 +599,8 @@ bool Controller::run(int iMode) {
     case CTRL_MODE_HIDE:
 
       if (bExistingProc) {
-        printf("Controller: Sending hide plot signal to previous PID (%d)\n", oldpid);
-        sendMsg(oldpid, iMode);
+        printf("Controller: Sending hide plot request to previous PID (%d)\n", oldpid);
+        sendRequest("hide");
         return false;
       }
       
@@ -561,8 +608,8 @@ bool Controller::run(int iMode) {
     case CTRL_MODE_DUMP_START:
 
       if (bExistingProc) {
-        printf("Controller: Sending start raw data dump signal to previous PID (%d)\n", oldpid);
-        sendMsg(oldpid, iMode);
+        printf("Controller: Sending start raw data dump request to previous PID (%d)\n", oldpid);
+        sendRequest("dump");
         return false;
       }
       
@@ -570,8 +617,56 @@ bool Controller::run(int iMode) {
     case CTRL_MODE_DUMP_STOP:
 
       if (bExistingProc) {
-        printf("Controller: Sending stop raw data dump signal to previous PID (%d)\n", oldpid);
-        sendMsg(oldpid, iMode);
+        printf("Controller: Sending stop raw data dump request to previous PID (%d)\n", oldpid);
+        sendRequest("nodump");
+        return false;
+      }
+
+    // Print the status of the existing instance
+    case CTRL_MODE_STATUS:
+
+      if (bExistingProc) {
+        sendRequest("status");
+        return false;
+      }
+
+    // Print the most recent spectra from the existing instance
+    case CTRL_MODE_SPECTRUM:
+
+      if (bExistingProc) {
+        sendRequest("spectrum");
+        return false;
+      }
+
+    // Print the metrics of the existing instance
+    case CTRL_MODE_METRICS:
+
+      if (bExistingProc) {
+        sendRequest("metrics");
+        return false;
+      }
+
+    // Tell existing instance to start recording trace spans
+    case CTRL_MODE_TRACE_START:
+
+      if (bExistingProc) {
+        sendRequest("trace on");
+        return false;
+      }
+
+    // Tell existing instance to stop recording trace spans
+    case CTRL_MODE_TRACE_STOP:
+
+      if (bExistingProc) {
+        sendRequest("trace off");
+        return false;
+      }
+
+    // Tell existing instance to write its trace spans to TRACE_FILE
+    case CTRL_MODE_TRACE_WRITE:
+
+      if (bExistingProc) {
+        sendRequest("trace write");
         return false;
       }
   }
@@ -581,20 +676,109 @@ bool Controller::run(int iMode) {
 
 
 // ----------------------------------------------------------------------------
-// sendMsg - Writes message to file and sends signal to the specified PID
+// sendRequest - Sends a request to the running instance over the control 
+//               socket and prints the reply.  Returns false if the socket 
+//               could not be reached.
 // ----------------------------------------------------------------------------
-int Controller::sendMsg(pid_t pid, int iMsg) {
-  
-  std::ofstream fs;
-  fs.open(MSG_FILE);
-  if (fs.is_open()) {
-    fs << iMsg;
-    fs.close();
-  } else {
-    return -1;
+bool Controller::sendRequest(const std::string& sRequest) {
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, SOCKET_FILE, sizeof(addr.sun_path) - 1);
+
+  int iSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (iSocket < 0) {
+    printf("Controller: Failed to create control socket\n");
+    return false;
   }
-  
-  return kill(pid, SIGUSR1);
+
+  if (connect(iSocket, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+    printf("Controller: Failed to connect to " SOCKET_FILE "\n");
+    close(iSocket);
+    return false;
+  }
+
+  std::string sLine = sRequest + "\n";
+  if (send(iSocket, sLine.c_str(), sLine.length(), MSG_NOSIGNAL) < 0) {
+    printf("Controller: Failed to send request\n");
+    close(iSocket);
+    return false;
+  }
+
+  // Print the reply until the server closes the connection
+  char buf[4096];
+  ssize_t n;
+  while ((n = recv(iSocket, buf, sizeof(buf), 0)) > 0) {
+    fwrite(buf, 1, n, stdout);
+  }
+
+  close(iSocket);
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// serverLoop - Accepts connections on the control socket and answers one 
+//              request on each until the server is stopped
+// ----------------------------------------------------------------------------
+void* Controller::serverLoop(void* pContext) {
+
+  Controller* pCtrl = (Controller*) pContext;
+  struct pollfd pfd;
+  pfd.fd = pCtrl->m_iServerSocket;
+  pfd.events = POLLIN;
+
+  while (pCtrl->m_bServerRunning) {
+
+    // Wake up regularly to check if we should stop
+    if (poll(&pfd, 1, 200) <= 0) {
+      continue;
+    }
+
+    int iClient = accept(pCtrl->m_iServerSocket, NULL, NULL);
+    if (iClient < 0) {
+      continue;
+    }
+
+    // Don't let a silent client hold up the server
+    struct timeval tv;
+    tv.tv_sec = 1;
+    tv.tv_usec = 0;
+    setsockopt(iClient, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    // Read the request line
+    std::string sRequest;
+    char c;
+    while ((sRequest.length() < 256) && (recv(iClient, &c, 1, 0) == 1) && (c != '\n')) {
+      sRequest += c;
+    }
+
+    // Send the reply
+    std::string sReply = pCtrl->onRequest(sRequest);
+    size_t uSent = 0;
+    while (uSent < sReply.length()) {
+      ssize_t n = send(iClient, sReply.c_str() + uSent, sReply.length() - uSent, MSG_NOSIGNAL);
+      if (n <= 0) {
+        break;
+      }
+      uSent += n;
+    }
+
+    close(iClient);
+  }
+
+  pthread_exit(NULL);
+}
+
+
+// ----------------------------------------------------------------------------
+// setReceiver - Object that answers status and spectrum requests
+// ----------------------------------------------------------------------------
+void Controller::setReceiver(ControlReceiver* pReceiver) { 
+  pthread_mutex_lock(&m_mutex);
+  m_pReceiver = pReceiver;
+  pthread_mutex_unlock(&m_mutex);
 }
 
 
@@ -697,13 +881,15 @@ std::string Controller::updateOutputBase(const TimeKeeper& tk) {
 
 // ----------------------------------------------------------------------------
 // setPlot - Tell the controller that there should be plotting (or not).
-//           uPlotbin channels are binned (averaged) together when saving the 
-//           temporary plot data.  uPlotbin is ignored when bPlot is false;
+//           uPlotbin channels are binned (averaged) together by the live 
+//           viewer, which redraws every dRefresh seconds.  Both are ignored
+//           when bPlot is false;
 //           
 // ----------------------------------------------------------------------------
-void Controller::setPlot(bool bPlot, unsigned int uPlotBin) { 
+void Controller::setPlot(bool bPlot, unsigned int uPlotBin, double dRefresh) { 
 
   m_uPlotBin = uPlotBin;
+  m_dPlotRefresh = dRefresh;
 
   // Nothing to do if already in the desired state
   if (bPlot == m_bPlot) {
@@ -728,6 +914,64 @@ void Controller::setDump(bool bDump) {
 }
 
 
+// ----------------------------------------------------------------------------
+// startServer - Start listening on the control socket in a new thread
+// ----------------------------------------------------------------------------
+bool Controller::startServer() {
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, SOCKET_FILE, sizeof(addr.sun_path) - 1);
+
+  // Remove a stale socket left by an instance that didn't exit cleanly
+  std::remove(SOCKET_FILE);
+
+  m_iServerSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+  if ((m_iServerSocket < 0) || 
+      (bind(m_iServerSocket, (struct sockaddr*) &addr, sizeof(addr)) < 0) ||
+      (listen(m_iServerSocket, 4) < 0)) {
+    printf("Controller: Failed to listen on " SOCKET_FILE "\n");
+    if (m_iServerSocket >= 0) {
+      close(m_iServerSocket);
+      m_iServerSocket = -1;
+    }
+    return false;
+  }
+
+  m_bServerRunning = true;
+  if (pthread_create(&m_serverThread, NULL, serverLoop, this) != 0) {
+    printf("Controller: Failed to create control socket thread\n");
+    m_bServerRunning = false;
+    close(m_iServerSocket);
+    m_iServerSocket = -1;
+    std::remove(SOCKET_FILE);
+    return false;
+  }
+
+  printf("Controller: Listening for requests on " SOCKET_FILE "\n");
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// stopServer - Stop the control socket thread and remove the socket
+// ----------------------------------------------------------------------------
+void Controller::stopServer() {
+
+  if (!m_bServerRunning) {
+    return;
+  }
+
+  m_bServerRunning = false;
+  pthread_join(m_serverThread, NULL);
+
+  close(m_iServerSocket);
+  m_iServerSocket = -1;
+  std::remove(SOCKET_FILE);
+}
+
+
 // ----------------------------------------------------------------------------
 // stop - Returns true if a stop signal has bene received
 // ----------------------------------------------------------------------------
@@ -737,52 +981,59 @@ bool Controller::stop() const {
 
 
 // ----------------------------------------------------------------------------
-// stopPlotter - Shutdown the external plotter
+// stopPlotter - Shutdown the external plotter.  Uses its own mutex because
+//               the hide request calls it with m_mutex held.
 // ----------------------------------------------------------------------------
 void Controller::stopPlotter() {
 
+  pthread_mutex_lock(&m_mutexPlot);
+
   if (m_pSpawn) {
-    m_pSpawn->stdin << "quit" << std::endl;
-    //sendStopSignal(m_pSpawn->child_pid);
+    kill(m_pSpawn->child_pid, SIGTERM);
+    m_pSpawn->wait();
     delete(m_pSpawn);
     m_pSpawn = NULL;
   }
+
+  pthread_mutex_unlock(&m_mutexPlot);
 }
 
 
 // ----------------------------------------------------------------------------
-// updatePlotter - Tells the plotter to reload the data file and replot
+// updatePlotter - Starts the live viewer if it isn't already running.  The
+//                 viewer reads each new set of spectra from the live feed
+//                 (see livefeed.h) on its own, so nothing is sent per cycle.
+//                 If the viewer has exited (or isn't installed) plotting 
+//                 is turned off until the next show request.  The viewer is
+//                 run from its installed path rather than searched for on 
+//                 the PATH, because the spectrometer may run setuid root.
 // ----------------------------------------------------------------------------
 void Controller::updatePlotter() {
 
-  // Start the plotter if it hasn't been started before
-  if (m_pSpawn == NULL) {
+  // The plot can be shown or hidden from the control socket thread
+  pthread_mutex_lock(&m_mutexPlot);
 
-    printf("Controller: Starting plotter...\n");        
-    const char* const argv[] = {PLOTTER_EXE, (const char*)0};
-    m_pSpawn = new spawn(argv, true);
-
-    // If the plotter process has been successfully spawned with a valid PID
-    if (m_pSpawn && (m_pSpawn->child_pid > 0) && (kill(m_pSpawn->child_pid, 0)==0)) {
-
-      // Send the commands to initialize the plotting
-      m_pSpawn->stdin << "set macros" << std::endl;
-      m_pSpawn->stdin << "set xlabel 'Frequency [MHz]'" << std::endl;
-      m_pSpawn->stdin << "raw = 'set ylabel \"Power [dB] (arb)\"; unset yrange; plot \"" << PLOT_FILE << "\" using 1:2 title \"p0 (antenna)\" with lines, \"" << PLOT_FILE << "\" using 1:3 title \"p1 (load)\" with lines, \"" << PLOT_FILE << "\" using 1:4 title \"p2 (load+cal)\" with lines'" << std::endl;
-      m_pSpawn->stdin << "ta = 'set ylabel \"Temperature [K]\"; set yrange [100:10000]; plot \"" << PLOT_FILE << "\" using 1:5 title \"T_{ant} (uncalib)\" with lines'" << std::endl;
-      m_pSpawn->stdin << "@raw" << std::endl;
-      m_pSpawn->stdin << "type=0" << std::endl;
-      m_pSpawn->stdin << "bind all 'x' 'type=!type; if (type) { @ta } else { @raw }'" << std::endl;
-      m_pSpawn->stdin << "set term qt title 'FASTSPEC Plot'" << std::endl;
-    }
+  // Reap a viewer that has exited since the last call
+  if (m_pSpawn && (waitpid(m_pSpawn->child_pid, NULL, WNOHANG) != 0)) {
+    printf("Controller: Plotter (" PLOTTER_EXE ") exited.  Use 'show' to restart it.\n");
+    delete(m_pSpawn);
+    m_pSpawn = NULL;
+    m_bPlot = false;
   }
 
-  // If the plotter process was previously spawned and still has a valid PID
-  if (m_pSpawn && (m_pSpawn->child_pid > 0) && (kill(m_pSpawn->child_pid, 0)==0)) {
+  // Start the viewer if it isn't running
+  if (m_bPlot && (m_pSpawn == NULL)) {
+
+    std::string sBin = std::to_string(m_uPlotBin);
+    std::string sRefresh = std::to_string(m_dPlotRefresh);
 
-    // Send the commands to update the plot
-    m_pSpawn->stdin << "replot" << std::endl;
+    printf("Controller: Starting plotter...\n");        
+    const char* const argv[] = {PLOTTER_EXE, "-b", sBin.c_str(), 
+                                "-r", sRefresh.c_str(), (const char*)0};
+    m_pSpawn = new spawn(argv, false);
   }
+
+  pthread_mutex_unlock(&m_mutexPlot);
 }
 
 
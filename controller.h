@@ -2,9 +2,9 @@
 #define _CONTROLLER_H_
 
 #define PID_FILE        "/tmp/fastspec.pid"
-#define MSG_FILE        "/tmp/fastspec.msg"
-#define PLOT_FILE       "/tmp/fastspec_plot.txt"
-#define PLOTTER_EXE     "/usr/bin/gnuplot"
+#define SOCKET_FILE     "/tmp/fastspec.sock"
+#define PLOTTER_EXE     "/usr/local/bin/fastview"
+#define PLOT_REFRESH    0.5
 #define PROC_DIR        "/proc"
 
 #define CTRL_MODE_NOTSET        0
@@ -17,9 +17,16 @@
 #define CTRL_MODE_ABORT         7
 #define CTRL_MODE_DUMP_START    8
 #define CTRL_MODE_DUMP_STOP     9
+#define CTRL_MODE_STATUS        10
+#define CTRL_MODE_SPECTRUM      11
+#define CTRL_MODE_METRICS       12
+#define CTRL_MODE_TRACE_START   13
+#define CTRL_MODE_TRACE_STOP    14
+#define CTRL_MODE_TRACE_WRITE   15
 
 #include <string>
 #include <unistd.h>     // pid
+#include <pthread.h>
 #include "accumulator.h"
 #include "ini.h"
 #include "spawn.h" 
@@ -27,11 +34,48 @@
 
 
 
+// ---------------------------------------------------------------------------
+//
+// ControlReceiver
+//
+// Virtual interface for a class that can answer status and spectrum requests
+// received by the controller.  Replies are plain text.
+//
+// ---------------------------------------------------------------------------
+class ControlReceiver {
+
+  public:  
+
+    virtual             ~ControlReceiver() {}
+    virtual std::string onStatusRequest() = 0;
+    virtual std::string onSpectrumRequest(unsigned int) = 0;
+};
+
+
+
+
 // ---------------------------------------------------------------------------
 //
 // Controller
 //
-// Handles process ID and IPC signal sending/receiving
+// Handles process ID and IPC with other instances of the application.  The
+// running instance listens on a Unix domain socket (SOCKET_FILE) in its own
+// thread.  Each connection carries one request line and receives a text 
+// reply that starts with "OK" or "ERROR" and ends when the connection is
+// closed.  Requests are:
+//
+//   stop              Stop gracefully
+//   dump | nodump     Start or stop dumping raw antenna samples
+//   show | hide       Show or hide the live plot
+//   status            Current state as "name: value" lines
+//   spectrum [bin]    Most recent spectra as "freq p0 p1 p2" lines
+//   metrics           All metrics in the Prometheus text format
+//   trace on | off    Start or stop recording trace spans
+//   trace write [file] Write recorded spans as Chrome trace JSON (default
+//                     TRACE_FILE)
+//
+// The command line verbs (e.g. 'fastspec stop') are clients of the socket.
+// A hard kill still uses the PID file and a signal.
 //
 // ---------------------------------------------------------------------------
 class Controller {
@@ -67,9 +111,6 @@ class Controller {
     // Return the filepath that should be used to start dump file
     std::string getDumpFilePath(const TimeKeeper& tk);
     
-    // Return the filepath that should be used for live plot file
-    std::string getPlotFilePath();   
-    
     // Binning level for reducing live plot data length
     unsigned int getPlotBinLevel() const;
 
@@ -99,14 +140,19 @@ class Controller {
     // Give the controller the INI file for parsing
     bool setINI(const std::string&);
 
+    // Give the controller an object to answer status and spectrum requests
+    // (NULL to disconnect)
+    void setReceiver(ControlReceiver*);
+
     // Set the parameters used to determine output filepath base for
     // writing spectrometer data (acq or dmp)
     void setOutputConfig( const std::string&, const std::string&, 
                           const std::string&, const std::string& );
                     
     
-      // Tell the controller if there should be plotting and how to bin data
-    void setPlot(bool, unsigned int);
+      // Tell the controller if there should be plotting, how to bin data,
+    // and how often (in seconds) the live plot should refresh
+    void setPlot(bool, unsigned int, double dRefresh = PLOT_REFRESH);
 
     // Tell the controller if there should be raw data dumping
     void setDump(bool);
@@ -114,8 +160,8 @@ class Controller {
     // True if a stop signal has bene received
     bool stop() const;    
 
-    // Should be called when a new plot file is ready for the plotter
-    // to load and plot
+    // Should be called after each new set of spectra is published to the
+    // live feed.  Starts the live viewer (fastview) if it isn't running.
     void updatePlotter(); 
 
     // Register a passed wrapper function pointer as the handler for 
@@ -133,11 +179,6 @@ class Controller {
     // Delete existing PID file
     void deletePID();
 
-    // Delete existing plot file
-    void deletePlot();
-
-    // Delete existing message file
-    void deleteMsg();
     
     // Get the start time associated with a PID
     unsigned long long getProcStart(pid_t pid);
@@ -146,12 +187,17 @@ class Controller {
     // Returns false if can't open the file
     bool readPID(pid_t& pid, unsigned long long& tm); 
     
-    // Read existing message file.
-    // Returns false if can't open the file    
-    bool readMsg(int& msg);
+    // Handle one request received on the control socket and return the reply
+    std::string onRequest(const std::string&);
+
+    // Send a request to the running instance and print the reply.  Returns 
+    // false if the running instance could not be reached.
+    bool sendRequest(const std::string&);
 
-    // Sends the appropriate message and notification signal
-    int sendMsg(pid_t pi, int msg);
+    // Start and stop listening on the control socket
+    bool startServer();
+    void stopServer();
+    static void* serverLoop(void*);
     
     // Shutdown the external plotter
     void stopPlotter();
@@ -175,6 +221,7 @@ class Controller {
     bool            m_bStopSignal;
     int             m_iMode;
     unsigned int    m_uPlotBin;
+    double          m_dPlotRefresh;
     spawn*          m_pSpawn;
     std::string     m_strConfig;
     std::string     m_sDataDir;
@@ -184,6 +231,12 @@ class Controller {
     std::string     m_sCurrentFilePathBase;
     TimeKeeper      m_tkCurrentFilePathTime;
     bool            m_bAutoName; 
+    ControlReceiver* m_pReceiver;
+    pthread_t       m_serverThread;
+    pthread_mutex_t m_mutex;
+    pthread_mutex_t m_mutexPlot;    // Guards the plotter (m_pSpawn)
+    int             m_iServerSocket;
+    bool            m_bServerRunning;
     
 
 };
@@ -0,0 +1,503 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <math.h>
+#include "ddc.h"
+#include "utility.h"
+#include "trace.h"
+#include "log.h"
+#include "thread_policy.h"
+
+
+
+#define THREAD_SLEEP_MICROSECONDS 5
+
+
+
+// ----------------------------------------------------------------------------
+// Constructor -- Reads blocks from pBuffer as reader uReader.  dCenter is the
+//                NCO frequency as a fraction of the sample rate.  The FIR has
+//                uDecimation*uTapsPerPhase taps.  The remaining arguments 
+//                configure the complex PFB, which gets its own buffer of 
+//                uNumBuffers frames.
+// ----------------------------------------------------------------------------
+template<typename T>
+DDC<T>::DDC( Buffer<T>* pBuffer, unsigned int uReader, unsigned int uNumThreads, 
+             unsigned int uNumBuffers, double dCenter, unsigned int uDecimation, 
+             unsigned int uTapsPerPhase, unsigned int uNumChannels, 
+             unsigned int uNumTaps, unsigned int uWindow, bool bReturnInOrder )
+{
+  m_pReceiver = NULL;
+  m_pBuffer = pBuffer;
+  m_uReader = uReader;
+  m_uBlockLength = m_pBuffer->itemLength();
+  m_uDecimation = (uDecimation < 1) ? 1 : uDecimation;
+  m_uNumFilterTaps = m_uDecimation * ((uTapsPerPhase < 1) ? 1 : uTapsPerPhase);
+  m_uNumThreads = uNumThreads;
+  m_dCenter = dCenter;
+  m_dADCmin = 0;
+  m_dADCmax = 0;
+  m_uNextIndex = 0;
+  m_uDrops = 0;
+  m_uLostSpectra = 0;
+  m_pLostMetric = NULL;
+  m_uId = 0;
+  m_bStop = false;
+
+  if (m_uNumFilterTaps > m_uBlockLength + 1) {
+    printf("DDC: Too many filter taps (%u) for block length %u.  Using %u.\n", 
+      m_uNumFilterTaps, m_uBlockLength, m_uBlockLength + 1);
+    m_uNumFilterTaps = m_uBlockLength + 1;
+  }
+
+  if (m_uBlockLength % (m_uDecimation * uNumChannels) != 0) {
+    printf("DDC: Block length %u is not a multiple of decimation x channels (%u)\n",
+      m_uBlockLength, m_uDecimation * uNumChannels);
+  }
+
+  printf("DDC: Center %.6g x sample rate, decimation %u, %u filter taps\n", 
+    m_dCenter, m_uDecimation, m_uNumFilterTaps);
+
+  // Low-pass filter with cutoff at the decimated Nyquist frequency: a 
+  // Blackman-Harris windowed sinc normalized to unity gain at DC.  Stored 
+  // time reversed so the filter loop runs forward over the samples.
+  T* pTemp = (T*) malloc(m_uNumFilterTaps * sizeof(T));
+  m_pFilter = (T*) malloc(m_uNumFilterTaps * sizeof(T));
+  get_blackman_harris(pTemp, m_uNumFilterTaps);
+
+  double dSum = 0;
+  double dHalf = (m_uNumFilterTaps - 1) / 2.0;
+  for (unsigned int i=0; i<m_uNumFilterTaps; i++) {
+    double x = M_PI * (i - dHalf) / m_uDecimation;
+    pTemp[i] *= (x == 0) ? 1.0 : sin(x)/x;
+    dSum += pTemp[i];
+  }
+
+  for (unsigned int i=0; i<m_uNumFilterTaps; i++) {
+    m_pFilter[i] = pTemp[m_uNumFilterTaps - 1 - i] / dSum;
+  }
+  free(pTemp);
+
+  // Oscillator table, exp(-j*2*pi*f*n), covering the filter history and one
+  // block.  Each block rotates it by the phase at its first sample.
+  unsigned int uLength = m_uNumFilterTaps - 1 + m_uBlockLength;
+  m_pNCO = (T*) malloc(2 * uLength * sizeof(T));
+  for (unsigned int n=0; n<uLength; n++) {
+    double dPhase = 2.0 * M_PI * fmod(m_dCenter * n, 1.0);
+    m_pNCO[2*n] = cos(dPhase);
+    m_pNCO[2*n+1] = -sin(dPhase);
+  }
+
+  // Create the complex PFB that channelizes the baseband samples
+  m_pPFB = new PFB<T>( uNumThreads, uNumBuffers, uNumChannels, uNumTaps, 
+                       uWindow, bReturnInOrder, true );
+  m_pPFB->setCallback(this);
+
+  // Initialize the mutex
+  pthread_mutex_init(&m_mutex, NULL);
+
+  // Busy time of each thread for status reports
+  m_pBusy = (double*) calloc(m_uNumThreads, sizeof(double));
+  m_statusTimer.tic();
+
+  // Spawn the threads
+  printf("DDC: Creating %d threads...\n", m_uNumThreads);
+  m_pThreads = (pthread_t*) malloc(m_uNumThreads * sizeof(pthread_t));
+
+  m_uNumReady = 0;
+  unsigned int uFailed = 0;
+  for (unsigned int i=0; i < m_uNumThreads; i++) {
+    if (pthread_create(&(m_pThreads[i]), NULL, threadLoop, this) != 0 ) {
+      printf("DDC: Failed to create thread %d of %d.", i, m_uNumThreads);
+      uFailed++;
+    } 
+  }
+
+  // Wait for all threads to report ready
+  Timer tr;
+  tr.tic();
+  while (m_uNumReady < (m_uNumThreads-uFailed)) {
+    usleep(10000);
+  }
+  printf("DDC: All threads ready after %.3g seconds\n", tr.toc());
+}
+
+
+
+// ----------------------------------------------------------------------------
+// Destructor
+// ----------------------------------------------------------------------------
+template<typename T>
+DDC<T>::~DDC()
+{
+  // Join all of our threads back to us
+  m_bStop = true;
+  
+  for (unsigned int i=0; i<m_uNumThreads; i++) {
+    pthread_join(m_pThreads[i], NULL);
+  }
+
+  free(m_pThreads);
+
+  if (m_uDrops > 0) {
+    printf("DDC: Dropped %lu blocks because the PFB buffer was full\n", m_uDrops);
+  }
+
+  delete m_pPFB;
+
+  pthread_mutex_destroy(&m_mutex);
+
+  free(m_pBusy);
+  free(m_pFilter);
+  free(m_pNCO);
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setCallback
+// ----------------------------------------------------------------------------
+template<typename T>
+void DDC<T>::setCallback(ChannelizerReceiver* pReceiver)
+{
+  m_pReceiver = pReceiver;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setSecondMoment
+// ----------------------------------------------------------------------------
+template<typename T>
+void DDC<T>::setSecondMoment(bool bEnable)
+{
+  m_pPFB->setSecondMoment(bEnable);
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setOutputChannels -- Limits the complex PFB output to a range of channels
+// ----------------------------------------------------------------------------
+template<typename T>
+bool DDC<T>::setOutputChannels(unsigned int uStart, unsigned int uStop)
+{
+  return m_pPFB->setOutputChannels(uStart, uStop);
+}
+
+
+
+// ----------------------------------------------------------------------------
+// waitForEmpty - Blocks until no more blocks can start processing and the 
+//                complex PFB has finished with everything it was given.
+// ----------------------------------------------------------------------------
+template<typename T>
+void DDC<T>::waitForEmpty()
+{
+  // Each request needs the previous block for the filter history
+  while (!m_bStop && ( (m_pBuffer->pending(m_uReader) >= 2) || 
+                       (m_pBuffer->holds() > 0))) {
+    usleep(THREAD_SLEEP_MICROSECONDS);
+  }
+
+  m_pPFB->waitForEmpty();
+
+  // Start over for the next set of blocks
+  m_uNextIndex = 0;
+  m_dADCmin = 0;
+  m_dADCmax = 0;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// push -- Copies data into the input buffer (normally done by the buffer's 
+//         owner when it is shared).
+// ----------------------------------------------------------------------------
+template<typename T>
+bool DDC<T>::push(SAMPLE_DATA_TYPE* pIn, unsigned int uLength, double dScale, 
+                  double dOffset, unsigned long long uSample)
+{
+  return m_pBuffer->push(pIn, uLength, dScale, dOffset, uSample);
+}
+
+
+
+// ----------------------------------------------------------------------------
+// onChannelizerData -- Pass spectra from the complex PFB on to our receiver
+// ----------------------------------------------------------------------------
+template<typename T>
+void DDC<T>::onChannelizerData(ChannelizerData<float>* pData)
+{
+  forward(pData);
+}
+
+template<typename T>
+void DDC<T>::onChannelizerData(ChannelizerData<double>* pData)
+{
+  forward(pData);
+}
+
+
+
+// ----------------------------------------------------------------------------
+// forward -- Passes a spectrum on to our receiver.  The ADC range is replaced
+//            with the range of the raw samples rather than the baseband 
+//            samples.
+// ----------------------------------------------------------------------------
+template<typename T>
+template<typename U>
+void DDC<T>::forward(ChannelizerData<U>* pData)
+{
+  if (m_pReceiver == NULL) {
+    Log::error("ERROR: DDC has no callback function assigned!\n");
+    return;
+  }
+
+  pData->uId = m_uId;
+  pData->dADCmin = m_dADCmin;
+  pData->dADCmax = m_dADCmax;
+
+  m_pReceiver->onChannelizerData(pData);
+}
+
+
+
+// ----------------------------------------------------------------------------
+// threadIsReady -- Allow a new thread to report is ready.  Returns the 
+//                  thread's index.
+// ----------------------------------------------------------------------------
+template<typename T>
+unsigned int DDC<T>::threadIsReady() {
+  pthread_mutex_lock(&m_mutex);
+  unsigned int uIndex = m_uNumReady++;
+  pthread_mutex_unlock(&m_mutex);
+  return uIndex;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setId -- Sets the id passed to the receiver with each spectrum.  The 
+//          complex PFB gets the same id, and we add the frames of priming 
+//          blocks to its lost spectra metric.
+// ----------------------------------------------------------------------------
+template<typename T>
+void DDC<T>::setId(unsigned int uId)
+{
+  m_uId = uId;
+  m_pPFB->setId(uId);
+  m_pLostMetric = Metrics::counter("fastspec_pfb_lost_spectra_total", 
+    "Spectra dropped because their taps reached across a gap in the samples", 
+    "pfb=\"" + std::to_string(uId) + "\"");
+}
+
+
+
+// ----------------------------------------------------------------------------
+// getStatus -- Adds the busy fraction of each of our threads since the 
+//              previous call and the frames lost to priming the filter, 
+//              followed by the status of the complex PFB.
+// ----------------------------------------------------------------------------
+template<typename T>
+void DDC<T>::getStatus(ChannelizerStatus& status)
+{
+  pthread_mutex_lock(&m_mutex);
+  status.uLostSpectra += m_uLostSpectra;
+  double dElapsed = m_statusTimer.toc();
+  for (unsigned int i=0; i<m_uNumThreads; i++) {
+    status.threadUtilization.push_back((dElapsed > 0) ? m_pBusy[i] / dElapsed : 0);
+    m_pBusy[i] = 0;
+  }
+  m_statusTimer.tic();
+  pthread_mutex_unlock(&m_mutex);
+
+  m_pPFB->getStatus(status);
+}
+
+
+
+// ----------------------------------------------------------------------------
+// threadLoop -- Primary execution loop of each thread
+// ----------------------------------------------------------------------------
+template<typename T>
+void* DDC<T>::threadLoop(void* pContext)
+{
+  DDC* pDDC = (DDC*) pContext;
+
+  // Allocate the mixed I and Q arrays (history plus one block) and the 
+  // interleaved output array
+  unsigned int uLength = pDDC->m_uNumFilterTaps - 1 + pDDC->m_uBlockLength;
+  T* pI = (T*) malloc(uLength * sizeof(T));
+  T* pQ = (T*) malloc(uLength * sizeof(T));
+  T* pOut = (T*) malloc(2 * pDDC->m_uBlockLength / 
+                        pDDC->m_uDecimation * sizeof(T));
+
+  // Create an iterator for the buffer
+  typename Buffer<T>::iterator iter;
+  Timer busyTimer;
+
+  // Report ready
+  unsigned int uThread = pDDC->threadIsReady();
+  ThreadPolicy::apply("channelizer", "ddc thread " + std::to_string(uThread));
+  unsigned int uTraceId = (unsigned int) -1;
+
+  while (!pDDC->m_bStop) {
+
+    // Try to get a block and the one after it
+    if (pDDC->m_pBuffer->request(iter, 2, pDDC->m_uReader)) {
+
+      // Name the thread in traces (the id can be set after we start)
+      if (uTraceId != pDDC->m_uId) {
+        uTraceId = pDDC->m_uId;
+        Trace::setThreadName("ddc" + std::to_string(uTraceId) + " thread " + std::to_string(uThread));
+      }
+
+      // Process the data in the buffer
+      busyTimer.tic();
+      TraceSpan span("ddc process");
+      pDDC->process(iter, pI, pQ, pOut);
+      span.end();
+
+      pthread_mutex_lock(&(pDDC->m_mutex));
+      pDDC->m_pBusy[uThread] += busyTimer.toc();
+      pthread_mutex_unlock(&(pDDC->m_mutex));
+
+      // Release the iterator to be able to do it again
+      pDDC->m_pBuffer->release(iter);
+
+    } else {
+
+      // Sleep before trying again
+      usleep(THREAD_SLEEP_MICROSECONDS);
+    }
+  }
+
+  free(pI);
+  free(pQ);
+  free(pOut);
+
+  // Exit the thread
+  pthread_exit(NULL);
+}
+
+
+
+// ----------------------------------------------------------------------------
+// process -- Down-converts the second block of the request, using the end of
+//            the first block as the filter history.
+// ----------------------------------------------------------------------------
+template<typename T>
+void DDC<T>::process( typename Buffer<T>::iterator& iter, T* pI, 
+                      T* pQ, T* pOut )
+{
+  unsigned int i;
+  unsigned int k;
+  unsigned int m;
+  unsigned int uHistory = m_uNumFilterTaps - 1;
+  unsigned int uNumOut = m_uBlockLength / m_uDecimation;
+  unsigned int uPFBLength = m_pPFB->getNumChannels() * 2;
+
+  // Keep a hold on the first block while we read from it
+  typename Buffer<T>::iterator iterStart;
+  m_pBuffer->copy(iter, iterStart);
+
+  unsigned long long uIndex = m_pBuffer->index(iter);
+  unsigned long long uPrevSample = m_pBuffer->sample(iter);
+  T* pPrev = m_pBuffer->data(iter);
+  m_pBuffer->next(iter);
+  T* pCur = m_pBuffer->data(iter);
+  unsigned long long uSample = m_pBuffer->sample(iter);
+  bool bContiguous = (uSample == uPrevSample + m_uBlockLength);
+
+  // Oscillator phase at the first history sample
+  double dPhase = 2.0 * M_PI * fmod( m_dCenter * 
+    ((double) uSample - uHistory), 1.0 );
+  T rotRe = cos(dPhase);
+  T rotIm = -sin(dPhase);
+  T re;
+  T im;
+  T x;
+
+  // Mix to baseband: history from the end of the previous block...
+  T* pIn = pPrev + m_uBlockLength - uHistory;
+  for (i=0; i<uHistory; i++) {
+    re = rotRe*m_pNCO[2*i] - rotIm*m_pNCO[2*i+1];
+    im = rotRe*m_pNCO[2*i+1] + rotIm*m_pNCO[2*i];
+    pI[i] = pIn[i] * re;
+    pQ[i] = pIn[i] * im;
+  }
+
+  // ...then the current block
+  T* pNCO = m_pNCO + 2*uHistory;
+  for (i=0; i<m_uBlockLength; i++) {
+    re = rotRe*pNCO[2*i] - rotIm*pNCO[2*i+1];
+    im = rotRe*pNCO[2*i+1] + rotIm*pNCO[2*i];
+    pI[uHistory+i] = pCur[i] * re;
+    pQ[uHistory+i] = pCur[i] * im;
+  }
+
+  // Find the ADC min and max of the raw block
+  T dMin = pCur[0];
+  T dMax = pCur[0];
+  for (i=0; i<m_uBlockLength; i++) {
+    x = pCur[i];
+    dMin = (x < dMin) ? x : dMin;
+    dMax = (x > dMax) ? x : dMax;
+  }
+
+  // Filter and decimate, only computing the outputs we keep
+  for (m=0; m<uNumOut; m++) {
+    T* pIm = pI + m*m_uDecimation;
+    T* pQm = pQ + m*m_uDecimation;
+    T sumI = 0;
+    T sumQ = 0;
+    for (k=0; k<m_uNumFilterTaps; k++) {
+      sumI += m_pFilter[k] * pIm[k];
+      sumQ += m_pFilter[k] * pQm[k];
+    }
+    pOut[2*m] = sumI;
+    pOut[2*m+1] = sumQ;
+  }
+
+  // Wait until it is our turn so the PFB sees the baseband stream in order
+  while (!m_bStop && (uIndex != m_uNextIndex)) {
+    usleep(THREAD_SLEEP_MICROSECONDS);			
+  }
+
+  // Hand the baseband samples to the PFB one frame at a time (unless the
+  // filter history was from before a gap)
+  for (i=0; bContiguous && (i<2*uNumOut); i+=uPFBLength) {
+    if (!m_pPFB->push(pOut + i, uPFBLength, uSample / m_uDecimation + i / 2)) {
+      m_uDrops++;
+    }
+  }
+
+  // Otherwise the block only primed the filter and its frames are lost, as
+  // are those of the first block after a clear, which is only ever history
+  unsigned int uFrames = 2 * uNumOut / uPFBLength;
+  unsigned int uLost = (bContiguous ? 0 : uFrames) + ((uIndex == 0) ? uFrames : 0);
+  if (uLost > 0) {
+    if (m_pLostMetric) {
+      m_pLostMetric->add(uLost);
+    }
+    Log::write(LOG_DEBUG, "DDC: ddc%u lost %u frames priming the filter at block %llu\n",
+               m_uId, uLost, uIndex);
+  }
+
+  pthread_mutex_lock(&m_mutex);
+  m_uLostSpectra += uLost;
+  m_dADCmin = (dMin < m_dADCmin) ? dMin : m_dADCmin;
+  m_dADCmax = (dMax > m_dADCmax) ? dMax : m_dADCmax;
+  m_uNextIndex++;
+  pthread_mutex_unlock(&m_mutex);
+
+  // Release the extra hold on the first block
+  m_pBuffer->release(iterStart);
+
+} // process()
+
+
+
+template class DDC<float>;
+template class DDC<double>;
@@ -0,0 +1,109 @@
+#ifndef _DDC_H_
+#define _DDC_H_
+
+#include <pthread.h>
+#include "channelizer.h"
+#include "buffer.h"
+#include "pfb.h"
+
+using namespace std;
+
+// ---------------------------------------------------------------------------
+//
+// DDC
+//
+// Digital down-converter front end for zoom channelization.  Worker threads 
+// pull blocks of real samples from a (shared) Buffer, mix them to baseband
+// with a numerically controlled oscillator, low-pass filter and decimate 
+// them with a decimating FIR (only every Dth output is computed), and push 
+// the complex baseband samples in order to a complex PFB.  The PFB spectra
+// cover only the band of interest (centered on the NCO frequency, one 
+// decimated sample rate wide) and are passed on to the receiver.
+//
+// The FIR uses the previous block for its history, so the first block after
+// the buffer is cleared only primes the filter.  If the previous block isn't
+// contiguous with the current one (see the sample index of Buffer), the 
+// current block also only primes the filter, and the PFB sees the gap in the
+// baseband sample index and drops the frames across it.  The frames of a
+// block that only primes the filter are counted as lost spectra too.  The
+// NCO phase is taken from the sample index, so it stays coherent across 
+// gaps.  The buffer block length must be a multiple of 
+// decimation*uNumChannels so that each block produces a whole number of PFB
+// frames.
+//
+// The inner loops are written as plain unit-stride multiply-adds over 
+// separate I and Q arrays so the compiler can vectorize them.  They and the
+// complex PFB compute in T, float or double (see ChannelizerBank).
+//
+// ---------------------------------------------------------------------------
+template<typename T>
+class DDC : public Channelizer, ChannelizerReceiver {
+
+  private:
+
+    // Member variables
+    ChannelizerReceiver*          m_pReceiver;
+    PFB<T>*                       m_pPFB;
+    Buffer<T>*                    m_pBuffer;
+    pthread_t*                    m_pThreads;
+    pthread_mutex_t               m_mutex;
+    double*                       m_pBusy;        // seconds per thread
+    Timer                         m_statusTimer;
+    T*                            m_pFilter;
+    T*                            m_pNCO;
+    double                        m_dCenter;      // cycles per sample
+    double                        m_dADCmin;
+    double                        m_dADCmax;
+    unsigned long long            m_uNextIndex;
+    unsigned long                 m_uDrops;
+    unsigned long                 m_uLostSpectra; // Frames of priming blocks
+    MetricCounter*                m_pLostMetric;
+    unsigned int                  m_uReader;
+    unsigned int                  m_uBlockLength;
+    unsigned int                  m_uDecimation;
+    unsigned int                  m_uNumFilterTaps;
+    unsigned int                  m_uNumThreads;
+    unsigned int                  m_uNumReady;
+    unsigned int                  m_uId;
+    bool                          m_bStop;
+
+    // Private helper functions
+    void            process( typename Buffer<T>::iterator&, T*, T*, T* );
+    unsigned int    threadIsReady();
+    template<typename U>
+    void            forward(ChannelizerData<U>*);
+
+  public:
+
+    // Constructor and destructor
+    DDC( Buffer<T>*, unsigned int, unsigned int, unsigned int, double, 
+         unsigned int, unsigned int, unsigned int, unsigned int, 
+         unsigned int, bool );
+    ~DDC();
+
+    // Interface functions
+    bool            push(SAMPLE_DATA_TYPE*, unsigned int, double, double, unsigned long long);
+    void            setCallback(ChannelizerReceiver*);
+    void            waitForEmpty();
+    void            getStatus(ChannelizerStatus&);
+
+    // Callback from the complex PFB (only ever in our precision)
+    void            onChannelizerData(ChannelizerData<float>*);
+    void            onChannelizerData(ChannelizerData<double>*);
+
+    // Other functions
+    bool            setOutputChannels(unsigned int, unsigned int);
+    void            setSecondMoment(bool);
+    void            setMinThreads(unsigned int uMin) { m_pPFB->setMinThreads(uMin); }
+    bool            setVoltageOutput(unsigned int uBits, const std::vector<float>& gains) {
+                      return m_pPFB->setVoltageOutput(uBits, gains); }
+    void            setFlagger(SpectrumFlagger* pFlagger) { m_pPFB->setFlagger(pFlagger); }
+    void            setId(unsigned int);
+    unsigned int    getId() const { return m_uId; }
+    static void*    threadLoop(void*);
+
+};
+
+
+
+#endif // _DDC_H_
@@ -1,11 +1,19 @@
 #ifndef _DIGITIZER_H_
 #define _DIGITIZER_H_
 
+#include "metrics.h"
+#include "trace.h"
+#include "thread_policy.h"
+
 // ---------------------------------------------------------------------------
 //
 // DigitizerReceiver
 //
-// Virtual Interface for class that can receive digitizer data.  
+// Virtual Interface for class that can receive digitizer data.  Each call
+// gets a transfer, its length, the samples accepted so far, the scale and
+// offset, and the sample index of the transfer's first sample.  The index
+// counts every sample the board acquired, so consecutive transfers are
+// contiguous only if it increased by the transfer length.
 //
 // SAMPLE_DATA_TYPE (e.g. short, unsigned short, etc.) must defined as a 
 // compiler directive.
@@ -19,7 +27,8 @@ class DigitizerReceiver {
                                              unsigned int, 
                                              unsigned long,
                                              double,
-                                             double ) = 0;
+                                             double,
+                                             unsigned long long ) = 0;
 };
 
 
@@ -60,7 +69,104 @@ class Digitizer {
     virtual double                offset() = 0;
     virtual Digitizer::DataType   type() = 0;
     virtual unsigned int          bytesPerSample() = 0;
+
+    // Number of inputs sampled at once.  With more than one, each transfer
+    // holds one sample of every input per sample time, interleaved in input
+    // order, and the sample index counts values rather than sample times.
+    virtual unsigned int          inputs() { return 1; }
+
+    // Print the timing of the transfers since the last call
+    virtual void                  printTiming() = 0;
     
 };
 
+// ---------------------------------------------------------------------------
+//
+// DigitizerMetrics
+//
+// Metrics shared by the acquisition loops of all digitizer classes.  Create
+// one at the start of acquire() and call onTransfer() after each callback.
+// Digitizers with a ring of transfers (see StreamingDigitizer) also call
+// onRing() whenever the number of filled transfers changes and onRingFull()
+// when the ring has no free transfer, and onTiming() with the hand-off
+// latency and slack of each transfer (see StreamingDigitizer).
+//
+// ---------------------------------------------------------------------------
+class DigitizerMetrics {
+
+  private:
+
+    MetricCounter*    m_pTransfers;
+    MetricCounter*    m_pSamples;
+    MetricCounter*    m_pDropped;
+    MetricHistogram*  m_pCallback;
+    MetricHistogram*  m_pWait;
+    MetricGauge*      m_pRing;
+    MetricGauge*      m_pRingMax;
+    MetricCounter*    m_pRingFull;
+    MetricGauge*      m_pPeriod;
+    MetricHistogram*  m_pLatency;
+    MetricHistogram*  m_pSlack;
+    MetricCounter*    m_pOverruns;
+
+  public:
+
+    DigitizerMetrics() {
+      m_pTransfers = Metrics::counter("fastspec_digitizer_transfers_total", 
+        "Transfers received from the digitizer");
+      m_pSamples = Metrics::counter("fastspec_digitizer_samples_total", 
+        "Samples received from the digitizer");
+      m_pDropped = Metrics::counter("fastspec_digitizer_samples_dropped_total", 
+        "Samples the receiver could not accept");
+      m_pCallback = Metrics::histogram("fastspec_digitizer_callback_seconds", 
+        "Time for the receiver to handle one transfer", 
+        MetricHistogram::exponential(1e-6, 2, 20));
+      m_pWait = Metrics::histogram("fastspec_digitizer_wait_seconds", 
+        "Time spent waiting for the next transfer to complete", 
+        MetricHistogram::exponential(1e-6, 2, 20));
+      m_pRing = Metrics::gauge("fastspec_digitizer_ring_transfers", 
+        "Filled transfers waiting for the receiver");
+      m_pRingMax = Metrics::gauge("fastspec_digitizer_ring_transfers_max", 
+        "Most filled transfers waiting for the receiver");
+      m_pRingFull = Metrics::counter("fastspec_digitizer_ring_full_total", 
+        "Times the transfer ring had no free transfer");
+      m_pPeriod = Metrics::gauge("fastspec_digitizer_transfer_period_seconds", 
+        "Time for the digitizer to acquire one transfer");
+      m_pLatency = Metrics::histogram("fastspec_digitizer_latency_seconds", 
+        "Time from a transfer completing to the receiver returning from it", 
+        MetricHistogram::exponential(1e-6, 2, 24));
+      m_pSlack = Metrics::histogram("fastspec_digitizer_slack_seconds", 
+        "Transfer period left over after the receiver handled a transfer", 
+        MetricHistogram::exponential(1e-6, 2, 20));
+      m_pOverruns = Metrics::counter("fastspec_digitizer_overruns_total", 
+        "Transfers the receiver took longer than the transfer period to handle");
+    }
+
+    void onTransfer(unsigned int uSamples, unsigned long uAccepted, double dCallbackSeconds) {
+      m_pTransfers->add();
+      m_pSamples->add(uSamples);
+      m_pDropped->add((uAccepted < uSamples) ? uSamples - uAccepted : 0);
+      m_pCallback->observe(dCallbackSeconds);
+    }
+
+    void onWait(double dSeconds) { m_pWait->observe(dSeconds); }
+
+    void onRing(unsigned int uFilled) {
+      m_pRing->set(uFilled);
+      m_pRingMax->setMax(uFilled);
+    }
+
+    void onRingFull() { m_pRingFull->add(); }
+
+    void setPeriod(double dSeconds) { m_pPeriod->set(dSeconds); }
+
+    void onTiming(double dLatencySeconds, double dSlackSeconds) {
+      m_pLatency->observe(dLatencySeconds);
+      m_pSlack->observe(dSlackSeconds);
+      if (dSlackSeconds < 0) {
+        m_pOverruns->add();
+      }
+    }
+};
+
 #endif // _DIGITIZER_H_
@@ -1,6 +1,9 @@
 #include <unistd.h>
 #include "dumper.h"
 #include "timing.h"
+#include "trace.h"
+#include "log.h"
+#include "thread_policy.h"
 #include "utility.h"
 #include "version.h"
 
@@ -29,6 +32,16 @@ Dumper::Dumper( unsigned long uBytesPerAccumulation,
   printf("\nDumper: Creating %d buffers (%g MB)...\n", uNumBuffers, 
     ((float) uNumBuffers)*m_uBytesPerTransfer/1024/1024);
   m_buffer.allocate(uNumBuffers, m_uBytesPerTransfer);
+  m_buffer.setName("dump");
+
+  // Metrics updated by the thread
+  m_pBytesMetric = Metrics::counter("fastspec_dumper_bytes_total", 
+    "Raw sample bytes written to dump files");
+  m_pWriteMetric = Metrics::histogram("fastspec_dumper_write_seconds", 
+    "Time to write one transfer to the dump file", 
+    MetricHistogram::exponential(1e-5, 2, 16));
+  m_pLagMetric = Metrics::gauge("fastspec_dumper_lag_blocks", 
+    "Transfers waiting to be written after the last write");
 
   // Spawn the thread
   printf("Dumper: Creating 1 thread...\n");
@@ -198,7 +211,7 @@ void Dumper::waitForEmpty()
   // Wait
   while (!m_bStop && ( (m_buffer.size() > 0) || (m_buffer.holds() > 0))) {
 
-    printf("Dump: buffer size = %u, holds = %u\n", m_buffer.size(), m_buffer.holds());
+    Log::write(LOG_DEBUG, "Dump: buffer size = %u, holds = %u\n", m_buffer.size(), m_buffer.holds());
     usleep(DUMPER_THREAD_SLEEP_MICROSECONDS);
   }
 
@@ -244,9 +257,13 @@ void* Dumper::threadLoop(void* pContext)
   
   // Create an iterator for the buffer
   ByteBuffer::iterator iter;
+  Timer writeTimer;
+  unsigned int uBytes = 0;
 
   // Report ready
   pDumper->threadIsReady();
+  Trace::setThreadName("dumper");
+  ThreadPolicy::apply("dumper", "dumper");
 
   while (!pDumper->m_bStop) {
 
@@ -254,9 +271,16 @@ void* Dumper::threadLoop(void* pContext)
     // the data from the buffer item to the file
     if (pDumper->m_pFile && pDumper->m_buffer.request(iter, 1)) {
 
-      pDumper->m_uBytesWritten += fwrite( pDumper->m_buffer.data(iter), 1, 
-                                          pDumper->m_uBytesPerTransfer, 
-                                          pDumper->m_pFile );
+      writeTimer.tic();
+      TraceSpan span("dump write");
+      uBytes = fwrite( pDumper->m_buffer.data(iter), 1, 
+                       pDumper->m_uBytesPerTransfer, 
+                       pDumper->m_pFile );
+      span.end();
+      pDumper->m_uBytesWritten += uBytes;
+
+      pDumper->m_pBytesMetric->add(uBytes);
+      pDumper->m_pWriteMetric->observe(writeTimer.toc());
     
       // If we've written all we expected for a given file, close the file
       if (pDumper->m_uBytesWritten >= pDumper->m_uBytesPerAccumulation) {
@@ -265,6 +289,7 @@ void* Dumper::threadLoop(void* pContext)
       
       // Release the iterator to be able to do it again
       pDumper->m_buffer.release(iter);
+      pDumper->m_pLagMetric->set(pDumper->m_buffer.size());
 
     } else {
 
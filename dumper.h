@@ -4,6 +4,7 @@
 #include <pthread.h>
 #include "bytebuffer.h"
 #include "timing.h"
+#include "metrics.h"
 
 #define DUMPER_THREAD_SLEEP_MICROSECONDS 5
 
@@ -25,6 +26,9 @@ class Dumper {
     double                        m_dOffset;
     bool                          m_bStop;
     Timer                         m_timer;
+    MetricCounter*                m_pBytesMetric;
+    MetricHistogram*              m_pWriteMetric;
+    MetricGauge*                  m_pLagMetric;
     
     // Private helper functions
     void            threadIsReady();
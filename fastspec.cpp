@@ -29,13 +29,23 @@
 
 
 #include "pfb.h"
+#include "pfb_bank.h"
 #include "dumper.h"
 #include "spectrometer.h"
 #include "switch.h"
 #include "utility.h"
 #include "controller.h"
+#include "trace.h"
+#include "log.h"
+#include "thread_policy.h"
+#include "arena.h"
+#include "planner.h"
+#include "numa.h"
 #include "version.h"
 #include <fstream>      // ifstream, ofstream, ios
+#include <memory>       // unique_ptr
+#include <sstream>      // stringstream
+#include <vector>
 
 
 // ----------------------------------------------------------------------------
@@ -91,7 +101,7 @@ void print_help()
   printf("               " DEFAULT_INI_FILE "\n\n");
 
   printf("FASTSPEC can also be called to control the behavior of an already running\n");
-  printf("instance.  Six commands are supported:\n\n");
+  printf("instance.  These commands are supported:\n\n");
 
   
   printf("dump      Start dumping raw antenna samples to .dmp files.\n");
@@ -99,15 +109,30 @@ void print_help()
   printf("show      Show the live plotting window.\n");
   printf("hide      Hide the live plotting window.\n");
   printf("kill      Send the hard abort 'kill -9' signal to the already running instance.\n"); 
-  printf("stop      Send a soft stop signal to the already running instance.\n\n");
-
-  printf("FASTSPEC uses gnuplot for live plotting ('-p', '--show_plots').  Gnuplot can be\n");
-  printf("installed using the system package manager, e.g. sudo apt-get install gnuplot.\n");
-  printf("In addition to the built-in gnuplot commands, such as '+' and '-' to scale\n");
-  printf("the plot, right clicking corners of a box to zoom, exporting to image files,\n");
-  printf("etc., the FASTSPEC plot can be toggled between a plot showing the raw switch\n");
-  printf("spectra and a plot showing the'corrected' (uncalibrated) antenna temperature\n"); 
-  printf("by pressing 'x' in the plot window.\n\n");
+  printf("metrics   Print the metrics of the already running instance (Prometheus format).\n");
+  printf("spectrum  Print the most recent spectra from the already running instance.\n");
+  printf("status    Print the status of the already running instance.\n");
+  printf("stop      Ask the already running instance to stop gracefully.\n");
+  printf("traceon   Start recording trace spans in the already running instance.\n");
+  printf("traceoff  Stop recording trace spans in the already running instance.\n");
+  printf("trace     Write the recorded trace spans to " TRACE_FILE ".\n\n");
+
+  printf("Except for kill, the commands are sent over the control socket:\n\n");
+  printf("               " SOCKET_FILE "\n\n");
+  printf("Other programs can connect to it and send the same commands (one per\n");
+  printf("connection, terminated by a newline).  Over the socket, 'spectrum <n>'\n");
+  printf("averages n adjacent channels into each line of the reply and\n");
+  printf("'trace write <file>' writes the trace spans to another file.\n\n");
+
+  printf("The latest spectra are published to shared memory ('-L', '--live_feed')\n");
+  printf("at /dev/shm" LIVEFEED_NAME ".  Live plotting ('-p', '--show_plots', or\n");
+  printf("'show') starts " PLOTTER_EXE ", which plots them with gnuplot.\n");
+  printf("Gnuplot can be installed using the system package manager,\n");
+  printf("e.g. sudo apt-get install gnuplot.  Run 'fastview -a' from another terminal\n");
+  printf("to plot the 'corrected' (uncalibrated) antenna temperature instead.\n\n");
+
+  printf("Trace spans of each pipeline stage ('-TF', '--trace_file') can be viewed in\n");
+  printf("chrome://tracing or https://ui.perfetto.dev.\n\n");
 
 }
 
@@ -143,6 +168,12 @@ int main(int argc, char* argv[])
     iCtrlMode = ctrl.getOptionBool("[ARGS]", "kill", "kill", false) ? CTRL_MODE_KILL : iCtrlMode;
     iCtrlMode = ctrl.getOptionBool("[ARGS]", "dump", "dump", false) ? CTRL_MODE_DUMP_START : iCtrlMode;
     iCtrlMode = ctrl.getOptionBool("[ARGS]", "nodump", "nodump", false) ? CTRL_MODE_DUMP_STOP : iCtrlMode;
+    iCtrlMode = ctrl.getOptionBool("[ARGS]", "status", "status", false) ? CTRL_MODE_STATUS : iCtrlMode;
+    iCtrlMode = ctrl.getOptionBool("[ARGS]", "spectrum", "spectrum", false) ? CTRL_MODE_SPECTRUM : iCtrlMode;
+    iCtrlMode = ctrl.getOptionBool("[ARGS]", "metrics", "metrics", false) ? CTRL_MODE_METRICS : iCtrlMode;
+    iCtrlMode = ctrl.getOptionBool("[ARGS]", "traceon", "traceon", false) ? CTRL_MODE_TRACE_START : iCtrlMode;
+    iCtrlMode = ctrl.getOptionBool("[ARGS]", "traceoff", "traceoff", false) ? CTRL_MODE_TRACE_STOP : iCtrlMode;
+    iCtrlMode = ctrl.getOptionBool("[ARGS]", "trace", "trace", false) ? CTRL_MODE_TRACE_WRITE : iCtrlMode;
     iCtrlMode = ctrl.getOptionBool("[ARGS]", "help", "-h", false) ? CTRL_MODE_HELP : iCtrlMode;
 
     // Set the controller's mode based on the above options.  If the
@@ -183,6 +214,7 @@ int main(int argc, char* argv[])
     long uSamplesPerAccum     = ctrl.getOptionInt("Spectrometer", "samples_per_accumulation", "-a", 1024L*2L*1024L*1024L);
     long uSamplesPerTransfer  = ctrl.getOptionInt("Spectrometer", "samples_per_transfer", "-t", 2*1024*1024);
     double dAcquisitionRate   = ctrl.getOptionInt("Spectrometer", "acquisition_rate", "-r", 400);
+    long uNumTransfers        = ctrl.getOptionInt("Spectrometer", "num_transfer_buffers", "-TB", 4);
     
     #if defined DIG_PXBOARD    
       long uInputChannel        = ctrl.getOptionInt("Spectrometer", "input_channel", "-l", 2);
@@ -194,6 +226,13 @@ int main(int argc, char* argv[])
       double dCWAmp2          = ctrl.getOptionReal("Spectrometer", "sim_cw_amp2", "-A2", 0.02);  
       double dNoiseAmp        = ctrl.getOptionReal("Spectrometer", "sim_noise_amp", "-AN", 0.5);
       double dOffset          = ctrl.getOptionReal("Spectrometer", "sim_offset", "-AO", 0.0);
+      double dSimFifoSeconds  = ctrl.getOptionReal("Spectrometer", "sim_fifo_seconds", "-SF", 0);
+      double dSimJitter       = ctrl.getOptionReal("Spectrometer", "sim_jitter_seconds", "-SJ", 0);
+      double dSimStall        = ctrl.getOptionReal("Spectrometer", "sim_stall_seconds", "-SS", 0);
+      double dSimStallInterval = ctrl.getOptionReal("Spectrometer", "sim_stall_interval", "-SI", 10);
+      long uSimInputs         = ctrl.getOptionInt("Spectrometer", "sim_inputs", "-SN", 1);
+      double dSimCorrelation  = ctrl.getOptionReal("Spectrometer", "sim_correlation", "-SC", 0);
+      double dSimPhase        = ctrl.getOptionReal("Spectrometer", "sim_phase", "-SP", 0);
     #endif
     
     // Channelizer configuration
@@ -201,10 +240,36 @@ int main(int argc, char* argv[])
     long uNumTaps             = ctrl.getOptionInt("Spectrometer", "num_taps", "-q", 5);
     long uWindowFunctionId    = ctrl.getOptionInt("Spectrometer", "window_function_id", "-w", 1);
     long uNumThreads          = ctrl.getOptionInt("Spectrometer", "num_fft_threads", "-m", 4);
+    long uMinThreads          = ctrl.getOptionInt("Spectrometer", "min_fft_threads", "-MT", 0);
+    bool bFixedPoint          = ctrl.getOptionBool("Spectrometer", "fixed_point_taps", "-FP", false);
+    string sPrecision         = ctrl.getOptionStr("Spectrometer", "precision", "-PR", "single");
+    long uVoltageBits         = ctrl.getOptionInt("Spectrometer", "voltage_bits", "-VB", 0);
+    double dVoltageGain       = ctrl.getOptionReal("Spectrometer", "voltage_gain", "-VG", 1.0);
+    long uVoltageSlots        = ctrl.getOptionInt("Spectrometer", "voltage_ring_slots", "-VS", 1024);
     long uNumBuffers          = ctrl.getOptionInt("Spectrometer", "num_fft_buffers", "-b", 400);
+    bool bKurtosis            = ctrl.getOptionBool("Spectrometer", "spectral_kurtosis", "-K", false);
+    double dSubSeconds        = ctrl.getOptionReal("Spectrometer", "sub_accumulation_seconds", "-S", 0);
+    string sBinnedSpectra     = ctrl.getOptionStr("Spectrometer", "binned_spectra", "-BS", "");
+    double dFlagChannel       = ctrl.getOptionReal("Spectrometer", "rfi_channel_threshold", "-FC", 0);
+    double dFlagSpectrum      = ctrl.getOptionReal("Spectrometer", "rfi_spectrum_threshold", "-FS", 0);
+    bool bFlagMask            = ctrl.getOptionBool("Spectrometer", "rfi_mask", "-FM", false);
+    double dZoomCenter        = ctrl.getOptionReal("Spectrometer", "zoom_center_freq", "-Z", 0);
+    long uZoomDecimation      = ctrl.getOptionInt("Spectrometer", "zoom_decimation", "-D", 1);
+    long uZoomTapsPerPhase    = ctrl.getOptionInt("Spectrometer", "zoom_fir_taps_per_phase", "-P", 8);
+    double dOutputStartFreq   = ctrl.getOptionReal("Spectrometer", "output_start_freq", "-FL", 0);
+    double dOutputStopFreq    = ctrl.getOptionReal("Spectrometer", "output_stop_freq", "-FH", 0);
+    string sExtraPFBs         = ctrl.getOptionStr("Spectrometer", "extra_channelizers", "-X", "");
     
     // Raw data dumper configuration
     long uNumDumpBuffers      = ctrl.getOptionInt("Spectrometer", "num_dump_buffers", "-M", 1000);
+
+    // Buffer planning (overrides num_fft_buffers and num_dump_buffers)
+    double dMemoryBudget      = ctrl.getOptionReal("Spectrometer", "memory_budget", "-PB", 0);
+    double dStallSeconds      = ctrl.getOptionReal("Spectrometer", "stall_seconds", "-PS", 1.0);
+
+    // Overload control (off unless overload_run_blocks is given)
+    long uOverloadRunBlocks   = ctrl.getOptionInt("Spectrometer", "overload_run_blocks", "-OR", 0);
+    long uOverloadMaxFactor   = ctrl.getOptionInt("Spectrometer", "overload_max_factor", "-OK", 8);
     
     // Run configuration
     long uStopCycles          = ctrl.getOptionInt("Spectrometer", "stop_cycles", "-c", 0); 
@@ -212,6 +277,21 @@ int main(int argc, char* argv[])
     string sStopTime          = ctrl.getOptionStr("Spectrometer", "stop_time", "-u", "");
     bool bPlot                = ctrl.getOptionBool("Spectrometer", "show_plots", "-p", false);    
     long uPlotBin             = ctrl.getOptionInt("Spectrometer", "plot_bin", "-B", 1);  
+    bool bLiveFeed            = ctrl.getOptionBool("Spectrometer", "live_feed", "-L", true);
+    string sMetricsFile       = ctrl.getOptionStr("Spectrometer", "metrics_file", "-MF", "");
+    string sTraceFile         = ctrl.getOptionStr("Spectrometer", "trace_file", "-TF", "");
+    long uLogLevel            = ctrl.getOptionInt("Spectrometer", "log_level", "-LL", LOG_INFO);
+
+    // Thread placement and scheduling
+    string sDigitizerCPUs     = ctrl.getOptionStr("Spectrometer", "digitizer_cpus", "-RD", "");
+    long iDigitizerPriority   = ctrl.getOptionInt("Spectrometer", "digitizer_priority", "-RP", 0);
+    string sTransferCPUs      = ctrl.getOptionStr("Spectrometer", "transfer_cpus", "-RT", "");
+    string sChannelizerCPUs   = ctrl.getOptionStr("Spectrometer", "channelizer_cpus", "-RC", "");
+    string sDumperCPUs        = ctrl.getOptionStr("Spectrometer", "dumper_cpus", "-RU", "");
+    bool bLockMemory          = ctrl.getOptionBool("Spectrometer", "lock_memory", "-RM", false);
+    long uHugePages           = ctrl.getOptionInt("Spectrometer", "huge_pages", "-HP", 0);
+    long uNumaShards          = ctrl.getOptionInt("Spectrometer", "numa_shards", "-NS", 0);
+    long uShardBlocks         = ctrl.getOptionInt("Spectrometer", "shard_blocks", "-NB", 64);
     bool bDump                = ctrl.getOptionBool("Spectrometer", "dump_raw_data", "-y", false); 
 
 
@@ -222,6 +302,36 @@ int main(int argc, char* argv[])
       return 0;
     }
 
+    // Messages from the data path go through the asynchronous logger so
+    // that those threads never wait on the terminal
+    Log::setLevel((unsigned int) uLogLevel);
+    Log::start();
+
+    // Set the CPUs and scheduling of each thread role before any of the 
+    // threads are started
+    // The transfer thread shares the digitizer's CPUs and priority unless
+    // it is given its own CPUs
+    if (sTransferCPUs.empty()) {
+      sTransferCPUs = sDigitizerCPUs;
+    }
+    if (!ThreadPolicy::set("digitizer", sDigitizerCPUs, (int) iDigitizerPriority) ||
+        !ThreadPolicy::set("transfer", sTransferCPUs, (int) iDigitizerPriority) ||
+        !ThreadPolicy::set("channelizer", sChannelizerCPUs, 0) ||
+        !ThreadPolicy::set("dumper", sDumperCPUs, 0)) {
+      return 1;
+    }
+    ThreadPolicy::report();
+
+    // Large blocks (buffers, FFT arrays, accumulators) come from an arena of
+    // huge pages if requested
+    if (!Arena::setPageSize((unsigned int) uHugePages)) {
+      return 1;
+    }
+
+    if (uNumaShards > 0) {
+      Numa::report();
+    }
+
     // Set some controls (the controller parses the configuration, but doesn't
     // used any of the info until explictly told)
     ctrl.setPlot(bPlot, (unsigned int) uPlotBin); 
@@ -232,12 +342,68 @@ int main(int argc, char* argv[])
     double dBandwidth = dAcquisitionRate / 2.0;
     unsigned int uNumFFT = uNumChannels * 2;
     printf("Bandwidth: %6.2f\n", dBandwidth);        
+
+    // In zoom mode the main channelizer is a complex PFB after a DDC, so each
+    // spectrum consumes decimation x channels samples and covers 
+    // acquisition_rate / decimation MHz centered on zoom_center_freq.
+    bool bZoom = (uZoomDecimation > 1);
+    double dZoomStart = dZoomCenter - dAcquisitionRate / uZoomDecimation / 2.0;
+    double dZoomStop = dZoomCenter + dAcquisitionRate / uZoomDecimation / 2.0;
+    if (bZoom) {
+      uNumFFT = uZoomDecimation * uNumChannels;
+      printf("Zoom band: %.6g to %.6g MHz\n", dZoomStart, dZoomStop);
+      if (uNumaShards > 1) {
+        printf("Zoom channelizer can't be split into NUMA shards. Abort.\n");
+        return 1;
+      }
+    }
     printf("Samples per FFT: %d\n", uNumFFT);  
 
+    // Dual channel acquisitions interleave the samples of two inputs.  Input 
+    // A is accumulated as usual, and input B and the cross power of the two
+    // are written alongside it.  Sample counts below are per input.
+    #if defined DIG_PXBOARD
+      unsigned int uInputs = (uInputChannel == 0) ? 2 : 1;
+    #elif defined DIG_PXSIM
+      unsigned int uInputs = (uSimInputs == 2) ? 2 : 1;
+    #else
+      unsigned int uInputs = 1;
+    #endif
+    if (uInputs > 1) {
+      printf("Inputs: %u\n", uInputs);
+    }
+
+    // Only the channels covering output_start_freq to output_stop_freq are 
+    // detected, accumulated and written (0 for either means the band edge).
+    // The channels are clamped to the band before they are made unsigned, 
+    // and a range outside the band is left empty to be rejected below.
+    double dFullStart = bZoom ? dZoomStart : 0;
+    double dFullStop = bZoom ? dZoomStop : dBandwidth;
+    double dChannelSize = (dFullStop - dFullStart) / uNumChannels;
+    double dStartChannel = 0;
+    double dStopChannel = uNumChannels;
+    if (dOutputStartFreq > dFullStart) {
+      dStartChannel = floor((dOutputStartFreq - dFullStart) / dChannelSize);
+    }
+    if ((dOutputStopFreq > 0) && (dOutputStopFreq < dFullStop)) {
+      dStopChannel = ceil((dOutputStopFreq - dFullStart) / dChannelSize);
+    }
+    dStartChannel = (dStartChannel < uNumChannels) ? dStartChannel : uNumChannels;
+    dStopChannel = (dStopChannel > 0) ? dStopChannel : 0;
+    dStopChannel = (dStopChannel < uNumChannels) ? dStopChannel : uNumChannels;
+    unsigned int uStartChannel = (unsigned int) dStartChannel;
+    unsigned int uStopChannel = (unsigned int) dStopChannel;
+    bool bPruned = (uStartChannel > 0) || (uStopChannel < uNumChannels);
+    if (bPruned && (uStartChannel < uStopChannel)) {
+      printf("Output channels: %u to %u (%.6g to %.6g MHz)\n", uStartChannel, 
+        uStopChannel - 1, dFullStart + uStartChannel * dChannelSize, 
+        dFullStart + uStopChannel * dChannelSize);
+    }
+
     // -----------------------------------------------------------------------
     // Check the configuration
     // -----------------------------------------------------------------------  
-    if (uSamplesPerTransfer % uNumFFT != 0) {
+    if (uSamplesPerTransfer % (uNumFFT * uInputs) != 0) {
       printf("WARNING: The number of samples per transfer is not a multiple "
              "of the number of FFT samples.  This wil likely lead to poor "
              "sidelobe performance in the channelizer (due to discontinuous "
@@ -251,6 +417,90 @@ int main(int argc, char* argv[])
              "achieve highest possible duty cycle.\n\n");
     }
 
+    if ((sPrecision != "single") && (sPrecision != "double")) {
+      printf("ERROR: precision must be single or double, not %s.  Abort.\n",
+             sPrecision.c_str());
+      return 1;
+    }
+    bool bDouble = (sPrecision == "double");
+
+    if ((uOverloadRunBlocks > 0) && (uOverloadRunBlocks <= uNumTaps)) {
+      printf("ERROR: overload_run_blocks (%ld) must be more than num_taps (%ld) "
+             "or the processed runs will not yield any spectra.  Abort.\n", 
+             uOverloadRunBlocks, uNumTaps);
+      return 1;
+    }
+
+    if (uStartChannel >= uStopChannel) {
+      printf("ERROR: The output frequency range (%.6g to %.6g MHz) does not "
+             "contain any channels.  Abort.\n", dOutputStartFreq, dOutputStopFreq);
+      return 1;
+    }
+
+    if (bZoom && ((dZoomStart < 0) || (dZoomStop > dBandwidth))) {
+      printf("ERROR: The zoom band (%.6g to %.6g MHz) must lie within 0 to "
+             "%.6g MHz.  Abort.\n", dZoomStart, dZoomStop, dBandwidth);
+      return 1;
+    }
+
+    if ((uInputs > 1) && (bZoom || (uNumaShards > 1) || !sExtraPFBs.empty())) {
+      printf("ERROR: Two inputs can't be used with zoom mode, NUMA shards or "
+             "extra channelizers.  Abort.\n");
+      return 1;
+    }
+
+    // Masking would zero channels of input A but not of input B or the 
+    // cross power, so two inputs can only skip flagged spectra
+    if ((uInputs > 1) && bFlagMask && ((dFlagChannel > 0) || (dFlagSpectrum > 0))) {
+      printf("ERROR: Two inputs can't be used with rfi_mask.  Abort.\n");
+      return 1;
+    }
+
+    // Extra channelizers are given as channels:taps:window:threads separated
+    // by commas.  Trailing fields default to the main channelizer's settings 
+    // (and one thread).  Each must divide the main FFT length evenly because
+    // they share its buffer blocks.
+    struct ExtraPFB { 
+      unsigned int uChannels; 
+      unsigned int uTaps; 
+      unsigned int uWindow; 
+      unsigned int uThreads; 
+    };
+    vector<ExtraPFB> extraPFBs;
+    stringstream ssExtraPFBs(sExtraPFBs);
+    string sItem;
+    while (getline(ssExtraPFBs, sItem, ',')) {
+      ExtraPFB extra = { 0, (unsigned int) uNumTaps, (unsigned int) uWindowFunctionId, 1 };
+      if ((sscanf(sItem.c_str(), "%u:%u:%u:%u", &extra.uChannels, &extra.uTaps, 
+                  &extra.uWindow, &extra.uThreads) < 1) || 
+          (extra.uChannels == 0) || (uNumFFT % (2*extra.uChannels) != 0)) {
+        printf("ERROR: Bad extra channelizer '%s'.  The number of channels must "
+               "divide evenly into %u.  Abort.\n", sItem.c_str(), uNumFFT / 2);
+        return 1;
+      }
+      extraPFBs.push_back(extra);
+    }
+
+    // Binned resolutions are given as factor:seconds separated by commas, in
+    // order of increasing factor.  The seconds default to 0 (one binned 
+    // accumulation per accumulation).
+    struct BinnedSpectra {
+      unsigned int uFactor;
+      double dSeconds;
+    };
+    vector<BinnedSpectra> binnedSpectra;
+    stringstream ssBinnedSpectra(sBinnedSpectra);
+    while (getline(ssBinnedSpectra, sItem, ',')) {
+      BinnedSpectra binned = { 0, 0 };
+      if ((sscanf(sItem.c_str(), "%u:%lf", &binned.uFactor, &binned.dSeconds) < 1) ||
+          (binned.uFactor < 2) || ((binned.uFactor & (binned.uFactor - 1)) != 0)) {
+        printf("ERROR: Bad binned spectra '%s'.  The factor must be a power of "
+               "2.  Abort.\n", sItem.c_str());
+        return 1;
+      }
+      binnedSpectra.push_back(binned);
+    }
+
     // -----------------------------------------------------------------------
     // Initialize the receiver switch
     // -----------------------------------------------------------------------      
@@ -292,21 +542,26 @@ int main(int argc, char* argv[])
 
     #if defined DIG_RAZORMAX
       RazorMax dig( dAcquisitionRate, 
-                    uSamplesPerAccum, 
+                    uSamplesPerAccum * uInputs, 
                     uSamplesPerTransfer ); 
     #elif defined DIG_PXBOARD
       PXBoard dig( dAcquisitionRate, 
-                   uSamplesPerAccum, 
+                   uSamplesPerAccum * uInputs, 
                    uSamplesPerTransfer, 
                    uInputChannel, 
                    uVoltageRange );
     #elif defined DIG_PXSIM
       PXSim dig( dAcquisitionRate, 
-                 uSamplesPerAccum, 
+                 uSamplesPerAccum * uInputs, 
                  uSamplesPerTransfer );
       dig.setSignal(dCWFreq1, dCWAmp1, dCWFreq2, dCWAmp2, dNoiseAmp, dOffset);
+      if (uInputs == 2) { dig.setSecondInput(dSimCorrelation, dSimPhase); }
+      dig.setFifo(dSimFifoSeconds);
+      dig.setJitter(dSimJitter, dSimStall, dSimStallInterval);
     #endif
 
+    dig.setTransferBuffers((unsigned int) uNumTransfers);
+
     // Connect to the digitizer board
     if (!dig.connect(1)) { 
       printf("Failed to connect to digitizer board. Abort. \n");
@@ -314,20 +569,101 @@ int main(int argc, char* argv[])
     }
 
     // -----------------------------------------------------------------------
-    // Initialize the asynchronous channelizer
+    // Size the buffer pools from the memory budget (if given)
     // -----------------------------------------------------------------------
-    PFB chan ( uNumThreads,
-               uNumBuffers,
-               uNumChannels, 
-               uNumTaps, 
-               uWindowFunctionId, 
-               false );
+    if (dMemoryBudget > 0) {
+
+      PlannerConfig plannerConfig;
+      plannerConfig.dSampleRate = dAcquisitionRate * 1e6 * uInputs;
+      plannerConfig.uSamplesPerTransfer = uSamplesPerTransfer;
+      plannerConfig.uBytesPerSample = dig.bytesPerSample();
+      plannerConfig.uBlockLength = uNumFFT * uInputs;
+      plannerConfig.uNumChannels = uNumFFT / 2;
+      plannerConfig.uNumTaps = uNumTaps;
+      plannerConfig.uWindow = uWindowFunctionId;
+      plannerConfig.uNumThreads = uNumThreads;
+      plannerConfig.bFixedPoint = bFixedPoint;
+      plannerConfig.bDouble = bDouble;
+      plannerConfig.uNumShards = uNumaShards;
+      plannerConfig.bDumper = true;
+      plannerConfig.bDump = bDump;
+      plannerConfig.sDumpDirectory = sDataDir.empty() ? "." : sDataDir;
+      if (sUserOutput.find_last_of('/') != string::npos) {
+        plannerConfig.sDumpDirectory = sUserOutput.substr(0, sUserOutput.find_last_of('/'));
+      }
+      plannerConfig.dBudgetMB = dMemoryBudget;
+      plannerConfig.dStallSeconds = dStallSeconds;
+
+      Planner planner(plannerConfig);
+      if (!planner.plan()) {
+        return 1;
+      }
+      uNumBuffers = planner.channelizerBuffers();
+      uNumDumpBuffers = planner.dumpBuffers();
+    }
+
+    // -----------------------------------------------------------------------
+    // Initialize the asynchronous channelizers.  The main channelizer and any
+    // extra channelizers all read the same buffered samples.
+    // -----------------------------------------------------------------------
+    MedianFlagger flagger(dFlagChannel, dFlagSpectrum, bFlagMask);  // Must outlive the channelizer
+    std::unique_ptr<ChannelizerBank> pChan ( 
+      ChannelizerBank::create( bDouble, uNumBuffers, uNumFFT * uInputs, 
+                               (unsigned int) uNumaShards, (unsigned int) uShardBlocks ) );
+
+    if ((uInputs > 1) && !pChan->setInputs(uInputs)) {
+      printf("Failed to channelize %u inputs.  Abort.\n", uInputs);
+      return 1;
+    }
+
+    bool bAdded = false;
+    if (bZoom) {
+      bAdded = pChan->addZoom( uNumThreads,
+                               uNumBuffers,
+                               dZoomCenter / dAcquisitionRate,
+                               uZoomDecimation,
+                               uZoomTapsPerPhase,
+                               uNumChannels, 
+                               uNumTaps, 
+                               uWindowFunctionId, 
+                               false );
+    } else {
+      bAdded = pChan->add( uNumThreads,
+                           uNumChannels, 
+                           uNumTaps, 
+                           uWindowFunctionId, 
+                           false );
+    }
+    if (bAdded && bPruned) { pChan->setOutputChannels(0, uStartChannel, uStopChannel); }
+
+    for (unsigned int i=0; i<extraPFBs.size(); i++) {
+      pChan->add( extraPFBs[i].uThreads,
+                  extraPFBs[i].uChannels,
+                  extraPFBs[i].uTaps,
+                  extraPFBs[i].uWindow,
+                  false );
+    }
+
+    pChan->setSecondMoment(bKurtosis);
+    pChan->setMinThreads((unsigned int) uMinThreads);
+    if (flagger.isOn()) { pChan->setFlagger(&flagger); }
+
+    if (bFixedPoint && !pChan->setFixedPoint(true)) {
+      printf("Failed to use fixed-point taps.  Abort.\n");
+      return 1;
+    }
+
+    if ((uVoltageBits > 0) && 
+        !pChan->setVoltageOutput((unsigned int) uVoltageBits, std::vector<float>(1, (float) dVoltageGain))) {
+      printf("Failed to pass on complex spectra.  Abort.\n");
+      return 1;
+    }
 
 
     // -----------------------------------------------------------------------
     // Initialize the asynchronous raw data dumper
     // -----------------------------------------------------------------------   
-    Dumper dump ( uSamplesPerAccum*dig.bytesPerSample(),
+    Dumper dump ( uSamplesPerAccum*uInputs*dig.bytesPerSample(),
                   uSamplesPerTransfer*dig.bytesPerSample(), 
                   uNumDumpBuffers,
                   dig.type(),
@@ -339,25 +675,65 @@ int main(int argc, char* argv[])
     // -----------------------------------------------------------------------
     // Initialize the Spectrometer
     // -----------------------------------------------------------------------
+    LiveFeed feed;  // Must outlive the spectrometer
+    VoltageRing ring;
     Spectrometer spec( uNumChannels, 
                        uSamplesPerAccum, 
                        dBandwidth, 
                        dSwitchDelay,
                        (Digitizer*) &dig,
-                       (Channelizer*) &chan,
+                       (Channelizer*) pChan.get(),
                        &dump,
                        (Switch*) &sw, 
                        &ctrl );
 
+    if (bZoom || bPruned) { 
+      spec.setFrequencyRange( uStopChannel - uStartChannel, 
+                              dFullStart + uStartChannel * dChannelSize,
+                              dFullStart + uStopChannel * dChannelSize, 
+                              uNumFFT ); 
+    }
+    if (bPruned) { spec.setChannelRange(uStartChannel, uNumChannels); }
+    if (uInputs > 1) { spec.setInputs(uInputs); }
     if (uStopCycles > 0) { spec.setStopCycles(uStopCycles); }
     if (dStopSeconds > 0) { spec.setStopSeconds(dStopSeconds); }
     if (!sStopTime.empty()) { spec.setStopTime(sStopTime); }
+    if (bKurtosis) { spec.setSecondMoment(bKurtosis); }
+    if (dSubSeconds > 0) { spec.setSubAccumulation(dSubSeconds); }
+    if (flagger.isOn()) { spec.setFlagging(&flagger, flagger.isMask()); }
+    for (unsigned int i=0; i<binnedSpectra.size(); i++) {
+      if (!spec.addBinning(binnedSpectra[i].uFactor, binnedSpectra[i].dSeconds)) {
+        printf("Failed to add binned spectra.  Abort.\n");
+        return 1;
+      }
+    }
+    if (bLiveFeed || bPlot) { spec.setLiveFeed(&feed); }
+    if (uVoltageBits > 0) { spec.setVoltageRing(&ring, (unsigned int) uVoltageSlots, (unsigned int) uVoltageBits); }
+    if (uOverloadRunBlocks > 0) { 
+      if (uOverloadRunBlocks > (1 - OVERLOAD_HIGH_FILL) * uNumBuffers) {
+        printf("WARNING: overload_run_blocks (%ld) is more than the free buffer "
+               "blocks left at the overload threshold.  Blocks will still be "
+               "dropped before the controller can react.\n\n", uOverloadRunBlocks);
+      }
+      spec.setOverload((unsigned int) uOverloadRunBlocks, (unsigned int) uOverloadMaxFactor); 
+    }
+    if (!sMetricsFile.empty()) { spec.setMetricsFile(sMetricsFile); }
+
+    for (unsigned int i=0; i<extraPFBs.size(); i++) {
+      spec.addChannelizerOutput(extraPFBs[i].uChannels);
+    }
 
     // -----------------------------------------------------------------------
     // Take data until the controller tell us it is time to stop
     // (usually when a SIGINT is received)
     // -----------------------------------------------------------------------    
+    if (!sTraceFile.empty()) { Trace::enable(true); }
+    if (bLockMemory) { ThreadPolicy::lockMemory(); }
+    Arena::report();
+
     spec.run();
 
+    if (!sTraceFile.empty()) { Trace::writeJSON(sTraceFile); }
+
     return 0;
 }
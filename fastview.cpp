@@ -0,0 +1,279 @@
+#include <string>
+#include <vector>
+#include <stdio.h>      // printf, popen
+#include <math.h>       // log10
+#include <signal.h>     // signal
+#include <unistd.h>     // usleep
+#include "livefeed.h"
+
+#define PLOTTER_CMD   "/usr/bin/gnuplot"
+
+// ---------------------------------------------------------------------------
+//
+// FASTVIEW
+//
+// Live viewer for the spectra that FASTSPEC and SIMPLESPEC publish to shared
+// memory (see livefeed.h).  Plots each new set of spectra with gnuplot, or
+// prints a one line summary per update with -t.  With -a, the three switch
+// positions are plotted as the uncalibrated antenna temperature instead.
+// It can be started and stopped at any time without affecting the running
+// spectrometer, which also starts it for its own live plots (show).
+//
+// ---------------------------------------------------------------------------
+
+static bool g_bStop = false;
+
+void on_signal(int)
+{
+  g_bStop = true;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// print_help
+// ----------------------------------------------------------------------------
+void print_help()
+{
+  printf("Usage:  fastview [-b bin] [-r seconds] [-a] [-t]\n\n");
+  printf("-b        Average this many adjacent channels before plotting (default 1)\n");
+  printf("-a        Plot the uncalibrated antenna temperature, 400*(p0-p1)/(p2-p1)+300\n");
+  printf("-r        Seconds between checks for new spectra (default 0.5)\n");
+  printf("-t        Print a summary line for each update instead of plotting\n");
+  printf("-h        View this help message\n\n");
+  printf("Reads spectra from /dev/shm" LIVEFEED_NAME ".  Press Ctrl-C to exit.\n\n");
+}
+
+
+
+// ----------------------------------------------------------------------------
+// plot_spectra -- Sends the spectra to gnuplot as inline data in dB
+// ----------------------------------------------------------------------------
+void plot_spectra(FILE* pPlotter, const LiveFeedHeader& header,
+                  const std::vector<ACCUM_DATA_TYPE>& data, unsigned int uBin)
+{
+  const char* titles[] = { "p0 (antenna)", "p1 (load)", "p2 (load+cal)", "p3" };
+  double df = (header.dStopFreq - header.dStartFreq) / header.uNumChannels;
+  TimeKeeper tk;
+  tk.set(header.dStartTime);
+
+  fprintf(pPlotter, "set title \"Cycle %lu at %s\"\n",
+    (unsigned long) header.uCycle, tk.getDateTimeString(5).c_str());
+  fprintf(pPlotter, "plot");
+  for (unsigned int k=0; k<header.uNumSpectra; k++) {
+    fprintf(pPlotter, "%s '-' using 1:2 title \"%s\" with lines", (k>0) ? "," : "",
+      (header.uNumSpectra > 1) ? titles[k] : "spectrum");
+  }
+  fprintf(pPlotter, "\n");
+
+  for (unsigned int k=0; k<header.uNumSpectra; k++) {
+
+    const ACCUM_DATA_TYPE* p = &(data[(size_t) k * header.uNumChannels]);
+    double dNorm = (header.dNumAccums[k] > 0) ? 1.0 / header.dNumAccums[k] : 1.0;
+
+    for (unsigned int i=0; i+uBin<=header.uNumChannels; i+=uBin) {
+      double d = 0;
+      for (unsigned int j=i; j<i+uBin; j++) {
+        d += p[j];
+      }
+      d = d * dNorm / uBin;
+      fprintf(pPlotter, "%.6f %.6g\n", header.dStartFreq + df * (i + (uBin-1) / 2.0),
+        (d > 0) ? 10*log10(d) : -200.0);
+    }
+    fprintf(pPlotter, "e\n");
+  }
+
+  fflush(pPlotter);
+}
+
+
+
+// ----------------------------------------------------------------------------
+// plot_temperature -- Sends the uncalibrated antenna temperature of the three
+//                     switch positions to gnuplot as inline data
+// ----------------------------------------------------------------------------
+void plot_temperature(FILE* pPlotter, const LiveFeedHeader& header,
+                      const std::vector<ACCUM_DATA_TYPE>& data, unsigned int uBin)
+{
+  if (header.uNumSpectra < 3) {
+    return;
+  }
+
+  double df = (header.dStopFreq - header.dStartFreq) / header.uNumChannels;
+  const ACCUM_DATA_TYPE* p0 = &(data[0]);
+  const ACCUM_DATA_TYPE* p1 = &(data[header.uNumChannels]);
+  const ACCUM_DATA_TYPE* p2 = &(data[2 * (size_t) header.uNumChannels]);
+  double dNorm[3];
+  TimeKeeper tk;
+  tk.set(header.dStartTime);
+
+  for (unsigned int k=0; k<3; k++) {
+    dNorm[k] = (header.dNumAccums[k] > 0) ? 1.0 / header.dNumAccums[k] : 1.0;
+  }
+
+  fprintf(pPlotter, "set title \"Cycle %lu at %s\"\n",
+    (unsigned long) header.uCycle, tk.getDateTimeString(5).c_str());
+  fprintf(pPlotter, "plot '-' using 1:2 title \"T_{ant} (uncalib)\" with lines\n");
+
+  for (unsigned int i=0; i+uBin<=header.uNumChannels; i+=uBin) {
+    double d0 = 0;
+    double d1 = 0;
+    double d2 = 0;
+    for (unsigned int j=i; j<i+uBin; j++) {
+      d0 += p0[j] * dNorm[0];
+      d1 += p1[j] * dNorm[1];
+      d2 += p2[j] * dNorm[2];
+    }
+    double ta = (d2 != d1) ? 400 * (d0 - d1) / (d2 - d1) + 300 : 0;
+    fprintf(pPlotter, "%.6f %.6g\n", header.dStartFreq + df * (i + (uBin-1) / 2.0), ta);
+  }
+  fprintf(pPlotter, "e\n");
+
+  fflush(pPlotter);
+}
+
+
+
+// ----------------------------------------------------------------------------
+// print_summary -- One line per update with the peak of each spectrum
+// ----------------------------------------------------------------------------
+void print_summary(const LiveFeedHeader& header, const std::vector<ACCUM_DATA_TYPE>& data)
+{
+  double df = (header.dStopFreq - header.dStartFreq) / header.uNumChannels;
+  TimeKeeper tk;
+  tk.set(header.dStartTime);
+
+  printf("Cycle %lu at %s |", (unsigned long) header.uCycle, tk.getDateTimeString(5).c_str());
+
+  for (unsigned int k=0; k<header.uNumSpectra; k++) {
+
+    const ACCUM_DATA_TYPE* p = &(data[(size_t) k * header.uNumChannels]);
+    unsigned int uPeak = 0;
+    for (unsigned int i=1; i<header.uNumChannels; i++) {
+      uPeak = (p[i] > p[uPeak]) ? i : uPeak;
+    }
+
+    double dPeak = (header.dNumAccums[k] > 0) ? p[uPeak] / header.dNumAccums[k] : 0;
+    printf(" p%u peak %.3f dB at %.4f MHz |", k, (dPeak > 0) ? 10*log10(dPeak) : -200.0,
+      header.dStartFreq + df * uPeak);
+  }
+
+  printf("\n");
+  fflush(stdout);
+}
+
+
+
+// ----------------------------------------------------------------------------
+// Main
+// ----------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+  unsigned int uBin = 1;
+  double dRefresh = 0.5;
+  bool bText = false;
+  bool bTemperature = false;
+
+  // -----------------------------------------------------------------------
+  // Parse the command line
+  // -----------------------------------------------------------------------
+  for (int i=1; i<argc; i++)
+  {
+    std::string sArg = argv[i];
+
+    if (sArg.compare("-h") == 0) {
+      print_help();
+      return 0;
+    } else if ((sArg.compare("-b") == 0) && (i+1 < argc)) {
+      uBin = std::stoul(argv[++i]);
+      uBin = (uBin < 1) ? 1 : uBin;
+    } else if ((sArg.compare("-r") == 0) && (i+1 < argc)) {
+      dRefresh = std::stod(argv[++i]);
+    } else if (sArg.compare("-t") == 0) {
+      bText = true;
+    } else if (sArg.compare("-a") == 0) {
+      bTemperature = true;
+    } else {
+      print_help();
+      return 1;
+    }
+  }
+
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+  signal(SIGPIPE, on_signal);
+
+  // -----------------------------------------------------------------------
+  // Start the plotter
+  // -----------------------------------------------------------------------
+  FILE* pPlotter = NULL;
+  if (!bText) {
+    if ((pPlotter = popen(PLOTTER_CMD, "w")) == NULL) {
+      printf("fastview: Failed to start plotter: %s\n", PLOTTER_CMD);
+      return 1;
+    }
+    fprintf(pPlotter, "set xlabel \"Frequency [MHz]\"\n");
+    if (bTemperature) {
+      fprintf(pPlotter, "set ylabel \"Temperature [K]\"\n");
+      fprintf(pPlotter, "set yrange [100:10000]\n");
+    } else {
+      fprintf(pPlotter, "set ylabel \"Power [dB] (arb)\"\n");
+    }
+    fprintf(pPlotter, "set grid\n");
+    fflush(pPlotter);
+  }
+
+  // -----------------------------------------------------------------------
+  // Poll the feed for new spectra
+  // -----------------------------------------------------------------------
+  LiveFeedReader reader;
+  LiveFeedHeader header;
+  std::vector<ACCUM_DATA_TYPE> data;
+  uint64_t uLastSequence = 0;
+  Timer idleTimer;
+  bool bWaiting = false;
+
+  idleTimer.tic();
+
+  while (!g_bStop) {
+
+    // (Re)attach to the feed.  A new spectrometer instance replaces the
+    // segment, so reattach if nothing has been published for a while.
+    if (!reader.isOpen() || (idleTimer.toc() > 10 * dRefresh + 10)) {
+      if (!reader.open(LIVEFEED_NAME)) {
+        if (!bWaiting) {
+          printf("fastview: Waiting for spectrometer...\n");
+          bWaiting = true;
+        }
+        usleep(1000000);
+        continue;
+      }
+      bWaiting = false;
+      uLastSequence = 0;
+      idleTimer.tic();
+    }
+
+    // Update if there is something new
+    if ((reader.sequence() != uLastSequence) && reader.read(header, data)) {
+
+      uLastSequence = header.uSequence;
+      idleTimer.tic();
+
+      if (bText) {
+        print_summary(header, data);
+      } else if (bTemperature) {
+        plot_temperature(pPlotter, header, data, uBin);
+      } else {
+        plot_spectra(pPlotter, header, data, uBin);
+      }
+    }
+
+    usleep((unsigned int) (dRefresh * 1e6));
+  }
+
+  if (pPlotter) {
+    pclose(pPlotter);
+  }
+
+  return 0;
+}
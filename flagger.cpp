@@ -0,0 +1,190 @@
+#include "flagger.h"
+#include <stdio.h>
+#include "arena.h"
+
+
+
+// ----------------------------------------------------------------------------
+// Constructor
+// ----------------------------------------------------------------------------
+MedianFlagger::MedianFlagger(double dChannelThreshold, double dSpectrumThreshold, bool bMask)
+{
+  m_dChannelThreshold = (dChannelThreshold > 0) ? dChannelThreshold : 0;
+  m_dSpectrumThreshold = (dSpectrumThreshold > 0) ? dSpectrumThreshold : 0;
+  m_bMask = bMask;
+  m_uPosition = 0;
+
+  m_pSpectraMetric = Metrics::counter("fastspec_rfi_flagged_spectra_total",
+    "Spectra flagged whole or skipped by the RFI flagger");
+  m_pChannelsMetric = Metrics::counter("fastspec_rfi_flagged_channels_total",
+    "Channels flagged by the RFI flagger");
+
+  if (isOn()) {
+    printf("Flagger: Flagging channels above %g x and spectra above %g x their "
+      "running median (0 is off), %s\n", m_dChannelThreshold, m_dSpectrumThreshold,
+      m_bMask ? "masking flagged channels" : "skipping flagged spectra");
+  }
+}
+
+
+
+// ----------------------------------------------------------------------------
+// newState
+// ----------------------------------------------------------------------------
+void* MedianFlagger::newState(unsigned int uLength)
+{
+  State* pState = new State;
+  pState->pMedian = Arena::allocate(FLAGGER_POSITIONS * uLength * sizeof(double), "flagger");  // Room for either precision
+  pState->uLength = uLength;
+
+  for (unsigned int i=0; i<FLAGGER_POSITIONS; i++) {
+    pState->dTotalMedian[i] = 0;
+    pState->uSpectra[i] = 0;
+  }
+
+  return pState;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// deleteState
+// ----------------------------------------------------------------------------
+void MedianFlagger::deleteState(void* pState)
+{
+  if (pState) {
+    Arena::free(((State*) pState)->pMedian);
+    delete (State*) pState;
+  }
+}
+
+
+
+// ----------------------------------------------------------------------------
+// flag -- Single and double precision spectra
+// ----------------------------------------------------------------------------
+bool MedianFlagger::flag(void* pState, float* pSpectrum, float* pSpectrum2,
+                         float* pWeights, unsigned int uLength)
+{
+  return flagSpectrum((State*) pState, pSpectrum, pSpectrum2, pWeights, uLength);
+}
+
+bool MedianFlagger::flag(void* pState, double* pSpectrum, double* pSpectrum2,
+                         double* pWeights, unsigned int uLength)
+{
+  return flagSpectrum((State*) pState, pSpectrum, pSpectrum2, pWeights, uLength);
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setPosition -- Positions beyond the last one share its baseline
+// ----------------------------------------------------------------------------
+void MedianFlagger::setPosition(unsigned int uPosition)
+{
+  m_uPosition = (uPosition < FLAGGER_POSITIONS) ? uPosition : FLAGGER_POSITIONS - 1;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// flagSpectrum
+// ----------------------------------------------------------------------------
+template<typename T>
+bool MedianFlagger::flagSpectrum(State* pState, T* pSpectrum, T* pSpectrum2, 
+                                 T* pWeights, unsigned int uLength)
+{
+  unsigned int p = m_uPosition;
+  T* pMedian = (T*) pState->pMedian + p * pState->uLength;
+  double& dTotalMedian = pState->dTotalMedian[p];
+  unsigned int n;
+
+  if (uLength != pState->uLength) {
+    for (n=0; n<uLength; n++) {
+      pWeights[n] = 1;
+    }
+    return true;
+  }
+
+  // The total power is summed in its own loop, since the compiler won't
+  // reorder floating point sums to vectorize them
+  double dTotal = 0;
+  for (n=0; n<uLength; n++) {
+    dTotal += pSpectrum[n];
+  }
+
+  // Start the medians from the first spectrum
+  if (pState->uSpectra[p] == 0) {
+    T fMean = (T) (dTotal / uLength);
+    for (n=0; n<uLength; n++) {
+      pMedian[n] = (pSpectrum[n] > 0) ? pSpectrum[n] : fMean;
+    }
+    dTotalMedian = dTotal;
+  }
+
+  bool bTrained = (++pState->uSpectra[p] > FLAGGER_WARMUP_SPECTRA);
+  bool bSpectrum = bTrained && (m_dSpectrumThreshold > 0) &&
+                   (dTotal > m_dSpectrumThreshold * dTotalMedian);
+  dTotalMedian *= (dTotal > dTotalMedian) ? (1 + FLAGGER_MEDIAN_STEP) : (1 - FLAGGER_MEDIAN_STEP);
+
+  // Flag the channels against their medians and step the medians toward the
+  // new spectrum.  The comparisons are used as 0 or 1 rather than to branch
+  // so that the loops vectorize.
+  T fDown = (T) (1 - FLAGGER_MEDIAN_STEP);
+  T fStep = (T) (2 * FLAGGER_MEDIAN_STEP);
+  unsigned int uFlagged = 0;
+
+  if (bTrained && (m_dChannelThreshold > 0)) {
+    T fThreshold = (T) m_dChannelThreshold;
+    for (n=0; n<uLength; n++) {
+      T x = pSpectrum[n];
+      T m = pMedian[n];
+      unsigned int uFlag = (x > fThreshold * m);
+      pWeights[n] = (T) (1 - uFlag);
+      uFlagged += uFlag;
+      pMedian[n] = m * (fDown + fStep * (T) (x > m));
+    }
+  } else {
+    for (n=0; n<uLength; n++) {
+      T m = pMedian[n];
+      pWeights[n] = 1;
+      pMedian[n] = m * (fDown + fStep * (T) (pSpectrum[n] > m));
+    }
+  }
+
+  if (uFlagged > 0) {
+    m_pChannelsMetric->add(uFlagged);
+  }
+
+  if (!bSpectrum && (uFlagged == 0)) {
+    return true;
+  }
+
+  // A flagged spectrum flags all of its channels
+  if (bSpectrum) {
+    for (n=0; n<uLength; n++) {
+      pWeights[n] = 0;
+    }
+  }
+
+  // Skip the spectrum, or mask the flagged channels
+  if (bSpectrum || !m_bMask) {
+    m_pSpectraMetric->add();
+  }
+
+  if (!m_bMask) {
+    return false;
+  }
+
+  for (n=0; n<uLength; n++) {
+    pSpectrum[n] *= pWeights[n];
+  }
+
+  if (pSpectrum2) {
+    for (n=0; n<uLength; n++) {
+      pSpectrum2[n] *= pWeights[n];
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,126 @@
+#ifndef _FLAGGER_H_
+#define _FLAGGER_H_
+
+#include "metrics.h"
+
+// ---------------------------------------------------------------------------
+//
+// SpectrumFlagger
+//
+// Virtual interface for a stage that flags RFI in each power spectrum after
+// it is detected and before it is passed on to be accumulated (see
+// PFB::setFlagger).  It runs in the channelizer's worker threads, so each
+// thread keeps its own state (e.g. a running baseline) made by newState().
+// flag() may zero channels of the spectrum (masking them) and gives the
+// weight of every channel: 1 if it was kept and 0 if it was flagged.  If it
+// returns false the whole spectrum is skipped instead, and the weights still
+// say which channels were flagged.  Spectra come in the
+// precision of the channelizer (see ChannelizerBank), so flag() takes both.
+//
+// ---------------------------------------------------------------------------
+class SpectrumFlagger {
+
+  public:
+
+    virtual         ~SpectrumFlagger() {}
+
+    // State for one worker thread's spectra of the given number of channels
+    virtual void*   newState(unsigned int) = 0;
+    virtual void    deleteState(void*) = 0;
+
+    // Flags the power spectrum (and its power squared, if not NULL) in
+    // place and writes the weight of each channel.  Returns false if the
+    // spectrum should be skipped.
+    virtual bool    flag(void*, float*, float*, float*, unsigned int) = 0;
+    virtual bool    flag(void*, double*, double*, double*, unsigned int) = 0;
+
+    // The receiver's switch position for the spectra that follow, so that 
+    // a baseline can be kept per position.  Only called while no spectra
+    // are being flagged.
+    virtual void    setPosition(unsigned int) = 0;
+};
+
+
+
+// ---------------------------------------------------------------------------
+//
+// MedianFlagger
+//
+// Flags channels and whole spectra that stand out from a running median.
+// Each thread tracks the median power of every channel, and of the total
+// power of the spectrum, by stepping its estimate up by a factor of
+// (1 + FLAGGER_MEDIAN_STEP) when the new value is above it and down by
+// (1 - FLAGGER_MEDIAN_STEP) when it is below.  The estimate settles where
+// as many values fall above as below, and a burst can only move it by one
+// step per spectrum, so the baseline follows slow changes in the bandpass
+// but not the RFI.
+//
+// A channel is flagged when its power is more than the channel threshold
+// times its median.  The power of one spectrum in a channel of Gaussian
+// noise exceeds t times its median with probability 2^-t, so a threshold
+// of 20 flags about one clean channel in a million.  A whole spectrum is
+// flagged when its total power is more than the spectrum threshold times
+// the median total (e.g. 1.2 for a broadband burst), which is sensitive to
+// bursts too weak to flag any single channel.  A threshold of 0 turns that
+// test off.
+//
+// Flagged channels get weight 0 (all of them if the whole spectrum is
+// flagged).  In mask mode they are also zeroed and the spectrum is kept.  In
+// skip mode, a spectrum with any flag is skipped.
+//
+// The antenna and the calibration loads have very different spectra, so
+// each thread keeps a separate set of medians for each of the 
+// FLAGGER_POSITIONS switch positions (see setPosition) and each set picks
+// up where it left off when its position comes round again.  The first
+// FLAGGER_WARMUP_SPECTRA spectra of each set only train the baseline.
+//
+// The channel pass is a single loop that uses its comparisons as 0 or 1
+// rather than branching, so the compiler vectorizes it.  The number of
+// flagged spectra and channels are published in
+// fastspec_rfi_flagged_spectra_total and fastspec_rfi_flagged_channels_total.
+//
+// ---------------------------------------------------------------------------
+
+#define FLAGGER_MEDIAN_STEP       0.0625
+#define FLAGGER_WARMUP_SPECTRA    128
+#define FLAGGER_POSITIONS         3
+
+class MedianFlagger : public SpectrumFlagger {
+
+  private:
+
+    struct State {
+      void*               pMedian;          // One per channel and position, in the spectra's precision
+      unsigned int        uLength;
+      double              dTotalMedian[FLAGGER_POSITIONS];
+      unsigned long       uSpectra[FLAGGER_POSITIONS];
+    };
+
+    // Member variables
+    double            m_dChannelThreshold;
+    double            m_dSpectrumThreshold;
+    bool              m_bMask;
+    unsigned int      m_uPosition;          // Index of the baseline in use
+    MetricCounter*    m_pSpectraMetric;
+    MetricCounter*    m_pChannelsMetric;
+
+    template<typename T>
+    bool    flagSpectrum(State*, T*, T*, T*, unsigned int);
+
+  public:
+
+    // Constructor and destructor
+    MedianFlagger( double, double, bool );
+    ~MedianFlagger() {}
+
+    void*   newState(unsigned int);
+    void    deleteState(void*);
+    bool    flag(void*, float*, float*, float*, unsigned int);
+    bool    flag(void*, double*, double*, double*, unsigned int);
+    void    setPosition(unsigned int);
+
+    bool    isMask() const { return m_bMask; }
+    bool    isOn() const { return (m_dChannelThreshold > 0) || (m_dSpectrumThreshold > 0); }
+};
+
+#endif // _FLAGGER_H_
@@ -0,0 +1,131 @@
+#ifndef _LATENCY_H_
+#define _LATENCY_H_
+
+#include <math.h>         // frexp
+#include <string.h>       // memset
+#include <stdint.h>
+
+// ---------------------------------------------------------------------------
+//
+// LatencyHistogram
+//
+// HDR-style histogram of durations for reporting percentiles.  Each power of
+// two from LATENCY_MIN_SECONDS up is split into LATENCY_SUB_BUCKETS linear
+// buckets, so every recorded duration is known to within about 6% however
+// long it is, and recording is a few instructions with no allocation.
+// Durations below LATENCY_MIN_SECONDS share the first bucket and durations
+// beyond the last octave share an overflow bucket.  Negative durations (e.g.
+// the slack of a late transfer) are kept in a mirror image of the same
+// buckets, so the low percentiles include them.  The exact minimum and
+// maximum are kept as well.
+//
+// Not thread safe.  The owner serializes record(), percentile() and reset().
+//
+// ---------------------------------------------------------------------------
+
+#define LATENCY_MIN_SECONDS     1e-6
+#define LATENCY_OCTAVES         26      // 1 us to about 67 s
+#define LATENCY_SUB_BUCKETS     16
+#define LATENCY_BUCKETS         (LATENCY_OCTAVES * LATENCY_SUB_BUCKETS + 1)
+
+class LatencyHistogram {
+
+  private:
+
+    uint64_t    m_counts[LATENCY_BUCKETS];      // Last is overflow
+    uint64_t    m_negCounts[LATENCY_BUCKETS];   // Same for -duration
+    uint64_t    m_uCount;
+    double      m_dSum;
+    double      m_dMin;
+    double      m_dMax;
+
+    // Upper bound of a bucket
+    static double upper(unsigned int uBucket) {
+      unsigned int uOctave = uBucket / LATENCY_SUB_BUCKETS;
+      unsigned int uSub = uBucket % LATENCY_SUB_BUCKETS;
+      return LATENCY_MIN_SECONDS * ldexp(1.0 + (uSub + 1.0) / LATENCY_SUB_BUCKETS, uOctave);
+    }
+
+    // Bucket of a duration that isn't negative
+    static unsigned int bucket(double dSeconds) {
+      if (dSeconds < LATENCY_MIN_SECONDS) {
+        return 0;
+      }
+      // dSeconds / min = m * 2^e with m in [0.5, 1)
+      int iExp = 0;
+      double dMantissa = frexp(dSeconds / LATENCY_MIN_SECONDS, &iExp);
+      unsigned int uOctave = iExp - 1;
+      if (uOctave >= LATENCY_OCTAVES) {
+        return LATENCY_BUCKETS - 1;
+      }
+      return uOctave * LATENCY_SUB_BUCKETS +
+             (unsigned int) ((2 * dMantissa - 1) * LATENCY_SUB_BUCKETS);
+    }
+
+    double clamp(double d) const {
+      return (d < m_dMin) ? m_dMin : (d > m_dMax) ? m_dMax : d;
+    }
+
+  public:
+
+    LatencyHistogram() { reset(); }
+
+    void reset() {
+      memset(m_counts, 0, sizeof(m_counts));
+      memset(m_negCounts, 0, sizeof(m_negCounts));
+      m_uCount = 0;
+      m_dSum = 0;
+      m_dMin = 0;
+      m_dMax = 0;
+    }
+
+    void record(double dSeconds) {
+
+      if (dSeconds < 0) {
+        m_negCounts[bucket(-dSeconds)]++;
+      } else {
+        m_counts[bucket(dSeconds)]++;
+      }
+
+      if ((m_uCount == 0) || (dSeconds < m_dMin)) { m_dMin = dSeconds; }
+      if ((m_uCount == 0) || (dSeconds > m_dMax)) { m_dMax = dSeconds; }
+      m_uCount++;
+      m_dSum += dSeconds;
+    }
+
+    // Duration that the fraction dQuantile (0 to 1) of the durations are at
+    // or below, to within the bucket width (0 if empty)
+    double percentile(double dQuantile) const {
+
+      if (m_uCount == 0) {
+        return 0;
+      }
+
+      uint64_t uRank = (uint64_t) ceil(dQuantile * m_uCount);
+      uint64_t uSoFar = 0;
+
+      // Negative durations first, most negative first.  The upper end of a
+      // mirrored bucket is minus the lower end of the positive one.
+      for (unsigned int i=LATENCY_BUCKETS; i>0; i--) {
+        uSoFar += m_negCounts[i-1];
+        if ((uSoFar >= uRank) && (uSoFar > 0)) {
+          return clamp((i > 1) ? -upper(i-2) : 0);
+        }
+      }
+
+      for (unsigned int i=0; i<LATENCY_BUCKETS-1; i++) {
+        uSoFar += m_counts[i];
+        if ((uSoFar >= uRank) && (uSoFar > 0)) {
+          return clamp(upper(i));
+        }
+      }
+      return m_dMax;
+    }
+
+    uint64_t    count() const { return m_uCount; }
+    double      mean() const { return m_uCount ? m_dSum / m_uCount : 0; }
+    double      min() const { return m_dMin; }
+    double      max() const { return m_dMax; }
+};
+
+#endif // _LATENCY_H_
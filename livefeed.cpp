@@ -0,0 +1,297 @@
+#include "livefeed.h"
+#include <stdio.h>
+#include <string.h>     // memcpy
+#include <fcntl.h>      // O_* constants
+#include <unistd.h>     // ftruncate
+#include <sys/mman.h>   // shm_open, mmap
+#include <sys/stat.h>   // fstat
+
+using namespace std;
+
+
+// ----------------------------------------------------------------------------
+// Constructor
+// ----------------------------------------------------------------------------
+LiveFeed::LiveFeed()
+{
+  m_pHeader = NULL;
+  m_pData = NULL;
+  m_uSize = 0;
+  m_uSequence = 0;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// Destructor
+// ----------------------------------------------------------------------------
+LiveFeed::~LiveFeed()
+{
+  close();
+}
+
+
+
+// ----------------------------------------------------------------------------
+// open() -- Creates (or replaces) the shared memory segment with room for
+//           uNumSpectra spectra of uNumChannels each
+// ----------------------------------------------------------------------------
+bool LiveFeed::open(const string& sName, unsigned int uNumSpectra,
+                    unsigned int uNumChannels)
+{
+  close();
+
+  if ((uNumSpectra == 0) || (uNumSpectra > LIVEFEED_MAX_SPECTRA) || (uNumChannels == 0)) {
+    printf("LiveFeed: Invalid size (%u spectra of %u channels)\n", uNumSpectra, uNumChannels);
+    return false;
+  }
+
+  // Start fresh so that readers of a previous instance's segment are not
+  // confused by a change in size
+  shm_unlink(sName.c_str());
+
+  int fd = shm_open(sName.c_str(), O_CREAT | O_RDWR, 0644);
+  if (fd < 0) {
+    printf("LiveFeed: Failed to create shared memory segment %s\n", sName.c_str());
+    return false;
+  }
+
+  m_uSize = sizeof(LiveFeedHeader) + (size_t) uNumSpectra * uNumChannels * sizeof(ACCUM_DATA_TYPE);
+
+  if (ftruncate(fd, m_uSize) != 0) {
+    printf("LiveFeed: Failed to size shared memory segment %s\n", sName.c_str());
+    ::close(fd);
+    shm_unlink(sName.c_str());
+    return false;
+  }
+
+  void* pMap = mmap(NULL, m_uSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+
+  if (pMap == MAP_FAILED) {
+    printf("LiveFeed: Failed to map shared memory segment %s\n", sName.c_str());
+    shm_unlink(sName.c_str());
+    return false;
+  }
+
+  m_sName = sName;
+  m_pHeader = (LiveFeedHeader*) pMap;
+  m_pData = (ACCUM_DATA_TYPE*) ((char*) pMap + sizeof(LiveFeedHeader));
+  m_uSequence = 0;
+
+  memset(pMap, 0, m_uSize);
+  m_pHeader->uVersion = LIVEFEED_VERSION;
+  m_pHeader->uCapacity = uNumChannels;
+  m_pHeader->uBytesPerValue = sizeof(ACCUM_DATA_TYPE);
+
+  // Set the magic number last so readers don't use a partial header
+  __atomic_store_n(&(m_pHeader->uMagic), LIVEFEED_MAGIC, __ATOMIC_RELEASE);
+
+  printf("LiveFeed: Publishing spectra to /dev/shm%s (%.02f MB)\n",
+    sName.c_str(), m_uSize / 1e6);
+
+  return true;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// close() -- Unmaps and removes the segment
+// ----------------------------------------------------------------------------
+void LiveFeed::close()
+{
+  if (m_pHeader) {
+    munmap(m_pHeader, m_uSize);
+    shm_unlink(m_sName.c_str());
+  }
+
+  m_pHeader = NULL;
+  m_pData = NULL;
+  m_uSize = 0;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// publish() -- Copies the sums and metadata of uNumSpectra accumulators into
+//              the segment.  All accumulators must have the same length.
+// ----------------------------------------------------------------------------
+bool LiveFeed::publish(Accumulator** pAccums, unsigned int uNumSpectra,
+                       unsigned long uCycle)
+{
+  if (!m_pHeader || (uNumSpectra == 0)) {
+    return false;
+  }
+
+  unsigned int uLength = pAccums[0]->getDataLength();
+  size_t uBytesPerSpectrum = (size_t) uLength * sizeof(ACCUM_DATA_TYPE);
+
+  if ((uNumSpectra > LIVEFEED_MAX_SPECTRA) ||
+      (sizeof(LiveFeedHeader) + uNumSpectra * uBytesPerSpectrum > m_uSize)) {
+    return false;
+  }
+
+  // Mark the segment as being updated
+  __atomic_store_n(&(m_pHeader->uSequence), ++m_uSequence, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  m_pHeader->uNumSpectra = uNumSpectra;
+  m_pHeader->uNumChannels = uLength;
+  m_pHeader->uCycle = uCycle;
+  m_pHeader->dStartFreq = pAccums[0]->getStartFreq();
+  m_pHeader->dStopFreq = pAccums[0]->getStopFreq();
+  m_pHeader->dStartTime = pAccums[0]->getStartTime().secondsSince1970();
+  m_pHeader->dStopTime = pAccums[uNumSpectra-1]->getStopTime().secondsSince1970();
+
+  for (unsigned int i=0; i<uNumSpectra; i++) {
+    m_pHeader->dNumAccums[i] = pAccums[i]->getNumAccums();
+    m_pHeader->dADCmin[i] = pAccums[i]->getADCmin();
+    m_pHeader->dADCmax[i] = pAccums[i]->getADCmax();
+    if (pAccums[i]->getDataLength() == uLength) {
+      memcpy(m_pData + (size_t) i * uLength, pAccums[i]->getSum(), uBytesPerSpectrum);
+    } else {
+      memset(m_pData + (size_t) i * uLength, 0, uBytesPerSpectrum);
+    }
+  }
+
+  // Mark the update as complete
+  __atomic_store_n(&(m_pHeader->uSequence), ++m_uSequence, __ATOMIC_RELEASE);
+
+  return true;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// LiveFeedReader constructor
+// ----------------------------------------------------------------------------
+LiveFeedReader::LiveFeedReader()
+{
+  m_pHeader = NULL;
+  m_uSize = 0;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// LiveFeedReader destructor
+// ----------------------------------------------------------------------------
+LiveFeedReader::~LiveFeedReader()
+{
+  close();
+}
+
+
+
+// ----------------------------------------------------------------------------
+// open() -- Maps an existing segment read-only
+// ----------------------------------------------------------------------------
+bool LiveFeedReader::open(const string& sName)
+{
+  struct stat st;
+
+  close();
+
+  int fd = shm_open(sName.c_str(), O_RDONLY, 0);
+  if (fd < 0) {
+    return false;
+  }
+
+  if ((fstat(fd, &st) != 0) || ((size_t) st.st_size < sizeof(LiveFeedHeader))) {
+    ::close(fd);
+    return false;
+  }
+
+  void* pMap = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+
+  if (pMap == MAP_FAILED) {
+    return false;
+  }
+
+  m_sName = sName;
+  m_pHeader = (LiveFeedHeader*) pMap;
+  m_uSize = st.st_size;
+
+  if ((__atomic_load_n(&(m_pHeader->uMagic), __ATOMIC_ACQUIRE) != LIVEFEED_MAGIC) ||
+      (m_pHeader->uVersion != LIVEFEED_VERSION) ||
+      (m_pHeader->uBytesPerValue != sizeof(ACCUM_DATA_TYPE))) {
+    close();
+    return false;
+  }
+
+  return true;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// close()
+// ----------------------------------------------------------------------------
+void LiveFeedReader::close()
+{
+  if (m_pHeader) {
+    munmap(m_pHeader, m_uSize);
+  }
+
+  m_pHeader = NULL;
+  m_uSize = 0;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// sequence()
+// ----------------------------------------------------------------------------
+uint64_t LiveFeedReader::sequence() const
+{
+  if (!m_pHeader) {
+    return 0;
+  }
+
+  return __atomic_load_n(&(m_pHeader->uSequence), __ATOMIC_ACQUIRE) & ~((uint64_t) 1);
+}
+
+
+
+// ----------------------------------------------------------------------------
+// read() -- Copies the header and spectra, retrying if the writer changed
+//           them during the copy
+// ----------------------------------------------------------------------------
+bool LiveFeedReader::read(LiveFeedHeader& header, vector<ACCUM_DATA_TYPE>& data,
+                          unsigned int uMaxTries)
+{
+  if (!m_pHeader) {
+    return false;
+  }
+
+  const ACCUM_DATA_TYPE* pData = (const ACCUM_DATA_TYPE*) ((const char*) m_pHeader + sizeof(LiveFeedHeader));
+  size_t uMaxValues = (m_uSize - sizeof(LiveFeedHeader)) / sizeof(ACCUM_DATA_TYPE);
+
+  for (unsigned int uTry=0; uTry<uMaxTries; uTry++) {
+
+    uint64_t uBefore = __atomic_load_n(&(m_pHeader->uSequence), __ATOMIC_ACQUIRE);
+
+    // Nothing published yet or an update is in progress
+    if ((uBefore == 0) || (uBefore & 1)) {
+      usleep(1000);
+      continue;
+    }
+
+    memcpy(&header, m_pHeader, sizeof(LiveFeedHeader));
+
+    size_t uNumValues = (size_t) header.uNumSpectra * header.uNumChannels;
+    if ((uNumValues > 0) && (header.uNumSpectra <= LIVEFEED_MAX_SPECTRA) && (uNumValues <= uMaxValues)) {
+      data.resize(uNumValues);
+      memcpy(&(data[0]), pData, uNumValues * sizeof(ACCUM_DATA_TYPE));
+    }
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    if (__atomic_load_n(&(m_pHeader->uSequence), __ATOMIC_RELAXED) == uBefore) {
+      return (uNumValues > 0) && (header.uNumSpectra <= LIVEFEED_MAX_SPECTRA) && (uNumValues <= uMaxValues);
+    }
+  }
+
+  return false;
+}
@@ -0,0 +1,108 @@
+#ifndef _LIVEFEED_H_
+#define _LIVEFEED_H_
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "accumulator.h"
+
+// ---------------------------------------------------------------------------
+//
+// LIVEFEED
+//
+// Publishes the latest accumulated spectra to a POSIX shared memory segment
+// (/dev/shm/fastspec_live) so that viewers (e.g. FASTVIEW) can display them
+// without the spectrometer formatting text files.  The segment begins with a
+// LiveFeedHeader followed by uNumSpectra arrays of uCapacity raw accumulator
+// sums (ACCUM_DATA_TYPE).  Divide by dNumAccums to get average power.
+//
+// Access is guarded by a sequence lock.  The writer makes uSequence odd
+// before changing the segment and even again when done, so a reader copies
+// the segment and keeps the copy only if uSequence was even and unchanged
+// across the copy.  The writer never waits for readers.
+//
+// ---------------------------------------------------------------------------
+
+#define LIVEFEED_NAME           "/fastspec_live"
+#define LIVEFEED_MAGIC          0x46534C56    // "VLSF"
+#define LIVEFEED_VERSION        1
+#define LIVEFEED_MAX_SPECTRA    4
+
+struct LiveFeedHeader {
+  uint32_t  uMagic;
+  uint32_t  uVersion;
+  uint64_t  uSequence;                      // Odd while being updated
+  uint32_t  uCapacity;                      // Channels allocated per spectrum
+  uint32_t  uNumSpectra;                    // Spectra in the latest update
+  uint32_t  uNumChannels;                   // Channels in the latest update
+  uint32_t  uBytesPerValue;
+  uint64_t  uCycle;
+  double    dStartFreq;                     // MHz
+  double    dStopFreq;                      // MHz
+  double    dStartTime;                     // Seconds since 1970 (UTC)
+  double    dStopTime;                      // Seconds since 1970 (UTC)
+  double    dNumAccums[LIVEFEED_MAX_SPECTRA];
+  double    dADCmin[LIVEFEED_MAX_SPECTRA];
+  double    dADCmax[LIVEFEED_MAX_SPECTRA];
+};
+
+
+// ---------------------------------------------------------------------------
+// LiveFeed -- Writer side, owned by the spectrometer
+// ---------------------------------------------------------------------------
+class LiveFeed {
+
+  private:
+
+    std::string       m_sName;
+    LiveFeedHeader*   m_pHeader;
+    ACCUM_DATA_TYPE*  m_pData;
+    size_t            m_uSize;
+    uint64_t          m_uSequence;
+
+  public:
+
+    // Constructor and destructor
+    LiveFeed();
+    ~LiveFeed();
+
+    // Create the segment with room for uNumSpectra x uNumChannels values
+    bool    open(const std::string&, unsigned int, unsigned int);
+    void    close();
+    bool    isOpen() const { return (m_pHeader != NULL); }
+
+    // Copy the accumulators into the segment
+    bool    publish(Accumulator**, unsigned int, unsigned long);
+};
+
+
+// ---------------------------------------------------------------------------
+// LiveFeedReader -- Reader side, used by viewers
+// ---------------------------------------------------------------------------
+class LiveFeedReader {
+
+  private:
+
+    std::string       m_sName;
+    LiveFeedHeader*   m_pHeader;
+    size_t            m_uSize;
+
+  public:
+
+    // Constructor and destructor
+    LiveFeedReader();
+    ~LiveFeedReader();
+
+    bool    open(const std::string&);
+    void    close();
+    bool    isOpen() const { return (m_pHeader != NULL); }
+
+    // Sequence number of the latest complete update (0 if none yet)
+    uint64_t  sequence() const;
+
+    // Consistent copy of the header and spectra.  Returns false if no
+    // complete update could be read.
+    bool    read(LiveFeedHeader&, std::vector<ACCUM_DATA_TYPE>&, unsigned int uMaxTries=100);
+};
+
+#endif // _LIVEFEED_H_
@@ -0,0 +1,275 @@
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>     // atexit
+#include <unistd.h>     // usleep
+#include <algorithm>    // sort
+#include <new>          // nothrow
+#include "timing.h"
+
+using namespace std;
+
+std::atomic<unsigned int>   Log::s_uLevel(LOG_INFO);
+std::atomic<bool>           Log::s_bRunning(false);
+std::atomic<uint64_t>       Log::s_uSequence(0);
+std::atomic<uint64_t>       Log::s_uDropped(0);
+pthread_mutex_t             Log::s_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_t                   Log::s_thread;
+std::vector<LogRing*>       Log::s_rings;
+__thread LogRing*           Log::t_pRing = NULL;
+
+// Output state, only used by the thread that drains
+static string               s_sLast;
+static unsigned long        s_uRepeats = 0;
+static unsigned long        s_uLines = 0;
+static unsigned long        s_uSuppressed = 0;
+static uint64_t             s_uReportedDrops = 0;
+static Timer                s_windowTimer;
+static Timer                s_repeatTimer;
+static Timer                s_dropTimer;
+
+
+
+// ----------------------------------------------------------------------------
+// start() -- Starts the drain thread
+// ----------------------------------------------------------------------------
+bool Log::start()
+{
+  static bool bRegistered = false;
+
+  if (s_bRunning) {
+    return true;
+  }
+
+  s_windowTimer.tic();
+  s_repeatTimer.tic();
+  s_dropTimer.tic();
+  s_bRunning = true;
+
+  if (pthread_create(&s_thread, NULL, threadLoop, NULL) != 0) {
+    s_bRunning = false;
+    printf("Log: Failed to create thread.  Printing messages directly.\n");
+    return false;
+  }
+
+  // Make sure queued messages are written when the application exits
+  if (!bRegistered) {
+    atexit(Log::stop);
+    bRegistered = true;
+  }
+
+  return true;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// stop() -- Stops the drain thread and writes anything still queued
+// ----------------------------------------------------------------------------
+void Log::stop()
+{
+  if (!s_bRunning) {
+    return;
+  }
+
+  s_bRunning = false;
+  pthread_join(s_thread, NULL);
+  drain(true);
+}
+
+
+
+// ----------------------------------------------------------------------------
+// write(), error(), warn(), info()
+// ----------------------------------------------------------------------------
+void Log::write(unsigned int uLevel, const char* sFormat, ...)
+{
+  va_list args;
+  va_start(args, sFormat);
+  vwrite(uLevel, sFormat, args);
+  va_end(args);
+}
+
+void Log::error(const char* sFormat, ...)
+{
+  va_list args;
+  va_start(args, sFormat);
+  vwrite(LOG_ERROR, sFormat, args);
+  va_end(args);
+}
+
+void Log::warn(const char* sFormat, ...)
+{
+  va_list args;
+  va_start(args, sFormat);
+  vwrite(LOG_WARN, sFormat, args);
+  va_end(args);
+}
+
+void Log::info(const char* sFormat, ...)
+{
+  va_list args;
+  va_start(args, sFormat);
+  vwrite(LOG_INFO, sFormat, args);
+  va_end(args);
+}
+
+
+
+// ----------------------------------------------------------------------------
+// vwrite() -- Formats the message into the calling thread's ring.  Never
+//             blocks once the ring exists.
+// ----------------------------------------------------------------------------
+void Log::vwrite(unsigned int uLevel, const char* sFormat, va_list args)
+{
+  if (uLevel > s_uLevel.load(std::memory_order_relaxed)) {
+    return;
+  }
+
+  if (!s_bRunning.load(std::memory_order_relaxed)) {
+    vprintf(sFormat, args);
+    return;
+  }
+
+  // Create our ring the first time this thread logs
+  if (!t_pRing) {
+    LogRing* pRing = new (std::nothrow) LogRing();
+    if (!pRing) {
+      s_uDropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    pRing->uHead.store(0);
+    pRing->uTail.store(0);
+    pthread_mutex_lock(&s_mutex);
+    s_rings.push_back(pRing);
+    pthread_mutex_unlock(&s_mutex);
+    t_pRing = pRing;
+  }
+
+  uint64_t uHead = t_pRing->uHead.load(std::memory_order_relaxed);
+  if (uHead - t_pRing->uTail.load(std::memory_order_acquire) >= LOG_RING_MESSAGES) {
+    s_uDropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  LogRecord& record = t_pRing->records[uHead % LOG_RING_MESSAGES];
+  record.uSequence = s_uSequence.fetch_add(1, std::memory_order_relaxed);
+  record.uLevel = uLevel;
+  vsnprintf(record.sText, LOG_MESSAGE_LENGTH, sFormat, args);
+
+  t_pRing->uHead.store(uHead + 1, std::memory_order_release);
+}
+
+
+
+// ----------------------------------------------------------------------------
+// drain() -- Writes the queued messages of all threads in the order they
+//            were logged, folding repeats and limiting the rate.
+// ----------------------------------------------------------------------------
+void Log::drain(bool bFinal)
+{
+  vector<LogRing*> rings;
+  vector<LogRecord> records;
+  string sOut;
+  char sLine[128];
+
+  pthread_mutex_lock(&s_mutex);
+  rings = s_rings;
+  pthread_mutex_unlock(&s_mutex);
+
+  for (unsigned int r=0; r<rings.size(); r++) {
+    uint64_t uHead = rings[r]->uHead.load(std::memory_order_acquire);
+    uint64_t uTail = rings[r]->uTail.load(std::memory_order_relaxed);
+    for (uint64_t i=uTail; i<uHead; i++) {
+      records.push_back(rings[r]->records[i % LOG_RING_MESSAGES]);
+    }
+    rings[r]->uTail.store(uHead, std::memory_order_release);
+  }
+
+  std::sort(records.begin(), records.end(),
+    [](const LogRecord& a, const LogRecord& b) { return a.uSequence < b.uSequence; });
+
+  for (unsigned int i=0; i<records.size(); i++) {
+
+    string sText = records[i].sText;
+
+    // Count repeats of the previous message
+    if (sText == s_sLast) {
+      s_uRepeats++;
+      continue;
+    }
+
+    if (s_uRepeats > 0) {
+      snprintf(sLine, sizeof(sLine), "Log: Last message repeated %lu times\n", s_uRepeats);
+      sOut += sLine;
+      s_uRepeats = 0;
+    }
+    s_repeatTimer.tic();
+    s_sLast = sText;
+
+    // Start a new rate window each second
+    if (s_windowTimer.toc() >= 1.0) {
+      if (s_uSuppressed > 0) {
+        snprintf(sLine, sizeof(sLine), "Log: Suppressed %lu messages\n", s_uSuppressed);
+        sOut += sLine;
+      }
+      s_windowTimer.tic();
+      s_uLines = 0;
+      s_uSuppressed = 0;
+    }
+
+    if (s_uLines < LOG_MAX_LINES_PER_SECOND) {
+      sOut += sText;
+      if (sText.empty() || (sText[sText.length()-1] != '\n')) {
+        sOut += "\n";
+      }
+      s_uLines++;
+    } else {
+      s_uSuppressed++;
+    }
+  }
+
+  // Report ongoing repeats, suppressions, and drops at least once a second
+  if ((s_uRepeats > 0) && (bFinal || (s_repeatTimer.toc() >= 1.0))) {
+    snprintf(sLine, sizeof(sLine), "Log: Last message repeated %lu times\n", s_uRepeats);
+    sOut += sLine;
+    s_uRepeats = 0;
+    s_repeatTimer.tic();
+  }
+
+  if ((s_uSuppressed > 0) && (bFinal || (s_windowTimer.toc() >= 1.0))) {
+    snprintf(sLine, sizeof(sLine), "Log: Suppressed %lu messages\n", s_uSuppressed);
+    sOut += sLine;
+    s_windowTimer.tic();
+    s_uLines = 0;
+    s_uSuppressed = 0;
+  }
+
+  uint64_t uDropped = dropped();
+  if ((uDropped != s_uReportedDrops) && (bFinal || (s_dropTimer.toc() >= 1.0))) {
+    snprintf(sLine, sizeof(sLine), "Log: Dropped %lu messages because a queue was full\n",
+      (unsigned long) (uDropped - s_uReportedDrops));
+    sOut += sLine;
+    s_uReportedDrops = uDropped;
+    s_dropTimer.tic();
+  }
+
+  if (!sOut.empty()) {
+    fwrite(sOut.c_str(), 1, sOut.length(), stdout);
+    fflush(stdout);
+  }
+}
+
+
+
+// ----------------------------------------------------------------------------
+// threadLoop()
+// ----------------------------------------------------------------------------
+void* Log::threadLoop(void*)
+{
+  while (s_bRunning) {
+    usleep(LOG_DRAIN_MICROSECONDS);
+    drain(false);
+  }
+
+  pthread_exit(NULL);
+}
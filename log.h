@@ -0,0 +1,106 @@
+#ifndef _LOG_H_
+#define _LOG_H_
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stdarg.h>
+#include <pthread.h>
+
+// ---------------------------------------------------------------------------
+//
+// LOG
+//
+// Asynchronous logger for messages from the data path (e.g. failed buffer
+// pushes), where printf to an unbuffered terminal or journald could block
+// the thread that should be keeping up with the digitizer.
+//
+// Each thread formats its messages into its own ring of LOG_RING_MESSAGES
+// fixed-size records without taking a lock.  If the ring is full the
+// message is counted and dropped rather than waiting.  A background thread
+// drains the rings every LOG_DRAIN_MICROSECONDS, writes the messages in the
+// order they were logged, and:
+//
+//   - Replaces repeats of the same message with one "repeated N times" line
+//   - Prints at most LOG_MAX_LINES_PER_SECOND lines per second and reports
+//     how many were suppressed
+//
+// Until start() is called (and after stop()), messages are printed directly.
+// Setup and shutdown messages can keep using printf.
+//
+//   Log::warn("Spectrometer: Failed to push to channelizer\n");
+//
+// ---------------------------------------------------------------------------
+
+#define LOG_ERROR                 0
+#define LOG_WARN                  1
+#define LOG_INFO                  2
+#define LOG_DEBUG                 3
+
+#define LOG_RING_MESSAGES         256
+#define LOG_MESSAGE_LENGTH        240
+#define LOG_DRAIN_MICROSECONDS    20000
+#define LOG_MAX_LINES_PER_SECOND  50
+
+struct LogRecord {
+  uint64_t      uSequence;
+  unsigned int  uLevel;
+  char          sText[LOG_MESSAGE_LENGTH];
+};
+
+
+// ---------------------------------------------------------------------------
+// LogRing -- Messages of one thread.  Single writer, single reader (the
+//            drain thread).
+// ---------------------------------------------------------------------------
+struct LogRing {
+  std::atomic<uint64_t>   uHead;            // Written by the logging thread
+  std::atomic<uint64_t>   uTail;            // Written by the drain thread
+  LogRecord               records[LOG_RING_MESSAGES];
+};
+
+
+// ---------------------------------------------------------------------------
+// Log
+// ---------------------------------------------------------------------------
+class Log {
+
+  public:
+
+    // Start and stop the drain thread.  stop() writes anything still queued.
+    static bool   start();
+    static void   stop();
+
+    // Messages above this level are discarded (default LOG_INFO)
+    static void   setLevel(unsigned int uLevel) { s_uLevel.store(uLevel, std::memory_order_relaxed); }
+
+    // Queue a printf-style message (use write(LOG_DEBUG, ...) for debug
+    // messages since utility.h defines a debug() macro)
+    static void   write(unsigned int uLevel, const char* sFormat, ...)
+                    __attribute__((format(printf, 2, 3)));
+
+    static void   error(const char* sFormat, ...) __attribute__((format(printf, 1, 2)));
+    static void   warn(const char* sFormat, ...) __attribute__((format(printf, 1, 2)));
+    static void   info(const char* sFormat, ...) __attribute__((format(printf, 1, 2)));
+
+    // Messages dropped because a ring was full
+    static uint64_t dropped() { return s_uDropped.load(std::memory_order_relaxed); }
+
+  private:
+
+    static std::atomic<unsigned int>  s_uLevel;
+    static std::atomic<bool>          s_bRunning;
+    static std::atomic<uint64_t>      s_uSequence;
+    static std::atomic<uint64_t>      s_uDropped;
+    static pthread_mutex_t            s_mutex;
+    static pthread_t                  s_thread;
+    static std::vector<LogRing*>      s_rings;
+    static __thread LogRing*          t_pRing;
+
+    static void   vwrite(unsigned int, const char*, va_list);
+    static void   drain(bool);
+    static void*  threadLoop(void*);
+};
+
+#endif // _LOG_H_
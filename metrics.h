@@ -0,0 +1,289 @@
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+// ---------------------------------------------------------------------------
+//
+// METRICS
+//
+// Process-wide registry of counters, gauges, and histograms that can be
+// exposed in the Prometheus text format, either on request (see the
+// "metrics" command of the controller) or by writing a file for the node
+// exporter's textfile collector.
+//
+// Registration takes a lock and should be done once, outside of hot paths.
+// The returned objects live until the process exits and are updated with
+// relaxed atomic operations, so any thread can update them without locking.
+// Each object is padded to its own cache line so that threads updating
+// different objects don't contend.
+//
+// Metrics are identified by name and label string, e.g.
+//
+//   MetricCounter* p = Metrics::counter("fastspec_pfb_spectra_total",
+//                                       "Spectra processed", "pfb=\"0\"");
+//   p->add();
+//
+// Registering the same name and labels again returns the same object.
+//
+// ---------------------------------------------------------------------------
+
+#define METRICS_CACHE_LINE 64
+
+
+// ---------------------------------------------------------------------------
+// MetricCounter -- Monotonically increasing count
+// ---------------------------------------------------------------------------
+class MetricCounter {
+
+  private:
+    std::atomic<uint64_t>   m_uValue;
+    char                    m_pad[METRICS_CACHE_LINE - sizeof(std::atomic<uint64_t>)];
+
+  public:
+    MetricCounter() : m_uValue(0) {}
+    void      add(uint64_t u = 1) { m_uValue.fetch_add(u, std::memory_order_relaxed); }
+    uint64_t  get() const { return m_uValue.load(std::memory_order_relaxed); }
+};
+
+
+// ---------------------------------------------------------------------------
+// MetricGauge -- Value that can go up and down.  setMax() keeps a high-water
+//                mark.
+// ---------------------------------------------------------------------------
+class MetricGauge {
+
+  private:
+    std::atomic<double>     m_dValue;
+    char                    m_pad[METRICS_CACHE_LINE - sizeof(std::atomic<double>)];
+
+  public:
+    MetricGauge() : m_dValue(0) {}
+    void      set(double d) { m_dValue.store(d, std::memory_order_relaxed); }
+    double    get() const { return m_dValue.load(std::memory_order_relaxed); }
+
+    void      setMax(double d) {
+      double dOld = m_dValue.load(std::memory_order_relaxed);
+      while ((d > dOld) &&
+             !m_dValue.compare_exchange_weak(dOld, d, std::memory_order_relaxed)) {}
+    }
+};
+
+
+// ---------------------------------------------------------------------------
+// MetricHistogram -- Counts of observations in buckets with fixed upper
+//                    bounds, plus the sum and count of all observations
+// ---------------------------------------------------------------------------
+class MetricHistogram {
+
+  private:
+    std::vector<double>     m_bounds;
+    std::atomic<uint64_t>*  m_pBuckets;       // One per bound plus +Inf
+    std::atomic<double>     m_dSum;
+    char                    m_pad[METRICS_CACHE_LINE];
+
+  public:
+    MetricHistogram(const std::vector<double>& bounds) : m_bounds(bounds), m_dSum(0) {
+      m_pBuckets = new std::atomic<uint64_t>[m_bounds.size() + 1];
+      for (unsigned int i=0; i<=m_bounds.size(); i++) {
+        m_pBuckets[i].store(0);
+      }
+    }
+
+    ~MetricHistogram() { delete[] m_pBuckets; }
+
+    void observe(double d) {
+      unsigned int i = 0;
+      while ((i < m_bounds.size()) && (d > m_bounds[i])) { i++; }
+      m_pBuckets[i].fetch_add(1, std::memory_order_relaxed);
+      double dOld = m_dSum.load(std::memory_order_relaxed);
+      while (!m_dSum.compare_exchange_weak(dOld, dOld + d, std::memory_order_relaxed)) {}
+    }
+
+    const std::vector<double>& bounds() const { return m_bounds; }
+    uint64_t  bucket(unsigned int i) const { return m_pBuckets[i].load(std::memory_order_relaxed); }
+    double    sum() const { return m_dSum.load(std::memory_order_relaxed); }
+
+    // Bucket bounds growing by a constant factor, e.g. exponential(1e-6, 4, 12)
+    static std::vector<double> exponential(double dStart, double dFactor, unsigned int uCount) {
+      std::vector<double> bounds;
+      for (unsigned int i=0; i<uCount; i++, dStart*=dFactor) {
+        bounds.push_back(dStart);
+      }
+      return bounds;
+    }
+};
+
+
+// ---------------------------------------------------------------------------
+// Metrics -- The registry
+// ---------------------------------------------------------------------------
+class Metrics {
+
+  private:
+
+    enum Type { COUNTER, GAUGE, HISTOGRAM };
+
+    struct Entry {
+      std::string         sName;
+      std::string         sHelp;
+      std::string         sLabels;
+      Type                type;
+      void*               pMetric;
+    };
+
+    pthread_mutex_t       m_mutex;
+    std::vector<Entry>    m_entries;
+
+    Metrics() { pthread_mutex_init(&m_mutex, NULL); }
+
+    static Metrics& instance() {
+      static Metrics metrics;
+      return metrics;
+    }
+
+    // Find or add an entry.  Returns the metric pointer.
+    void* find(const std::string& sName, const std::string& sHelp,
+               const std::string& sLabels, Type type,
+               const std::vector<double>* pBounds = NULL) {
+
+      void* pMetric = NULL;
+
+      pthread_mutex_lock(&m_mutex);
+
+      for (unsigned int i=0; i<m_entries.size(); i++) {
+        if ((m_entries[i].sName == sName) && (m_entries[i].sLabels == sLabels) &&
+            (m_entries[i].type == type)) {
+          pMetric = m_entries[i].pMetric;
+          break;
+        }
+      }
+
+      if (!pMetric) {
+        switch (type) {
+          case COUNTER: pMetric = new MetricCounter(); break;
+          case GAUGE: pMetric = new MetricGauge(); break;
+          case HISTOGRAM: pMetric = new MetricHistogram(*pBounds); break;
+        }
+
+        // Keep entries of the same name together so each family is
+        // exposed as one block
+        Entry entry = { sName, sHelp, sLabels, type, pMetric };
+        std::vector<Entry>::iterator it = m_entries.end();
+        for (unsigned int i=m_entries.size(); i>0; i--) {
+          if (m_entries[i-1].sName == sName) {
+            it = m_entries.begin() + i;
+            break;
+          }
+        }
+        m_entries.insert(it, entry);
+      }
+
+      pthread_mutex_unlock(&m_mutex);
+
+      return pMetric;
+    }
+
+    static std::string labelled(const std::string& sName, const std::string& sLabels,
+                                const std::string& sExtra = "") {
+      std::string s = sLabels;
+      if (!sExtra.empty()) {
+        s += (s.empty() ? "" : ",") + sExtra;
+      }
+      return s.empty() ? sName : sName + "{" + s + "}";
+    }
+
+  public:
+
+    static MetricCounter* counter(const std::string& sName, const std::string& sHelp,
+                                  const std::string& sLabels = "") {
+      return (MetricCounter*) instance().find(sName, sHelp, sLabels, COUNTER);
+    }
+
+    static MetricGauge* gauge(const std::string& sName, const std::string& sHelp,
+                              const std::string& sLabels = "") {
+      return (MetricGauge*) instance().find(sName, sHelp, sLabels, GAUGE);
+    }
+
+    static MetricHistogram* histogram(const std::string& sName, const std::string& sHelp,
+                                      const std::vector<double>& bounds,
+                                      const std::string& sLabels = "") {
+      return (MetricHistogram*) instance().find(sName, sHelp, sLabels, HISTOGRAM, &bounds);
+    }
+
+    // All metrics in the Prometheus text exposition format
+    static std::string expose() {
+
+      Metrics& m = instance();
+      std::ostringstream ss;
+      ss.precision(10);
+
+      pthread_mutex_lock(&m.m_mutex);
+
+      for (unsigned int i=0; i<m.m_entries.size(); i++) {
+
+        const Entry& e = m.m_entries[i];
+
+        if ((i == 0) || (m.m_entries[i-1].sName != e.sName)) {
+          ss << "# HELP " << e.sName << " " << e.sHelp << "\n";
+          ss << "# TYPE " << e.sName << " "
+             << ((e.type == COUNTER) ? "counter" : (e.type == GAUGE) ? "gauge" : "histogram")
+             << "\n";
+        }
+
+        if (e.type == COUNTER) {
+          ss << labelled(e.sName, e.sLabels) << " " << ((MetricCounter*) e.pMetric)->get() << "\n";
+        } else if (e.type == GAUGE) {
+          ss << labelled(e.sName, e.sLabels) << " " << ((MetricGauge*) e.pMetric)->get() << "\n";
+        } else {
+          MetricHistogram* pHist = (MetricHistogram*) e.pMetric;
+          uint64_t uCount = 0;
+          for (unsigned int b=0; b<=pHist->bounds().size(); b++) {
+            std::ostringstream le;
+            le.precision(6);
+            if (b < pHist->bounds().size()) {
+              le << "le=\"" << pHist->bounds()[b] << "\"";
+            } else {
+              le << "le=\"+Inf\"";
+            }
+            uCount += pHist->bucket(b);
+            ss << labelled(e.sName + "_bucket", e.sLabels, le.str()) << " " << uCount << "\n";
+          }
+          ss << labelled(e.sName + "_sum", e.sLabels) << " " << pHist->sum() << "\n";
+          ss << labelled(e.sName + "_count", e.sLabels) << " " << uCount << "\n";
+        }
+      }
+
+      pthread_mutex_unlock(&m.m_mutex);
+
+      return ss.str();
+    }
+
+    // Write all metrics to a file for the textfile collector.  The file is
+    // written under a temporary name and renamed so that a scraper never sees
+    // a partial file.
+    static bool writeFile(const std::string& sFilePath) {
+
+      std::string sTemp = sFilePath + ".tmp";
+      std::string s = expose();
+      FILE* pFile = fopen(sTemp.c_str(), "w");
+
+      if (!pFile) {
+        return false;
+      }
+
+      bool bReturn = (fwrite(s.c_str(), 1, s.size(), pFile) == s.size());
+      bReturn = (fclose(pFile) == 0) && bReturn;
+      bReturn = bReturn && (rename(sTemp.c_str(), sFilePath.c_str()) == 0);
+
+      return bReturn;
+    }
+};
+
+#endif // _METRICS_H_
@@ -0,0 +1,197 @@
+#include "numa.h"
+#include "thread_policy.h"
+#include <stdio.h>
+#include <string.h>       // strerror
+#include <dirent.h>
+#include <sched.h>        // cpu_set_t
+#include <unistd.h>       // sysconf
+#include <algorithm>      // sort
+
+using namespace std;
+
+#define NUMA_SYSFS_PATH   "/sys/devices/system/node"
+
+pthread_mutex_t               Numa::s_mutex = PTHREAD_MUTEX_INITIALIZER;
+std::vector< std::vector<int> > Numa::s_nodes;
+
+
+
+// ----------------------------------------------------------------------------
+// detect() -- Reads the CPU list of each node.  Called with the mutex held.
+// ----------------------------------------------------------------------------
+void Numa::detect()
+{
+  vector<unsigned int> ids;
+
+  if (!s_nodes.empty()) {
+    return;
+  }
+
+  DIR* pDir = opendir(NUMA_SYSFS_PATH);
+  if (pDir) {
+    struct dirent* pEntry;
+    while ((pEntry = readdir(pDir)) != NULL) {
+      unsigned int uId;
+      char cExtra;
+      if (sscanf(pEntry->d_name, "node%u%c", &uId, &cExtra) == 1) {
+        ids.push_back(uId);
+      }
+    }
+    closedir(pDir);
+  }
+
+  // Nodes are numbered in order, though the numbers can have gaps
+  std::sort(ids.begin(), ids.end());
+
+  for (unsigned int i=0; i<ids.size(); i++) {
+
+    char sPath[256];
+    char sList[4096];
+    vector<int> cpus;
+
+    snprintf(sPath, sizeof(sPath), NUMA_SYSFS_PATH "/node%u/cpulist", ids[i]);
+    FILE* pFile = fopen(sPath, "r");
+    if (!pFile) {
+      continue;
+    }
+    if (fgets(sList, sizeof(sList), pFile)) {
+      sList[strcspn(sList, "\n")] = '\0';
+      ThreadPolicy::parse(sList, cpus);
+    }
+    fclose(pFile);
+
+    // Memory-only nodes have no CPUs to run workers on
+    if (!cpus.empty()) {
+      s_nodes.push_back(cpus);
+    }
+  }
+
+  if (s_nodes.empty()) {
+    vector<int> cpus;
+    long iNumCPUs = sysconf(_SC_NPROCESSORS_CONF);
+    for (long i=0; i<iNumCPUs; i++) {
+      cpus.push_back((int) i);
+    }
+    s_nodes.push_back(cpus);
+  }
+}
+
+
+
+// ----------------------------------------------------------------------------
+// nodes()
+// ----------------------------------------------------------------------------
+unsigned int Numa::nodes()
+{
+  pthread_mutex_lock(&s_mutex);
+  detect();
+  unsigned int uNodes = s_nodes.size();
+  pthread_mutex_unlock(&s_mutex);
+
+  return uNodes;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// cpus() -- The list doesn't change once detected, so it can be returned
+//           by reference
+// ----------------------------------------------------------------------------
+const vector<int>& Numa::cpus(unsigned int uNode)
+{
+  pthread_mutex_lock(&s_mutex);
+  detect();
+  const vector<int>& cpus = s_nodes[uNode % s_nodes.size()];
+  pthread_mutex_unlock(&s_mutex);
+
+  return cpus;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// nodeOfCPU()
+// ----------------------------------------------------------------------------
+unsigned int Numa::nodeOfCPU(int iCPU)
+{
+  unsigned int uNode = 0;
+
+  pthread_mutex_lock(&s_mutex);
+  detect();
+  for (unsigned int n=0; n<s_nodes.size(); n++) {
+    if (std::find(s_nodes[n].begin(), s_nodes[n].end(), iCPU) != s_nodes[n].end()) {
+      uNode = n;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&s_mutex);
+
+  return uNode;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// bind()
+// ----------------------------------------------------------------------------
+bool Numa::bind(unsigned int uNode)
+{
+  const vector<int>& nodeCPUs = cpus(uNode);
+  cpu_set_t current;
+  cpu_set_t cpuset;
+  int iError;
+
+  CPU_ZERO(&current);
+  pthread_getaffinity_np(pthread_self(), sizeof(current), &current);
+
+  // Prefer the node's CPUs that the thread is already allowed to use
+  CPU_ZERO(&cpuset);
+  for (unsigned int i=0; i<nodeCPUs.size(); i++) {
+    if (CPU_ISSET(nodeCPUs[i], &current)) {
+      CPU_SET(nodeCPUs[i], &cpuset);
+    }
+  }
+
+  if (CPU_COUNT(&cpuset) == 0) {
+    for (unsigned int i=0; i<nodeCPUs.size(); i++) {
+      CPU_SET(nodeCPUs[i], &cpuset);
+    }
+  }
+
+  if ((iError = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset)) != 0) {
+    printf("Numa: Failed to bind thread to node %u: %s\n", uNode % nodes(), strerror(iError));
+    return false;
+  }
+
+  return true;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// report()
+// ----------------------------------------------------------------------------
+void Numa::report()
+{
+  pthread_mutex_lock(&s_mutex);
+  detect();
+  printf("Numa: %u node(s)\n", (unsigned int) s_nodes.size());
+  for (unsigned int n=0; n<s_nodes.size(); n++) {
+
+    // Print the CPUs as a list of ranges
+    const vector<int>& cpus = s_nodes[n];
+    string sCPUs;
+    for (unsigned int i=0; i<cpus.size(); i++) {
+      unsigned int j = i;
+      while ((j+1 < cpus.size()) && (cpus[j+1] == cpus[j] + 1)) {
+        j++;
+      }
+      sCPUs += (sCPUs.empty() ? "" : ",") + to_string(cpus[i]) + 
+        ((j > i) ? "-" + to_string(cpus[j]) : "");
+      i = j;
+    }
+
+    printf("Numa: Node %u has %u CPUs (%s)\n", n, (unsigned int) cpus.size(), sCPUs.c_str());
+  }
+  pthread_mutex_unlock(&s_mutex);
+}
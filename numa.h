@@ -0,0 +1,52 @@
+#ifndef _NUMA_H_
+#define _NUMA_H_
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+// ---------------------------------------------------------------------------
+//
+// NUMA
+//
+// Memory topology of the machine, read from /sys/devices/system/node on
+// first use.  Machines without that directory (or a kernel without NUMA
+// support) are treated as one node with every configured CPU.
+//
+// Memory is placed without libnuma by relying on the kernel's first-touch
+// policy: a page lands on the node of the CPU that first writes it.  A
+// thread bound to a node with bind() therefore allocates node-local memory
+// as long as it writes each block itself before use (see Buffer::allocate).
+//
+// ---------------------------------------------------------------------------
+
+class Numa {
+
+  public:
+
+    // Number of memory nodes (at least 1)
+    static unsigned int             nodes();
+
+    // CPUs of a node
+    static const std::vector<int>&  cpus(unsigned int uNode);
+
+    // Node of a CPU, or 0 if it isn't listed
+    static unsigned int             nodeOfCPU(int iCPU);
+
+    // Keep the calling thread on the CPUs of a node.  If the thread is
+    // already limited to some of them (e.g. by ThreadPolicy), it stays on
+    // those.  Returns false if the affinity can't be set.
+    static bool                     bind(unsigned int uNode);
+
+    // Print the nodes and their CPUs
+    static void                     report();
+
+  private:
+
+    static pthread_mutex_t                  s_mutex;
+    static std::vector< std::vector<int> >  s_nodes;
+
+    static void   detect();
+};
+
+#endif // _NUMA_H_
@@ -0,0 +1,96 @@
+#include "overload.h"
+#include <stdio.h>
+#include "log.h"
+
+
+
+// ----------------------------------------------------------------------------
+// Constructor
+// ----------------------------------------------------------------------------
+OverloadController::OverloadController(unsigned int uRunBlocks, unsigned int uMaxFactor)
+{
+  m_uRunBlocks = (uRunBlocks < 1) ? 1 : uRunBlocks;
+  m_uMaxFactor = (uMaxFactor < 1) ? 1 : uMaxFactor;
+  m_uFactor = 1;
+  m_uBlock = 0;
+  m_uRun = 0;
+  m_uCalmRuns = 0;
+  m_bProcess = true;
+  m_uSkippedRuns = 0;
+
+  m_pFactorMetric = Metrics::gauge("fastspec_overload_factor",
+    "One in this many runs of blocks is processed (1 when not overloaded)");
+  m_pFactorMetric->set(m_uFactor);
+  m_pSkippedMetric = Metrics::counter("fastspec_overload_skipped_samples_total",
+    "Samples skipped on purpose to relieve the channelizer");
+
+  printf("Overload: Runs of %u blocks, up to 1 in %u skipped when the "
+    "channelizer falls behind\n", m_uRunBlocks, m_uMaxFactor);
+}
+
+
+
+// ----------------------------------------------------------------------------
+// plan -- Adjusts the decimation factor for the buffer fill at the start of a
+//         run and decides whether the run is processed
+// ----------------------------------------------------------------------------
+void OverloadController::plan(double dFill)
+{
+  unsigned int uFactor = m_uFactor;
+
+  if (dFill > OVERLOAD_HIGH_FILL) {
+    m_uCalmRuns = 0;
+    if (m_uFactor < m_uMaxFactor) {
+      m_uFactor = (2 * m_uFactor < m_uMaxFactor) ? 2 * m_uFactor : m_uMaxFactor;
+    }
+  } else if (dFill < OVERLOAD_LOW_FILL) {
+    if ((m_uFactor > 1) && (++m_uCalmRuns >= OVERLOAD_CALM_RUNS)) {
+      m_uCalmRuns = 0;
+      m_uFactor /= 2;
+    }
+  } else {
+    m_uCalmRuns = 0;
+  }
+
+  if (m_uFactor != uFactor) {
+    m_pFactorMetric->set(m_uFactor);
+    if (m_uFactor == 1) {
+      Log::info("Overload: Buffer %.0f%% full, processing every run again\n", 100*dFill);
+    } else {
+      Log::info("Overload: Buffer %.0f%% full, processing 1 in %u runs\n", 100*dFill, m_uFactor);
+    }
+
+    // Process the first run at the new factor
+    m_uRun = 0;
+  }
+
+  m_bProcess = (m_uRun % m_uFactor == 0);
+  if (!m_bProcess) {
+    m_uSkippedRuns++;
+  }
+}
+
+
+
+// ----------------------------------------------------------------------------
+// admit
+// ----------------------------------------------------------------------------
+bool OverloadController::admit(Channelizer* pChannelizer, unsigned int uLength)
+{
+  if (m_uBlock == 0) {
+    plan(pChannelizer->fill());
+  }
+
+  bool bProcess = m_bProcess;
+
+  if (++m_uBlock == m_uRunBlocks) {
+    m_uBlock = 0;
+    m_uRun++;
+  }
+
+  if (!bProcess) {
+    m_pSkippedMetric->add(uLength);
+  }
+
+  return bProcess;
+}
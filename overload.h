@@ -0,0 +1,80 @@
+#ifndef _OVERLOAD_H_
+#define _OVERLOAD_H_
+
+#include "channelizer.h"
+#include "metrics.h"
+
+// ---------------------------------------------------------------------------
+//
+// OverloadController
+//
+// Plans which blocks to skip when the channelizer can't keep up, instead of
+// letting the buffer fill and drop blocks wherever a push happens to fail.
+// Random drops cut the sample stream into many short pieces, and every gap
+// costs the spectra whose taps reach across it, so the spectra lost to a
+// drop fraction can be several times that fraction.
+//
+// The sample stream is divided into runs of a fixed number of blocks (at
+// least taps + 1, so each run yields spectra).  In decimation factor k only
+// every k-th run is pushed and the others are skipped whole, so there is one
+// gap per k runs and each processed run gives its full share of spectra.
+//
+// At the start of each run the controller reads how full the channelizer's
+// buffer is.  Above OVERLOAD_HIGH_FILL the factor doubles (up to the
+// maximum).  Below OVERLOAD_LOW_FILL for OVERLOAD_CALM_RUNS runs in a row it
+// halves again, down to 1 (every run processed).  Each change is logged and
+// the factor is published in fastspec_overload_factor.
+//
+// Skipped samples aren't drops.  They are counted separately (see
+// Accumulator::addSkips() and fastspec_overload_skipped_samples_total) so
+// the drop fraction still flags blocks that were lost unplanned.  The
+// integration actually achieved is the number of spectra accumulated, which
+// is recorded with each accumulation as before.
+//
+// Only called from the thread that pushes to the channelizer.
+//
+// ---------------------------------------------------------------------------
+
+#define OVERLOAD_HIGH_FILL      0.75
+#define OVERLOAD_LOW_FILL       0.25
+#define OVERLOAD_CALM_RUNS      16
+
+class OverloadController {
+
+  private:
+
+    // Member variables
+    unsigned int      m_uRunBlocks;
+    unsigned int      m_uMaxFactor;
+    unsigned int      m_uFactor;        // Every m_uFactor-th run is processed
+    unsigned int      m_uBlock;         // Position in the current run
+    unsigned long     m_uRun;
+    unsigned int      m_uCalmRuns;
+    bool              m_bProcess;       // Current run is pushed
+    unsigned long     m_uSkippedRuns;
+    MetricGauge*      m_pFactorMetric;
+    MetricCounter*    m_pSkippedMetric;
+
+    // Private helper functions
+    void              plan(double);
+
+  public:
+
+    // Constructor and destructor
+    OverloadController( unsigned int, unsigned int );
+    ~OverloadController() {}
+
+    // Called for each block (of the given number of samples) before it is
+    // pushed.  Returns false if the block should be skipped.
+    bool              admit(Channelizer*, unsigned int);
+
+    // Starts a new run at the next block (e.g. after the acquisition
+    // restarts).  The factor is kept.
+    void              restart() { m_uBlock = 0; }
+
+    unsigned int      factor() const { return m_uFactor; }
+    unsigned int      runBlocks() const { return m_uRunBlocks; }
+    unsigned long     skippedRuns() const { return m_uSkippedRuns; }
+};
+
+#endif // _OVERLOAD_H_
@@ -2,44 +2,178 @@
 #include <algorithm>
 #include <stdlib.h>
 #include <unistd.h>
+#include <math.h>         // lround, fabs, log10
+#include <cmath>          // std::nearbyint
+#include <limits>
+#include <type_traits>
 #include "pfb.h"
 #include "utility.h"
+#include "trace.h"
+#include "log.h"
+#include "thread_policy.h"
+#include "numa.h"
+#include "arena.h"
 
 
 
 #define THREAD_SLEEP_MICROSECONDS 5
+#define PFB_SCALE_SECONDS         0.25
+#define PFB_SCALE_UP_FILL         0.5
+#define PFB_SCALE_DOWN_FILL       0.1
+#define PFB_SCALE_DOWN_CHECKS     8
 
 
 
 // ----------------------------------------------------------------------------
-// Constructor
+// Constructor -- Creates a PFB with its own buffer of uNumBuffers blocks, each
+//                one FFT long.
 // ----------------------------------------------------------------------------
-PFB::PFB( unsigned int uNumThreads, unsigned int uNumBuffers, 
-          unsigned int uNumChannels, unsigned int uNumTaps, 
-          unsigned int uWindow, bool bReturnInOrder)
+template<typename T>
+PFB<T>::PFB( unsigned int uNumThreads, unsigned int uNumBuffers, 
+             unsigned int uNumChannels, unsigned int uNumTaps, 
+             unsigned int uWindow, bool bReturnInOrder, bool bComplex, 
+             int iNode)
+{
+  m_uNumBuffers = uNumBuffers;
+  m_pBuffer = &m_buffer;
+  m_uReader = 0;
+
+  // Create buffers
+  printf("\nPFB: Creating %d buffers (%g MB)...\n", m_uNumBuffers, 
+    ((float) m_uNumBuffers)*2*uNumChannels*sizeof(T)/1024/1024);
+  m_buffer.allocate(m_uNumBuffers, 2*uNumChannels, iNode);
+
+  init(uNumThreads, uNumChannels, uNumTaps, uWindow, bReturnInOrder, bComplex, 
+       iNode);
+}
+
+
+
+// ----------------------------------------------------------------------------
+// Constructor -- Creates a PFB that reads from a buffer shared with other 
+//                readers.  The buffer must already be allocated and its block
+//                length must be a multiple of the FFT length (2*uNumChannels).
+//                Data should be pushed to the shared buffer by its owner 
+//                rather than through this PFB.
+// ----------------------------------------------------------------------------
+template<typename T>
+PFB<T>::PFB( Buffer<T>* pBuffer, unsigned int uReader, unsigned int uNumThreads, 
+             unsigned int uNumChannels, unsigned int uNumTaps, 
+             unsigned int uWindow, bool bReturnInOrder, bool bComplex, 
+             int iNode)
+{
+  m_uNumBuffers = 0;
+  m_pBuffer = pBuffer;
+  m_uReader = uReader;
+
+  init(uNumThreads, uNumChannels, uNumTaps, uWindow, bReturnInOrder, bComplex, 
+       iNode);
+}
+
+
+
+// ----------------------------------------------------------------------------
+// init -- Configuration shared by both constructors.  Spawns the threads.
+// ----------------------------------------------------------------------------
+template<typename T>
+void PFB<T>::init( unsigned int uNumThreads, unsigned int uNumChannels, 
+                   unsigned int uNumTaps, unsigned int uWindow, 
+                   bool bReturnInOrder, bool bComplex, int iNode)
 {
   m_uNumTaps = uNumTaps;
   m_uNumThreads = uNumThreads;
-  m_uNumBuffers = uNumBuffers;
   m_uNumChannels = uNumChannels;
   m_uNumFFT = 2*m_uNumChannels;
-  m_uNumSamples = m_uNumTaps*m_uNumFFT;
+  m_uStartChannel = 0;
+  m_uStopChannel = m_uNumChannels;
+  m_bComplex = bComplex;
+
+  // One window coefficient per sample (real) or per I/Q pair (complex)
+  m_uNumSamples = m_uNumTaps * (m_bComplex ? m_uNumChannels : m_uNumFFT);
   m_pReceiver = NULL;
   m_bStop = false;
   m_bReturnInOrder = bReturnInOrder;
+  m_bSecondMoment = false;
+  m_uNextIndex = 0;
+  m_uLostSpectra = 0;
+  m_uId = 0;
+  m_iNode = iNode;
+
+  // With two inputs, each block holds the frames of input A followed by
+  // those of input B (see Buffer::setInputs)
+  unsigned int uBufferInputs = m_pBuffer->inputs();
+  m_uInputs = m_bComplex ? 1 : uBufferInputs;
+  if (m_uInputs < uBufferInputs) {
+    printf("PFB: Complex PFB only channelizes the first of %u inputs\n", uBufferInputs);
+  }
+
+  // Each buffer block holds one or more FFT frames.  A request needs enough
+  // blocks for every frame in the first block to have all of its taps.
+  m_uFramesPerBlock = m_pBuffer->itemLength() / uBufferInputs / m_uNumFFT;
+  if ((m_uFramesPerBlock == 0) || (m_pBuffer->itemLength() % (uBufferInputs * m_uNumFFT) != 0)) {
+    printf("PFB: Buffer block length %u is not a multiple of %u FFT lengths of %u\n", 
+      m_pBuffer->itemLength(), uBufferInputs, m_uNumFFT);
+    m_uFramesPerBlock = 1;
+  }
+  m_uBlocksPerRequest = 1 + (m_uFramesPerBlock + m_uNumTaps - 2) / m_uFramesPerBlock;
+
+  // Pick the tap kernel
+  switch (m_uNumTaps) {
+    case 1:  m_pWeightTaps = m_bComplex ? &PFB::weightTaps<1, true> : &PFB::weightTaps<1, false>; break;
+    case 3:  m_pWeightTaps = m_bComplex ? &PFB::weightTaps<3, true> : &PFB::weightTaps<3, false>; break;
+    case 4:  m_pWeightTaps = m_bComplex ? &PFB::weightTaps<4, true> : &PFB::weightTaps<4, false>; break;
+    case 5:  m_pWeightTaps = m_bComplex ? &PFB::weightTaps<5, true> : &PFB::weightTaps<5, false>; break;
+    case 8:  m_pWeightTaps = m_bComplex ? &PFB::weightTaps<8, true> : &PFB::weightTaps<8, false>; break;
+    default: m_pWeightTaps = m_bComplex ? &PFB::weightTaps<0, true> : &PFB::weightTaps<0, false>; break;
+  }
+
+  // Fixed-point taps are off until setFixedPoint
+  m_bFixedPoint = false;
+  m_pWindowFixed = NULL;
+  m_pWindowSum = NULL;
+  m_dWindowScale = 1;
+  switch (m_uNumTaps) {
+    case 1:  m_pWeightTapsFixed = &PFB::weightTapsFixed<1>; break;
+    case 3:  m_pWeightTapsFixed = &PFB::weightTapsFixed<3>; break;
+    case 4:  m_pWeightTapsFixed = &PFB::weightTapsFixed<4>; break;
+    case 5:  m_pWeightTapsFixed = &PFB::weightTapsFixed<5>; break;
+    case 8:  m_pWeightTapsFixed = &PFB::weightTapsFixed<8>; break;
+    default: m_pWeightTapsFixed = &PFB::weightTapsFixed<0>; break;
+  }
+
+  // No voltage output until setVoltageOutput
+  m_uVoltageBits = 0;
+  m_pVoltageGains = NULL;
+  m_pFlagger = NULL;
 
   // Allocate space for window function
   m_pWindow = NULL;
   setWindowFunction(uWindow);
 
-  // Create buffers
-  printf("\nPFB: Creating %d buffers (%g MB)...\n", m_uNumBuffers, 
-    ((float) m_uNumBuffers)*m_uNumFFT*sizeof(BUFFER_DATA_TYPE)/1024/1024);
-  m_buffer.allocate(m_uNumBuffers, m_uNumFFT);
-
   // Initialize the mutexes
   pthread_mutex_init(&m_mutexCallback, NULL);
   pthread_mutex_init(&m_mutexPlan, NULL);
+  pthread_mutex_init(&m_mutexStatus, NULL);
+  pthread_mutex_init(&m_mutexPark, NULL);
+  pthread_cond_init(&m_condPark, NULL);
+
+  // All threads are active until setMinThreads
+  m_uMinThreads = m_uNumThreads;
+  m_uActiveThreads = m_uNumThreads;
+  m_uLowChecks = 0;
+  m_scaleTimer.tic();
+
+  // Busy time of each thread for status reports
+  m_pBusy = (double*) calloc(m_uNumThreads, sizeof(double));
+  m_statusTimer.tic();
+
+  // No metrics until setId
+  m_pSpectraMetric = NULL;
+  m_pLostMetric = NULL;
+  m_pClippedMetric = NULL;
+  m_pActiveMetric = NULL;
+  m_pScaleUpMetric = NULL;
+  m_pScaleDownMetric = NULL;
 
   // Allocate space for thread handles
   printf("PFB: Creating %d threads...\n", m_uNumThreads);
@@ -69,10 +203,14 @@ PFB::PFB( unsigned int uNumThreads, unsigned int uNumBuffers,
 // ----------------------------------------------------------------------------
 // Destructor
 // ----------------------------------------------------------------------------
-PFB::~PFB()
+template<typename T>
+PFB<T>::~PFB()
 {
-  // Join all of our threads back to us
+  // Join all of our threads back to us (waking any that are parked)
+  pthread_mutex_lock(&m_mutexPark);
   m_bStop = true;
+  pthread_cond_broadcast(&m_condPark);
+  pthread_mutex_unlock(&m_mutexPark);
   
   for (unsigned int i=0; i<m_uNumThreads; i++) {
     pthread_join(m_pThreads[i], NULL);
@@ -84,11 +222,19 @@ PFB::~PFB()
   // Destroy the mutexes
   pthread_mutex_destroy(&m_mutexCallback);
   pthread_mutex_destroy(&m_mutexPlan);
+  pthread_mutex_destroy(&m_mutexStatus);
+  pthread_mutex_destroy(&m_mutexPark);
+  pthread_cond_destroy(&m_condPark);
+
+  free(m_pBusy);
 
   // Free with the window array
   if (m_pWindow != NULL) {
     free(m_pWindow);
   }
+  free(m_pWindowFixed);
+  free(m_pWindowSum);
+  free(m_pVoltageGains);
 }
 
 
@@ -96,23 +242,479 @@ PFB::~PFB()
 // ----------------------------------------------------------------------------
 // setCallback
 // ----------------------------------------------------------------------------
-void PFB::setCallback(ChannelizerReceiver* pReceiver)
+template<typename T>
+void PFB<T>::setCallback(ChannelizerReceiver* pReceiver)
 {
   m_pReceiver = pReceiver;
 }
 
 
 
+// ----------------------------------------------------------------------------
+// setFlagger -- Flags RFI in each spectrum before it is passed to the 
+//               receiver (NULL to stop).  The flagger must outlive the PFB.
+//               Should be set before data is pushed.
+// ----------------------------------------------------------------------------
+template<typename T>
+void PFB<T>::setFlagger(SpectrumFlagger* pFlagger)
+{
+  m_pFlagger = pFlagger;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setSecondMoment -- When enabled, each spectrum delivered to the callback
+//                    also carries the power squared in each channel so that
+//                    receivers can accumulate the second moment (e.g. for
+//                    spectral kurtosis).  Should be set before data is pushed.
+// ----------------------------------------------------------------------------
+template<typename T>
+void PFB<T>::setSecondMoment(bool bEnable)
+{
+  m_bSecondMoment = bEnable;
+  
+  if (m_bSecondMoment) {
+    printf("PFB: Calculating power squared (second moment) for each spectrum\n");
+  }
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setMinThreads -- Makes the thread pool elastic between uMin and the number
+//                  of threads the PFB was created with.  Starts with uMin
+//                  active threads.  A uMin of 0 or at least the number of
+//                  threads keeps all of them active.
+// ----------------------------------------------------------------------------
+template<typename T>
+void PFB<T>::setMinThreads(unsigned int uMin)
+{
+  if ((uMin == 0) || (uMin > m_uNumThreads)) {
+    uMin = m_uNumThreads;
+  }
+
+  pthread_mutex_lock(&m_mutexPark);
+  m_uMinThreads = uMin;
+  m_uActiveThreads = uMin;
+  m_uLowChecks = 0;
+  m_scaleTimer.tic();
+  pthread_mutex_unlock(&m_mutexPark);
+
+  if (m_pActiveMetric) {
+    m_pActiveMetric->set(uMin);
+  }
+
+  if (m_uMinThreads < m_uNumThreads) {
+    printf("PFB: Using %u to %u threads as needed\n", m_uMinThreads, m_uNumThreads);
+  }
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setFixedPoint -- Sums the taps of 16 bit sample codes in integers (see
+//                  pfb.h).  Only for a real PFB.  The buffer must be raw, 
+//                  which is set here if the PFB owns it.  Should be set 
+//                  before data is pushed.
+// ----------------------------------------------------------------------------
+template<typename T>
+bool PFB<T>::setFixedPoint(bool bEnable)
+{
+  if (bEnable) {
+
+    if (m_bComplex) {
+      printf("PFB: Fixed-point taps need real samples\n");
+      return false;
+    }
+
+    if (m_uNumTaps > PFB_FIXED_MAX_TAPS) {
+      printf("PFB: Fixed-point taps support up to %u taps\n", PFB_FIXED_MAX_TAPS);
+      return false;
+    }
+
+    if ((m_pBuffer == &m_buffer) && !m_buffer.setRaw(true)) {
+      return false;
+    }
+
+    if (!m_pBuffer->raw()) {
+      printf("PFB: Fixed-point taps need a raw buffer\n");
+      return false;
+    }
+
+    if (!quantizeWindow()) {
+      return false;
+    }
+
+    printf("PFB: Summing taps in fixed point (window scale %.3g)\n", m_dWindowScale);
+
+  } else if (m_pBuffer == &m_buffer) {
+    m_buffer.setRaw(false);
+  }
+
+  m_bFixedPoint = bEnable;
+  return true;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setVoltageOutput -- Passes the complex spectrum to the receiver with each 
+//                     power spectrum (see pfb.h) with uBits per part: 8 or 16
+//                     for integers, 32 or 64 for floating point, or 0 to turn 
+//                     it off.  Integers are multiplied by the gains first, 
+//                     one for all channels or one per channel (of the FFT, 
+//                     not just the output channels).  Should be set before 
+//                     data is pushed.
+// ----------------------------------------------------------------------------
+template<typename T>
+bool PFB<T>::setVoltageOutput(unsigned int uBits, const std::vector<float>& gains)
+{
+  if ((uBits != 0) && (uBits != 8) && (uBits != 16) && (uBits != 32) && (uBits != 64)) {
+    printf("PFB: Voltage output can't have %u bits (use 8, 16, 32 or 64)\n", uBits);
+    return false;
+  }
+
+  if ((uBits == 8) || (uBits == 16)) {
+
+    if ((gains.size() != 1) && (gains.size() != m_uNumChannels)) {
+      printf("PFB: Need 1 or %u voltage gains, not %u\n", m_uNumChannels, 
+        (unsigned int) gains.size());
+      return false;
+    }
+
+    if (m_pVoltageGains == NULL) {
+      m_pVoltageGains = (float*) malloc(m_uNumChannels * sizeof(float));
+      if (m_pVoltageGains == NULL) {
+        printf("PFB: Failed to allocate memory for voltage gains\n");
+        return false;
+      }
+    }
+
+    for (unsigned int i=0; i<m_uNumChannels; i++) {
+      m_pVoltageGains[i] = (gains.size() == 1) ? gains[0] : gains[i];
+    }
+  }
+
+  m_uVoltageBits = uBits;
+
+  if (uBits > 0) {
+    printf("PFB: Passing on the complex spectrum as %u bit %s\n", uBits, 
+      (uBits < 32) ? "integers" : "floating point");
+  }
+
+  return true;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// packVoltage -- Returns the complex spectrum of the output channels in the
+//                format set by setVoltageOutput, in place in the FFT output
+//                if it needs no conversion or in pOut otherwise.  Adds the
+//                number of clipped parts to uClipped.
+// ----------------------------------------------------------------------------
+template<typename T>
+void* PFB<T>::packVoltage(Complex* pSpectrum, void* pOut, unsigned int& uClipped)
+{
+  switch (m_uVoltageBits) {
+    case 8:  uClipped += packVoltage(pSpectrum, (int8_t*) pOut); break;
+    case 16: uClipped += packVoltage(pSpectrum, (int16_t*) pOut); break;
+    case 32: 
+      if (!m_bComplex && (std::is_same<T, float>::value)) {
+        return pSpectrum + m_uStartChannel;
+      }
+      packVoltage(pSpectrum, (float*) pOut); 
+      break;
+    case 64: 
+      if (!m_bComplex && (std::is_same<T, double>::value)) {
+        return pSpectrum + m_uStartChannel;
+      }
+      packVoltage(pSpectrum, (double*) pOut); 
+      break;
+    default:
+      return NULL;
+  }
+
+  return pOut;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// packVoltage -- Converts the output channels to V in pOut (in complex mode
+//                with the negative frequencies first, like the power).  
+//                Returns the number of clipped parts.
+// ----------------------------------------------------------------------------
+template<typename T>
+template<typename V>
+unsigned int PFB<T>::packVoltage(Complex* pSpectrum, V* pOut)
+{
+  unsigned int uNumOut = m_uStopChannel - m_uStartChannel;
+  unsigned int uHalf = m_uNumChannels / 2;
+  unsigned int uClipped = 0;
+
+  for (unsigned int n=0; n<uNumOut; n++) {
+
+    unsigned int i = m_uStartChannel + n;
+    unsigned int k = i;
+    if (m_bComplex) {
+      k = (i < uHalf) ? i + (m_uNumChannels - uHalf) : i - uHalf;
+    }
+
+    if constexpr (std::is_integral<V>::value) {
+      const T fMax = std::numeric_limits<V>::max();
+      T fGain = m_pVoltageGains[i];
+      for (unsigned int p=0; p<2; p++) {
+        T f = std::nearbyint(pSpectrum[k][p] * fGain);
+        if (f > fMax) {
+          f = fMax;
+          uClipped++;
+        } else if (f < -fMax) {
+          f = -fMax;
+          uClipped++;
+        }
+        pOut[2*n+p] = (V) f;
+      }
+    } else {
+      pOut[2*n] = (V) pSpectrum[k][0];
+      pOut[2*n+1] = (V) pSpectrum[k][1];
+    }
+  }
+
+  return uClipped;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// quantizeWindow -- Converts the window to int16 coefficients for the fixed-
+//                   point taps.  The scale is chosen so each coefficient fits
+//                   and the magnitudes summed over the taps of any sample
+//                   stay within PFB_FIXED_WINDOW_SUM after rounding (which
+//                   can add 0.5 per tap, so the scale leaves one per tap).
+// ----------------------------------------------------------------------------
+template<typename T>
+bool PFB<T>::quantizeWindow()
+{
+  unsigned int uWindowLength = m_uNumSamples / m_uNumTaps;
+  unsigned int i;
+  unsigned int t;
+
+  if (m_pWindowFixed == NULL) {
+    m_pWindowFixed = (int16_t*) malloc(m_uNumSamples * sizeof(int16_t));
+    m_pWindowSum = (T*) malloc(uWindowLength * sizeof(T));
+    if ((m_pWindowFixed == NULL) || (m_pWindowSum == NULL)) {
+      printf("PFB: Failed to allocate memory for fixed-point window function\n");
+      return false;
+    }
+  }
+
+  double dMaxSum = 0;
+  double dMaxAbs = 0;
+  for (i=0; i<uWindowLength; i++) {
+    double dSum = 0;
+    for (t=0; t<m_uNumTaps; t++) {
+      double dAbs = fabs(m_pWindow[t * uWindowLength + i]);
+      dSum += dAbs;
+      dMaxAbs = (dAbs > dMaxAbs) ? dAbs : dMaxAbs;
+    }
+    dMaxSum = (dSum > dMaxSum) ? dSum : dMaxSum;
+  }
+
+  m_dWindowScale = max(dMaxSum / (PFB_FIXED_WINDOW_SUM - m_uNumTaps), dMaxAbs / 32767);
+  if (m_dWindowScale <= 0) {
+    m_dWindowScale = 1;
+  }
+
+  for (i=0; i<m_uNumSamples; i++) {
+    m_pWindowFixed[i] = (int16_t) lround(m_pWindow[i] / m_dWindowScale);
+  }
+
+  // The offset of the codes is weighted by the quantized window, so the
+  // fixed-point sum matches the floating point one for a constant input
+  for (i=0; i<uWindowLength; i++) {
+    long iSum = 0;
+    for (t=0; t<m_uNumTaps; t++) {
+      iSum += m_pWindowFixed[t * uWindowLength + i];
+    }
+    m_pWindowSum[i] = (T) (iSum * m_dWindowScale);
+  }
+
+  return true;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// printFixedPointError -- Prints the signal to noise ratio of the fixed-point
+//                         and floating point tap sums, each against a double
+//                         precision sum of the same codes.  Uniform noise at
+//                         full scale and at -40 dBFS shows the dynamic range
+//                         the quantized window leaves.
+// ----------------------------------------------------------------------------
+template<typename T>
+void PFB<T>::printFixedPointError()
+{
+  if (m_pWindowFixed == NULL) {
+    return;
+  }
+
+  unsigned int uWindowLength = m_uNumSamples / m_uNumTaps;
+  unsigned int uSeed = 1;
+  int16_t* pCodes = (int16_t*) malloc(m_uNumSamples * sizeof(int16_t));
+  if (pCodes == NULL) {
+    return;
+  }
+
+  const int levels[] = { 32767, 327 };
+  for (int iLevel : levels) {
+
+    for (unsigned int i=0; i<m_uNumSamples; i++) {
+      pCodes[i] = (int16_t) ((int) (rand_r(&uSeed) % (2 * iLevel + 1)) - iLevel);
+    }
+
+    double dSignal = 0;
+    double dFixedError = 0;
+    double dFloatError = 0;
+    for (unsigned int i=0; i<uWindowLength; i++) {
+      double dExact = 0;
+      int32_t iFixed = 0;
+      T fFloat = 0;
+      for (unsigned int t=0; t<m_uNumTaps; t++) {
+        unsigned int n = t * uWindowLength + i;
+        dExact += pCodes[n] * (double) m_pWindow[n];
+        iFixed += (int32_t) pCodes[n] * m_pWindowFixed[n];
+        fFloat += ((T) pCodes[n]) * m_pWindow[n];
+      }
+      double dFixed = iFixed * m_dWindowScale;
+      dSignal += dExact * dExact;
+      dFixedError += (dFixed - dExact) * (dFixed - dExact);
+      dFloatError += (fFloat - dExact) * (fFloat - dExact);
+    }
+
+    printf("PFB: pfb%u tap sums at %5.1f dBFS have SNR %.1f dB fixed point, "
+           "%.1f dB floating point\n", m_uId, 20 * log10(iLevel / 32767.0),
+           (dFixedError > 0) ? 10 * log10(dSignal / dFixedError) : INFINITY,
+           (dFloatError > 0) ? 10 * log10(dSignal / dFloatError) : INFINITY);
+  }
+
+  free(pCodes);
+}
+
+
+
+// ----------------------------------------------------------------------------
+// scale -- Wakes or parks a thread depending on how full the buffer is for
+//          us.  Called by the first thread, which is never parked.
+// ----------------------------------------------------------------------------
+template<typename T>
+void PFB<T>::scale()
+{
+  if ((m_uMinThreads == m_uNumThreads) || (m_scaleTimer.toc() < PFB_SCALE_SECONDS)) {
+    return;
+  }
+  m_scaleTimer.tic();
+
+  double dFill = ((double) m_pBuffer->pending(m_uReader)) / m_pBuffer->capacity();
+  unsigned int uActive = m_uActiveThreads;
+
+  if (dFill > PFB_SCALE_UP_FILL) {
+
+    m_uLowChecks = 0;
+    if (uActive < m_uNumThreads) {
+      pthread_mutex_lock(&m_mutexPark);
+      m_uActiveThreads = ++uActive;
+      pthread_cond_broadcast(&m_condPark);
+      pthread_mutex_unlock(&m_mutexPark);
+      if (m_pScaleUpMetric) {
+        m_pScaleUpMetric->add();
+      }
+      Log::info("PFB: pfb%u buffer %.0f%% full, waking thread (%u of %u active)\n",
+        m_uId, 100*dFill, uActive, m_uNumThreads);
+    }
+
+  } else if (dFill < PFB_SCALE_DOWN_FILL) {
+
+    // Shrink slowly so a short lull doesn't park threads needed again soon
+    if ((++m_uLowChecks >= PFB_SCALE_DOWN_CHECKS) && (uActive > m_uMinThreads)) {
+      m_uLowChecks = 0;
+      m_uActiveThreads = --uActive;
+      if (m_pScaleDownMetric) {
+        m_pScaleDownMetric->add();
+      }
+      Log::info("PFB: pfb%u buffer %.0f%% full, parking thread (%u of %u active)\n",
+        m_uId, 100*dFill, uActive, m_uNumThreads);
+    }
+
+  } else {
+    m_uLowChecks = 0;
+  }
+
+  if (m_pActiveMetric) {
+    m_pActiveMetric->set(uActive);
+  }
+}
+
+
+
+// ----------------------------------------------------------------------------
+// park -- Blocks thread uThread while it is not one of the active threads.
+//         Returns true if it was parked.
+// ----------------------------------------------------------------------------
+template<typename T>
+bool PFB<T>::park(unsigned int uThread)
+{
+  if (uThread < m_uActiveThreads) {
+    return false;
+  }
+
+  pthread_mutex_lock(&m_mutexPark);
+  while (!m_bStop && (uThread >= m_uActiveThreads)) {
+    pthread_cond_wait(&m_condPark, &m_mutexPark);
+  }
+  pthread_mutex_unlock(&m_mutexPark);
+
+  return true;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setOutputChannels -- Only detect and pass on channels uStart up to (but not
+//                      including) uStop.  Should be set before data is pushed.
+// ----------------------------------------------------------------------------
+template<typename T>
+bool PFB<T>::setOutputChannels(unsigned int uStart, unsigned int uStop)
+{
+  if ((uStart >= uStop) || (uStop > m_uNumChannels)) {
+    printf("PFB: Invalid output channel range %u to %u (of %u channels)\n", 
+      uStart, uStop, m_uNumChannels);
+    return false;
+  }
+
+  m_uStartChannel = uStart;
+  m_uStopChannel = uStop;
+
+  printf("PFB: Output limited to channels %u to %u\n", m_uStartChannel, 
+    m_uStopChannel - 1);
+  
+  return true;
+}
+
+
+
 // ----------------------------------------------------------------------------
 // setWindowFunction - 
 //     
 // ----------------------------------------------------------------------------
-bool PFB::setWindowFunction(unsigned int uType)
+template<typename T>
+bool PFB<T>::setWindowFunction(unsigned int uType)
 {
 
   // Create the window array if it doesn't already exist
   if (m_pWindow == NULL) {
-    m_pWindow = (BUFFER_DATA_TYPE*) malloc(m_uNumSamples*sizeof(BUFFER_DATA_TYPE));
+    m_pWindow = (T*) malloc(m_uNumSamples*sizeof(T));
     if (m_pWindow == NULL) {
       printf("PFB:: Failed to allocate memory for window function.");
       return false;
@@ -137,14 +739,18 @@ bool PFB::setWindowFunction(unsigned int uType)
     case 3:
       printf ("PFB: Using sinc with Blackman Harris window function\n");
       get_blackman_harris(m_pWindow, m_uNumSamples);
-      get_sinc(m_pWindow, m_uNumSamples, m_uNumChannels, true);
+      get_sinc(m_pWindow, m_uNumSamples, m_uNumSamples / m_uNumTaps / 2, true);
       break;
 
     default: 
       printf ("PFB: Using sinc only, no additional window function\n");
-      get_sinc(m_pWindow, m_uNumSamples, m_uNumChannels, false);
+      get_sinc(m_pWindow, m_uNumSamples, m_uNumSamples / m_uNumTaps / 2, false);
       break;
   }
+
+  if (m_bFixedPoint) {
+    return quantizeWindow();
+  }
     
   return true;
 }
@@ -153,19 +759,27 @@ bool PFB::setWindowFunction(unsigned int uType)
 
 // ----------------------------------------------------------------------------
 // waitForEmpty - Blocks until stop signal is received or no more items can
-//                start  processing (which is when there are only m_uNumTaps-1
-//                item in the full list).  Make sure holds on all items
+//                start  processing (which is when there are fewer than 
+//                m_uBlocksPerRequest items we haven't requested).  Make sure holds on all items
 //                have cleared, indicating no items are still in processing.
 // ----------------------------------------------------------------------------
-void PFB::waitForEmpty()
+template<typename T>
+void PFB<T>::waitForEmpty()
 {
   // Wait
-  while (!m_bStop && ( (m_buffer.size() >= m_uNumTaps) || (m_buffer.holds() > 0))) {
+  while (!m_bStop && ( (m_pBuffer->pending(m_uReader) >= m_uBlocksPerRequest) || 
+                       (m_pBuffer->holds() > 0))) {
     usleep(THREAD_SLEEP_MICROSECONDS);
   }
 
-  // Can't process any more so clear the stragglers from the buffer
-  m_buffer.clear();
+  // Start counting again from the first block pushed after the buffer clears
+  m_uNextIndex = 0;
+
+  // Can't process any more so clear the stragglers from the buffer (a shared
+  // buffer is cleared by its owner once all of its readers are done)
+  if (m_pBuffer == &m_buffer) {
+    m_buffer.clear();
+  }
 }
 
 
@@ -174,22 +788,126 @@ void PFB::waitForEmpty()
 // push -- Copies data into a buffer for processing.  If no buffers are 
 //         available, it will return false.
 // ----------------------------------------------------------------------------
-bool PFB::push(SAMPLE_DATA_TYPE* pIn, unsigned int uLength, double dScale, 
-               double dOffset)
+template<typename T>
+bool PFB<T>::push(SAMPLE_DATA_TYPE* pIn, unsigned int uLength, double dScale, 
+                  double dOffset, unsigned long long uSample)
 {
-  return m_buffer.push(pIn, uLength, dScale, dOffset);
+  return m_pBuffer->push(pIn, uLength, dScale, dOffset, uSample);
 
 } // push()
 
 
 
 // ----------------------------------------------------------------------------
-// threadIsReady -- Allow a new thread to report is ready
+// push -- Copies already scaled data (e.g. baseband I/Q samples from a DDC)
+//         into a buffer for processing.  In complex mode, uSample counts
+//         I/Q pairs.
 // ----------------------------------------------------------------------------
-void PFB::threadIsReady() {
+template<typename T>
+bool PFB<T>::push(T* pIn, unsigned int uLength, unsigned long long uSample)
+{
+  return m_pBuffer->push(pIn, uLength, uSample);
+
+} // push()
+
+
+
+// ----------------------------------------------------------------------------
+// threadIsReady -- Allow a new thread to report is ready.  Returns the 
+//                  thread's index.
+// ----------------------------------------------------------------------------
+template<typename T>
+unsigned int PFB<T>::threadIsReady() {
   pthread_mutex_lock(&m_mutexCallback);
-  m_uNumReady++;
+  unsigned int uIndex = m_uNumReady++;
   pthread_mutex_unlock(&m_mutexCallback);
+  return uIndex;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setId -- Sets the id passed to the receiver with each spectrum and 
+//          registers our metrics with it as their label.  Call once, before
+//          any samples are pushed.  A PFB without an id publishes no metrics.
+// ----------------------------------------------------------------------------
+template<typename T>
+void PFB<T>::setId(unsigned int uId) 
+{
+  if (m_pSpectraMetric) {
+    printf("PFB: pfb%u already has its metrics, ignoring new id %u\n", m_uId, uId);
+    return;
+  }
+
+  m_uId = uId;
+  registerMetrics();
+}
+
+
+
+// ----------------------------------------------------------------------------
+// registerMetrics -- Looks up the metrics for our id (once, from setId).
+//                    Threads update them with atomics and no lock, and skip 
+//                    them while m_pSpectraMetric is NULL, so it is set last.
+// ----------------------------------------------------------------------------
+template<typename T>
+void PFB<T>::registerMetrics() 
+{
+  std::string sLabels = "pfb=\"" + std::to_string(m_uId) + "\"";
+
+  m_pLostMetric = Metrics::counter("fastspec_pfb_lost_spectra_total", 
+    "Spectra dropped because their taps reached across a gap in the samples", sLabels);
+  m_pClippedMetric = Metrics::counter("fastspec_pfb_voltage_clipped_total", 
+    "Parts of requantized voltage spectra clipped to the integer range", sLabels);
+
+  m_pActiveMetric = Metrics::gauge("fastspec_pfb_active_threads",
+    "Channelizer threads taking blocks (the rest are parked)", sLabels);
+  m_pActiveMetric->set(m_uActiveThreads);
+  m_pScaleUpMetric = Metrics::counter("fastspec_pfb_scale_total",
+    "Channelizer threads woken or parked", sLabels + ",direction=\"up\"");
+  m_pScaleDownMetric = Metrics::counter("fastspec_pfb_scale_total",
+    "Channelizer threads woken or parked", sLabels + ",direction=\"down\"");
+
+  m_processMetrics.resize(m_uNumThreads);
+  for (unsigned int i=0; i<m_uNumThreads; i++) {
+    m_processMetrics[i] = Metrics::histogram("fastspec_pfb_process_seconds", 
+      "Time for a channelizer thread to process one buffer block", 
+      MetricHistogram::exponential(1e-5, 2, 16), 
+      sLabels + ",thread=\"" + std::to_string(i) + "\"");
+  }
+
+  m_pSpectraMetric = Metrics::counter("fastspec_pfb_spectra_total", 
+    "Spectra produced by the channelizer", sLabels);
+
+  if (m_pBuffer == &m_buffer) {
+    m_buffer.setName("pfb" + std::to_string(m_uId));
+  }
+}
+
+
+
+// ----------------------------------------------------------------------------
+// getStatus -- Adds the occupancy of our own buffer (a shared buffer is 
+//              reported by its owner) and the busy fraction of each thread 
+//              since the previous call.
+// ----------------------------------------------------------------------------
+template<typename T>
+void PFB<T>::getStatus(ChannelizerStatus& status)
+{
+  if (m_pBuffer == &m_buffer) {
+    status.uBuffersUsed += m_buffer.size();
+    status.uBuffersTotal += m_buffer.capacity();
+  }
+
+  pthread_mutex_lock(&m_mutexStatus);
+  status.uLostSpectra += m_uLostSpectra;
+  double dElapsed = m_statusTimer.toc();
+  for (unsigned int i=0; i<m_uNumThreads; i++) {
+    status.threadUtilization.push_back((dElapsed > 0) ? m_pBusy[i] / dElapsed : 0);
+    m_pBusy[i] = 0;
+  }
+  m_statusTimer.tic();
+  pthread_mutex_unlock(&m_mutexStatus);
 }
 
 
@@ -197,38 +915,126 @@ void PFB::threadIsReady() {
 // ----------------------------------------------------------------------------
 // threadLoop -- Primary execution loop of each thread
 // ----------------------------------------------------------------------------
-void* PFB::threadLoop(void* pContext)
+template<typename T>
+void* PFB<T>::threadLoop(void* pContext)
 {
   PFB* pPool = (PFB*) pContext;
 
-  // Allocate the FFT and final spectrum buffers
-  FFT_REAL_TYPE* pLocal1 = (FFT_REAL_TYPE*) FFT_MALLOC(pPool->m_uNumFFT * sizeof(FFT_REAL_TYPE));
-  FFT_COMPLEX_TYPE* pLocal2 = (FFT_COMPLEX_TYPE*) FFT_MALLOC((pPool->m_uNumChannels+1) * sizeof(FFT_COMPLEX_TYPE));
+  // Move to our node first so the arrays below are placed in its memory
+  if (pPool->m_iNode >= 0) {
+    Numa::bind((unsigned int) pPool->m_iNode);
+  }
 
-  // Create the FFT plan
+  // Allocate the FFT and final spectrum buffers (aligned for SIMD FFTs)
+  T* pLocal1 = (T*) Arena::allocate(pPool->m_uNumFFT * sizeof(T), 
+                                    "fft scratch", pPool->m_iNode);
+  Complex* pLocal2 = (Complex*) Arena::allocate((pPool->m_uNumChannels+1) * sizeof(Complex), 
+                                                "fft scratch", pPool->m_iNode);
+  T* pLocal3 = (T*) Arena::allocate(pPool->m_uNumChannels * sizeof(T), 
+                                    "fft scratch", pPool->m_iNode);
+  void* pLocal4 = Arena::allocate(2 * pPool->m_uNumChannels * PFB_VOLTAGE_MAX_BYTES, 
+                                  "fft scratch", pPool->m_iNode);
+  T** pBlocks = (T**) malloc(pPool->m_uInputs * pPool->m_uBlocksPerRequest * sizeof(T*));
+
+  // The second input's FFT output, and its power and the cross power
+  Complex* pLocal5 = NULL;
+  T* pLocal6 = NULL;
+  if (pPool->m_uInputs == 2) {
+    pLocal5 = (Complex*) Arena::allocate((pPool->m_uNumChannels+1) * sizeof(Complex), 
+                                         "fft scratch", pPool->m_iNode);
+    pLocal6 = (T*) Arena::allocate(3 * pPool->m_uNumChannels * sizeof(T), 
+                                   "fft scratch", pPool->m_iNode);
+  }
+
+  // Create the FFT plan (in complex mode pLocal1 holds interleaved I/Q)
   pthread_mutex_lock(&(pPool->m_mutexPlan));
-  FFT_PLAN_TYPE pPlan = FFT_PLAN(pPool->m_uNumFFT, pLocal1, pLocal2, FFTW_MEASURE);
+  Plan pPlan;
+  if (pPool->m_bComplex) {
+    pPlan = FFT<T>::planC2C(pPool->m_uNumChannels, (Complex*) pLocal1, pLocal2, 
+                            FFTW_FORWARD, FFTW_MEASURE);
+  } else {
+    pPlan = FFT<T>::plan(pPool->m_uNumFFT, pLocal1, pLocal2, FFTW_MEASURE);
+  }
+
+  // The second input is transformed from the same input array
+  Plan pPlanB = NULL;
+  if (pPool->m_uInputs == 2) {
+    pPlanB = FFT<T>::plan(pPool->m_uNumFFT, pLocal1, pLocal5, FFTW_MEASURE);
+  }
   pthread_mutex_unlock(&(pPool->m_mutexPlan));
 
+  // The flagger's state and the channel weights, made when first needed 
+  // (the flagger can be set after we start)
+  SpectrumFlagger* pFlagger = NULL;
+  void* pFlagState = NULL;
+  T* pLocal7 = NULL;
+
   // Do a trial FFT execution 
-  FFT_EXECUTE(pPlan);
+  FFT<T>::execute(pPlan);
 
   // Create an iterator for the buffer
-  Buffer::iterator iter;
+  typename Buffer<T>::iterator iter;
+  Timer busyTimer;
 
   // Report ready
-  pPool->threadIsReady();
+  unsigned int uThread = pPool->threadIsReady();
+  ThreadPolicy::apply("channelizer", "pfb thread " + std::to_string(uThread));
+  if (pPool->m_iNode >= 0) {
+    // The role's CPUs can span several nodes, so stay on ours
+    Numa::bind((unsigned int) pPool->m_iNode);
+  }
+  unsigned int uTraceId = (unsigned int) -1;
 
   while (!pPool->m_bStop) {
 
+    // Wait while parked, then warm the caches with the plan before working
+    if (uThread == 0) {
+      pPool->scale();
+    } else if (pPool->park(uThread)) {
+      FFT<T>::execute(pPlan);
+      continue;
+    }
+
     // Try to get a full set of buffer items that need processing
-    if (pPool->m_buffer.request(iter, pPool->m_uNumTaps)) {
+    if (pPool->m_pBuffer->request(iter, pPool->m_uBlocksPerRequest, pPool->m_uReader)) {
+
+      // Name the thread in traces (the id can be set after we start)
+      if (uTraceId != pPool->m_uId) {
+        uTraceId = pPool->m_uId;
+        Trace::setThreadName("pfb" + std::to_string(uTraceId) + " thread " + std::to_string(uThread));
+      }
+
+      // Make the flagger state for our output channels
+      if (pPool->m_pFlagger && (pFlagger != pPool->m_pFlagger)) {
+        if (pFlagger) {
+          pFlagger->deleteState(pFlagState);
+        }
+        pFlagger = pPool->m_pFlagger;
+        pFlagState = pFlagger->newState(pPool->getNumOutputChannels());
+        if (pLocal7 == NULL) {
+          pLocal7 = (T*) Arena::allocate(pPool->m_uNumChannels * sizeof(T), 
+                                         "fft scratch", pPool->m_iNode);
+        }
+      }
 
       // Process the data in the buffer
-      pPool->process(iter, pLocal1, pLocal2, pPlan);
+      busyTimer.tic();
+      unsigned int uSpectra = pPool->process(iter, pBlocks, pLocal1, pLocal2, pLocal3, pLocal4, pPlan,
+                                             pLocal5, pLocal6, pPlanB, 
+                                             pPool->m_pFlagger ? pFlagState : NULL, pLocal7);
+      busyTimer.toc();
+
+      pthread_mutex_lock(&(pPool->m_mutexStatus));
+      pPool->m_pBusy[uThread] += busyTimer.get();
+      pthread_mutex_unlock(&(pPool->m_mutexStatus));
+
+      if (pPool->m_pSpectraMetric) {
+        pPool->m_pSpectraMetric->add(uSpectra);
+        pPool->m_processMetrics[uThread]->observe(busyTimer.get());
+      }
 
       // Release the iterator to be able to do it again
-      pPool->m_buffer.release(iter);
+      pPool->m_pBuffer->release(iter);
 
     } else {
 
@@ -237,12 +1043,24 @@ void* PFB::threadLoop(void* pContext)
     }
   }
 
-  // Destroy the FFT plan
-  FFT_DESTROY_PLAN(pPlan);
+  // Destroy the FFT plans
+  FFT<T>::destroy(pPlan);
+  if (pPlanB) {
+    FFT<T>::destroy(pPlanB);
+  }
 
   // Release the local buffers
-  FFT_FREE(pLocal1);
-  FFT_FREE(pLocal2);
+  Arena::free(pLocal1);
+  Arena::free(pLocal2);
+  Arena::free(pLocal3);
+  Arena::free(pLocal4);
+  Arena::free(pLocal5);
+  Arena::free(pLocal6);
+  Arena::free(pLocal7);
+  if (pFlagger) {
+    pFlagger->deleteState(pFlagState);
+  }
+  free(pBlocks);
 
   // Exit the thread
   pthread_exit(NULL);
@@ -251,118 +1069,434 @@ void* PFB::threadLoop(void* pContext)
 
 
 // ----------------------------------------------------------------------------
-// process -- Handle a buffer of data
+// weightTaps -- Fills pOut with the window-weighted sum of the taps of the
+//               frame starting uFrame frames into the request.  TAPS is the
+//               tap count, or 0 for any count (m_uNumTaps).  In complex mode
+//               the window weights each I/Q pair.
 // ----------------------------------------------------------------------------
-void PFB::process( Buffer::iterator& iter, FFT_REAL_TYPE* pLocal1, 
-                       FFT_COMPLEX_TYPE* pLocal2, FFT_PLAN_TYPE pPlan)
+template<typename T>
+template<unsigned int TAPS, bool COMPLEX>
+void PFB<T>::weightTaps(T* pOut, T** pBlocks, unsigned int uFrame)
 {
+  unsigned int uLength = COMPLEX ? m_uNumChannels : m_uNumFFT;
+  unsigned int uWindowLength = m_uNumSamples / m_uNumTaps;
+  unsigned int i;
+  unsigned int t;
 
+  if constexpr (TAPS == 0) {
+
+    // One pass over the frame per tap
+    for (t=0; t<m_uNumTaps; t++) {
+
+      unsigned int f = uFrame + t;
+      T* pIn = pBlocks[f / m_uFramesPerBlock] + (f % m_uFramesPerBlock) * m_uNumFFT;
+      T* pWin = m_pWindow + t * uWindowLength;
+
+      // Overwrite anything already in the array with the first tap and add
+      // the others in place
+      if (t == 0) {
+        for (i=0; i<uLength; i++) {
+          if constexpr (COMPLEX) {
+            pOut[2*i] = pIn[2*i] * pWin[i];
+            pOut[2*i+1] = pIn[2*i+1] * pWin[i];
+          } else {
+            pOut[i] = pIn[i] * pWin[i];
+          }
+        }
+      } else {
+        for (i=0; i<uLength; i++) {
+          if constexpr (COMPLEX) {
+            pOut[2*i] += pIn[2*i] * pWin[i];
+            pOut[2*i+1] += pIn[2*i+1] * pWin[i];
+          } else {
+            pOut[i] += pIn[i] * pWin[i];
+          }
+        }
+      }
+    }
+
+  } else {
+
+    // Each output sample is summed over all taps before it is written, in
+    // the same order as above
+    T* pIn[TAPS];
+    T* pWin[TAPS];
+    for (t=0; t<TAPS; t++) {
+      unsigned int f = uFrame + t;
+      pIn[t] = pBlocks[f / m_uFramesPerBlock] + (f % m_uFramesPerBlock) * m_uNumFFT;
+      pWin[t] = m_pWindow + t * uWindowLength;
+    }
+
+    for (i=0; i<uLength; i++) {
+      if constexpr (COMPLEX) {
+        T dRe = pIn[0][2*i] * pWin[0][i];
+        T dIm = pIn[0][2*i+1] * pWin[0][i];
+        for (t=1; t<TAPS; t++) {
+          dRe += pIn[t][2*i] * pWin[t][i];
+          dIm += pIn[t][2*i+1] * pWin[t][i];
+        }
+        pOut[2*i] = dRe;
+        pOut[2*i+1] = dIm;
+      } else {
+        T d = pIn[0][i] * pWin[0][i];
+        for (t=1; t<TAPS; t++) {
+          d += pIn[t][i] * pWin[t][i];
+        }
+        pOut[i] = d;
+      }
+    }
+  }
+}
+
+
+
+// ----------------------------------------------------------------------------
+// weightTapsFixed -- Fills pOut with the window-weighted sum of the taps of
+//                    the frame starting uFrame frames into the request, from
+//                    raw 16 bit codes.  The sum is taken in int32 and scaled
+//                    once with the codes' scale and offset (fScale already
+//                    includes the window scale).  TAPS is the tap count, or 
+//                    0 for any count up to PFB_FIXED_MAX_TAPS.
+// ----------------------------------------------------------------------------
+template<typename T>
+template<unsigned int TAPS>
+void PFB<T>::weightTapsFixed(T* pOut, T** pBlocks, unsigned int uFrame, 
+                             T fScale, T fOffset)
+{
+  const unsigned int uTaps = (TAPS > 0) ? TAPS : m_uNumTaps;
+  int16_t* pIn[(TAPS > 0) ? TAPS : PFB_FIXED_MAX_TAPS];
+  int16_t* pWin[(TAPS > 0) ? TAPS : PFB_FIXED_MAX_TAPS];
   unsigned int i;
   unsigned int t;
-  BUFFER_DATA_TYPE* pIn = NULL;
-  BUFFER_DATA_TYPE* pWin = m_pWindow;
-  BUFFER_DATA_TYPE dMax = 0;
-  BUFFER_DATA_TYPE dMin = 0;
+
+  for (t=0; t<uTaps; t++) {
+    unsigned int f = uFrame + t;
+    pIn[t] = ((int16_t*) pBlocks[f / m_uFramesPerBlock]) + (f % m_uFramesPerBlock) * m_uNumFFT;
+    pWin[t] = m_pWindowFixed + t * m_uNumFFT;
+  }
+
+  for (i=0; i<m_uNumFFT; i++) {
+    int32_t iSum = (int32_t) pIn[0][i] * pWin[0][i];
+    for (t=1; t<uTaps; t++) {
+      iSum += (int32_t) pIn[t][i] * pWin[t][i];
+    }
+    pOut[i] = iSum * fScale + fOffset * m_pWindowSum[i];
+  }
+}
+
+
+
+// ----------------------------------------------------------------------------
+// findRange -- Finds the smallest and largest sample in the first tap of
+//              frame uFrame, scaling raw codes with the block's scale and
+//              offset.
+// ----------------------------------------------------------------------------
+template<typename T>
+void PFB<T>::findRange( T** pBlocks, unsigned int uFrame, 
+                        double dRawScale, double dRawOffset,
+                        T& dMin, T& dMax )
+{
+  unsigned int i;
+
+  if (m_bFixedPoint) {
+    int16_t* pRaw = ((int16_t*) pBlocks[uFrame / m_uFramesPerBlock]) + (uFrame % m_uFramesPerBlock) * m_uNumFFT;
+    int16_t iMax = pRaw[0];
+    int16_t iMin = pRaw[0];
+    for (i=0; i<m_uNumFFT; i++) {
+      if (pRaw[i] < iMin) { 
+        iMin = pRaw[i]; 
+      } else if (pRaw[i] > iMax) { 
+        iMax = pRaw[i]; 
+      }
+    }
+    dMax = (T) (iMax * dRawScale + dRawOffset);
+    dMin = (T) (iMin * dRawScale + dRawOffset);
+  } else {
+    T* pIn = pBlocks[uFrame / m_uFramesPerBlock] + (uFrame % m_uFramesPerBlock) * m_uNumFFT;
+    dMax = pIn[0];
+    dMin = pIn[0];
+    for (i=0; i<m_uNumFFT; i++) {
+      if (pIn[i] < dMin) { 
+        dMin = pIn[i]; 
+      } else if (pIn[i] > dMax) { 
+        dMax = pIn[i]; 
+      }
+    }
+  }
+}
+
+
+
+// ----------------------------------------------------------------------------
+// process -- Handle a buffer of data.  Produces one spectrum for each FFT 
+//            frame in the first block of the request.  Returns the number
+//            of spectra produced.  With two inputs, pLocal5, pLocal6 and 
+//            pPlanB are the second input's FFT output, detected spectra 
+//            and plan.  With a flagger, pFlagState is this thread's state
+//            and pLocal7 receives the channel weights.
+// ----------------------------------------------------------------------------
+template<typename T>
+unsigned int PFB<T>::process( typename Buffer<T>::iterator& iter, T** pBlocks, 
+                          T* pLocal1, Complex* pLocal2, 
+                          T* pLocal3, void* pLocal4, Plan pPlan,
+                          Complex* pLocal5, T* pLocal6, 
+                          Plan pPlanB, void* pFlagState, T* pLocal7)
+{
+
+  unsigned int i;
+  unsigned int j;
+  T dMax = 0;
+  T dMin = 0;
+  T dMaxB = 0;
+  T dMinB = 0;
+  unsigned int uClipped = 0;
   
   // Make a copy of the head of the iterator for use later if we're in 
-  // release-in-order mode;
-  Buffer::iterator iterStart;
-  m_buffer.copy(iter, iterStart);
+  // release-in-order mode.  It also keeps a hold on the first block so none 
+  // of the blocks after it can be recycled while we work.
+  typename Buffer<T>::iterator iterStart;
+  m_pBuffer->copy(iter, iterStart);
+
+  // Raw codes are scaled after the taps are summed (see setFixedPoint).  All
+  // blocks of a request come from the same digitizer, so share a scale.
+  double dRawScale = m_bFixedPoint ? m_pBuffer->scale(iterStart) : 1;
+  double dRawOffset = m_bFixedPoint ? m_pBuffer->offset(iterStart) : 0;
   
   //printf("PFB::Process: Starting...\n");
-  
-  // Loop over taps of data
-  for (t=0; t<m_uNumTaps; t++) {
 
-    //printf("PFB: Tap item index=%llu\n", m_buffer.index(iter));
+  // Collect the blocks needed for this request and find the first block
+  // that doesn't follow on from the one before it
+  unsigned long long uBlockSamples = m_pBuffer->itemLength() / (m_bComplex ? 2 : 1) / m_pBuffer->inputs();
+  unsigned long long uExpected = m_pBuffer->sample(iter);
+  unsigned long long uGap = 0;
+  unsigned int uGapBlock = m_uBlocksPerRequest;
+  for (i=0; i<m_uBlocksPerRequest; i++) {
 
-    // Get the current buffer block and window block
-    pIn = m_buffer.data(iter);
-    pWin = &(m_pWindow[t*m_uNumFFT]);
+    //printf("PFB: Block item index=%llu\n", m_pBuffer->index(iter));
 
-    // Populate the pre-FFT array
-    // Treat the first tap specially
-    if (t==0) {
+    pBlocks[i] = m_pBuffer->data(iter);
 
-      // Overwrite anything already in array
-      for (i=0; i<m_uNumFFT; i++) {
-        pLocal1[i] = pIn[i] * pWin[i];
-      }
+    // The second input is in the second half of the block (in raw codes for
+    // fixed point)
+    if (m_uInputs == 2) {
+      pBlocks[m_uBlocksPerRequest + i] = m_bFixedPoint ? 
+        (T*) (((int16_t*) pBlocks[i]) + m_pBuffer->itemLength() / 2) :
+        pBlocks[i] + m_pBuffer->itemLength() / 2;
+    }
 
-      // Find the ADC max and min *** NOTE***
-      // By only searching the first tap of data, when the entire buffer is 
-      // processed across all threads, we won't have searched the last 
-      // (m_uNumTaps-1) blocks of data.  Saving this for future work.
-      dMax = pIn[0];
-      dMin = pIn[0];
-      for (i=0; i<m_uNumFFT; i++) {
-        if (pIn[i] < dMin) { 
-          dMin = pIn[i]; 
-        } else if (pIn[i] > dMax) { 
-          dMax = pIn[i]; 
-        }
-      }
+    if ((uGapBlock == m_uBlocksPerRequest) && (m_pBuffer->sample(iter) != uExpected)) {
+      uGapBlock = i;
+      uGap = m_pBuffer->sample(iter) - uExpected;
+    }
+    uExpected = m_pBuffer->sample(iter) + uBlockSamples;
 
-    // All other taps
-    } else {
+    // Advance the iterator to next block of data 
+    if (i<(m_uBlocksPerRequest-1)) {
+      m_pBuffer->next(iter);
+    }
+  }
 
-      // Add in place to the array
-      for (i=0; i<m_uNumFFT; i++) {
-        pLocal1[i] += pIn[i] * pWin[i];
-      }
+  if (m_pReceiver == NULL) {
+    Log::error("ERROR: PFB process has no callback function assigned!\n");
+    m_pBuffer->release(iterStart); 
+    return 0;
+  }
+
+  // Skip requests that span two segments (not contiguous samples) or start
+  // with history that was already processed in another buffer
+  unsigned int uNumFrames = m_uFramesPerBlock;
+  if ((m_pBuffer->segment(iterStart) != m_pBuffer->segment(iter)) ||
+      (m_pBuffer->lag(iterStart) >= m_uBlocksPerRequest)) {
+    uNumFrames = 0;
+
+  } else if (uGapBlock < m_uBlocksPerRequest) {
+
+    // Only the frames whose last tap comes before the gap are contiguous
+    unsigned int uBefore = uGapBlock * m_uFramesPerBlock;
+    uNumFrames = (uBefore >= m_uNumTaps) ? uBefore - m_uNumTaps + 1 : 0;
+    uNumFrames = (uNumFrames < m_uFramesPerBlock) ? uNumFrames : m_uFramesPerBlock;
+
+    unsigned int uLost = m_uFramesPerBlock - uNumFrames;
+    pthread_mutex_lock(&m_mutexStatus);
+    m_uLostSpectra += uLost;
+    pthread_mutex_unlock(&m_mutexStatus);
+    if (m_pSpectraMetric) {
+      m_pLostMetric->add(uLost);
     }
 
-    // Advance the iterator to next block of data for next tap
-    if (t<(m_uNumTaps-1)) {
-      m_buffer.next(iter);
+    // Each gap shows up in several requests, but only once right after the
+    // first block
+    if (uGapBlock == 1) {
+      Log::write(LOG_DEBUG, "PFB: pfb%u gap of %llu samples, restarting the taps\n", m_uId, uGap);
     }
   }
-  
-  // Perform the FFT
-  FFT_EXECUTE(pPlan);
 
-  // Square and calculate the spectrum 
-  // This ignores the nyquist (highest) frequency keeping with preivous 
-  // EDGES codes
-  for (i = 0; i < m_uNumChannels; i++) { 
-    pLocal1[i] = pLocal2[i][0]*pLocal2[i][0] + pLocal2[i][1]*pLocal2[i][1];
+  // Wait until it is our turn (only if we're returning in order)
+  if (m_bReturnInOrder) {
+    while (!m_bStop && (m_pBuffer->index(iterStart) != m_uNextIndex)) {
+
+      // Sleep before trying again
+      usleep(THREAD_SLEEP_MICROSECONDS);			
+    }
   }
+  
+  // Loop over the FFT frames that start in the first block
+  for (j=0; j<uNumFrames; j++) {
 
-  // Pack the resulting spectrum for sending to callback
-  ChannelizerData sData;
-  sData.pData = pLocal1;
-  sData.uNumChannels = m_uNumChannels;
-  sData.dADCmin = dMin;
-  sData.dADCmax = dMax;
+    uint64_t uTrace0 = Trace::enabled() ? Trace::now() : 0;
 
-  // Send the resulting spectrum to the callback function for handling
-  
-  if (m_pReceiver == NULL) {
-    printf("ERROR: PFB process has no callback function assigned!\n");
-  } else {
+    // Populate the pre-FFT array with the weighted taps
+    if (m_bFixedPoint) {
+      (this->*m_pWeightTapsFixed)(pLocal1, pBlocks, j, 
+        (T) (dRawScale * m_dWindowScale), (T) dRawOffset);
+    } else {
+      (this->*m_pWeightTaps)(pLocal1, pBlocks, j);
+    }
 
-    if (m_bReturnInOrder) {
+    // Find the ADC max and min *** NOTE***
+    // By only searching the first tap of data, when the entire buffer is 
+    // processed across all threads, we won't have searched the last 
+    // (m_uNumTaps-1) blocks of data.  Saving this for future work.
+    findRange(pBlocks, j, dRawScale, dRawOffset, dMin, dMax);
     
-		  // Wait until it is our turn (only if we're returning in order)
-		  while (!m_buffer.oldest(iterStart)) {
+    uint64_t uTrace1 = uTrace0 ? Trace::now() : 0;
+
+    // Perform the FFT
+    FFT<T>::execute(pPlan);
+
+    // Then the same frame of the second input into its own output
+    if (m_uInputs == 2) {
+      T** pBlocksB = pBlocks + m_uBlocksPerRequest;
+      if (m_bFixedPoint) {
+        (this->*m_pWeightTapsFixed)(pLocal1, pBlocksB, j, 
+          (T) (dRawScale * m_dWindowScale), (T) dRawOffset);
+      } else {
+        (this->*m_pWeightTaps)(pLocal1, pBlocksB, j);
+      }
+      findRange(pBlocksB, j, dRawScale, dRawOffset, dMinB, dMaxB);
+      FFT<T>::execute(pPlanB);
+    }
 
-	      // Sleep before trying again
-	      usleep(THREAD_SLEEP_MICROSECONDS);			
-		  }
-		
-		}
- 	
-		//printf("PFB::Process: Calling receiver...\n");
+    uint64_t uTrace2 = uTrace0 ? Trace::now() : 0;
+
+    // Square and calculate the spectrum for the output channels only
+    // This ignores the nyquist (highest) frequency keeping with preivous 
+    // EDGES codes.  If requested, the power squared is produced in the same
+    // pass so the second moment costs only one extra multiply per channel.
+    // In complex mode the two halves are swapped so that the negative 
+    // frequencies come first.
+    Complex* pOut = pLocal2 + m_uStartChannel;
+    unsigned int uNumOut = m_uStopChannel - m_uStartChannel;
+    if (m_bComplex) {
+      unsigned int uHalf = m_uNumChannels / 2;
+      for (i = m_uStartChannel; i < m_uStopChannel; i++) { 
+        unsigned int k = (i < uHalf) ? i + (m_uNumChannels - uHalf) : i - uHalf;
+        pLocal1[i - m_uStartChannel] = pLocal2[k][0]*pLocal2[k][0] + pLocal2[k][1]*pLocal2[k][1];
+      }
+      if (m_bSecondMoment) {
+        for (i = 0; i < uNumOut; i++) { 
+          pLocal3[i] = pLocal1[i]*pLocal1[i];
+        }
+      }
+    } else if (m_uInputs == 2) {
+      // Both powers and the cross power in one pass over the two outputs
+      Complex* pOutB = pLocal5 + m_uStartChannel;
+      T* pPowerB = pLocal6;
+      T* pCrossRe = pLocal6 + uNumOut;
+      T* pCrossIm = pLocal6 + 2*uNumOut;
+      for (i = 0; i < uNumOut; i++) { 
+        T aRe = pOut[i][0];
+        T aIm = pOut[i][1];
+        T bRe = pOutB[i][0];
+        T bIm = pOutB[i][1];
+        pLocal1[i] = aRe*aRe + aIm*aIm;
+        pPowerB[i] = bRe*bRe + bIm*bIm;
+        pCrossRe[i] = aRe*bRe + aIm*bIm;
+        pCrossIm[i] = aIm*bRe - aRe*bIm;
+      }
+      if (m_bSecondMoment) {
+        for (i = 0; i < uNumOut; i++) { 
+          pLocal3[i] = pLocal1[i]*pLocal1[i];
+        }
+      }
+    } else if (m_bSecondMoment) {
+      for (i = 0; i < uNumOut; i++) { 
+        pLocal1[i] = pOut[i][0]*pOut[i][0] + pOut[i][1]*pOut[i][1];
+        pLocal3[i] = pLocal1[i]*pLocal1[i];
+      }
+    } else {
+      for (i = 0; i < uNumOut; i++) { 
+        pLocal1[i] = pOut[i][0]*pOut[i][0] + pOut[i][1]*pOut[i][1];
+      }
+    }
+
+    // Flag RFI.  A skipped spectrum still goes to the receiver so that it
+    // can count the flagged channels.
+    bool bSkipped = pFlagState && !m_pFlagger->flag(pFlagState, pLocal1, 
+                                                    m_bSecondMoment ? pLocal3 : NULL, 
+                                                    pLocal7, uNumOut);
+
+    // The complex spectrum as well, if requested (the FFT output is intact)
+    void* pVoltage = (m_uVoltageBits && !bSkipped) ? packVoltage(pLocal2, pLocal4, uClipped) : NULL;
+
+    // Pack the resulting spectrum for sending to callback
+    ChannelizerData<T> sData;
+    sData.pData = pLocal1;
+    sData.pData2 = m_bSecondMoment ? pLocal3 : NULL;
+    sData.uNumChannels = uNumOut;
+    sData.dADCmin = dMin;
+    sData.dADCmax = dMax;
+    sData.uId = m_uId;
+    sData.uSample = m_pBuffer->sample(iterStart) + j * (m_bComplex ? m_uNumChannels : m_uNumFFT);
+    sData.pVoltage = pVoltage;
+    sData.uVoltageBits = m_uVoltageBits;
+    sData.pVoltageGains = (pVoltage && (m_uVoltageBits < 32)) ? m_pVoltageGains + m_uStartChannel : NULL;
+    sData.pDataB = (m_uInputs == 2) ? pLocal6 : NULL;
+    sData.pCross = (m_uInputs == 2) ? pLocal6 + uNumOut : NULL;
+    sData.dADCminB = dMinB;
+    sData.dADCmaxB = dMaxB;
+    sData.pWeights = pFlagState ? pLocal7 : NULL;
+    sData.bSkipped = bSkipped;
+
+    // Send the resulting spectrum to the callback function for handling
+    //printf("PFB::Process: Calling receiver...\n");
 		
+    uint64_t uTrace3 = uTrace0 ? Trace::now() : 0;
     pthread_mutex_lock(&m_mutexCallback);   
+    uint64_t uTrace4 = uTrace0 ? Trace::now() : 0;
     m_pReceiver->onChannelizerData(&sData);
     pthread_mutex_unlock(&m_mutexCallback);
+
+    if (uTrace0) {
+      Trace::record("pfb taps", uTrace0, uTrace1);
+      Trace::record("pfb fft", uTrace1, uTrace2);
+      Trace::record("pfb detect", uTrace2, uTrace3);
+      Trace::record("pfb lock wait", uTrace3, uTrace4);
+      Trace::record("pfb callback", uTrace4, Trace::now());
+    }
     
-    //printf("PFB::Process: Done with chunk.\n");
-    
-    // Release the extra hold on the head (used above if return in order)
-	  m_buffer.release(iterStart); 
+    //printf("PFB::Process: Done with frame.\n");
+  }
 
+  if ((uClipped > 0) && m_pSpectraMetric) {
+    m_pClippedMetric->add(uClipped);
+  }
+
+  // Let the next block through (used above if return in order)
+  if (m_bReturnInOrder) {
+    pthread_mutex_lock(&m_mutexCallback);   
+    m_uNextIndex++;
+    pthread_mutex_unlock(&m_mutexCallback);
   }
 
+  // Release the extra hold on the head
+  m_pBuffer->release(iterStart); 
+
+  return uNumFrames;
+
 } // process()
+
+
+
+template class PFB<float>;
+template class PFB<double>;
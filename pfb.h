@@ -2,79 +2,281 @@
 #define _PFB_H_
 
 #include <functional>
+#include <atomic>
 #include <fftw3.h>
 #include <pthread.h>
 #include "channelizer.h"
 #include "buffer.h"
 #include "accumulator.h"
+#include "metrics.h"
+#include "flagger.h"
 
-#if defined FFT_DOUBLE_PRECISION
-  #define FFT_REAL_TYPE           double
-  #define FFT_COMPLEX_TYPE        fftw_complex
-  #define FFT_PLAN_TYPE           fftw_plan
-  #define FFT_EXECUTE             fftw_execute
-  #define FFT_PLAN                fftw_plan_dft_r2c_1d
-  #define FFT_DESTROY_PLAN        fftw_destroy_plan
-  #define FFT_MALLOC              fftw_malloc
-  #define FFT_FREE                fftw_free
-#elif defined FFT_SINGLE_PRECISION
-  #define FFT_REAL_TYPE           float
-  #define FFT_COMPLEX_TYPE        fftwf_complex
-  #define FFT_PLAN_TYPE           fftwf_plan
-  #define FFT_EXECUTE             fftwf_execute
-  #define FFT_PLAN                fftwf_plan_dft_r2c_1d
-  #define FFT_DESTROY_PLAN        fftwf_destroy_plan
-  #define FFT_MALLOC              fftwf_malloc
-  #define FFT_FREE                fftwf_free
-#elif
-  #error Aborted in pfb.h because FFT precision was not defined.
-#endif
+// FFTW has separate float and double APIs.  FFT<T> gives the PFB the types
+// and functions for its compute type T.
+template<typename T> struct FFT;
+
+template<> struct FFT<float> {
+  typedef fftwf_complex   Complex;
+  typedef fftwf_plan      Plan;
+  static Plan plan(int n, float* pIn, Complex* pOut, unsigned int uFlags) {
+    return fftwf_plan_dft_r2c_1d(n, pIn, pOut, uFlags); }
+  static Plan planC2C(int n, Complex* pIn, Complex* pOut, int iSign, unsigned int uFlags) {
+    return fftwf_plan_dft_1d(n, pIn, pOut, iSign, uFlags); }
+  static void execute(Plan p) { fftwf_execute(p); }
+  static void destroy(Plan p) { fftwf_destroy_plan(p); }
+};
+
+template<> struct FFT<double> {
+  typedef fftw_complex    Complex;
+  typedef fftw_plan       Plan;
+  static Plan plan(int n, double* pIn, Complex* pOut, unsigned int uFlags) {
+    return fftw_plan_dft_r2c_1d(n, pIn, pOut, uFlags); }
+  static Plan planC2C(int n, Complex* pIn, Complex* pOut, int iSign, unsigned int uFlags) {
+    return fftw_plan_dft_1d(n, pIn, pOut, iSign, uFlags); }
+  static void execute(Plan p) { fftw_execute(p); }
+  static void destroy(Plan p) { fftw_destroy_plan(p); }
+};
 
 using namespace std;
 
+// ---------------------------------------------------------------------------
+//
+// PFB
+//
+// Polyphase filter bank channelizer.  Spreads the processing across a pool
+// of worker threads that pull blocks of samples from a Buffer.  By default
+// the PFB owns its buffer and each block is one FFT long.  Alternatively, a
+// PFB can read from a buffer shared with other channelizers (see PFBBank), 
+// in which case the block length can be any multiple of its FFT length and
+// each block yields several spectra.
+//
+// In complex mode, the buffer holds interleaved I/Q samples (e.g. from a 
+// DDC) and a complex FFT of uNumChannels points is used.  The output 
+// channels are reordered to run from the most negative to the most positive
+// frequency.  Each frame is still 2*uNumChannels buffer values long.
+//
+// The output can be limited to a range of channels (see setOutputChannels),
+// in which case only those channels are detected and passed to the 
+// receiver, starting with the first channel of the range.
+//
+// If a NUMA node is given, the worker threads run on its CPUs and allocate
+// their FFT arrays (and the PFB's own buffer) in its memory.  A request 
+// whose blocks cross into a new buffer segment, or whose first block is 
+// history that another PFB already processed (its lag is at least the 
+// number of blocks per request), is released without producing spectra.
+//
+// Every block is pushed with the sample index of its first sample.  If a
+// block is missing (e.g. a push failed because the buffer was full), the
+// blocks on either side of the gap are not contiguous and a polyphase sum
+// over them would mix unrelated samples.  The frames whose taps reach
+// across a gap are dropped instead, so the tap history restarts after it.
+// The dropped frames are counted as lost spectra, logged, and published in
+// the fastspec_pfb_lost_spectra_total metric.
+//
+// The taps of each frame are weighted and summed by a kernel picked for the
+// tap count when the PFB is created.  For the common counts (1, 3, 4, 5 and
+// 8) the count is a template parameter, so each output sample is summed
+// over all taps in one pass with the tap loop unrolled.  Other counts make
+// one pass over the frame per tap.
+//
+// The PFB is a template on its compute type T, float or double, which is 
+// also the type of its buffer's samples and of the spectra it passes on.
+// Both are compiled into every executable, and ChannelizerBank creates one
+// or the other when the spectrometer starts, so the precision is a run 
+// time setting.
+//
+// With setFixedPoint, a real PFB sums the taps in integers instead.  Its
+// buffer must be in raw mode (see Buffer), so each block holds the 16 bit
+// sample codes, and the window is quantized to 16 bits.  Each output sample
+// is an int16 x int16 -> int32 sum over the taps, converted to floating
+// point once with the block's scale and offset before the FFT.  The taps
+// read half the bytes and twice as many products fit in a SIMD register,
+// so this is cheaper when the channelizer is CPU bound.  The window is
+// scaled so the sum of its quantized magnitudes over the taps of any sample
+// is at most PFB_FIXED_WINDOW_SUM, which keeps the int32 sums from
+// overflowing for any codes.  printFixedPointError() reports how much error
+// that adds.
+//
+// setVoltageOutput passes the complex spectrum of the output channels to
+// the receiver along with the power (ChannelizerData::pVoltage), so phase
+// is kept for correlation or coherent averaging downstream.  As floating
+// point of the FFT's own precision from a real PFB, it points straight into
+// the FFT output.  Otherwise each thread converts it into its own array:
+// to the other floating point precision, or multiplied by a gain per
+// channel and rounded to int8 or int16.  Integer values that don't fit are
+// clipped to +/-127 or +/-32767 and counted in
+// fastspec_pfb_voltage_clipped_total.
+//
+// A real PFB reading a buffer with two inputs (see Buffer::setInputs) 
+// channelizes both with the same window and taps.  Each frame of input A is
+// weighted and transformed, then the frame of input B at the same time into
+// a second FFT output.  One pass over both outputs then detects the power
+// of A and B and the cross power A x conj(B), so the receiver gets all three
+// for every frame (ChannelizerData::pDataB and pCross).  The block length 
+// holds the frames of both inputs, so each block yields half as many frames.
+// The second moment and voltage output are only for input A.
+//
+// setFlagger runs an RFI flagging stage (see SpectrumFlagger) on every
+// spectrum after it is detected and before it goes to the receiver.  Each
+// thread makes its own flagger state when it first needs it.  Spectra the
+// flagger skips are passed on marked as skipped (ChannelizerData::bSkipped),
+// and every flagged spectrum goes with the weight of each channel
+// (ChannelizerData::pWeights).  Only the power (and power
+// squared) of input A is flagged.
+//
+// The thread pool can be made elastic (see setMinThreads).  All threads
+// are created up front with their FFT plans, but only the active ones take
+// blocks; the rest are parked.  Every PFB_SCALE_SECONDS the first thread
+// checks how full the buffer is for this PFB.  Above PFB_SCALE_UP_FILL
+// another thread is woken.  Below PFB_SCALE_DOWN_FILL for
+// PFB_SCALE_DOWN_CHECKS checks in a row, one is parked again.  Each change
+// is logged and published in the fastspec_pfb_active_threads and
+// fastspec_pfb_scale_total metrics.
+//
+// ---------------------------------------------------------------------------
+
+#define PFB_FIXED_MAX_TAPS        32
+#define PFB_FIXED_WINDOW_SUM      65535   // 32768 x 65535 < 2^31
+#define PFB_VOLTAGE_MAX_BYTES     sizeof(double)  // Per part
+
+template<typename T>
 class PFB : public Channelizer {
 
   private:
 
+    typedef typename FFT<T>::Complex  Complex;
+    typedef typename FFT<T>::Plan     Plan;
+
     // Member variables
     ChannelizerReceiver*          m_pReceiver;
     pthread_t*                    m_pThreads;
     pthread_mutex_t               m_mutexPlan;
     pthread_mutex_t               m_mutexCallback;
-    BUFFER_DATA_TYPE*             m_pWindow;
-    Buffer                        m_buffer;
+    pthread_mutex_t               m_mutexStatus;
+    pthread_mutex_t               m_mutexPark;
+    pthread_cond_t                m_condPark;
+    Timer                         m_scaleTimer;
+    unsigned int                  m_uMinThreads;
+    std::atomic<unsigned int>     m_uActiveThreads;
+    unsigned int                  m_uLowChecks;
+    MetricGauge*                  m_pActiveMetric;
+    MetricCounter*                m_pScaleUpMetric;
+    MetricCounter*                m_pScaleDownMetric;
+    double*                       m_pBusy;        // seconds per thread
+    Timer                         m_statusTimer;
+    MetricCounter*                m_pSpectraMetric;
+    MetricCounter*                m_pLostMetric;
+    MetricCounter*                m_pClippedMetric;
+    unsigned long                 m_uLostSpectra;
+    std::vector<MetricHistogram*> m_processMetrics; // one per thread
+    T*                            m_pWindow;
+    Buffer<T>                     m_buffer;
+    Buffer<T>*                    m_pBuffer;
+    unsigned int                  m_uReader;
+    unsigned int                  m_uFramesPerBlock;
+    unsigned int                  m_uBlocksPerRequest;
+    unsigned long long            m_uNextIndex;
+    unsigned int                  m_uId;
     unsigned int                  m_uNumTaps;
     unsigned int                  m_uNumThreads;
     unsigned int                  m_uNumChannels;
+    unsigned int                  m_uStartChannel;
+    unsigned int                  m_uStopChannel;
     unsigned int                  m_uNumFFT;
     unsigned int                  m_uNumSamples;
     unsigned int                  m_uNumBuffers;
     unsigned int                  m_uNumReady;
+    int                           m_iNode;
     bool                          m_bStop;
     bool                          m_bReturnInOrder;
+    bool                          m_bSecondMoment;
+    bool                          m_bComplex;
+    unsigned int                  m_uInputs;      // 2 for cross power
+
+    // Kernel that weights and sums the taps of one frame, picked for the
+    // tap count in init()
+    void (PFB::*m_pWeightTaps)(T*, T**, unsigned int);
+
+    // Fixed-point taps (see setFixedPoint)
+    bool                          m_bFixedPoint;
+    int16_t*                      m_pWindowFixed;
+    T*                            m_pWindowSum;   // Sum over taps, per sample
+    double                        m_dWindowScale;
+    void (PFB::*m_pWeightTapsFixed)(T*, T**, unsigned int, T, T);
+
+    // Complex voltage output (see setVoltageOutput)
+    unsigned int                  m_uVoltageBits;     // 0 if off
+    float*                        m_pVoltageGains;    // One per channel
+
+    // RFI flagging (see setFlagger)
+    SpectrumFlagger*              m_pFlagger;         // NULL if off
     
     // Private helper functions
-    void            process(Buffer::iterator&, 
-                            FFT_REAL_TYPE*, 
-                            FFT_COMPLEX_TYPE*, 
-                            FFT_PLAN_TYPE );
+    void            init( unsigned int, unsigned int, unsigned int, 
+                          unsigned int, bool, bool, int );
+    
+    unsigned int    process(typename Buffer<T>::iterator&, 
+                            T**,
+                            T*, 
+                            Complex*, 
+                            T*,
+                            void*,
+                            Plan,
+                            Complex*,
+                            T*,
+                            Plan,
+                            void*,
+                            T* );
+
+    void            findRange(T**, unsigned int, double, double, T&, T&);
+
+    template<unsigned int TAPS, bool COMPLEX>
+    void            weightTaps(T*, T**, unsigned int);
+
+    template<unsigned int TAPS>
+    void            weightTapsFixed(T*, T**, unsigned int, T, T);
+    bool            quantizeWindow();
+
+    void*           packVoltage(Complex*, void*, unsigned int&);
+    template<typename V>
+    unsigned int    packVoltage(Complex*, V*);
 
-    void            threadIsReady();
+    unsigned int    threadIsReady();
+    void            registerMetrics();
+    void            scale();
+    bool            park(unsigned int);
 
   public:
 
     // Constructor and destructor
     PFB( unsigned int, unsigned int, unsigned int, unsigned int, 
-         unsigned int, bool );
+         unsigned int, bool, bool bComplex = false, int iNode = -1 );
+    PFB( Buffer<T>*, unsigned int, unsigned int, unsigned int, unsigned int, 
+         unsigned int, bool, bool bComplex = false, int iNode = -1 );
     ~PFB();
 
     // Interface functions
-    bool            push(SAMPLE_DATA_TYPE*, unsigned int, double, double);
+    bool            push(SAMPLE_DATA_TYPE*, unsigned int, double, double, unsigned long long);
+    bool            push(T*, unsigned int, unsigned long long);
     void            setCallback(ChannelizerReceiver*);
     void            waitForEmpty();
+    void            getStatus(ChannelizerStatus&);
 
     // Other functions
     bool            setWindowFunction(unsigned int);
+    bool            setOutputChannels(unsigned int, unsigned int);
+    void            setSecondMoment(bool);
+    void            setMinThreads(unsigned int);
+    bool            setFixedPoint(bool);
+    bool            setVoltageOutput(unsigned int, const std::vector<float>&);
+    void            setFlagger(SpectrumFlagger*);
+    void            printFixedPointError();
+    void            setId(unsigned int);
+    unsigned int    getId() const { return m_uId; }
+    unsigned int    getNumChannels() const { return m_uNumChannels; }
+    unsigned int    getNumOutputChannels() const { return m_uStopChannel - m_uStartChannel; }
+    unsigned int    getBlocksPerRequest() const { return m_uBlocksPerRequest; }
+    unsigned int    getNumInputs() const { return m_uInputs; }
     static void*    threadLoop(void*);
 
 };
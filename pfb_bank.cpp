@@ -0,0 +1,586 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "pfb_bank.h"
+#include "numa.h"
+
+
+
+// ----------------------------------------------------------------------------
+// Constructor -- Allocates the shared buffer of uNumBuffers blocks, each
+//                uBlockLength samples long.  With uNumShards of 1 or more,
+//                every shard gets such a buffer on its NUMA node and
+//                receives runs of uRunBlocks pushed blocks in turn.
+//                With 0 (the default), memory and threads are left where
+//                the system puts them.
+// ----------------------------------------------------------------------------
+template<typename T>
+PFBBank<T>::PFBBank( unsigned int uNumBuffers, unsigned int uBlockLength,
+                     unsigned int uNumShards, unsigned int uRunBlocks )
+{
+  m_uNumBuffers = uNumBuffers;
+  m_uBlockLength = uBlockLength;
+  m_uHistoryBlocks = 0;
+  m_uHistoryCount = 0;
+  m_uHistoryNext = 0;
+  m_uRunBlocks = (uRunBlocks < 1) ? 1 : uRunBlocks;
+  m_uRunCount = 0;
+  m_uShard = 0;
+  m_uSegment = 0;
+  m_pHistoryFailures = Metrics::counter("fastspec_shard_history_push_failures_total",
+    "History blocks that could not be pushed to start a run on the next shard");
+
+  if (uNumShards == 0) {
+    m_nodes.push_back(-1);
+  } else {
+    for (unsigned int s=0; s<uNumShards; s++) {
+      m_nodes.push_back(s % Numa::nodes());
+    }
+  }
+
+  // Create buffers
+  for (unsigned int s=0; s<m_nodes.size(); s++) {
+
+    if (m_nodes[s] < 0) {
+      printf("\nPFBBank: Creating %d shared buffers (%g MB)...\n", m_uNumBuffers,
+        ((float) m_uNumBuffers)*m_uBlockLength*sizeof(T)/1024/1024);
+    } else {
+      printf("\nPFBBank: Creating %d shared buffers (%g MB) for shard %u on node %d...\n",
+        m_uNumBuffers, ((float) m_uNumBuffers)*m_uBlockLength*sizeof(T)/1024/1024,
+        s, m_nodes[s]);
+    }
+
+    Buffer<T>* pBuffer = new Buffer<T>();
+    pBuffer->allocate(m_uNumBuffers, m_uBlockLength, m_nodes[s]);
+    pBuffer->setName((m_nodes.size() > 1) ? "channelizer" + std::to_string(s) : "channelizer");
+    m_buffers.push_back(pBuffer);
+  }
+
+  if (m_buffers.size() > 1) {
+    printf("PFBBank: Sending runs of %u blocks to each of %u shards in turn\n",
+      m_uRunBlocks, (unsigned int) m_buffers.size());
+  }
+}
+
+
+
+// ----------------------------------------------------------------------------
+// Destructor
+// ----------------------------------------------------------------------------
+template<typename T>
+PFBBank<T>::~PFBBank()
+{
+  // Stop and free the channelizers before the buffers they read go away
+  for (unsigned int i=0; i<m_pfbs.size(); i++) {
+    for (unsigned int s=0; s<m_pfbs[i].size(); s++) {
+      delete m_pfbs[i][s];
+    }
+  }
+  m_pfbs.clear();
+
+  for (unsigned int i=0; i<m_ddcs.size(); i++) {
+    delete m_ddcs[i];
+  }
+  m_ddcs.clear();
+
+  for (unsigned int s=0; s<m_buffers.size(); s++) {
+    delete m_buffers[s];
+  }
+  m_buffers.clear();
+
+  for (unsigned int i=0; i<m_history.size(); i++) {
+    free(m_history[i]);
+  }
+  m_history.clear();
+}
+
+
+
+// ----------------------------------------------------------------------------
+// add -- Creates a new PFB reading from the shared buffer (one per shard).
+//        Returns false if the block length is not a multiple of the PFB's 
+//        FFT length.
+// ----------------------------------------------------------------------------
+template<typename T>
+bool PFBBank<T>::add( unsigned int uNumThreads, unsigned int uNumChannels,
+                      unsigned int uNumTaps, unsigned int uWindow,
+                      bool bReturnInOrder )
+{
+  unsigned int uInputs = m_buffers[0]->inputs();
+  if ((uNumChannels == 0) || (m_uBlockLength % (2*uNumChannels*uInputs) != 0)) {
+    printf("PFBBank: Cannot add PFB with %u channels.  Block length %u must be "
+           "a multiple of the FFT length for each of %u inputs.\n", uNumChannels, 
+           m_uBlockLength, uInputs);
+    return false;
+  }
+
+  printf("PFBBank: Adding PFB %u with %u channels, %u taps\n",
+    size(), uNumChannels, uNumTaps);
+
+  vector<PFB<T>*> shards;
+  for (unsigned int s=0; s<m_buffers.size(); s++) {
+
+    // The first channelizer uses the buffer's default reader.  The others 
+    // may only fall half the buffer behind, so a slow one drops blocks 
+    // rather than stalling the first.
+    unsigned int uReader = (size() == 0) ? 0 : m_buffers[s]->addReader(m_buffers[s]->capacity() / 2);
+
+    PFB<T>* pPFB = new PFB<T>( m_buffers[s], uReader, uNumThreads, uNumChannels,
+                               uNumTaps, uWindow, bReturnInOrder, false, m_nodes[s] );
+    pPFB->setId(size());
+    shards.push_back(pPFB);
+  }
+  m_pfbs.push_back(shards);
+
+  // Each run must start with enough of the previous run for the new PFB
+  if (shards[0]->getBlocksPerRequest() - 1 > m_uHistoryBlocks) {
+
+    for (unsigned int i=0; i<m_history.size(); i++) {
+      free(m_history[i]);
+    }
+    m_history.clear();
+
+    m_uHistoryBlocks = shards[0]->getBlocksPerRequest() - 1;
+    m_uHistoryCount = 0;
+    m_uHistoryNext = 0;
+
+    if (m_buffers.size() > 1) {
+      for (unsigned int i=0; i<m_uHistoryBlocks; i++) {
+        m_history.push_back((T*) malloc(m_uBlockLength*sizeof(T)));
+        if (m_history.back() == NULL) {
+          printf("PFBBank: Failed to allocate history block %u\n", i);
+          return false;
+        }
+      }
+      m_historySamples.assign(m_uHistoryBlocks, 0);
+
+      if (m_uRunBlocks < m_uHistoryBlocks) {
+        printf("PFBBank: Runs of %u blocks are shorter than the %u blocks of history "
+               "needed.  Using %u.\n", m_uRunBlocks, m_uHistoryBlocks, m_uHistoryBlocks);
+        m_uRunBlocks = m_uHistoryBlocks;
+      }
+    }
+  }
+
+  return true;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// addZoom -- Creates a new DDC reading from the shared buffer that mixes the
+//            band around dCenter (fraction of the sample rate) to baseband,
+//            decimates by uDecimation, and channelizes it with a complex PFB
+//            of uNumChannels.  Returns false if the block length does not 
+//            hold a whole number of decimated PFB frames or the bank is 
+//            sharded.
+// ----------------------------------------------------------------------------
+template<typename T>
+bool PFBBank<T>::addZoom( unsigned int uNumThreads, unsigned int uNumPFBBuffers,
+                          double dCenter, unsigned int uDecimation,
+                          unsigned int uTapsPerPhase, unsigned int uNumChannels,
+                          unsigned int uNumTaps, unsigned int uWindow,
+                          bool bReturnInOrder )
+{
+  if ((uNumChannels == 0) || (uDecimation == 0) ||
+      (m_uBlockLength % (uDecimation*uNumChannels) != 0)) {
+    printf("PFBBank: Cannot add zoom with %u channels.  Block length %u must be "
+           "a multiple of decimation x channels.\n", uNumChannels, m_uBlockLength);
+    return false;
+  }
+
+  if (m_buffers.size() > 1) {
+    printf("PFBBank: Cannot add zoom to a bank with %u shards\n",
+      (unsigned int) m_buffers.size());
+    return false;
+  }
+
+  if (m_buffers[0]->inputs() > 1) {
+    printf("PFBBank: Cannot add zoom to a bank with %u inputs\n", 
+      m_buffers[0]->inputs());
+    return false;
+  }
+
+  unsigned int uReader = (size() == 0) ? 0 : m_buffers[0]->addReader(m_buffers[0]->capacity() / 2);
+
+  printf("PFBBank: Adding zoom %u with %u channels, %u taps, decimation %u\n",
+    size(), uNumChannels, uNumTaps, uDecimation);
+
+  DDC<T>* pDDC = new DDC<T>( m_buffers[0], uReader, uNumThreads, uNumPFBBuffers,
+                             dCenter, uDecimation, uTapsPerPhase, uNumChannels,
+                             uNumTaps, uWindow, bReturnInOrder );
+  pDDC->setId(size());
+  m_ddcs.push_back(pDDC);
+
+  return true;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setCallback -- All channelizers in the bank deliver to the same receiver
+// ----------------------------------------------------------------------------
+template<typename T>
+void PFBBank<T>::setCallback(ChannelizerReceiver* pReceiver)
+{
+  for (unsigned int i=0; i<m_pfbs.size(); i++) {
+    for (unsigned int s=0; s<m_pfbs[i].size(); s++) {
+      m_pfbs[i][s]->setCallback(pReceiver);
+    }
+  }
+
+  for (unsigned int i=0; i<m_ddcs.size(); i++) {
+    m_ddcs[i]->setCallback(pReceiver);
+  }
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setOutputChannels -- Limits the output of the channelizer with id uId (and
+//                      its copies in the other shards)
+// ----------------------------------------------------------------------------
+template<typename T>
+bool PFBBank<T>::setOutputChannels(unsigned int uId, unsigned int uStart, unsigned int uStop)
+{
+  for (unsigned int i=0; i<m_ddcs.size(); i++) {
+    if (m_ddcs[i]->getId() == uId) {
+      return m_ddcs[i]->setOutputChannels(uStart, uStop);
+    }
+  }
+
+  for (unsigned int i=0; i<m_pfbs.size(); i++) {
+    if (m_pfbs[i][0]->getId() == uId) {
+      for (unsigned int s=0; s<m_pfbs[i].size(); s++) {
+        if (!m_pfbs[i][s]->setOutputChannels(uStart, uStop)) {
+          return false;
+        }
+      }
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setSecondMoment
+// ----------------------------------------------------------------------------
+template<typename T>
+void PFBBank<T>::setSecondMoment(bool bEnable)
+{
+  for (unsigned int i=0; i<m_pfbs.size(); i++) {
+    for (unsigned int s=0; s<m_pfbs[i].size(); s++) {
+      m_pfbs[i][s]->setSecondMoment(bEnable);
+    }
+  }
+
+  for (unsigned int i=0; i<m_ddcs.size(); i++) {
+    m_ddcs[i]->setSecondMoment(bEnable);
+  }
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setMinThreads -- Makes the thread pool of every channelizer elastic (see
+//                  PFB::setMinThreads).  Channelizers with fewer threads
+//                  keep them all.
+// ----------------------------------------------------------------------------
+template<typename T>
+void PFBBank<T>::setMinThreads(unsigned int uMin)
+{
+  for (unsigned int i=0; i<m_pfbs.size(); i++) {
+    for (unsigned int s=0; s<m_pfbs[i].size(); s++) {
+      m_pfbs[i][s]->setMinThreads(uMin);
+    }
+  }
+
+  for (unsigned int i=0; i<m_ddcs.size(); i++) {
+    m_ddcs[i]->setMinThreads(uMin);
+  }
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setVoltageOutput -- Every channelizer passes on its complex spectrum (see
+//                     PFB::setVoltageOutput).  Gains per channel must suit
+//                     every channelizer.
+// ----------------------------------------------------------------------------
+template<typename T>
+bool PFBBank<T>::setVoltageOutput(unsigned int uBits, const std::vector<float>& gains)
+{
+  for (unsigned int i=0; i<m_pfbs.size(); i++) {
+    for (unsigned int s=0; s<m_pfbs[i].size(); s++) {
+      if (!m_pfbs[i][s]->setVoltageOutput(uBits, gains)) {
+        return false;
+      }
+    }
+  }
+
+  for (unsigned int i=0; i<m_ddcs.size(); i++) {
+    if (!m_ddcs[i]->setVoltageOutput(uBits, gains)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setFlagger -- The channelizer with id 0 flags RFI in its spectra (see 
+//               PFB::setFlagger)
+// ----------------------------------------------------------------------------
+template<typename T>
+void PFBBank<T>::setFlagger(SpectrumFlagger* pFlagger)
+{
+  for (unsigned int i=0; i<m_pfbs.size(); i++) {
+    for (unsigned int s=0; s<m_pfbs[i].size(); s++) {
+      if (m_pfbs[i][s]->getId() == 0) {
+        m_pfbs[i][s]->setFlagger(pFlagger);
+      }
+    }
+  }
+
+  for (unsigned int i=0; i<m_ddcs.size(); i++) {
+    if (m_ddcs[i]->getId() == 0) {
+      m_ddcs[i]->setFlagger(pFlagger);
+    }
+  }
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setInputs -- Splits each pushed block into uInputs interleaved inputs (see
+//              pfb_bank.h).  Must be called before any channelizer is added.
+// ----------------------------------------------------------------------------
+template<typename T>
+bool PFBBank<T>::setInputs(unsigned int uInputs)
+{
+  if (size() > 0) {
+    printf("PFBBank: Inputs must be set before channelizers are added\n");
+    return false;
+  }
+
+  if ((uInputs > 1) && (m_buffers.size() > 1)) {
+    printf("PFBBank: %u inputs can't be used with %u shards\n", uInputs,
+      (unsigned int) m_buffers.size());
+    return false;
+  }
+
+  for (unsigned int s=0; s<m_buffers.size(); s++) {
+    if (!m_buffers[s]->setInputs(uInputs)) {
+      return false;
+    }
+  }
+
+  if (uInputs > 1) {
+    printf("PFBBank: Channelizing %u inputs with cross power\n", uInputs);
+  }
+
+  return true;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setFixedPoint -- Sums the taps of every PFB in fixed point and prints the
+//                  error that adds for each channelizer.  Should be set 
+//                  before data is pushed.  On failure the bank is left in
+//                  floating point.
+// ----------------------------------------------------------------------------
+template<typename T>
+bool PFBBank<T>::setFixedPoint(bool bEnable)
+{
+  if (bEnable && !m_ddcs.empty()) {
+    printf("PFBBank: Fixed-point taps can't be used with zoom channelizers\n");
+    return false;
+  }
+
+  if (bEnable && (m_buffers.size() > 1)) {
+    printf("PFBBank: Fixed-point taps can't be used with %u shards\n",
+      (unsigned int) m_buffers.size());
+    return false;
+  }
+
+  bool bOK = m_buffers[0]->setRaw(bEnable);
+  for (unsigned int i=0; bOK && (i<m_pfbs.size()); i++) {
+    bOK = m_pfbs[i][0]->setFixedPoint(bEnable);
+  }
+
+  if (!bOK) {
+    for (unsigned int i=0; i<m_pfbs.size(); i++) {
+      m_pfbs[i][0]->setFixedPoint(false);
+    }
+    m_buffers[0]->setRaw(false);
+    return false;
+  }
+
+  if (bEnable) {
+    for (unsigned int i=0; i<m_pfbs.size(); i++) {
+      m_pfbs[i][0]->printFixedPointError();
+    }
+  }
+
+  return true;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// waitForEmpty - Blocks until every channelizer has finished what it can
+//                process, then clears the stragglers from the shared buffers.
+//                The next push starts a new run without history.
+// ----------------------------------------------------------------------------
+template<typename T>
+void PFBBank<T>::waitForEmpty()
+{
+  for (unsigned int i=0; i<m_pfbs.size(); i++) {
+    for (unsigned int s=0; s<m_pfbs[i].size(); s++) {
+      m_pfbs[i][s]->waitForEmpty();
+    }
+  }
+
+  for (unsigned int i=0; i<m_ddcs.size(); i++) {
+    m_ddcs[i]->waitForEmpty();
+  }
+
+  for (unsigned int s=0; s<m_buffers.size(); s++) {
+    m_buffers[s]->clear();
+  }
+
+  m_uHistoryCount = 0;
+  m_uRunCount = m_uRunBlocks;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// getStatus -- Adds the shared buffer occupancy and the status of every
+//              channelizer in the bank.
+// ----------------------------------------------------------------------------
+template<typename T>
+void PFBBank<T>::getStatus(ChannelizerStatus& status)
+{
+  for (unsigned int s=0; s<m_buffers.size(); s++) {
+    status.uBuffersUsed += m_buffers[s]->size();
+    status.uBuffersTotal += m_buffers[s]->capacity();
+  }
+
+  for (unsigned int i=0; i<m_pfbs.size(); i++) {
+    for (unsigned int s=0; s<m_pfbs[i].size(); s++) {
+      m_pfbs[i][s]->getStatus(status);
+    }
+  }
+
+  for (unsigned int i=0; i<m_ddcs.size(); i++) {
+    m_ddcs[i]->getStatus(status);
+  }
+}
+
+
+
+// ----------------------------------------------------------------------------
+// fill -- Fraction of the fullest shard's buffer in use
+// ----------------------------------------------------------------------------
+template<typename T>
+double PFBBank<T>::fill()
+{
+  double dFill = 0;
+  for (unsigned int s=0; s<m_buffers.size(); s++) {
+    double d = ((double) m_buffers[s]->size()) / m_buffers[s]->capacity();
+    dFill = (d > dFill) ? d : dFill;
+  }
+
+  return dFill;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// push -- Copies data into the shared buffer once for all PFBs.  If no
+//         buffers are available, it will return false.  When sharded, the
+//         data goes to the current shard's buffer and the last blocks of each
+//         run are also kept to start the next run on the next shard.
+//         History blocks that can't be pushed are only counted (the new 
+//         run loses the spectra that reach back into them), so the result 
+//         is that of the live block.
+// ----------------------------------------------------------------------------
+template<typename T>
+bool PFBBank<T>::push(SAMPLE_DATA_TYPE* pIn, unsigned int uLength, double dScale,
+                      double dOffset, unsigned long long uSample)
+{
+  if (m_buffers.size() == 1) {
+    return m_buffers[0]->push(pIn, uLength, dScale, dOffset, uSample);
+  }
+
+  // Start a new run on the next shard with the end of the previous run.
+  // Each history block is marked with how many blocks before the run it is.
+  if (m_uRunCount >= m_uRunBlocks) {
+
+    m_uShard = (m_uShard + 1) % m_buffers.size();
+    m_uRunCount = 0;
+    m_uSegment++;
+
+    Buffer<T>* pBuffer = m_buffers[m_uShard];
+    for (unsigned int k=m_uHistoryCount; k>0; k--) {
+      unsigned int h = (m_uHistoryNext + m_uHistoryBlocks - k) % m_uHistoryBlocks;
+      pBuffer->setSegment(m_uSegment, k);
+      if (!pBuffer->push(m_history[h], m_uBlockLength, m_historySamples[h])) {
+        m_pHistoryFailures->add();
+      }
+    }
+    pBuffer->setSegment(m_uSegment, 0);
+  }
+
+  // Keep a scaled copy of the blocks the next run will need
+  if ((m_uHistoryBlocks > 0) && (uLength == m_uBlockLength) &&
+      (m_uRunCount + m_uHistoryBlocks >= m_uRunBlocks)) {
+
+    T* pHistory = m_history[m_uHistoryNext];
+    T scale = (T) dScale;
+    T offset = (T) dOffset;
+    for (unsigned int i=0; i<uLength; i++) {
+      pHistory[i] = ((T) pIn[i]) * scale + offset;
+    }
+    m_historySamples[m_uHistoryNext] = uSample;
+
+    m_uHistoryNext = (m_uHistoryNext + 1) % m_uHistoryBlocks;
+    m_uHistoryCount = (m_uHistoryCount < m_uHistoryBlocks) ? m_uHistoryCount + 1 : m_uHistoryBlocks;
+  }
+
+  m_uRunCount++;
+
+  return m_buffers[m_uShard]->push(pIn, uLength, dScale, dOffset, uSample);
+
+} // push()
+
+
+
+// ----------------------------------------------------------------------------
+// create -- Makes a bank that computes in double precision if bDouble is 
+//           set, otherwise in single precision
+// ----------------------------------------------------------------------------
+ChannelizerBank* ChannelizerBank::create( bool bDouble, unsigned int uNumBuffers,
+                                          unsigned int uBlockLength,
+                                          unsigned int uNumShards,
+                                          unsigned int uRunBlocks )
+{
+  printf("\nChannelizerBank: Computing in %s precision\n", bDouble ? "double" : "single");
+
+  if (bDouble) {
+    return new PFBBank<double>(uNumBuffers, uBlockLength, uNumShards, uRunBlocks);
+  }
+
+  return new PFBBank<float>(uNumBuffers, uBlockLength, uNumShards, uRunBlocks);
+}
+
+
+
+template class PFBBank<float>;
+template class PFBBank<double>;
@@ -0,0 +1,148 @@
+#ifndef _PFB_BANK_H_
+#define _PFB_BANK_H_
+
+#include <vector>
+#include "channelizer.h"
+#include "buffer.h"
+#include "pfb.h"
+#include "ddc.h"
+
+using namespace std;
+
+// ---------------------------------------------------------------------------
+//
+// CHANNELIZERBANK
+//
+// Interface to a PFBBank of either compute precision.  create() makes a 
+// PFBBank<float> or PFBBank<double>, so the precision is a run-time setting
+// rather than a build option.  Channelizers are referred to by their id 
+// (their order of addition, starting at 0).
+//
+// ---------------------------------------------------------------------------
+class ChannelizerBank : public Channelizer {
+
+  public:
+
+    static ChannelizerBank* create( bool, unsigned int, unsigned int, 
+                                    unsigned int uNumShards = 0, 
+                                    unsigned int uRunBlocks = 64 );
+
+    virtual ~ChannelizerBank() {}
+
+    virtual bool          add( unsigned int, unsigned int, unsigned int, 
+                               unsigned int, bool ) = 0;
+    virtual bool          addZoom( unsigned int, unsigned int, double, 
+                                   unsigned int, unsigned int, unsigned int,
+                                   unsigned int, unsigned int, bool ) = 0;
+    virtual bool          setOutputChannels(unsigned int, unsigned int, unsigned int) = 0;
+    virtual void          setSecondMoment(bool) = 0;
+    virtual void          setMinThreads(unsigned int) = 0;
+    virtual bool          setFixedPoint(bool) = 0;
+    virtual bool          setVoltageOutput(unsigned int, const std::vector<float>&) = 0;
+    virtual bool          setInputs(unsigned int) = 0;
+    virtual void          setFlagger(SpectrumFlagger*) = 0;
+    virtual unsigned int  size() const = 0;
+
+};
+
+
+
+// ---------------------------------------------------------------------------
+//
+// PFBBANK
+//
+// Fans one stream of samples out to several PFB channelizers with different
+// configurations (channels, taps, window).  The bank owns the buffer and 
+// each PFB reads from it as an independent reader, so each sample is copied 
+// into the buffer only once regardless of how many PFBs use it.  The block 
+// length pushed into the bank must be a multiple of every PFB's FFT length.
+//
+// Zoom channelizers (a DDC feeding a complex PFB) can be added to the bank 
+// as well and read from the same buffer.
+//
+// Each PFB or DDC is given an id (its order of addition, starting at 0) that
+// is passed to the receiver in ChannelizerData::uId.
+//
+// On NUMA machines the bank can be split into shards, one per node in turn.
+// Each shard has its own buffer in its node's memory and its own copy of 
+// every PFB, with threads bound to the node.  Pushed blocks go to one shard
+// for a run of blocks, then to the next.  Each run starts with the last 
+// blocks of the previous run (enough for the taps of its final frames), 
+// marked as history, so no spectra are lost or repeated at the boundaries.
+// Zoom channelizers can't be sharded.
+//
+// setFixedPoint switches every PFB to fixed-point taps (see PFB) and the
+// buffer to raw 16 bit codes.  It needs a single shard and no zoom
+// channelizers, which read scaled samples from the same buffer.
+//
+// setFlagger runs an RFI flagging stage on the spectra of the first 
+// channelizer added (id 0, in every shard).  The others aren't flagged.
+//
+// setInputs(2) takes pushed blocks with two interleaved inputs (see 
+// Buffer::setInputs) and every PFB then channelizes both and forms their
+// cross power.  Each block holds half as many samples of each input.  It 
+// must be set before channelizers are added, and needs a single shard and
+// no zoom channelizers.
+//
+// The buffer, PFBs and DDCs all compute in T (float or double).
+//
+// ---------------------------------------------------------------------------
+template<typename T>
+class PFBBank : public ChannelizerBank {
+
+  private:
+
+    // Member variables
+    vector<Buffer<T>*>            m_buffers;      // One per shard
+    vector<int>                   m_nodes;        // NUMA node of each shard
+    vector< vector<PFB<T>*> >     m_pfbs;         // [channelizer][shard]
+    vector<DDC<T>*>               m_ddcs;
+    unsigned int                  m_uNumBuffers;
+    unsigned int                  m_uBlockLength;
+
+    // Routing of blocks to shards
+    vector<T*>                    m_history;      // Last blocks of the run
+    vector<unsigned long long>    m_historySamples; // and their sample indices
+    unsigned int                  m_uHistoryBlocks;
+    unsigned int                  m_uHistoryCount;
+    unsigned int                  m_uHistoryNext;
+    unsigned int                  m_uRunBlocks;
+    unsigned int                  m_uRunCount;
+    unsigned int                  m_uShard;
+    unsigned long long            m_uSegment;
+    MetricCounter*                m_pHistoryFailures;
+
+  public:
+
+    // Constructor and destructor
+    PFBBank( unsigned int, unsigned int, unsigned int uNumShards = 0, 
+             unsigned int uRunBlocks = 64 );
+    ~PFBBank();
+
+    // Interface functions
+    bool            push(SAMPLE_DATA_TYPE*, unsigned int, double, double, unsigned long long);
+    void            setCallback(ChannelizerReceiver*);
+    void            waitForEmpty();
+    void            getStatus(ChannelizerStatus&);
+    double          fill();
+
+    // Other functions
+    bool            add( unsigned int, unsigned int, unsigned int, 
+                         unsigned int, bool );
+    bool            addZoom( unsigned int, unsigned int, double, unsigned int,
+                             unsigned int, unsigned int, unsigned int, 
+                             unsigned int, bool );
+    bool            setOutputChannels(unsigned int, unsigned int, unsigned int);
+    void            setSecondMoment(bool);
+    void            setMinThreads(unsigned int);
+    bool            setFixedPoint(bool);
+    bool            setVoltageOutput(unsigned int, const std::vector<float>&);
+    bool            setInputs(unsigned int);
+    void            setFlagger(SpectrumFlagger*);
+    unsigned int    size() const { return m_pfbs.size() + m_ddcs.size(); }
+
+};
+
+
+
+#endif // _PFB_BANK_H_
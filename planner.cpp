@@ -0,0 +1,263 @@
+#include "planner.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>       // memset
+#include <unistd.h>       // sysconf, usleep, fsync, unlink
+#include <math.h>         // ceil, floor
+#include <atomic>
+#include "pfb.h"
+#include "numa.h"
+#include "timing.h"
+
+using namespace std;
+
+
+
+// ----------------------------------------------------------------------------
+// BenchReceiver -- Counts the spectra from the benchmark PFB
+// ----------------------------------------------------------------------------
+class BenchReceiver : public ChannelizerReceiver {
+
+  public:
+
+    std::atomic<unsigned long>  m_uSpectra;
+
+    BenchReceiver() : m_uSpectra(0) {}
+
+    void onChannelizerData(ChannelizerData<float>*) { m_uSpectra++; }
+    void onChannelizerData(ChannelizerData<double>*) { m_uSpectra++; }
+};
+
+
+
+// ----------------------------------------------------------------------------
+// Constructor
+// ----------------------------------------------------------------------------
+Planner::Planner(const PlannerConfig& config)
+{
+  m_config = config;
+  m_dPFBRate = 0;
+  m_dDiskRate = 0;
+  m_uChannelizerBuffers = 0;
+  m_uDumpBuffers = 0;
+  m_dStallSeconds = 0;
+
+  if (m_config.uNumShards < 1) {
+    m_config.uNumShards = 1;
+  }
+
+  if (!m_config.bDumper) {
+    m_config.bDump = false;
+  }
+}
+
+
+
+// ----------------------------------------------------------------------------
+// benchmarkPFB -- Returns the samples per second a PFB with the main
+//                 channelizer's configuration can process in precision T
+// ----------------------------------------------------------------------------
+template<typename T>
+double Planner::benchmarkPFB()
+{
+  unsigned int uNumFFT = 2 * m_config.uNumChannels;
+  BenchReceiver receiver;
+
+  printf("\nPlanner: Benchmarking the channelizer for %g seconds...\n", PLANNER_PFB_SECONDS);
+
+  PFB<T>* pPFB = new PFB<T>( m_config.uNumThreads, PLANNER_PFB_BUFFERS,
+                             m_config.uNumChannels, m_config.uNumTaps,
+                             m_config.uWindow, false );
+
+  // No setId, so the benchmark PFB doesn't leave metrics behind
+  if (m_config.bFixedPoint) {
+    pPFB->setFixedPoint(true);
+  }
+  pPFB->setCallback(&receiver);
+
+  SAMPLE_DATA_TYPE* pSamples = (SAMPLE_DATA_TYPE*) malloc(uNumFFT * sizeof(SAMPLE_DATA_TYPE));
+  if (!pSamples) {
+    delete pPFB;
+    return 0;
+  }
+  for (unsigned int i=0; i<uNumFFT; i++) {
+    pSamples[i] = (SAMPLE_DATA_TYPE) (i % 64);
+  }
+
+  // Keep the PFB's buffer full until time is up
+  Timer timer;
+  timer.tic();
+  unsigned long uStart = receiver.m_uSpectra;
+  unsigned long long uSample = 0;
+  while (timer.toc() < PLANNER_PFB_SECONDS) {
+    if (pPFB->push(pSamples, uNumFFT, 1.0, 0.0, uSample)) {
+      uSample += uNumFFT;
+    } else {
+      usleep(10);
+    }
+  }
+  double dElapsed = timer.toc();
+  unsigned long uSpectra = receiver.m_uSpectra - uStart;
+
+  pPFB->waitForEmpty();
+  delete pPFB;
+  free(pSamples);
+
+  return (dElapsed > 0) ? uSpectra * (double) uNumFFT / dElapsed : 0;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// benchmarkDisk -- Returns the bytes per second written to a scratch file in
+//                  the dump directory, or 0 if it can't be written
+// ----------------------------------------------------------------------------
+double Planner::benchmarkDisk()
+{
+  unsigned long uBlock = m_config.uSamplesPerTransfer * m_config.uBytesPerSample;
+  string sPath = m_config.sDumpDirectory + "/.fastspec_planner.tmp";
+  unsigned long uWritten = 0;
+
+  printf("Planner: Benchmarking writes to %s...\n", m_config.sDumpDirectory.c_str());
+
+  char* pBlock = (char*) malloc(uBlock);
+  FILE* pFile = fopen(sPath.c_str(), "wb");
+  if (!pBlock || !pFile) {
+    printf("Planner: Failed to write %s\n", sPath.c_str());
+    free(pBlock);
+    if (pFile) { fclose(pFile); }
+    return 0;
+  }
+  memset(pBlock, 0x5a, uBlock);
+
+  Timer timer;
+  timer.tic();
+  while ((uWritten < PLANNER_DISK_BYTES) && (timer.toc() < PLANNER_DISK_SECONDS)) {
+    if (fwrite(pBlock, 1, uBlock, pFile) != uBlock) {
+      break;
+    }
+    uWritten += uBlock;
+  }
+
+  // Include the time to get it onto the disk
+  fflush(pFile);
+  fsync(fileno(pFile));
+  double dElapsed = timer.toc();
+
+  fclose(pFile);
+  unlink(sPath.c_str());
+  free(pBlock);
+
+  return (dElapsed > 0) ? uWritten / dElapsed : 0;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// channelizerBytes, dumpBytes -- Memory of a pool of uBuffers
+// ----------------------------------------------------------------------------
+double Planner::channelizerBytes(unsigned int uBuffers) const
+{
+  return ((double) uBuffers) * m_config.uBlockLength *
+    (m_config.bDouble ? sizeof(double) : sizeof(float)) *
+    m_config.uNumShards;
+}
+
+double Planner::dumpBytes(unsigned int uBuffers) const
+{
+  return ((double) uBuffers) * m_config.uSamplesPerTransfer * m_config.uBytesPerSample;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// plan
+// ----------------------------------------------------------------------------
+bool Planner::plan()
+{
+  double dRate = m_config.dSampleRate;
+  double dBudget = m_config.dBudgetMB * 1024 * 1024;
+
+  // Each pool needs at least a transfer's worth of blocks plus the blocks the
+  // consumer holds while it works.  Every second of stall adds a second of
+  // samples.
+  unsigned int uMinChannelizer = (unsigned int) ceil(((double) m_config.uSamplesPerTransfer) /
+    m_config.uBlockLength) + m_config.uNumTaps;
+  unsigned int uMinDump = m_config.bDumper ? PLANNER_MIN_DUMP : 0;
+  double dChannelizerPerSecond = dRate / m_config.uBlockLength;
+  double dDumpPerSecond = m_config.bDump ? dRate / m_config.uSamplesPerTransfer : 0;
+
+  // Measure the consumers
+  m_dPFBRate = m_config.bDouble ? benchmarkPFB<double>() : benchmarkPFB<float>();
+  m_dPFBRate *= min(m_config.uNumShards, Numa::nodes());
+  m_dDiskRate = m_config.bDump ? benchmarkDisk() : 0;
+
+  // Fit both pools in the budget, shortening the stall they cover if needed
+  double dMinBytes = channelizerBytes(uMinChannelizer) + dumpBytes(uMinDump);
+  double dBytesPerSecond = channelizerBytes(1) * dChannelizerPerSecond +
+                           dumpBytes(1) * dDumpPerSecond;
+
+  if (dMinBytes > dBudget) {
+    printf("Planner: The minimum pools need %.1f MB, more than the budget of %.1f MB. Abort.\n",
+      dMinBytes / 1024 / 1024, m_config.dBudgetMB);
+    return false;
+  }
+
+  m_dStallSeconds = m_config.dStallSeconds;
+  if (dMinBytes + dBytesPerSecond * m_dStallSeconds > dBudget) {
+    m_dStallSeconds = (dBudget - dMinBytes) / dBytesPerSecond;
+  }
+
+  m_uChannelizerBuffers = uMinChannelizer + (unsigned int) floor(dChannelizerPerSecond * m_dStallSeconds);
+  m_uDumpBuffers = uMinDump + (unsigned int) floor(dDumpPerSecond * m_dStallSeconds);
+
+  double dTotal = channelizerBytes(m_uChannelizerBuffers) + dumpBytes(m_uDumpBuffers);
+  double dPhysical = ((double) sysconf(_SC_PHYS_PAGES)) * sysconf(_SC_PAGESIZE);
+  double dAvailable = ((double) sysconf(_SC_AVPHYS_PAGES)) * sysconf(_SC_PAGESIZE);
+
+  // Print the plan
+  printf("\nPlanner: Channelizer processes %.1f MS/s, needs %.1f MS/s (%.0f%%)\n",
+    m_dPFBRate / 1e6, dRate / 1e6, 100.0 * dRate / m_dPFBRate);
+  if (m_config.bDump) {
+    if (m_dDiskRate > 0) {
+      printf("Planner: Disk writes %.1f MB/s, dump needs %.1f MB/s (%.0f%%)\n",
+        m_dDiskRate / 1024 / 1024, dRate * m_config.uBytesPerSample / 1024 / 1024,
+        100.0 * dRate * m_config.uBytesPerSample / m_dDiskRate);
+    }
+  } else if (m_config.bDumper) {
+    printf("Planner: Dumping is off, so the dump pool has the minimum %u buffers\n", uMinDump);
+  }
+  printf("Planner: num_fft_buffers  = %u (%.1f MB", m_uChannelizerBuffers,
+    channelizerBytes(m_uChannelizerBuffers) / 1024 / 1024);
+  if (m_config.uNumShards > 1) {
+    printf(" for %u shards", m_config.uNumShards);
+  }
+  printf(")\n");
+  if (m_config.bDumper) {
+    printf("Planner: num_dump_buffers = %u (%.1f MB)\n", m_uDumpBuffers,
+      dumpBytes(m_uDumpBuffers) / 1024 / 1024);
+  }
+  printf("Planner: Covers a stall of %.3g seconds (target %.3g seconds)\n",
+    m_dStallSeconds, m_config.dStallSeconds);
+  printf("Planner: Total %.1f MB of %.1f MB budget, %.1f MB physical memory (%.1f MB free)\n",
+    dTotal / 1024 / 1024, m_config.dBudgetMB, dPhysical / 1024 / 1024, dAvailable / 1024 / 1024);
+
+  if (m_dPFBRate < dRate) {
+    printf("Planner: WARNING! The channelizer is slower than the digitizer.  The pool will "
+           "only delay drops.\n");
+  }
+  if (m_config.bDump && (m_dDiskRate > 0) && (m_dDiskRate < dRate * m_config.uBytesPerSample)) {
+    printf("Planner: WARNING! The disk is slower than the dump.  The pool will only delay "
+           "drops.\n");
+  }
+  if (m_dStallSeconds < m_config.dStallSeconds) {
+    printf("Planner: WARNING! The budget only covers a stall of %.3g seconds\n", m_dStallSeconds);
+  }
+
+  if (dTotal > dPhysical) {
+    printf("Planner: The plan needs more than the physical memory. Abort.\n");
+    return false;
+  }
+
+  return true;
+}
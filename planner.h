@@ -0,0 +1,90 @@
+#ifndef _PLANNER_H_
+#define _PLANNER_H_
+
+#include <string>
+
+// ---------------------------------------------------------------------------
+//
+// PLANNER
+//
+// Sizes the channelizer and dump buffer pools at startup from a memory
+// budget instead of fixed num_fft_buffers and num_dump_buffers.  Each pool
+// should hold the samples that arrive while its consumer stalls for a
+// target time (e.g. a slow disk or a burst of other work on the CPUs), on
+// top of the blocks it needs to operate at all.
+//
+// Before sizing, plan() runs two short benchmarks so the plan can say
+// whether the consumers keep up at all:
+//
+//   - A PFB with the main channelizer's configuration, fed as fast as
+//     possible for PLANNER_PFB_SECONDS
+//   - Writing up to PLANNER_DISK_BYTES of transfers to the dump directory
+//     (only if dumping is on)
+//
+// If both pools covering the target stall don't fit in the budget, the
+// stall they cover is reduced until they do.  plan() fails if even the
+// minimum pools don't fit, or if the plan needs more than the physical
+// memory of the machine (swapping is worse than dropping).
+//
+// ---------------------------------------------------------------------------
+
+#define PLANNER_PFB_SECONDS     0.5
+#define PLANNER_PFB_BUFFERS     64
+#define PLANNER_DISK_BYTES      (256UL*1024*1024)
+#define PLANNER_DISK_SECONDS    2.0
+#define PLANNER_MIN_DUMP        2
+
+struct PlannerConfig {
+  double          dSampleRate;            // Samples per second
+  unsigned long   uSamplesPerTransfer;
+  unsigned int    uBytesPerSample;        // Raw samples (dump)
+  unsigned int    uBlockLength;           // Samples per channelizer block
+  unsigned int    uNumChannels;
+  unsigned int    uNumTaps;
+  unsigned int    uWindow;
+  unsigned int    uNumThreads;
+  bool            bFixedPoint;            // See PFB::setFixedPoint
+  bool            bDouble;                // Compute precision (see ChannelizerBank)
+  unsigned int    uNumShards;             // Channelizer pools (see PFBBank)
+  bool            bDumper;                // There is a dump pool
+  bool            bDump;                  // Size the dump pool for dumping
+  std::string     sDumpDirectory;
+  double          dBudgetMB;
+  double          dStallSeconds;
+};
+
+
+class Planner {
+
+  private:
+
+    // Member variables
+    PlannerConfig     m_config;
+    double            m_dPFBRate;             // Samples per second
+    double            m_dDiskRate;            // Bytes per second (0 if unknown)
+    unsigned int      m_uChannelizerBuffers;
+    unsigned int      m_uDumpBuffers;
+    double            m_dStallSeconds;        // Stall both pools cover
+
+    // Private helper functions
+    template<typename T>
+    double            benchmarkPFB();
+    double            benchmarkDisk();
+    double            channelizerBytes(unsigned int) const;
+    double            dumpBytes(unsigned int) const;
+
+  public:
+
+    // Constructor and destructor
+    Planner( const PlannerConfig& );
+    ~Planner() {}
+
+    // Benchmark, size the pools and print the plan.  Returns false if the
+    // plan doesn't fit in the budget or in physical memory.
+    bool              plan();
+
+    unsigned int      channelizerBuffers() const { return m_uChannelizerBuffers; }
+    unsigned int      dumpBuffers() const { return m_uDumpBuffers; }
+};
+
+#endif // _PLANNER_H_
@@ -14,6 +14,7 @@
 #include <ctype.h>
 
 #include "pxboard.h"
+#include "timing.h"
 
 
 
@@ -24,30 +25,25 @@ PXBoard::PXBoard( double dAcquisitionRate,
                   unsigned long uSamplesPerAccumulation,
                   unsigned int uSamplesPerTransfer,
                   unsigned int uInputChannel,
-                  unsigned int uVoltageRange )
+                  unsigned int uVoltageRange ) :
+  StreamingDigitizer(dAcquisitionRate, uSamplesPerAccumulation, uSamplesPerTransfer)
 {
 
   // Pre-populate the user specifiable setup parameters
   m_dAcquisitionRate = dAcquisitionRate;        // MS/s
-  m_uSamplesPerAccumulation = uSamplesPerAccumulation;
-  m_uSamplesPerTransfer = uSamplesPerTransfer;  // 2^20 known to work well
   m_uInputChannel = uInputChannel;              // 0 = dual, 1= input1, 2=input2
   m_uVoltageRange1 = uVoltageRange;
   m_uVoltageRange2 = uVoltageRange;
 
+  // Dual channel transfers interleave the samples of both inputs
+  setInputs((m_uInputChannel == 0) ? 2 : 1);
+
   // To be retrieved from board
   m_uSerialNumber = -1;
   m_uBoardRevision = -1;
 
   // To be assigned 
   m_hBoard = NULL;
-  m_pBuffer1 = NULL;
-  m_pBuffer2 = NULL;
-  m_pReceiver = NULL;
-  m_dScale = 0;
-  m_dOffset = 0;
-
-  m_bStop = false;
 }
 
 
@@ -61,16 +57,6 @@ PXBoard::~PXBoard()
 
 
 
-// ----------------------------------------------------------------------------
-// stop
-// ----------------------------------------------------------------------------
-void PXBoard::stop()
-{
-  m_bStop = true;
-}
-
-
-
 // ----------------------------------------------------------------------------
 // connect -- Connect to and initialize the PX14400 device
 // uBoardNumber = 1 will use first board found, otherwise specify serial number
@@ -133,15 +119,7 @@ void PXBoard::disconnect()
 
     EndBufferedPciAcquisitionPX14(m_hBoard);
 
-    if (m_pBuffer1) {
-      FreeDmaBufferPX14(m_hBoard, m_pBuffer1);
-      m_pBuffer1 = NULL;
-    }
-
-    if (m_pBuffer2) {
-      FreeDmaBufferPX14(m_hBoard, m_pBuffer2);
-      m_pBuffer2 = NULL;
-    }
+    freeRing();
 
     DisconnectFromDevicePX14(m_hBoard);
 
@@ -158,42 +136,16 @@ void PXBoard::disconnect()
 // ----------------------------------------------------------------------------
 bool PXBoard::setSamplesPerTransfer() 
 {
-  // Allocate a DMA buffer that will receive PCI acquisition data. By
-  // allocating a DMA buffer, we can use the "fast" PX14400 library
-  // transfer routines for highest performance.  We allocate two DMA 
-  // buffers and alternate transfers between them.  We'll use 
-  // asynchronous data transfers so we can transfer to one buffer 
-  // while processing the other.
-
-  int res;
-
-
-  // Apply the settings (if connected to board)
+  // Allocate the DMA buffers that will receive PCI acquisition data. By
+  // allocating DMA buffers, we can use the "fast" PX14400 library
+  // transfer routines for highest performance.  We allocate a ring of DMA 
+  // buffers and transfer into them in turn.  We'll use asynchronous data 
+  // transfers so we can transfer to one buffer while the others are 
+  // processed.
+
+  // Apply the settings (if connected to board).  Old buffers are freed first.
   if (m_hBoard) {
-
-    // First free old buffers (if they exist)
-    if (m_pBuffer1) {
-      FreeDmaBufferPX14(m_hBoard, m_pBuffer1);
-      m_pBuffer1 = NULL;
-    }
-
-    if (m_pBuffer2) {
-      FreeDmaBufferPX14(m_hBoard, m_pBuffer2);
-      m_pBuffer2 = NULL;
-    }
-
-    // Then allocate new buffers
-    res = AllocateDmaBufferPX14(m_hBoard, m_uSamplesPerTransfer, &m_pBuffer1);
-    if (SIG_SUCCESS != res) {
-      DumpLibErrorPX14(res, "Failed to allocate DMA buffer #1: ", m_hBoard);
-      return false;
-    }
-
-    res = AllocateDmaBufferPX14(m_hBoard, m_uSamplesPerTransfer, &m_pBuffer2);
-    if (SIG_SUCCESS != res) {
-      DumpLibErrorPX14(res, "Failed to allocate DMA buffer #2: ", m_hBoard);
-      return false;
-    }
+    return allocateRing();
   }
 
   return true;
@@ -299,24 +251,6 @@ bool PXBoard::setVoltageRange()
 } // setVoltageRange()
 
 
-// ----------------------------------------------------------------------------
-// scale
-// ----------------------------------------------------------------------------
-double PXBoard::scale() 
-{ 
-  return m_dScale; 
-}  // scale()
-
-
-// ----------------------------------------------------------------------------
-// offset
-// ----------------------------------------------------------------------------
-double PXBoard::offset() 
-{
-  return m_dOffset; 
-} // offset()
-
-
 // ----------------------------------------------------------------------------
 // bytesPerSample
 // ----------------------------------------------------------------------------
@@ -339,37 +273,45 @@ Digitizer::DataType PXBoard::type()
 
 
 // ----------------------------------------------------------------------------
-// acquire() - Transfer data from the board 
-//
-//         Set m_uSamplesPerAccumulation = 0 for infinte loop.  Otherwise, 
-//         transfers are are acquired and sent to the callback.  The callback 
-//         should return the number of samples handled successfully.  This  
-//         function will continue to deliver samples to the callback until the 
-//         sum of all callbacks responses reach m_uSamplesPerAccumulation. 
-//         The loop can be aborted by calling stop().
-//
+// allocateTransfer
 // ----------------------------------------------------------------------------
-bool PXBoard::acquire()
+void* PXBoard::allocateTransfer()
 {
-  px14_sample_t *pCurrentBuffer = NULL;
-  px14_sample_t *pPreviousBuffer = NULL;
-  unsigned long uNumSamples = 0;
-  unsigned long n = 0;
-  int res;
+  px14_sample_t* pBuffer = NULL;
+
+  int res = AllocateDmaBufferPX14(m_hBoard, m_uSamplesPerTransfer, &pBuffer);
+  if (SIG_SUCCESS != res) {
+    DumpLibErrorPX14(res, "Failed to allocate DMA buffer: ", m_hBoard);
+    return NULL;
+  }
 
-  // Reset the stop flag
-  m_bStop = false;
+  return pBuffer;
+} // allocateTransfer()
+
+
+
+// ----------------------------------------------------------------------------
+// freeTransfer
+// ----------------------------------------------------------------------------
+void PXBoard::freeTransfer(void* pBuffer)
+{
+  FreeDmaBufferPX14(m_hBoard, (px14_sample_t*) pBuffer);
+} // freeTransfer()
+
+
+
+// ----------------------------------------------------------------------------
+// startStream -- Arm recording and trigger it
+// ----------------------------------------------------------------------------
+bool PXBoard::startStream()
+{
+  int res;
 
   if (m_hBoard == NULL) {
     printf("No board handle at start of run.  Was PXBoard::connect() called?");
     return false;
   }
 
-  if (m_pBuffer1 == NULL || m_pBuffer2 == NULL) {
-    printf("No transfer buffers at start of run.  Was PXBoard::connect() called?");
-    return false;
-  }
-
   // Arm recording - Acquisition will begin when the PX14400 receives
   // a trigger event and then continue until stopped.
   if ((res=BeginBufferedPciAcquisitionPX14(m_hBoard)) != SIG_SUCCESS) {
@@ -382,100 +324,69 @@ bool PXBoard::acquire()
   // no input is connected to the board.
   if ((res=IssueSoftwareTriggerPX14(m_hBoard)) != SIG_SUCCESS) {
     DumpLibErrorPX14(res, "Failed to issue software trigger: ", m_hBoard);
+    EndBufferedPciAcquisitionPX14(m_hBoard);
     return false;
   }
 
-  // Main recording loop - The main idea here is that we're alternating
-  // between two halves of our DMA buffer. While we're transferring
-  // fresh acquisition data to one half, we process the other half.
+  return true;
+} // startStream()
 
-  // Loop over number of transfers requested
-  while (!m_bStop) {
 
-    // Determine where new data transfer data will go. We alternate
-    // between our two DMA buffers
-    if (n & 1) {
-       pCurrentBuffer = m_pBuffer2;
-    } else {
-       pCurrentBuffer = m_pBuffer1;
-    }
 
-    // Start asynchronous DMA transfer of new data; this function starts
-    // the transfer and returns without waiting for it to finish. This
-    // gives us a chance to process the last batch of data in parallel
-    // with this transfer.
-    if ((res=GetPciAcquisitionDataFastPX14(m_hBoard, m_uSamplesPerTransfer, 
-          pCurrentBuffer, PX14_TRUE)) != SIG_SUCCESS) {
-      DumpLibErrorPX14 (res, "\nPXBoard::run() - Failed to obtain acquisition data: ", m_hBoard);
-      EndBufferedPciAcquisitionPX14(m_hBoard);
-      return false;
-    }
-
-    // Call the callback function to process previous chunk of data while we're
-    // transfering the current.
-    if (pPreviousBuffer) {
-      if (m_pReceiver) {
-        uNumSamples += m_pReceiver->onDigitizerData( (SAMPLE_DATA_TYPE*) pPreviousBuffer, 
-          m_uSamplesPerTransfer, uNumSamples, m_dScale, m_dOffset);
-      } else {
-        uNumSamples += m_uSamplesPerTransfer;
-      }
-    }
+// ----------------------------------------------------------------------------
+// startTransfer -- Start asynchronous DMA transfer of new data; this function 
+//                  starts the transfer and returns without waiting for it to 
+//                  finish.
+// ----------------------------------------------------------------------------
+bool PXBoard::startTransfer(void* pBuffer)
+{
+  int res;
 
-    // Wait for the asynchronous DMA transfer to complete so we can loop
-    // back around to start a new one. Calling thread will sleep until
-    // the transfer completes.
-    res = WaitForTransferCompletePX14(m_hBoard);
+  if ((res=GetPciAcquisitionDataFastPX14(m_hBoard, m_uSamplesPerTransfer, 
+        (px14_sample_t*) pBuffer, PX14_TRUE)) != SIG_SUCCESS) {
+    DumpLibErrorPX14 (res, "\nPXBoard::run() - Failed to obtain acquisition data: ", m_hBoard);
+    return false;
+  }
 
-    // Check for error condition - board had FIFO overflow
-    if (GetFifoFullFlagPX14(m_hBoard)) {
-      printf("FIFO overflow\n");
-      EndBufferedPciAcquisitionPX14(m_hBoard);
-      return false;
-    }
-    
-    // Check for error condition - all others
-    if (SIG_SUCCESS != res) {
-      if (SIG_CANCELLED == res)
-        printf ("\nAcquisition cancelled");
-      else {
-        DumpLibErrorPX14(res, "\nAn error occurred waiting for transfer to complete: ", m_hBoard);
-      }
-      EndBufferedPciAcquisitionPX14(m_hBoard);
-      return false;
-    }
+  return true;
+} // startTransfer()
 
-    // Switch buffers
-    pPreviousBuffer = pCurrentBuffer;
-    n++;
-    
-    // Check if we need to the stop the loop.  Only stop if we've reached the 
-    // the number of desired samples.  If the accumulation size is zero, we 
-    // will run continuously and only stop by an external trigger, never on 
-    // our own.    
-    if ((m_uSamplesPerAccumulation > 0) && (m_uSamplesPerAccumulation <= uNumSamples))
-    {
-      stop();
-    }
 
-  } // transfer loop
 
+// ----------------------------------------------------------------------------
+// waitTransfer -- Wait for the asynchronous DMA transfer to complete.  
+//                 Calling thread will sleep until the transfer completes.
+// ----------------------------------------------------------------------------
+bool PXBoard::waitTransfer()
+{
+  int res = WaitForTransferCompletePX14(m_hBoard);
 
-  // Stop acquisition 
-  EndBufferedPciAcquisitionPX14(m_hBoard);
+  // Check for error condition - board had FIFO overflow
+  if (GetFifoFullFlagPX14(m_hBoard)) {
+    printf("FIFO overflow\n");
+    return false;
+  }
+  
+  // Check for error condition - all others
+  if (SIG_SUCCESS != res) {
+    if (SIG_CANCELLED == res)
+      printf ("\nAcquisition cancelled");
+    else {
+      DumpLibErrorPX14(res, "\nAn error occurred waiting for transfer to complete: ", m_hBoard);
+    }
+    return false;
+  }
 
   return true;
-
-} // acquire()
+} // waitTransfer()
 
 
 
 // ----------------------------------------------------------------------------
-// setCallback() -- Specify the callback function to use when
-//                  a transfer is received
+// endStream -- Stop acquisition
 // ----------------------------------------------------------------------------
-void PXBoard::setCallback(DigitizerReceiver* pReceiver) 
+void PXBoard::endStream()
 {
-  m_pReceiver = pReceiver;
-} // setCallback()
+  EndBufferedPciAcquisitionPX14(m_hBoard);
+} // endStream()
 
@@ -3,7 +3,7 @@
 
 #include <functional>
 #include <px14.h>
-#include "digitizer.h"
+#include "streaming_digitizer.h"
 
 
 // ---------------------------------------------------------------------------
@@ -12,13 +12,14 @@
 //
 // Wrapper class that exposes basic functionality for a PX14000 digitizer
 // board.  The principal method to retrieve data is "acquire", which utilizes
-// a callback function set using "setCallback".
+// a callback function set using "setCallback".  Transfers stream through a
+// ring of DMA buffers (see StreamingDigitizer).
 //
 // Use:
 // #define SAMPLE_DATA_TYPE unsigned short
 //
 // ---------------------------------------------------------------------------
-class PXBoard : public Digitizer {
+class PXBoard : public StreamingDigitizer {
 
   private:
 
@@ -27,22 +28,24 @@ class PXBoard : public Digitizer {
     unsigned int                m_uInputChannel;
     unsigned int                m_uVoltageRange1;
     unsigned int                m_uVoltageRange2;
-    unsigned int                m_uSamplesPerTransfer;
-    unsigned long               m_uSamplesPerAccumulation;
     unsigned int                m_uBoardRevision;
     unsigned int                m_uSerialNumber;
     HPX14                       m_hBoard;
-    px14_sample_t*              m_pBuffer1; 
-    px14_sample_t*              m_pBuffer2;
-    DigitizerReceiver*          m_pReceiver;
-    bool                        m_bStop;
-    double                      m_dScale;
-    double                      m_dOffset;
 
     bool setAcquisitionRate();
     bool setInputChannel();
     bool setVoltageRange();
     bool setSamplesPerTransfer();
+
+  protected:
+
+    // Transfer ring (see StreamingDigitizer)
+    void* allocateTransfer();
+    void freeTransfer(void*);
+    bool startStream();
+    bool startTransfer(void*);
+    bool waitTransfer();
+    void endStream();
     
   public:
 
@@ -54,14 +57,7 @@ class PXBoard : public Digitizer {
     bool connect(unsigned int);
     void disconnect();
 
-    // Interface
-    void setCallback(DigitizerReceiver*);
-    bool acquire();
-    void stop();
-
     // Description functions
-    double scale();
-    double offset();
     unsigned int bytesPerSample();
     Digitizer::DataType type();
     
@@ -2,7 +2,8 @@
 #define _PXSIM_H_
 
 #include <unistd.h> // usleep
-#include "digitizer.h"
+#include <stdlib.h> // rand_r
+#include "streaming_digitizer.h"
 #include "timing.h"
 
 
@@ -34,11 +35,33 @@ unsigned long xorshf96() { //period 2^96-1
 // uniform random (**not gaussian**).  Mostly just for rough approximation.
 // Generating better random numbers was too slow.
 //
+// Transfers go through the same ring as the boards (see StreamingDigitizer).
+// Each transfer is generated by the transfer thread and completes when the
+// samples would have been acquired.  If a transfer starts late (e.g. the
+// ring was full), the simulated board catches up as a real FIFO would.  
+// With setFifo(), a transfer that starts more than that many seconds late
+// fails with a FIFO overflow like the boards do.  Without it (the default),
+// the simulated board never overflows and just restarts its clock.
+//
+// With setJitter(), the hand-off of each transfer to the receiver is 
+// delayed by a random time up to the jitter, and once every stall interval
+// by the stall time, as if the receiver had been held up.  The delays show
+// in the transfer timing (see StreamingDigitizer) and, once they fill the
+// ring, in the FIFO.  Raising them until the FIFO overflows measures how
+// much slack the pipeline needs.
+//
+// With setSecondInput(), the simulated board samples two inputs like a
+// PX14400 in dual channel mode, interleaving them in each transfer.  Input B
+// sees the same continuous waves shifted by a phase, and noise that has the
+// given correlation with input A's noise: rho*nA + sqrt(1-rho^2)*n, with n
+// independent of nA.  The cross power of the two inputs then shows the
+// correlation in the noise and the phase at the continuous waves.
+//
 // Use:
 // #define SAMPLE_DATA_TYPE unsigned short
 // 
 // ---------------------------------------------------------------------------
-class PXSim : public Digitizer {
+class PXSim : public StreamingDigitizer {
 
   private:
 
@@ -50,62 +73,30 @@ class PXSim : public Digitizer {
     double                      m_dCWAmp2;              // 0 to 1 
     double                      m_dNoiseAmp;            // 0 to 1  
     double                      m_dVoltageOffset;
-    unsigned long               m_uSamplesPerAccumulation; 
-    unsigned int                m_uSamplesPerTransfer;
-    SAMPLE_DATA_TYPE*           m_pBuffer; 
-    DigitizerReceiver*          m_pReceiver;
-    bool                        m_bStop;
-    double                      m_dScale;
-    double                      m_dOffset;
-
-  public:
-
-    // Constructor and destructor
-    PXSim( double dAcquisitionRate, 
-           unsigned long uSamplesPerAccumulation, 
-           unsigned int uSamplesPerTransfer ) {
-      m_bStop = false;
-      m_dCWFreq1 = 0;
-      m_dCWAmp1 = 0;
-      m_dCWFreq2 = 0;
-      m_dCWAmp2 = 0;   
-      m_dNoiseAmp = 0;   
-      m_dVoltageOffset = 0;
-      m_dScale =  1.0/32768;
-      m_dOffset = -1.0;
-      m_dAcquisitionRate = dAcquisitionRate;     // MS/s
-      m_uSamplesPerAccumulation = uSamplesPerAccumulation;
-      m_uSamplesPerTransfer = uSamplesPerTransfer;  
-      printf("Using SIMULATED digitizer\n");
-      
-      m_pBuffer = (SAMPLE_DATA_TYPE*) malloc(m_uSamplesPerTransfer * sizeof(SAMPLE_DATA_TYPE));
-      m_pReceiver = NULL;
+    double                      m_dCorrelation;         // Of input B's noise with A's
+    double                      m_dPhase;               // Of input B's CWs (radians)
+    double                      m_dFifoSeconds;         // 0 for no overflow
+    double                      m_dJitterSeconds;
+    double                      m_dStallSeconds;
+    double                      m_dStallInterval;       // seconds
+    unsigned int                m_uSeed;                // For the jitter
+    Timer                       m_stallTimer;
+    double                      m_dTransferTime;        // seconds
+    double                      m_dDue;                 // seconds since start
+    double                      m_dSampleIndex;
+    unsigned long               m_uTransfers;
+    bool                        m_bConnected;
+    Timer                       m_timer;
+
+  protected:
+
+    void* allocateTransfer() { 
+      return malloc(m_uSamplesPerTransfer * sizeof(SAMPLE_DATA_TYPE));
     }
 
-    ~PXSim() { 
-      if (m_pBuffer) {
-        free(m_pBuffer);
-        m_pBuffer = NULL;
-      }
-    }
-  
-
-    bool acquire() {
+    void freeTransfer(void* p) { free(p); }
 
-      unsigned long uNumSamples = 0;
-      Timer timer;
-      
-      double dTransferTime = m_uSamplesPerTransfer / m_dAcquisitionRate / 1.0e6;
-      
-      // printf("PXSim: Desired transfer time=%10.10f\n", dTransferTime);
-
-      // Reset the stop flag
-      m_bStop = false;
-
-      if (m_pBuffer == NULL) {
-        printf("PXSim: No transfer buffers at start of run. Was setTransferSamples() called?\n");
-        return false;
-      }
+    bool startStream() {
 
       if (m_dAcquisitionRate == 0) {
         printf("PXSim: No transfer buffers at start of run.  Was setAcquisitionRate() called?\n");
@@ -116,95 +107,198 @@ class PXSim : public Digitizer {
         printf("PXSim: WARNING! No signal being generated. Was setSignal() called? Proceeding with null signal.\n");       
       }
 
-      // Start the timer
-      timer.tic();
+      m_dTransferTime = m_uSamplesPerTransfer / m_uInputs / m_dAcquisitionRate / 1.0e6;
+      m_dDue = m_dTransferTime;
+      m_uTransfers = 0;
+      m_dSampleIndex = 0;
+      m_timer.tic();
+
+      return true;
+    }
 
-      // Loop over number of transfers requested
-      double uSampleIndex = 0;  
+    bool startTransfer(void* pTransfer) {
+
+      SAMPLE_DATA_TYPE* pBuffer = (SAMPLE_DATA_TYPE*) pTransfer;
       unsigned long uRandom = 0;
       unsigned short* pPointer = 0; // used to divide 64 bit uRandom into 4 x 16 bit components
       float cw[4];     
       float dCW1 = 2.0 * M_PI * m_dCWFreq1 / m_dAcquisitionRate;
       float dCW2 = 2.0 * M_PI * m_dCWFreq2 / m_dAcquisitionRate;
-            
-      while (!m_bStop) {
 
-        // printf("PXSim: uNumSamples= %lu of %lu\n", uNumSamples, m_uSamplesPerAccumulation);
+      // The board keeps sampling while nobody takes its data
+      double dLate = m_timer.toc() - (m_dDue - m_dTransferTime);
+      if ((m_dFifoSeconds > 0) && (dLate > m_dFifoSeconds)) {
+        printf("PXSim: FIFO overflow (transfer started %.3g seconds late)\n", dLate);
+        return false;
+      }
+
+      if (m_uInputs == 2) {
+        fillDual(pBuffer);
+        return true;
+      }
+
+      // For each transfer, populate the buffer
+      for (unsigned int i=0; i<m_uSamplesPerTransfer; i+=4) {
         
-        // For each transfer, populate the buffer
-        for (unsigned int i=0; i<m_uSamplesPerTransfer; i+=4) {
-          
-          // Calculate four voltage samples of two continuous waves
-          cw[0]  = m_dCWAmp1 * sin(dCW1 * uSampleIndex);
-          cw[0] += m_dCWAmp2 * sin(dCW2 * uSampleIndex++);
-          cw[1]  = m_dCWAmp1 * sin(dCW1 * uSampleIndex);
-          cw[1] += m_dCWAmp2 * sin(dCW2 * uSampleIndex++);
-          cw[2]  = m_dCWAmp1 * sin(dCW1 * uSampleIndex);
-          cw[2] += m_dCWAmp2 * sin(dCW2 * uSampleIndex++);
-          cw[3]  = m_dCWAmp1 * sin(dCW1 * uSampleIndex);
-          cw[3] += m_dCWAmp2 * sin(dCW2 * uSampleIndex++);
-          
-          // Add the noise and offset contributions to each voltage sample
-          uRandom = xorshf96(); 
-          pPointer = (unsigned short*) &uRandom;
-          cw[0] += m_dNoiseAmp * (pPointer[0] / 32768.0 - 1) + m_dVoltageOffset;
-          cw[1] += m_dNoiseAmp * (pPointer[1] / 32768.0 - 1) + m_dVoltageOffset;
-          cw[2] += m_dNoiseAmp * (pPointer[2] / 32768.0 - 1) + m_dVoltageOffset;
-          cw[3] += m_dNoiseAmp * (pPointer[3] / 32768.0 - 1) + m_dVoltageOffset;
-                    
-          /// Convert from voltages to PX digitizer data units
-          cw[0] = (cw[0] - m_dOffset) / m_dScale;
-          cw[1] = (cw[1] - m_dOffset) / m_dScale;
-          cw[2] = (cw[2] - m_dOffset) / m_dScale;
-          cw[3] = (cw[3] - m_dOffset) / m_dScale;
-          
-          // Store in buffer.  This implicitly casts to SAMPLE_DATA_TYPE
-          m_pBuffer[i] = cw[0];
-          m_pBuffer[i+1] = cw[1];
-          m_pBuffer[i+2] = cw[2];
-          m_pBuffer[i+3] = cw[3];
-          
-        }
+        // Calculate four voltage samples of two continuous waves
+        cw[0]  = m_dCWAmp1 * sin(dCW1 * m_dSampleIndex);
+        cw[0] += m_dCWAmp2 * sin(dCW2 * m_dSampleIndex++);
+        cw[1]  = m_dCWAmp1 * sin(dCW1 * m_dSampleIndex);
+        cw[1] += m_dCWAmp2 * sin(dCW2 * m_dSampleIndex++);
+        cw[2]  = m_dCWAmp1 * sin(dCW1 * m_dSampleIndex);
+        cw[2] += m_dCWAmp2 * sin(dCW2 * m_dSampleIndex++);
+        cw[3]  = m_dCWAmp1 * sin(dCW1 * m_dSampleIndex);
+        cw[3] += m_dCWAmp2 * sin(dCW2 * m_dSampleIndex++);
+        
+        // Add the noise and offset contributions to each voltage sample
+        uRandom = xorshf96(); 
+        pPointer = (unsigned short*) &uRandom;
+        cw[0] += m_dNoiseAmp * (pPointer[0] / 32768.0 - 1) + m_dVoltageOffset;
+        cw[1] += m_dNoiseAmp * (pPointer[1] / 32768.0 - 1) + m_dVoltageOffset;
+        cw[2] += m_dNoiseAmp * (pPointer[2] / 32768.0 - 1) + m_dVoltageOffset;
+        cw[3] += m_dNoiseAmp * (pPointer[3] / 32768.0 - 1) + m_dVoltageOffset;
+                  
+        /// Convert from voltages to PX digitizer data units
+        cw[0] = (cw[0] - m_dOffset) / m_dScale;
+        cw[1] = (cw[1] - m_dOffset) / m_dScale;
+        cw[2] = (cw[2] - m_dOffset) / m_dScale;
+        cw[3] = (cw[3] - m_dOffset) / m_dScale;
+        
+        // Store in buffer.  This implicitly casts to SAMPLE_DATA_TYPE
+        pBuffer[i] = cw[0];
+        pBuffer[i+1] = cw[1];
+        pBuffer[i+2] = cw[2];
+        pBuffer[i+3] = cw[3];
+        
+      }
+
+      return true;
+    }
+
+    // Populates a transfer with pairs of samples of inputs A and B
+    void fillDual(SAMPLE_DATA_TYPE* pBuffer) {
 
-        // Wait until enough time has passed that the samples would have been 
-        // acquired if we were actually taking the data
-        if (timer.toc() < dTransferTime) {
-            usleep( (dTransferTime - timer.get()) * 1e6 );
+      unsigned long uRandom = 0;
+      unsigned short* pPointer = (unsigned short*) &uRandom;
+      float cw[4];
+      float noise[2];
+      float dCW1 = 2.0 * M_PI * m_dCWFreq1 / m_dAcquisitionRate;
+      float dCW2 = 2.0 * M_PI * m_dCWFreq2 / m_dAcquisitionRate;
+      float dMix = sqrt(1.0 - m_dCorrelation * m_dCorrelation);
+
+      // Two sample times per pass
+      for (unsigned int i=0; i<m_uSamplesPerTransfer; i+=4) {
+
+        for (unsigned int k=0; k<2; k++) {
+          cw[2*k]    = m_dCWAmp1 * sin(dCW1 * m_dSampleIndex);
+          cw[2*k]   += m_dCWAmp2 * sin(dCW2 * m_dSampleIndex);
+          cw[2*k+1]  = m_dCWAmp1 * sin(dCW1 * m_dSampleIndex + m_dPhase);
+          cw[2*k+1] += m_dCWAmp2 * sin(dCW2 * m_dSampleIndex++ + m_dPhase);
         }
 
-        if (uNumSamples == 0) {
-          printf("Actual transfer time: %8.6f, Desired transfer time: %8.6f, Diff: %8.6f\n", 
-            timer.get(), dTransferTime, (dTransferTime-timer.get())*1.0e6);
+        // Input B's noise is partly input A's
+        uRandom = xorshf96();
+        for (unsigned int k=0; k<2; k++) {
+          noise[0] = pPointer[2*k] / 32768.0 - 1;
+          noise[1] = pPointer[2*k+1] / 32768.0 - 1;
+          cw[2*k] += m_dNoiseAmp * noise[0] + m_dVoltageOffset;
+          cw[2*k+1] += m_dNoiseAmp * (m_dCorrelation * noise[0] + dMix * noise[1]) + m_dVoltageOffset;
         }
-        
-        // Reset the timer
-        timer.tic();
-
-        // Call the callback function to process the chunk of data
-        uNumSamples += m_pReceiver->onDigitizerData(m_pBuffer, m_uSamplesPerTransfer, uNumSamples, m_dScale, m_dOffset);
-
-        // Check if we need to the stop the loop.  Only stop if we've reached the 
-        // the number of desired samples.  If the accumulation size is zero, we 
-        // will run continuously and only stop by an external trigger, never on 
-        // our own.    
-        if ((m_uSamplesPerAccumulation > 0) && (m_uSamplesPerAccumulation <= uNumSamples))
-        {
-          stop();
+
+        // Convert from voltages to PX digitizer data units.  This implicitly 
+        // casts to SAMPLE_DATA_TYPE.
+        for (unsigned int k=0; k<4; k++) {
+          pBuffer[i+k] = (cw[k] - m_dOffset) / m_dScale;
         }
-    
-      } // transfer loop
+      }
+    }
+
+    bool waitTransfer() {
+
+      // Wait until enough time has passed that the samples would have been 
+      // acquired if we were actually taking the data
+      double dNow = m_timer.toc();
+      if (dNow < m_dDue) {
+        usleep( (m_dDue - dNow) * 1e6 );
+      } else if (m_dFifoSeconds == 0) {
+        m_dDue = dNow;
+      }
+
+      if (m_uTransfers == 0) {
+        printf("Actual transfer time: %8.6f, Desired transfer time: %8.6f, Diff: %8.6f\n", 
+          dNow, m_dTransferTime, (m_dTransferTime-dNow)*1.0e6);
+      }
+
+      m_uTransfers++;
+      m_dDue += m_dTransferTime;
 
       return true;
     }
 
+    void endStream() { }
+
+    void delayReceiver() {
+
+      double dDelay = 0;
+      if (m_dJitterSeconds > 0) {
+        dDelay += m_dJitterSeconds * rand_r(&m_uSeed) / RAND_MAX;
+      }
+      if ((m_dStallSeconds > 0) && (m_stallTimer.toc() >= m_dStallInterval)) {
+        dDelay += m_dStallSeconds;
+        m_stallTimer.tic();
+      }
+
+      if (dDelay > 0) {
+        usleep(dDelay * 1e6);
+      }
+    }
+
+  public:
+
+    // Constructor and destructor
+    PXSim( double dAcquisitionRate, 
+           unsigned long uSamplesPerAccumulation, 
+           unsigned int uSamplesPerTransfer ) : 
+      StreamingDigitizer(dAcquisitionRate, uSamplesPerAccumulation, uSamplesPerTransfer) {
+      m_dCWFreq1 = 0;
+      m_dCWAmp1 = 0;
+      m_dCWFreq2 = 0;
+      m_dCWAmp2 = 0;   
+      m_dNoiseAmp = 0;   
+      m_dVoltageOffset = 0;
+      m_dCorrelation = 0;
+      m_dPhase = 0;
+      m_dFifoSeconds = 0;
+      m_dJitterSeconds = 0;
+      m_dStallSeconds = 0;
+      m_dStallInterval = 0;
+      m_uSeed = 1;
+      m_dTransferTime = 0;
+      m_dDue = 0;
+      m_dSampleIndex = 0;
+      m_uTransfers = 0;
+      m_bConnected = false;
+      m_dScale =  1.0/32768;
+      m_dOffset = -1.0;
+      m_dAcquisitionRate = dAcquisitionRate;     // MS/s
+      printf("Using SIMULATED digitizer\n");
+    }
+
+    ~PXSim() { 
+      disconnect();
+    }
+
     bool connect(unsigned int) {      
-      
-      if (m_pBuffer == NULL) { return false;}
-      
-      return true;
+      m_bConnected = allocateRing();
+      return m_bConnected;
     }
 
-    void disconnect() { }
+    void disconnect() { 
+      if (m_bConnected) {
+        freeRing();
+        m_bConnected = false;
+      }
+    }
 
     void setSignal(double dFreq1, double dAmp1, double dFreq2, double dAmp2, double dNoiseAmp, double dVoltageOffset) { 
       m_dCWFreq1 = dFreq1; 
@@ -221,13 +315,40 @@ class PXSim : public Digitizer {
       printf("PXSim: Constant offset %g\n", m_dVoltageOffset);
     }
 
-    void setCallback(DigitizerReceiver* pReceiver) { m_pReceiver = pReceiver; }
+    // Sample a second input whose noise has correlation dCorrelation (-1 to 
+    // 1) with the first input's and whose continuous waves are shifted by
+    // dPhase degrees.  Must be called before connect().
+    void setSecondInput(double dCorrelation, double dPhase) {
+      m_dCorrelation = (dCorrelation > 1) ? 1 : ((dCorrelation < -1) ? -1 : dCorrelation);
+      m_dPhase = dPhase * M_PI / 180.0;
+      setInputs(2);
 
-    void stop() { m_bStop = true; }
-    
-    double scale() { return m_dScale; }
-    
-    double offset() { return m_dOffset; }
+      printf("PXSim: Second input with noise correlation %g and CW phase %g degrees\n", 
+        m_dCorrelation, dPhase);
+    }
+
+    // Seconds of samples the simulated board's FIFO holds (0 for no limit)
+    void setFifo(double dSeconds) { 
+      m_dFifoSeconds = dSeconds;
+      if (m_dFifoSeconds > 0) {
+        printf("PXSim: FIFO overflows after %g seconds behind\n", m_dFifoSeconds);
+      }
+    }
+
+    // Delay each hand-off to the receiver by up to dJitterSeconds (uniform
+    // random), plus dStallSeconds once every dStallInterval seconds
+    void setJitter(double dJitterSeconds, double dStallSeconds, double dStallInterval) {
+      m_dJitterSeconds = dJitterSeconds;
+      m_dStallSeconds = dStallSeconds;
+      m_dStallInterval = dStallInterval;
+      m_stallTimer.tic();
+      if (m_dJitterSeconds > 0) {
+        printf("PXSim: Hand-off jitter up to %g seconds\n", m_dJitterSeconds);
+      }
+      if (m_dStallSeconds > 0) {
+        printf("PXSim: Hand-off stall of %g seconds every %g seconds\n", m_dStallSeconds, m_dStallInterval);
+      }
+    }
     
     unsigned int bytesPerSample() { return 2; }
     
@@ -1,4 +1,5 @@
 #include "razormax.h"
+#include "timing.h"
 
 // ----------------------------------------------------------------------------
 // The Gage SDK library headers have complicated dependencies which make it
@@ -27,25 +28,19 @@ void DisplayErrorString(const int i32Status)
 // ----------------------------------------------------------------------------
 RazorMax::RazorMax(double dAcquisitionRate, 
                    unsigned long uSamplesPerAccumulation, 
-                   unsigned int uSamplesPerTransfer)
+                   unsigned int uSamplesPerTransfer) :
+  StreamingDigitizer(dAcquisitionRate, uSamplesPerAccumulation, uSamplesPerTransfer)
 {
 
   // Pre-populate the user specifiable setup parameters
   m_uAcquisitionRate = 1000000*dAcquisitionRate;    // Hz
-  m_uSamplesPerAccumulation = uSamplesPerAccumulation;
-  m_uSamplesPerTransfer = uSamplesPerTransfer;
   m_uInputChannel = 1;        // 1 is always used for single channel mode
   m_u32BoardIndex = 1;        // 1 is always the first (only) board
 
   // To be assigned
   m_hBoard = 0;
-  m_pBuffer1 = NULL;
-  m_pBuffer2 = NULL;
-  m_pReceiver = NULL;
   m_uBytesPerTransfer = 0;            
   m_uEffectiveSamplesPerTransfer = 0; 
-
-  m_bStop = false;
 }
 
 
@@ -59,33 +54,6 @@ RazorMax::~RazorMax()
 
 
 
-// ----------------------------------------------------------------------------
-// stop
-// ----------------------------------------------------------------------------
-void RazorMax::stop()
-{
-  m_bStop = true;
-}
-
-
-// ----------------------------------------------------------------------------
-// scale
-// ----------------------------------------------------------------------------
-double RazorMax::scale() 
-{ 
-  return m_dScale; 
-}  // scale()
-
-
-// ----------------------------------------------------------------------------
-// offset
-// ----------------------------------------------------------------------------
-double RazorMax::offset() 
-{
-  return m_dOffset; 
-} // offset()
-
-
 // ----------------------------------------------------------------------------
 // bytesPerSample
 // ----------------------------------------------------------------------------
@@ -291,22 +259,9 @@ bool RazorMax::connect(unsigned int uBoardNumber)
     return false;
   }
 
-  // Create Buffer #1
-  iStatus = CsStmAllocateBuffer(m_hBoard, m_u32BoardIndex,  m_uBytesPerTransfer, &m_pBuffer1);
-  if (CS_FAILED(iStatus))
-  {
-    printf("\nRazorMax::connect -- Failed to allocate memory for stream buffer 1 (board index: %u, bytes: %u).\n", 
-      m_u32BoardIndex, m_uBytesPerTransfer);
-    disconnect();
-    return false;
-  }
-
-  // Create Buffer #2
-  iStatus = CsStmAllocateBuffer(m_hBoard, m_u32BoardIndex,  m_uBytesPerTransfer, &m_pBuffer2);
-  if (CS_FAILED(iStatus))
+  // Create the ring of stream buffers
+  if (!allocateRing())
   {
-    printf("\nRazorMax::connect -- Failed to allocate memory for stream buffer 2 (board index: %u, bytes: %u).\n", 
-      m_u32BoardIndex, m_uBytesPerTransfer);
     disconnect();
     return false;
   }
@@ -343,15 +298,7 @@ void RazorMax::disconnect()
     // Abort the current acquisition
     CsDo(m_hBoard, ACTION_ABORT);
 
-    if (m_pBuffer1) {
-      CsStmFreeBuffer(m_hBoard, 0, m_pBuffer1);
-      m_pBuffer1 = NULL;
-    }
-
-    if (m_pBuffer2) {
-      CsStmFreeBuffer(m_hBoard, 0, m_pBuffer2);
-      m_pBuffer2 = NULL;
-    }
+    freeRing();
 
     CsFreeSystem(m_hBoard);
     m_hBoard = 0;
@@ -385,158 +332,129 @@ bool RazorMax::setAcquisitionRate(unsigned int dAcquisitionRate)
 */
 
 // ----------------------------------------------------------------------------
-// acquire() - Transfer data from the board
-//
-//         Set uNumSamplesToTransfer = 0 for infinte loop.  Otherwise,
-//         transfers are are acquired and sent to the callback.  The callback
-//         should return the number of samples handled successfully.  This
-//         function will continue to deliver sample to the callback until the
-//         sum of all callbacks responses reaches uNumSamplestoTransfer. Te loop
-//         can be aborted by calling stop().
-//
+// allocateTransfer
 // ----------------------------------------------------------------------------
-bool RazorMax::acquire()
+void* RazorMax::allocateTransfer()
 {
-  void *pCurrentBuffer = NULL;
-  void *pPreviousBuffer = NULL;
-  unsigned long uNumSamples = 0;
-  unsigned long n = 0;
-  int iStatus = CS_SUCCESS;
+  void* pBuffer = NULL;
+
+  int iStatus = CsStmAllocateBuffer(m_hBoard, m_u32BoardIndex, m_uBytesPerTransfer, &pBuffer);
+  if (CS_FAILED(iStatus))
+  {
+    printf("\nRazorMax::connect -- Failed to allocate memory for stream buffer (board index: %u, bytes: %u).\n", 
+      m_u32BoardIndex, m_uBytesPerTransfer);
+    return NULL;
+  }
+
+  return pBuffer;
+} // allocateTransfer()
+
+
+
+// ----------------------------------------------------------------------------
+// freeTransfer
+// ----------------------------------------------------------------------------
+void RazorMax::freeTransfer(void* pBuffer)
+{
+  CsStmFreeBuffer(m_hBoard, 0, pBuffer);
+} // freeTransfer()
 
-  unsigned int u32TransferTimeout = 5000;
-  unsigned int u32ErrorFlag = 0;
-  unsigned int u32ActualLength = 0;
-  unsigned int u8EndOfData = 0;
 
-  // Reset the stop flag
-  m_bStop = false;
 
+// ----------------------------------------------------------------------------
+// startStream -- Start the data acquisition
+// ----------------------------------------------------------------------------
+bool RazorMax::startStream()
+{
   if (m_hBoard == 0) {
     printf("\nRazorMax:acquire -- No board handle.  Was RazorMax::connect() called?");
     printf("\nAborting acquisition.");
     return false;
   }
 
-  if (m_pBuffer1 == NULL || m_pBuffer2 == NULL) {
-    printf("\nRazorMax::Acquire -- No transfer buffers.  Was RazorMax::connect() called?");
-    printf("\nAborting acquisition.");
-    return false;
-  }
-
-  // Start the data acquisition
-  iStatus = CsDo(m_hBoard, ACTION_START);
+  int iStatus = CsDo(m_hBoard, ACTION_START);
   if (CS_FAILED(iStatus))
   {
     printf("\nAborting acquisition.");
     return false;
   }
 
-  // Main recording loop - The main idea here is that we're alternating
-  // between two halves of our DMA buffer. While we're transferring
-  // fresh acquisition data to one half, we process the other half.
+  return true;
+} // startStream()
+
 
-  // Loop over number of transfers requested
-  while (!m_bStop) {
 
-    // Determine where new data transfer data will go. We alternate
-    // between our two DMA buffers
-    if (n & 1) {
-       pCurrentBuffer = m_pBuffer2;
+// ----------------------------------------------------------------------------
+// startTransfer -- Start asynchronous DMA transfer of new data; this function 
+//                  starts the transfer and returns without waiting for it to 
+//                  finish.
+// ----------------------------------------------------------------------------
+bool RazorMax::startTransfer(void* pBuffer)
+{
+  int iStatus = CsStmTransferToBuffer(m_hBoard, m_u32BoardIndex, pBuffer, 
+    m_uEffectiveSamplesPerTransfer);
+  if (CS_FAILED(iStatus))
+  {
+    if ( CS_STM_COMPLETED == iStatus ) {
+      printf("*** Stream supposedly completed.  Aborting acquisition ***\n");
     } else {
-       pCurrentBuffer = m_pBuffer1;
+      DisplayErrorString(iStatus);
+      printf("*** Transfer failed.  Aborting acquisition ***\n");
     }
+    return false;
+  }
 
-    // Start asynchronous DMA transfer of new data; this function starts
-    // the transfer and returns without waiting for it to finish. This
-    // gives us a chance to process the last batch of data in parallel
-    // with this transfer.
-    iStatus = CsStmTransferToBuffer(m_hBoard, m_u32BoardIndex, pCurrentBuffer, 
-      m_uEffectiveSamplesPerTransfer);
-    if (CS_FAILED(iStatus))
-    {
-      if ( CS_STM_COMPLETED == iStatus ) {
-        printf("*** Stream supposedly completed.  Aborting acquisition ***\n");
-        CsDo(m_hBoard, ACTION_ABORT);
-        return false;
-      } else {
-        DisplayErrorString(iStatus);
-        printf("*** Transfer failed.  Aborting acquisition ***\n");
-        CsDo(m_hBoard, ACTION_ABORT);
-        return false;
-      }
-    }
+  return true;
+} // startTransfer()
 
-    // Call the callback function to process previous chunk of data while we're
-    // transfering the current.
-    if (pPreviousBuffer) {
-      if (m_pReceiver) {                      
-        uNumSamples += m_pReceiver->onDigitizerData((SAMPLE_DATA_TYPE*) pPreviousBuffer, 
-          m_uSamplesPerTransfer, uNumSamples, m_dScale, m_dOffset);
-      } else {
-        uNumSamples += m_uSamplesPerTransfer;
-      }
-    }
 
-    // Wait for the asynchronous DMA transfer to complete so we can loop
-    // back around to start a new one. Calling thread will sleep until
-    // the transfer completes.
-    iStatus = CsStmGetTransferStatus(m_hBoard, m_u32BoardIndex, 
-      u32TransferTimeout, &u32ErrorFlag, &u32ActualLength, &u8EndOfData );
-    if (CS_FAILED(iStatus))
-    {
-      DisplayErrorString(iStatus);
 
-      if ( CS_STM_TRANSFER_TIMEOUT == iStatus )
-      {
-        printf("\n *** Time Out Error ***\n");
-      }
+// ----------------------------------------------------------------------------
+// waitTransfer -- Wait for the asynchronous DMA transfer to complete.  
+//                 Calling thread will sleep until the transfer completes.
+// ----------------------------------------------------------------------------
+bool RazorMax::waitTransfer()
+{
+  unsigned int u32TransferTimeout = 5000;
+  unsigned int u32ErrorFlag = 0;
+  unsigned int u32ActualLength = 0;
+  unsigned int u8EndOfData = 0;
 
-      CsDo(m_hBoard, ACTION_ABORT);
-      return false;
-    }
+  int iStatus = CsStmGetTransferStatus(m_hBoard, m_u32BoardIndex, 
+    u32TransferTimeout, &u32ErrorFlag, &u32ActualLength, &u8EndOfData );
+  if (CS_FAILED(iStatus))
+  {
+    DisplayErrorString(iStatus);
 
-    /*
-    // (must #include CsExpert.h)
-    if ( STM_TRANSFER_ERROR_FIFOFULL & u32ErrorFlag )
+    if ( CS_STM_TRANSFER_TIMEOUT == iStatus )
     {
-      printf("\n *** FIFO Full Error ***\n");
-      CsDo(m_hBoard, ACTION_ABORT);
-      return false;
+      printf("\n *** Time Out Error ***\n");
     }
-    */
-
-    // Switch buffers
-    pPreviousBuffer = pCurrentBuffer;
-    n++;
 
-    // Check if we need to the stop the loop.  Only stop if we've reached the 
-    // the number of desired samples.  If the accumulation size is zero, we 
-    // will run continuously and only stop by an external trigger, never on 
-    // our own.    
-    if ((m_uSamplesPerAccumulation > 0) && (m_uSamplesPerAccumulation <= uNumSamples))
-    {
-      stop();
-    }
-    
-  } // transfer loop
+    return false;
+  }
 
-  // Stop acquisition
-  CsDo(m_hBoard, ACTION_ABORT);
+  /*
+  // (must #include CsExpert.h)
+  if ( STM_TRANSFER_ERROR_FIFOFULL & u32ErrorFlag )
+  {
+    printf("\n *** FIFO Full Error ***\n");
+    return false;
+  }
+  */
 
   return true;
-
-} // acquire()
+} // waitTransfer()
 
 
 
 // ----------------------------------------------------------------------------
-// setCallback() -- Specify the callback function to use when
-//                  a transfer is received
+// endStream -- Stop acquisition
 // ----------------------------------------------------------------------------
-void RazorMax::setCallback(DigitizerReceiver* pReceiver)
+void RazorMax::endStream()
 {
-  m_pReceiver = pReceiver;
-} // setCallback()
+  CsDo(m_hBoard, ACTION_ABORT);
+} // endStream()
 
 
 
@@ -2,7 +2,7 @@
 #define _RAZORMAX_H_
 
 #include <functional>
-#include "digitizer.h"
+#include "streaming_digitizer.h"
 
 #include "CsPrototypes.h"
 
@@ -12,31 +12,24 @@
 //
 // Wrapper class that exposes basic functionality for a PX14000 digitizer
 // board.  The principal method to retrieve data is "acquire", which utilizes
-// a callback function set using "setCallback".
+// a callback function set using "setCallback".  Transfers stream through a
+// ring of DMA buffers (see StreamingDigitizer).
 //
 // Use:
 // #define SAMPLE_DATA_TYPE short
 //
 // ---------------------------------------------------------------------------
-class RazorMax : public Digitizer {
+class RazorMax : public StreamingDigitizer {
 
   private:
 
     // Member variables
     unsigned int                m_uAcquisitionRate;
-    unsigned long               m_uSamplesPerAccumulation;
-    unsigned int                m_uSamplesPerTransfer;
     unsigned int                m_uBytesPerTransfer;
     unsigned int                m_uEffectiveSamplesPerTransfer;
     unsigned int                m_uInputChannel;
     unsigned int                m_u32BoardIndex; 
     CSHANDLE                    m_hBoard;
-    void*                       m_pBuffer1; 
-    void*                       m_pBuffer2;
-    DigitizerReceiver*          m_pReceiver;
-    bool                        m_bStop;
-    double                      m_dScale;
-    double                      m_dOffset;
 
     // Diagnostic information functions
     bool printAcquisitionConfig();
@@ -44,6 +37,16 @@ class RazorMax : public Digitizer {
     bool printTriggerConfig(unsigned int);
     bool printBoardInfo();
 
+  protected:
+
+    // Transfer ring (see StreamingDigitizer)
+    void* allocateTransfer();
+    void freeTransfer(void*);
+    bool startStream();
+    bool startTransfer(void*);
+    bool waitTransfer();
+    void endStream();
+
   public:
 
     // Constructor and destructor
@@ -59,15 +62,7 @@ class RazorMax : public Digitizer {
     //bool setVoltageRange(unsigned int);
     //bool setTransferSamples(unsigned int);
 
-    void setCallback(DigitizerReceiver*);
-
-    // Main execution function
-    bool acquire();
-    void stop();
-    
     // Description functions
-    double scale();
-    double offset();
     unsigned int bytesPerSample();
     Digitizer::DataType type();
 };
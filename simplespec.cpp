@@ -13,13 +13,19 @@
 #endif
 
 
-#include "pfb.h"
+#include "pfb_bank.h"
 #include "dumper.h"
 #include "spectrometer_simple.h"
 #include "utility.h"
 #include "controller.h"
+#include "trace.h"
+#include "log.h"
+#include "thread_policy.h"
+#include "arena.h"
+#include "planner.h"
 #include "version.h"
 #include <fstream>      // ifstream, ofstream, ios
+#include <memory>       // unique_ptr
 
 
 // ----------------------------------------------------------------------------
@@ -72,7 +78,7 @@ void print_help()
   printf("               " DEFAULT_INI_FILE "\n\n");
 
   printf("SIMPLESPEC can also be called to control the behavior of an already running\n");
-  printf("instance.  Six commands are supported:\n\n");
+  printf("instance.  These commands are supported:\n\n");
 
   
   printf("dump      Start dumping raw antenna samples to .dmp files.\n");
@@ -80,15 +86,30 @@ void print_help()
   printf("show      Show the live plotting window.\n");
   printf("hide      Hide the live plotting window.\n");
   printf("kill      Send the hard abort 'kill -9' signal to the already running instance.\n"); 
-  printf("stop      Send a soft stop signal to the already running instance.\n\n");
-
-  printf("SIMPLESPEC uses gnuplot for live plotting ('-p', '--show_plots').  Gnuplot can be\n");
-  printf("installed using the system package manager, e.g. sudo apt-get install gnuplot.\n");
-  printf("In addition to the built-in gnuplot commands, such as '+' and '-' to scale\n");
-  printf("the plot, right clicking corners of a box to zoom, exporting to image files,\n");
-  printf("etc., the SIMPLESPEC plot can be toggled between a plot showing the raw switch\n");
-  printf("spectra and a plot showing the'corrected' (uncalibrated) antenna temperature\n"); 
-  printf("by pressing 'x' in the plot window.\n\n");
+  printf("metrics   Print the metrics of the already running instance (Prometheus format).\n");
+  printf("spectrum  Print the most recent spectra from the already running instance.\n");
+  printf("status    Print the status of the already running instance.\n");
+  printf("stop      Ask the already running instance to stop gracefully.\n");
+  printf("traceon   Start recording trace spans in the already running instance.\n");
+  printf("traceoff  Stop recording trace spans in the already running instance.\n");
+  printf("trace     Write the recorded trace spans to " TRACE_FILE ".\n\n");
+
+  printf("Except for kill, the commands are sent over the control socket:\n\n");
+  printf("               " SOCKET_FILE "\n\n");
+  printf("Other programs can connect to it and send the same commands (one per\n");
+  printf("connection, terminated by a newline).  Over the socket, 'spectrum <n>'\n");
+  printf("averages n adjacent channels into each line of the reply and\n");
+  printf("'trace write <file>' writes the trace spans to another file.\n\n");
+
+  printf("The latest spectra are published to shared memory ('-L', '--live_feed')\n");
+  printf("at /dev/shm" LIVEFEED_NAME ".  Live plotting ('-p', '--show_plots', or\n");
+  printf("'show') starts " PLOTTER_EXE ", which plots them with gnuplot.\n");
+  printf("Gnuplot can be installed using the system package manager,\n");
+  printf("e.g. sudo apt-get install gnuplot.  Run 'fastview -a' from another terminal\n");
+  printf("to plot the 'corrected' (uncalibrated) antenna temperature instead.\n\n");
+
+  printf("Trace spans of each pipeline stage ('-TF', '--trace_file') can be viewed in\n");
+  printf("chrome://tracing or https://ui.perfetto.dev.\n\n");
 
 }
 
@@ -124,6 +145,12 @@ int main(int argc, char* argv[])
     iCtrlMode = ctrl.getOptionBool("[ARGS]", "kill", "kill", false) ? CTRL_MODE_KILL : iCtrlMode;
     iCtrlMode = ctrl.getOptionBool("[ARGS]", "dump", "dump", false) ? CTRL_MODE_DUMP_START : iCtrlMode;
     iCtrlMode = ctrl.getOptionBool("[ARGS]", "nodump", "nodump", false) ? CTRL_MODE_DUMP_STOP : iCtrlMode;
+    iCtrlMode = ctrl.getOptionBool("[ARGS]", "status", "status", false) ? CTRL_MODE_STATUS : iCtrlMode;
+    iCtrlMode = ctrl.getOptionBool("[ARGS]", "spectrum", "spectrum", false) ? CTRL_MODE_SPECTRUM : iCtrlMode;
+    iCtrlMode = ctrl.getOptionBool("[ARGS]", "metrics", "metrics", false) ? CTRL_MODE_METRICS : iCtrlMode;
+    iCtrlMode = ctrl.getOptionBool("[ARGS]", "traceon", "traceon", false) ? CTRL_MODE_TRACE_START : iCtrlMode;
+    iCtrlMode = ctrl.getOptionBool("[ARGS]", "traceoff", "traceoff", false) ? CTRL_MODE_TRACE_STOP : iCtrlMode;
+    iCtrlMode = ctrl.getOptionBool("[ARGS]", "trace", "trace", false) ? CTRL_MODE_TRACE_WRITE : iCtrlMode;
     iCtrlMode = ctrl.getOptionBool("[ARGS]", "help", "-h", false) ? CTRL_MODE_HELP : iCtrlMode;
 
     // Set the controller's mode based on the above options.  If the
@@ -154,6 +181,7 @@ int main(int argc, char* argv[])
     long uSamplesPerTransfer  = ctrl.getOptionInt("Spectrometer", "samples_per_transfer", "-t", 2*1024*1024);
     long uNumAccumulators		  = ctrl.getOptionInt("Spectrometer", "num_accumulators", "-o", 32);
     double dAcquisitionRate   = ctrl.getOptionInt("Spectrometer", "acquisition_rate", "-r", 400);
+    long uNumTransfers        = ctrl.getOptionInt("Spectrometer", "num_transfer_buffers", "-TB", 4);
     
     #if defined DIG_PXBOARD    
       long uInputChannel        = ctrl.getOptionInt("Spectrometer", "input_channel", "-l", 2);
@@ -165,6 +193,10 @@ int main(int argc, char* argv[])
       double dCWAmp2          = ctrl.getOptionReal("Spectrometer", "sim_cw_amp2", "-A2", 0.02);  
       double dNoiseAmp        = ctrl.getOptionReal("Spectrometer", "sim_noise_amp", "-AN", 0.5);
       double dOffset          = ctrl.getOptionReal("Spectrometer", "sim_offset", "-AO", 0.0);
+      double dSimFifoSeconds  = ctrl.getOptionReal("Spectrometer", "sim_fifo_seconds", "-SF", 0);
+      double dSimJitter       = ctrl.getOptionReal("Spectrometer", "sim_jitter_seconds", "-SJ", 0);
+      double dSimStall        = ctrl.getOptionReal("Spectrometer", "sim_stall_seconds", "-SS", 0);
+      double dSimStallInterval = ctrl.getOptionReal("Spectrometer", "sim_stall_interval", "-SI", 10);
     #endif
     
     // Channelizer configuration
@@ -172,7 +204,24 @@ int main(int argc, char* argv[])
     long uNumTaps             = ctrl.getOptionInt("Spectrometer", "num_taps", "-q", 5);
     long uWindowFunctionId    = ctrl.getOptionInt("Spectrometer", "window_function_id", "-w", 1);
     long uNumThreads          = ctrl.getOptionInt("Spectrometer", "num_fft_threads", "-m", 4);
+    long uMinThreads          = ctrl.getOptionInt("Spectrometer", "min_fft_threads", "-MT", 0);
+    bool bFixedPoint          = ctrl.getOptionBool("Spectrometer", "fixed_point_taps", "-FP", false);
+    string sPrecision         = ctrl.getOptionStr("Spectrometer", "precision", "-PR", "single");
+    long uVoltageBits         = ctrl.getOptionInt("Spectrometer", "voltage_bits", "-VB", 0);
+    double dVoltageGain       = ctrl.getOptionReal("Spectrometer", "voltage_gain", "-VG", 1.0);
+    long uVoltageSlots        = ctrl.getOptionInt("Spectrometer", "voltage_ring_slots", "-VS", 1024);
     long uNumBuffers          = ctrl.getOptionInt("Spectrometer", "num_fft_buffers", "-b", 400);
+    double dMemoryBudget      = ctrl.getOptionReal("Spectrometer", "memory_budget", "-PB", 0);
+    double dStallSeconds      = ctrl.getOptionReal("Spectrometer", "stall_seconds", "-PS", 1.0);
+    long uOverloadRunBlocks   = ctrl.getOptionInt("Spectrometer", "overload_run_blocks", "-OR", 0);
+    long uOverloadMaxFactor   = ctrl.getOptionInt("Spectrometer", "overload_max_factor", "-OK", 8);
+    bool bKurtosis            = ctrl.getOptionBool("Spectrometer", "spectral_kurtosis", "-K", false);
+    double dSubSeconds        = ctrl.getOptionReal("Spectrometer", "sub_accumulation_seconds", "-S", 0);
+    double dZoomCenter        = ctrl.getOptionReal("Spectrometer", "zoom_center_freq", "-Z", 0);
+    long uZoomDecimation      = ctrl.getOptionInt("Spectrometer", "zoom_decimation", "-D", 1);
+    long uZoomTapsPerPhase    = ctrl.getOptionInt("Spectrometer", "zoom_fir_taps_per_phase", "-P", 8);
+    double dOutputStartFreq   = ctrl.getOptionReal("Spectrometer", "output_start_freq", "-FL", 0);
+    double dOutputStopFreq    = ctrl.getOptionReal("Spectrometer", "output_stop_freq", "-FH", 0);
         
     // Run configuration
     long uStopCycles          = ctrl.getOptionInt("Spectrometer", "stop_cycles", "-c", 0); 
@@ -180,6 +229,19 @@ int main(int argc, char* argv[])
     string sStopTime          = ctrl.getOptionStr("Spectrometer", "stop_time", "-u", "");
     bool bPlot                = ctrl.getOptionBool("Spectrometer", "show_plots", "-p", false);    
     long uPlotBin             = ctrl.getOptionInt("Spectrometer", "plot_bin", "-B", 1);    
+    bool bLiveFeed            = ctrl.getOptionBool("Spectrometer", "live_feed", "-L", true);
+    string sMetricsFile       = ctrl.getOptionStr("Spectrometer", "metrics_file", "-MF", "");
+    string sTraceFile         = ctrl.getOptionStr("Spectrometer", "trace_file", "-TF", "");
+    long uLogLevel            = ctrl.getOptionInt("Spectrometer", "log_level", "-LL", LOG_INFO);
+
+    // Thread placement and scheduling
+    string sDigitizerCPUs     = ctrl.getOptionStr("Spectrometer", "digitizer_cpus", "-RD", "");
+    long iDigitizerPriority   = ctrl.getOptionInt("Spectrometer", "digitizer_priority", "-RP", 0);
+    string sTransferCPUs      = ctrl.getOptionStr("Spectrometer", "transfer_cpus", "-RT", "");
+    string sChannelizerCPUs   = ctrl.getOptionStr("Spectrometer", "channelizer_cpus", "-RC", "");
+    string sWriterCPUs        = ctrl.getOptionStr("Spectrometer", "writer_cpus", "-RW", "");
+    bool bLockMemory          = ctrl.getOptionBool("Spectrometer", "lock_memory", "-RM", false);
+    long uHugePages           = ctrl.getOptionInt("Spectrometer", "huge_pages", "-HP", 0);
     long uPlotInterval        = ctrl.getOptionInt("Spectrometer", "plot_interval_seconds", "-e", 10);  
    // bool bDump                = ctrl.getOptionBool("Spectrometer", "dump_raw_data", "-y", false); 
 
@@ -191,17 +253,81 @@ int main(int argc, char* argv[])
       return 0;
     }
 
+    // Messages from the data path go through the asynchronous logger so
+    // that those threads never wait on the terminal
+    Log::setLevel((unsigned int) uLogLevel);
+    Log::start();
+
+    // Set the CPUs and scheduling of each thread role before any of the 
+    // threads are started
+    // The transfer thread shares the digitizer's CPUs and priority unless
+    // it is given its own CPUs
+    if (sTransferCPUs.empty()) {
+      sTransferCPUs = sDigitizerCPUs;
+    }
+    if (!ThreadPolicy::set("digitizer", sDigitizerCPUs, (int) iDigitizerPriority) ||
+        !ThreadPolicy::set("transfer", sTransferCPUs, (int) iDigitizerPriority) ||
+        !ThreadPolicy::set("channelizer", sChannelizerCPUs, 0) ||
+        !ThreadPolicy::set("writer", sWriterCPUs, 0)) {
+      return 1;
+    }
+    ThreadPolicy::report();
+
+    // Large blocks (buffers, FFT arrays, accumulators) come from an arena of
+    // huge pages if requested
+    if (!Arena::setPageSize((unsigned int) uHugePages)) {
+      return 1;
+    }
+
     // Set some controls (the controller parses the configuration, but doesn't
     // used any of the info until explictly told)
-    ctrl.setPlot(bPlot, (unsigned int) uPlotBin); 
+    ctrl.setPlot(bPlot, (unsigned int) uPlotBin, (double) uPlotInterval); 
     ctrl.setOutputConfig(sDataDir, sSite, sInstrument, sUserOutput);
 
     // Calculate a few derived configuration parameters
     double dBandwidth = dAcquisitionRate / 2.0;
     unsigned int uNumFFT = uNumChannels * 2;
     printf("Bandwidth: %6.2f\n", dBandwidth);        
+
+    // In zoom mode the main channelizer is a complex PFB after a DDC, so each
+    // spectrum consumes decimation x channels samples and covers 
+    // acquisition_rate / decimation MHz centered on zoom_center_freq.
+    bool bZoom = (uZoomDecimation > 1);
+    double dZoomStart = dZoomCenter - dAcquisitionRate / uZoomDecimation / 2.0;
+    double dZoomStop = dZoomCenter + dAcquisitionRate / uZoomDecimation / 2.0;
+    if (bZoom) {
+      uNumFFT = uZoomDecimation * uNumChannels;
+      printf("Zoom band: %.6g to %.6g MHz\n", dZoomStart, dZoomStop);
+    }
     printf("Samples per FFT: %d\n", uNumFFT);  
 
+    // Only the channels covering output_start_freq to output_stop_freq are 
+    // detected, accumulated and written (0 for either means the band edge).
+    // The channels are clamped to the band before they are made unsigned, 
+    // and a range outside the band is left empty to be rejected below.
+    double dFullStart = bZoom ? dZoomStart : 0;
+    double dFullStop = bZoom ? dZoomStop : dBandwidth;
+    double dChannelSize = (dFullStop - dFullStart) / uNumChannels;
+    double dStartChannel = 0;
+    double dStopChannel = uNumChannels;
+    if (dOutputStartFreq > dFullStart) {
+      dStartChannel = floor((dOutputStartFreq - dFullStart) / dChannelSize);
+    }
+    if ((dOutputStopFreq > 0) && (dOutputStopFreq < dFullStop)) {
+      dStopChannel = ceil((dOutputStopFreq - dFullStart) / dChannelSize);
+    }
+    dStartChannel = (dStartChannel < uNumChannels) ? dStartChannel : uNumChannels;
+    dStopChannel = (dStopChannel > 0) ? dStopChannel : 0;
+    dStopChannel = (dStopChannel < uNumChannels) ? dStopChannel : uNumChannels;
+    unsigned int uStartChannel = (unsigned int) dStartChannel;
+    unsigned int uStopChannel = (unsigned int) dStopChannel;
+    bool bPruned = (uStartChannel > 0) || (uStopChannel < uNumChannels);
+    if (bPruned && (uStartChannel < uStopChannel)) {
+      printf("Output channels: %u to %u (%.6g to %.6g MHz)\n", uStartChannel, 
+        uStopChannel - 1, dFullStart + uStartChannel * dChannelSize, 
+        dFullStart + uStopChannel * dChannelSize);
+    }
+
     // -----------------------------------------------------------------------
     // Check the configuration
     // -----------------------------------------------------------------------  
@@ -219,6 +345,32 @@ int main(int argc, char* argv[])
              "achieve highest possible duty cycle.\n\n");
     }
 
+    if ((sPrecision != "single") && (sPrecision != "double")) {
+      printf("ERROR: precision must be single or double, not %s.  Abort.\n",
+             sPrecision.c_str());
+      return 1;
+    }
+    bool bDouble = (sPrecision == "double");
+
+    if ((uOverloadRunBlocks > 0) && (uOverloadRunBlocks <= uNumTaps)) {
+      printf("ERROR: overload_run_blocks (%ld) must be more than num_taps (%ld) "
+             "or the processed runs will not yield any spectra.  Abort.\n", 
+             uOverloadRunBlocks, uNumTaps);
+      return 1;
+    }
+
+    if (uStartChannel >= uStopChannel) {
+      printf("ERROR: The output frequency range (%.6g to %.6g MHz) does not "
+             "contain any channels.  Abort.\n", dOutputStartFreq, dOutputStopFreq);
+      return 1;
+    }
+
+    if (bZoom && ((dZoomStart < 0) || (dZoomStop > dBandwidth))) {
+      printf("ERROR: The zoom band (%.6g to %.6g MHz) must lie within 0 to "
+             "%.6g MHz.  Abort.\n", dZoomStart, dZoomStop, dBandwidth);
+      return 1;
+    }
+
    
     // -----------------------------------------------------------------------
     // Initialize the digitizer board
@@ -239,45 +391,133 @@ int main(int argc, char* argv[])
                  0, // for continuous sampling
                  uSamplesPerTransfer );
       dig.setSignal(dCWFreq1, dCWAmp1, dCWFreq2, dCWAmp2, dNoiseAmp, dOffset);
+      dig.setFifo(dSimFifoSeconds);
+      dig.setJitter(dSimJitter, dSimStall, dSimStallInterval);
     #endif
 
+    dig.setTransferBuffers((unsigned int) uNumTransfers);
+
     // Connect to the digitizer board
     if (!dig.connect(1)) { 
       printf("Failed to connect to digitizer board. Abort. \n");
       return 1;
     }
 
+    // -----------------------------------------------------------------------
+    // Size the buffer pools from the memory budget (if given)
+    // -----------------------------------------------------------------------
+    if (dMemoryBudget > 0) {
+
+      PlannerConfig plannerConfig;
+      plannerConfig.dSampleRate = dAcquisitionRate * 1e6;
+      plannerConfig.uSamplesPerTransfer = uSamplesPerTransfer;
+      plannerConfig.uBytesPerSample = dig.bytesPerSample();
+      plannerConfig.uBlockLength = uNumFFT;
+      plannerConfig.uNumChannels = uNumFFT / 2;
+      plannerConfig.uNumTaps = uNumTaps;
+      plannerConfig.uWindow = uWindowFunctionId;
+      plannerConfig.uNumThreads = uNumThreads;
+      plannerConfig.bFixedPoint = bFixedPoint;
+      plannerConfig.bDouble = bDouble;
+      plannerConfig.uNumShards = 1;
+      plannerConfig.bDumper = false;
+      plannerConfig.bDump = false;
+      plannerConfig.dBudgetMB = dMemoryBudget;
+      plannerConfig.dStallSeconds = dStallSeconds;
+
+      Planner planner(plannerConfig);
+      if (!planner.plan()) {
+        return 1;
+      }
+      uNumBuffers = planner.channelizerBuffers();
+    }
+
     // -----------------------------------------------------------------------
     // Initialize the asynchronous channelizer
     // -----------------------------------------------------------------------
-    PFB chan ( uNumThreads,
-               uNumBuffers,
-               uNumChannels, 
-               uNumTaps, 
-               uWindowFunctionId,
-               true );  // return in order
+    std::unique_ptr<ChannelizerBank> pChan ( ChannelizerBank::create( bDouble, uNumBuffers, uNumFFT ) );
+
+    bool bAdded = false;
+    if (bZoom) {
+      bAdded = pChan->addZoom( uNumThreads,
+                               uNumBuffers,
+                               dZoomCenter / dAcquisitionRate,
+                               uZoomDecimation,
+                               uZoomTapsPerPhase,
+                               uNumChannels, 
+                               uNumTaps, 
+                               uWindowFunctionId,
+                               true );  // return in order
+    } else {
+      bAdded = pChan->add( uNumThreads,
+                           uNumChannels, 
+                           uNumTaps, 
+                           uWindowFunctionId,
+                           true );  // return in order
+    }
+    if (bAdded && bPruned) { pChan->setOutputChannels(0, uStartChannel, uStopChannel); }
+
+    pChan->setSecondMoment(bKurtosis);
+    pChan->setMinThreads((unsigned int) uMinThreads);
+
+    if (bFixedPoint && !pChan->setFixedPoint(true)) {
+      printf("Failed to use fixed-point taps.  Abort.\n");
+      return 1;
+    }
+
+    if ((uVoltageBits > 0) && 
+        !pChan->setVoltageOutput((unsigned int) uVoltageBits, std::vector<float>(1, (float) dVoltageGain))) {
+      printf("Failed to pass on complex spectra.  Abort.\n");
+      return 1;
+    }
 
     // -----------------------------------------------------------------------
     // Initialize the Spectrometer
     // -----------------------------------------------------------------------
+    LiveFeed feed;  // Must outlive the spectrometer
+    VoltageRing ring;
     SpectrometerSimple spec( uNumChannels, 
                              uSamplesPerAccum, 
                              dBandwidth,
                              uNumAccumulators,
-                             (double) uPlotInterval,
                              (Digitizer*) &dig,
-                             (Channelizer*) &chan,
+                             (Channelizer*) pChan.get(),
                              &ctrl );
 
+    if (bZoom || bPruned) { 
+      spec.setFrequencyRange( uStopChannel - uStartChannel, 
+                              dFullStart + uStartChannel * dChannelSize,
+                              dFullStart + uStopChannel * dChannelSize, 
+                              uNumFFT ); 
+    }
     if (uStopCycles > 0) { spec.setStopCycles(uStopCycles); }
     if (dStopSeconds > 0) { spec.setStopSeconds(dStopSeconds); }
     if (!sStopTime.empty()) { spec.setStopTime(sStopTime); }
+    if (bKurtosis) { spec.setSecondMoment(bKurtosis); }
+    if (dSubSeconds > 0) { spec.setSubAccumulation(dSubSeconds); }
+    if (bLiveFeed || bPlot) { spec.setLiveFeed(&feed); }
+    if (uVoltageBits > 0) { spec.setVoltageRing(&ring, (unsigned int) uVoltageSlots, (unsigned int) uVoltageBits); }
+    if (uOverloadRunBlocks > 0) { 
+      if (uOverloadRunBlocks > (1 - OVERLOAD_HIGH_FILL) * uNumBuffers) {
+        printf("WARNING: overload_run_blocks (%ld) is more than the free buffer "
+               "blocks left at the overload threshold.  Blocks will still be "
+               "dropped before the controller can react.\n\n", uOverloadRunBlocks);
+      }
+      spec.setOverload((unsigned int) uOverloadRunBlocks, (unsigned int) uOverloadMaxFactor); 
+    }
+    if (!sMetricsFile.empty()) { spec.setMetricsFile(sMetricsFile); }
 
     // -----------------------------------------------------------------------
     // Take data until the controller tells us it is time to stop
     // (usually when a SIGINT is received)
     // -----------------------------------------------------------------------    
+    if (!sTraceFile.empty()) { Trace::enable(true); }
+    if (bLockMemory) { ThreadPolicy::lockMemory(); }
+    Arena::report();
+
     spec.run();
 
+    if (!sTraceFile.empty()) { Trace::writeJSON(sTraceFile); }
+
     return 0;
 }
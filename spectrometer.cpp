@@ -1,9 +1,12 @@
 
 #include "spectrometer.h"
 #include "timing.h"
+#include "trace.h"
+#include "log.h"
 #include "utility.h"
 #include "version.h"
 #include <unistd.h> // usleep
+#include <sstream>  // stringstream
 
 #define SWITCH_SLEEP_MICROSECONDS 500000
 
@@ -57,9 +60,35 @@ Spectrometer::Spectrometer(unsigned long uNumChannels,
   // Remember the controller
   m_pController = pController;
 
+  // No live feed or overload control unless set
+  m_pLiveFeed = NULL;
+  m_pVoltageRing = NULL;
+  m_pFlagger = NULL;
+  m_pOverload = NULL;
+
+  // One input unless set
+  m_uInputs = 1;
+  m_pInputB = NULL;
+  m_pCross = NULL;
+
+  // Metrics updated after each switch cycle
+  m_pCyclesMetric = Metrics::counter("fastspec_spectrometer_cycles_total", 
+    "Switch cycles written");
+  m_pDroppedMetric = Metrics::counter("fastspec_spectrometer_dropped_samples_total", 
+    "Samples dropped from accumulations");
+  m_pDutyCycleMetric = Metrics::gauge("fastspec_spectrometer_duty_cycle", 
+    "Fraction of the last cycle spent accumulating");
+  m_pDropFractionMetric = Metrics::gauge("fastspec_spectrometer_drop_fraction", 
+    "Fraction of samples dropped in the last cycle");
+  m_pWriteMetric = Metrics::histogram("fastspec_spectrometer_write_seconds", 
+    "Time to write the spectra of one cycle to disk", 
+    MetricHistogram::exponential(1e-4, 2, 16));
+
   // Rember the antenna raw data dumper (if present)
   m_pDumper = pDumper;
   m_bDumpingThisCycle = false;
+  m_bSecondMoment = false;
+  m_bSubAccumulation = false;
   
   // Initialize the Accumulators
   m_accumAntenna.init( m_uNumChannels, m_dStartFreq, 
@@ -70,6 +99,7 @@ Spectrometer::Spectrometer(unsigned long uNumChannels,
                    m_dStopFreq, m_dChannelFactor );
   
   m_pCurrentAccum = NULL;
+  m_uSwitchState = 0;
 
   // Setup the stop flags
   m_bLocalStop = false;
@@ -79,6 +109,13 @@ Spectrometer::Spectrometer(unsigned long uNumChannels,
   m_uStopCycles = 0;
   m_dStopSeconds = 0;
 
+  // Nothing to report until the first cycle is done
+  pthread_mutex_init(&m_mutexStatus, NULL);
+  m_uNumCycles = 0;
+  m_dDutyCycle = 0;
+  m_dDropFraction = 0;
+  m_dRunSeconds = 0;
+
   // Initialize the FFT pool
   m_uNumFFT = 2*m_uNumChannels;
   m_pChannelizer = pChannelizer;
@@ -93,6 +130,11 @@ Spectrometer::Spectrometer(unsigned long uNumChannels,
 // ----------------------------------------------------------------------------
 Spectrometer::~Spectrometer()
 {
+  // Stop answering requests from the controller
+  if (m_pController) {
+    m_pController->setReceiver(NULL);
+  }
+
   // Disconnect from digitizer
   if (m_pDigitizer) {
     m_pDigitizer->setCallback(NULL);
@@ -114,6 +156,26 @@ Spectrometer::~Spectrometer()
     m_pDumper->closeFile();
   }
 
+  // Free the accumulators for any extra channelizers
+  for (unsigned int i=0; i<m_extraAccums.size(); i++) {
+    delete[] m_extraAccums[i];
+  }
+
+  // And the feeds of the binned resolutions
+  for (unsigned int i=0; i<m_binnedFeeds.size(); i++) {
+    delete m_binnedFeeds[i];
+    delete[] m_binnedLatest[i];
+  }
+
+  delete[] m_pInputB;
+  delete[] m_pCross;
+
+  if (m_pOverload) {
+    delete m_pOverload;
+  }
+
+  pthread_mutex_destroy(&m_mutexStatus);
+
 } // destructor
 
 
@@ -131,6 +193,7 @@ void Spectrometer::run()
   TimeKeeper tk;
   double dDutyCycle_Overall;
   unsigned long uCycleDrops = 0;
+  unsigned long uCycleSkips = 0;
   unsigned long uCycle = 0;
 
   if ((m_pDigitizer == NULL) || (m_pChannelizer == NULL) || (m_pSwitch == NULL)) {
@@ -138,6 +201,11 @@ void Spectrometer::run()
     return;
   }
 
+  // Answer status and spectrum requests now that the setup is complete
+  if (m_pController) {
+    m_pController->setReceiver(this);
+  }
+
   // Loop until a stop signal is received
   totalRunTimer.tic();
   printf("\n");
@@ -172,6 +240,11 @@ void Spectrometer::run()
 
       // Wait for any previous channelizer processes still running to finish
       m_pChannelizer->waitForEmpty();
+
+      // Flag against this position's baseline
+      if (m_pFlagger) {
+        m_pFlagger->setPosition(i);
+      }
                 
       // Reset the accumulator
       switch(i) {
@@ -193,6 +266,23 @@ void Spectrometer::run()
       // Reset current accumulator and record start time
       m_pCurrentAccum->clear();
       m_pCurrentAccum->setStartTime(tk);
+      m_uSwitchState = i;
+
+      for (unsigned int n=0; n<m_extraAccums.size(); n++) {
+        m_extraAccums[n][i].clear();
+        m_extraAccums[n][i].setStartTime(tk);
+      }
+
+      for (unsigned int n=0; n<m_binnedPublished.size(); n++) {
+        m_binnedPublished[n] = 0;
+      }
+
+      if (m_pInputB) {
+        m_pInputB[i].clear();
+        m_pInputB[i].setStartTime(tk);
+        m_pCross[i].clear();
+        m_pCross[i].setStartTime(tk);
+      }
 
       // Start a fresh raw data dump if on antenna position and dump requested
       if (m_pController->dump() && i==0) {
@@ -200,11 +290,21 @@ void Spectrometer::run()
         m_pDumper->openFile(m_pController->getDumpFilePath(tk), tk, i);
       }   
       
-      // Acquire data
+      // Acquire data (the samples aren't contiguous with the previous state)
+      if (m_pOverload) { m_pOverload->restart(); }
       m_pDigitizer->acquire();
 
       // Note the stop time
       m_pCurrentAccum->setStopTime();
+
+      for (unsigned int n=0; n<m_extraAccums.size(); n++) {
+        m_extraAccums[n][i].setStopTime();
+      }
+
+      if (m_pInputB) {
+        m_pInputB[i].setStopTime();
+        m_pCross[i].setStopTime();
+      }
     }
 
     // Wait for any remaining channelizer processes to finish
@@ -217,6 +317,23 @@ void Spectrometer::run()
       m_pDumper->closeFile();
     }
 
+    // Form the full spectra from the sub-accumulations (if used)
+    if (m_bSubAccumulation) {
+      m_accumAntenna.combineSubs();
+      m_accumAmbientLoad.combineSubs();
+      m_accumHotLoad.combineSubs();
+    }
+
+    // Time the accumulations of the binned resolutions (if any)
+    m_accumAntenna.combineBinned();
+    m_accumAmbientLoad.combineBinned();
+    m_accumHotLoad.combineBinned();
+
+    // Average each channel over the spectra it was kept in (if flagging)
+    m_accumAntenna.normalizeWeights();
+    m_accumAmbientLoad.normalizeWeights();
+    m_accumHotLoad.normalizeWeights();
+
     // Normalize ADCmin and ADCmax:  we divide adcmin and adcmax by 2 here to  
     // be backwards compatible with pxspec.  This limits adcmin and adcmax to 
     // +/- 0.5 rather than +/-1.0
@@ -226,22 +343,61 @@ void Spectrometer::run()
     m_accumAmbientLoad.setADCmax(m_accumAmbientLoad.getADCmax()/2);
     m_accumHotLoad.setADCmin(m_accumHotLoad.getADCmin()/2);
     m_accumHotLoad.setADCmax(m_accumHotLoad.getADCmax()/2);
+
+    for (unsigned int n=0; n<m_extraAccums.size(); n++) {
+      for (unsigned int k=0; k<3; k++) {
+        m_extraAccums[n][k].setADCmin(m_extraAccums[n][k].getADCmin()/2);
+        m_extraAccums[n][k].setADCmax(m_extraAccums[n][k].getADCmax()/2);
+      }
+    }
+
+    for (unsigned int k=0; m_pInputB && (k<3); k++) {
+      m_pInputB[k].setADCmin(m_pInputB[k].getADCmin()/2);
+      m_pInputB[k].setADCmax(m_pInputB[k].getADCmax()/2);
+    }
     
     // Write to ACQ
     writeTimer.tic();
     //printf("\nSpectrometer: Writing to file...\n");
+    TraceSpan writeSpan("acq write");
     writeToAcqFile();
+    writeSpan.end();
     writeTimer.toc();
     
-    // Create plot file if needed
+    // Publish for live plotting
     plotTimer.tic();
-    handleLivePlot();
+    handleLivePlot(uCycle);
     plotTimer.toc();
 
     // Calculate overall duty cycle
     dutyCycleTimer.toc();
     dDutyCycle_Overall = 3.0 * m_uNumSamplesPerAccumulation / (2.0 * 1e6 * m_dBandwidth) / dutyCycleTimer.get();
     uCycleDrops = m_accumAntenna.getDrops() + m_accumAmbientLoad.getDrops() + m_accumHotLoad.getDrops();
+    uCycleSkips = m_accumAntenna.getSkips() + m_accumAmbientLoad.getSkips() + m_accumHotLoad.getSkips();
+
+    // Keep a copy of the results for status and spectrum requests
+    pthread_mutex_lock(&m_mutexStatus);
+    m_uNumCycles = uCycle;
+    m_dDutyCycle = dDutyCycle_Overall;
+    m_dDropFraction = 1.0 * uCycleDrops / (m_uNumSamplesPerAccumulation + uCycleDrops);
+    m_dRunSeconds = totalRunTimer.toc();
+    m_tkSnapshot = m_accumAntenna.getStartTime();
+    Accumulator* pAccums[3] = { &m_accumAntenna, &m_accumAmbientLoad, &m_accumHotLoad };
+    for (unsigned int k=0; k<3; k++) {
+      m_snapshot[k].resize(pAccums[k]->getDataLength());
+      pAccums[k]->getCopyOfAverage(&(m_snapshot[k][0]), m_snapshot[k].size());
+    }
+    pthread_mutex_unlock(&m_mutexStatus);
+
+    // Update the metrics and write them for the textfile collector
+    m_pCyclesMetric->add();
+    m_pDroppedMetric->add(uCycleDrops);
+    m_pDutyCycleMetric->set(dDutyCycle_Overall);
+    m_pDropFractionMetric->set(1.0 * uCycleDrops / (m_uNumSamplesPerAccumulation + uCycleDrops));
+    m_pWriteMetric->observe(writeTimer.get());
+    if (!m_sMetricsFile.empty() && !Metrics::writeFile(m_sMetricsFile)) {
+      printf("Spectrometer: Failed to write metrics to %s\n", m_sMetricsFile.c_str());
+    }
 
     printf("\n");
     printf("Spectrometer: Cycle time             = %6.3f seconds\n", dutyCycleTimer.get());
@@ -249,7 +405,7 @@ void Spectrometer::run()
     printf("Spectrometer: Switch time (ideal)    = %6.3f seconds\n", 3*m_dSwitchDelayTime);
     printf("Spectrometer: ACQ write time         = %6.3f seconds\n", writeTimer.get());
     if (m_pController->plot()) {
-      printf("Spectrometer: Plot write time        = %6.3f seconds\n", plotTimer.get());
+      printf("Spectrometer: Plot publish time      = %6.3f seconds\n", plotTimer.get());
     }
     if (m_bDumpingThisCycle) {
       printf("Spectrometer: Dump time (async)      = %6.3f seconds\n", m_pDumper->getTimerInterval());
@@ -260,9 +416,19 @@ void Spectrometer::run()
     } else {
       printf("Spectrometer: Drop fraction          = %6.3f\n", 1.0 * uCycleDrops / (m_uNumSamplesPerAccumulation + uCycleDrops));
     }
+    if (m_pOverload) {
+      printf("Spectrometer: Skip fraction          = %6.3f (1 in %u runs processed)\n", 
+        1.0 * uCycleSkips / (3.0 * m_uNumSamplesPerAccumulation + uCycleDrops + uCycleSkips), 
+        m_pOverload->factor());
+      printf("Spectrometer: Integration (actual)   = %6.3f, %6.3f, %6.3f seconds\n", 
+        m_accumAntenna.getNumAccums() * m_uNumFFT / (2.0 * 1e6 * m_dBandwidth),
+        m_accumAmbientLoad.getNumAccums() * m_uNumFFT / (2.0 * 1e6 * m_dBandwidth),
+        m_accumHotLoad.getNumAccums() * m_uNumFFT / (2.0 * 1e6 * m_dBandwidth));
+    }
     printf("Spectrometer: p0 (antenna) -- acdmin = %6.3f,  adcmax = %6.3f\n", m_accumAntenna.getADCmin(), m_accumAntenna.getADCmax());
     printf("Spectrometer: p1 (ambient) -- acdmin = %6.3f,  adcmax = %6.3f\n", m_accumAmbientLoad.getADCmin(), m_accumAmbientLoad.getADCmax());
     printf("Spectrometer: p2 (hot)     -- acdmin = %6.3f,  adcmax = %6.3f\n", m_accumHotLoad.getADCmin(), m_accumHotLoad.getADCmax());
+    m_pDigitizer->printTiming();
     printf("\n");
 
     // Reset the dumping flag (we'll check again at the start of the next cycle)
@@ -282,6 +448,89 @@ void Spectrometer::run()
 } // run()
 
 
+// ----------------------------------------------------------------------------
+// onStatusRequest() -- Called by the controller (from its socket thread) to
+//                      describe the current state as "name: value" lines.
+// ----------------------------------------------------------------------------
+std::string Spectrometer::onStatusRequest() 
+{
+  std::ostringstream ss;
+
+  ChannelizerStatus chan;
+  chan.uBuffersUsed = 0;
+  chan.uBuffersTotal = 0;
+  chan.uLostSpectra = 0;
+  if (m_pChannelizer) {
+    m_pChannelizer->getStatus(chan);
+  }
+
+  pthread_mutex_lock(&m_mutexStatus);
+  ss << "cycles: " << m_uNumCycles << "\n";
+  ss << "switch_state: " << m_uSwitchState << "\n";
+  ss << "run_seconds: " << m_dRunSeconds << "\n";
+  ss << "duty_cycle: " << m_dDutyCycle << "\n";
+  ss << "drop_fraction: " << m_dDropFraction << "\n";
+  pthread_mutex_unlock(&m_mutexStatus);
+
+  ss << "buffers_used: " << chan.uBuffersUsed << "\n";
+  ss << "buffers_total: " << chan.uBuffersTotal << "\n";
+  ss << "lost_spectra: " << chan.uLostSpectra << "\n";
+  ss << "thread_utilization:";
+  for (unsigned int i=0; i<chan.threadUtilization.size(); i++) {
+    ss << " " << chan.threadUtilization[i];
+  }
+  ss << "\n";
+
+  return ss.str();
+}
+
+
+
+// ----------------------------------------------------------------------------
+// onSpectrumRequest() -- Called by the controller (from its socket thread) 
+//                        for the average spectra of the most recent switch 
+//                        cycle.  Each line is "freq p0 p1 p2" with uBin 
+//                        channels averaged together.
+// ----------------------------------------------------------------------------
+std::string Spectrometer::onSpectrumRequest(unsigned int uBin) 
+{
+  std::string sReply;
+  char line[128];
+
+  pthread_mutex_lock(&m_mutexStatus);
+
+  if (m_snapshot[0].empty()) {
+    pthread_mutex_unlock(&m_mutexStatus);
+    return "ERROR no spectrum yet\n";
+  }
+
+  unsigned int uLength = m_snapshot[0].size();
+  double dStep = (m_accumAntenna.getStopFreq() - m_accumAntenna.getStartFreq()) / uLength;
+
+  sReply = "OK\n";
+  sReply += "# start: " + m_tkSnapshot.getDateTimeString(5) + "\n";
+  sReply += "# freq p0 p1 p2\n";
+
+  for (unsigned int i=0; i+uBin<=uLength; i+=uBin) {
+    double d[3] = {0, 0, 0};
+    for (unsigned int k=0; k<3; k++) {
+      for (unsigned int j=i; j<i+uBin; j++) {
+        d[k] += m_snapshot[k][j];
+      }
+      d[k] /= uBin;
+    }
+    snprintf(line, sizeof(line), "%.6f %.6e %.6e %.6e\n", 
+      m_accumAntenna.getStartFreq() + dStep * (i + (uBin-1) / 2.0), d[0], d[1], d[2]);
+    sReply += line;
+  }
+
+  pthread_mutex_unlock(&m_mutexStatus);
+
+  return sReply;
+}
+
+
+
 // ----------------------------------------------------------------------------
 // isAbort() 
 // ----------------------------------------------------------------------------
@@ -373,6 +622,373 @@ void Spectrometer::setStopTime(const string& strDateTime)
 
 
 
+// ----------------------------------------------------------------------------
+// setFrequencyRange() -- Configures the main accumulators for a channelizer
+//                        that covers only part of the band (e.g. a zoom DDC)
+//                        with uNumChannels channels between dStartFreq and 
+//                        dStopFreq (MHz).  uSamplesPerSpectrum is the number 
+//                        of digitizer samples consumed by each spectrum and
+//                        is the block length pushed to the channelizer.  
+//                        Should be called before setSecondMoment and 
+//                        setSubAccumulation.
+// ----------------------------------------------------------------------------
+void Spectrometer::setFrequencyRange( unsigned long uNumChannels, 
+                                      double dStartFreq, double dStopFreq,
+                                      unsigned long uSamplesPerSpectrum ) 
+{
+  m_uNumChannels = uNumChannels;
+  m_dStartFreq = dStartFreq;
+  m_dStopFreq = dStopFreq;
+  m_dChannelSize = (m_dStopFreq - m_dStartFreq) / (double) m_uNumChannels; // MHz
+  m_uNumFFT = uSamplesPerSpectrum;
+
+  m_accumAntenna.init( m_uNumChannels, m_dStartFreq, 
+                   m_dStopFreq, m_dChannelFactor, m_bSecondMoment );
+  m_accumAmbientLoad.init( m_uNumChannels, m_dStartFreq, 
+                   m_dStopFreq, m_dChannelFactor, m_bSecondMoment );
+  m_accumHotLoad.init( m_uNumChannels, m_dStartFreq, 
+                   m_dStopFreq, m_dChannelFactor, m_bSecondMoment );
+
+  printf("Spectrometer: Main spectra have %lu channels from %.6g to %.6g MHz "
+         "(%.4g kHz per channel)\n", m_uNumChannels, m_dStartFreq, m_dStopFreq, 
+         m_dChannelSize * 1e3);
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setChannelRange() -- Records that the main spectra start at channel 
+//                      uFirstChannel of a channelizer with uTotalChannels 
+//                      channels (when its output is limited to a range of 
+//                      channels) so the .acq file is scaled and flagged as if
+//                      it held the full spectrum.
+// ----------------------------------------------------------------------------
+void Spectrometer::setChannelRange( unsigned long uFirstChannel, 
+                                    unsigned long uTotalChannels ) 
+{
+  m_accumAntenna.setChannelRange(uFirstChannel, uTotalChannels);
+  m_accumAmbientLoad.setChannelRange(uFirstChannel, uTotalChannels);
+  m_accumHotLoad.setChannelRange(uFirstChannel, uTotalChannels);
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setSecondMoment() -- Keep the sum of power squared in each accumulator so
+//                      that spectral kurtosis and variance can be written 
+//                      alongside the .acq file.  The channelizer must also be
+//                      told to provide the power squared.
+// ----------------------------------------------------------------------------
+void Spectrometer::setSecondMoment(bool bSecondMoment) 
+{
+  m_bSecondMoment = bSecondMoment;
+
+  m_accumAntenna.init( m_uNumChannels, m_dStartFreq, 
+                   m_dStopFreq, m_dChannelFactor, m_bSecondMoment );
+  m_accumAmbientLoad.init( m_uNumChannels, m_dStartFreq, 
+                   m_dStopFreq, m_dChannelFactor, m_bSecondMoment );
+  m_accumHotLoad.init( m_uNumChannels, m_dStartFreq, 
+                   m_dStopFreq, m_dChannelFactor, m_bSecondMoment );
+
+  for (unsigned int n=0; n<m_extraAccums.size(); n++) {
+    for (unsigned int k=0; k<3; k++) {
+      m_extraAccums[n][k].init( m_extraAccums[n][k].getDataLength(), 
+                                m_extraAccums[n][k].getStartFreq(), 
+                                m_extraAccums[n][k].getStopFreq(), 
+                                m_dChannelFactor, m_bSecondMoment );
+    }
+  }
+
+  if (m_bSecondMoment) {
+    printf("Spectrometer: Writing spectral kurtosis and variance to .sk files\n");
+  }
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setSubAccumulation() -- Split each accumulation into sub-accumulations of 
+//                         approximately dSeconds each.  The sub-accumulations
+//                         are written to .sub files alongside the .acq file.
+// ----------------------------------------------------------------------------
+void Spectrometer::setSubAccumulation(double dSeconds) 
+{
+  unsigned int uSpectraPerSub = 0;
+  unsigned int uNumSubs = 0;
+
+  if (dSeconds > 0) {
+    unsigned long uSpectraPerAccum = m_uNumSamplesPerAccumulation / m_uNumFFT;
+    uSpectraPerSub = (unsigned int) (dSeconds * 2.0 * 1e6 * m_dBandwidth / m_uNumFFT + 0.5);
+    uSpectraPerSub = (uSpectraPerSub < 1) ? 1 : uSpectraPerSub;
+    uNumSubs = (uSpectraPerAccum + uSpectraPerSub - 1) / uSpectraPerSub;
+  }
+
+  m_bSubAccumulation = (uNumSubs > 0);
+
+  if (!m_accumAntenna.initSubs(uNumSubs, uSpectraPerSub) ||
+      !m_accumAmbientLoad.initSubs(uNumSubs, uSpectraPerSub) ||
+      !m_accumHotLoad.initSubs(uNumSubs, uSpectraPerSub)) {
+    m_bSubAccumulation = false;
+    return;
+  }
+
+  if (m_bSubAccumulation) {
+    printf("Spectrometer: Writing %u sub-accumulations of %u spectra (%.3g seconds) "
+           "per accumulation to .sub files\n", uNumSubs, uSpectraPerSub, 
+           uSpectraPerSub * m_uNumFFT / (2.0 * 1e6 * m_dBandwidth));
+  }
+}
+
+
+
+// ----------------------------------------------------------------------------
+// addBinning() -- Also accumulate the main spectra with uFactor channels 
+//                 summed into each bin, in accumulations of approximately 
+//                 dSeconds each (0 for one per accumulation).  Written to 
+//                 .bN files alongside the .acq file, where N is the factor.
+//                 Call in order of increasing factor, after 
+//                 setFrequencyRange() and setSecondMoment().
+// ----------------------------------------------------------------------------
+bool Spectrometer::addBinning(unsigned int uFactor, double dSeconds) 
+{
+  unsigned long uSpectraPerAccum = m_uNumSamplesPerAccumulation / m_uNumFFT;
+  unsigned int uSpectraPerBin = (unsigned int) uSpectraPerAccum;
+
+  if (dSeconds > 0) {
+    uSpectraPerBin = (unsigned int) (dSeconds * 2.0 * 1e6 * m_dBandwidth / m_uNumFFT + 0.5);
+  }
+  uSpectraPerBin = (uSpectraPerBin < 1) ? 1 : uSpectraPerBin;
+  unsigned int uNumBins = (uSpectraPerAccum + uSpectraPerBin - 1) / uSpectraPerBin;
+  uNumBins = (uNumBins < 1) ? 1 : uNumBins;
+
+  if (!m_accumAntenna.addBinning(uFactor, uNumBins, uSpectraPerBin) ||
+      !m_accumAmbientLoad.addBinning(uFactor, uNumBins, uSpectraPerBin) ||
+      !m_accumHotLoad.addBinning(uFactor, uNumBins, uSpectraPerBin)) {
+    return false;
+  }
+
+  printf("Spectrometer: Writing %u channels binned by %u in %u accumulations of "
+         "%u spectra (%.3g seconds) per accumulation to .b%u files\n", 
+         m_accumAntenna.getBinned(m_accumAntenna.getNumBinned()-1)->getDataLength(),
+         uFactor, uNumBins, uSpectraPerBin, 
+         uSpectraPerBin * m_uNumFFT / (2.0 * 1e6 * m_dBandwidth), uFactor);
+
+  return true;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setFlagging() -- Count the flagged channels of the main spectra, flagged
+//                  by pFlagger (see PFBBank::setFlagger), and, if the 
+//                  flagger masks rather than skips, keep their weights.  
+//                  Both are written to .wt files alongside the .acq file.
+//                  Call after setFrequencyRange().
+// ----------------------------------------------------------------------------
+void Spectrometer::setFlagging(SpectrumFlagger* pFlagger, bool bMask) 
+{
+  m_pFlagger = pFlagger;
+
+  if (bMask) {
+    m_accumAntenna.initWeights();
+    m_accumAmbientLoad.initWeights();
+    m_accumHotLoad.initWeights();
+  }
+
+  m_accumAntenna.initFlags();
+  m_accumAmbientLoad.initFlags();
+  m_accumHotLoad.initFlags();
+
+  printf("Spectrometer: Writing RFI flagging weights and counts to .wt files\n");
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setLiveFeed() -- Publish the spectra of each switch cycle to the shared 
+//                  memory feed.  Opens the feed with room for the configured
+//                  number of channels, so must be called after 
+//                  setFrequencyRange().  Each binned resolution gets a feed
+//                  of its own (LIVEFEED_NAME + "_b<factor>"), so call after
+//                  addBinning() too.
+// ----------------------------------------------------------------------------
+void Spectrometer::setLiveFeed(LiveFeed* pLiveFeed) 
+{
+  m_pLiveFeed = NULL;
+
+  if (pLiveFeed && pLiveFeed->open(LIVEFEED_NAME, 3, m_uNumChannels)) {
+    m_pLiveFeed = pLiveFeed;
+  }
+
+  for (unsigned int n=0; m_pLiveFeed && (n<m_accumAntenna.getNumBinned()); n++) {
+
+    const Accumulator* pBinned = m_accumAntenna.getBinned(n);
+    LiveFeed* pFeed = new LiveFeed;
+
+    if (!pFeed->open(LIVEFEED_NAME "_b" + std::to_string(pBinned->getId()), 3, 
+                     pBinned->getDataLength())) {
+      delete pFeed;
+      break;
+    }
+
+    Accumulator* pLatest = new Accumulator[3];
+    for (unsigned int i=0; i<3; i++) {
+      pLatest[i].init(pBinned->getDataLength(), pBinned->getStartFreq(), 
+                      pBinned->getStopFreq(), pBinned->getChannelFactor());
+    }
+
+    m_binnedFeeds.push_back(pFeed);
+    m_binnedLatest.push_back(pLatest);
+    m_binnedPublished.push_back(0);
+  }
+}
+
+
+
+// ----------------------------------------------------------------------------
+// publishBinned() -- Publishes binned resolution n to its feed if another of
+//                    its accumulations at this switch position is complete.
+//                    The feed holds the latest accumulation at each position.
+//                    Called for each spectrum, so it's cheap when there's 
+//                    nothing to publish.
+// ----------------------------------------------------------------------------
+void Spectrometer::publishBinned(unsigned int n)
+{
+  const Accumulator* pBinned = m_pCurrentAccum->getBinned(n);
+  unsigned int uIndex = m_binnedPublished[n];
+
+  if ((pBinned == NULL) || (pBinned->getSubNumAccums(uIndex) < pBinned->getSpectraPerSub())) {
+    return;
+  }
+
+  // It ran from the end of the one before (or the start of the position) 
+  // until now
+  Accumulator* pLatest = m_binnedLatest[n];
+  Accumulator* pAccum = &pLatest[m_uSwitchState];
+
+  TimeKeeper startTime = (uIndex > 0) ? pAccum->getStopTime() : m_pCurrentAccum->getStartTime();
+  pBinned->copySub(uIndex, pAccum);
+  pAccum->setStartTime(startTime);
+  pAccum->setStopTime();
+
+  Accumulator* pAccums[3] = { &pLatest[0], &pLatest[1], &pLatest[2] };
+  m_binnedFeeds[n]->publish(pAccums, 3, m_uNumCycles + 1);
+
+  m_binnedPublished[n]++;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setVoltageRing() -- Stream the complex spectra of the main channelizer to
+//                     a shared memory ring of uNumSlots slots.  The 
+//                     channelizer must pass them on with uBits per part (see
+//                     PFB::setVoltageOutput).  Must be called after 
+//                     setFrequencyRange().
+// ----------------------------------------------------------------------------
+void Spectrometer::setVoltageRing(VoltageRing* pRing, unsigned int uNumSlots, unsigned int uBits) 
+{
+  m_pVoltageRing = NULL;
+
+  if (pRing && pRing->open(VOLTAGERING_NAME, uNumSlots, m_uNumChannels, uBits, 
+                           m_dStartFreq, m_dStopFreq)) {
+    m_pVoltageRing = pRing;
+  }
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setInputs() -- Number of inputs interleaved in each transfer (1 or 2).  With
+//                two, the channelizer must return the power of input B and 
+//                the cross power with each spectrum (see PFBBank::setInputs).
+//                Must be called after setFrequencyRange() and 
+//                setChannelRange().
+// ----------------------------------------------------------------------------
+void Spectrometer::setInputs(unsigned int uInputs) 
+{
+  delete[] m_pInputB;
+  delete[] m_pCross;
+  m_pInputB = NULL;
+  m_pCross = NULL;
+  m_uInputs = (uInputs == 2) ? 2 : 1;
+
+  if (m_uInputs == 2) {
+
+    // The cross power has the real parts of all channels, then the imaginary
+    m_pInputB = new Accumulator[3];
+    m_pCross = new Accumulator[3];
+    for (unsigned int k=0; k<3; k++) {
+      m_pInputB[k].init( m_uNumChannels, m_dStartFreq, m_dStopFreq, m_dChannelFactor );
+      m_pInputB[k].setChannelRange( m_accumAntenna.getFirstChannel(), 
+                                    m_accumAntenna.getTotalChannels() );
+      m_pCross[k].init( 2*m_uNumChannels, m_dStartFreq, m_dStopFreq, m_dChannelFactor );
+    }
+
+    printf("Spectrometer: Writing input B to _b.acq files and the cross power "
+           "to .xc files\n");
+  }
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setOverload() -- Skip whole runs of uRunBlocks blocks (up to uMaxFactor-1 
+//                  runs in uMaxFactor) when the channelizer falls behind, 
+//                  instead of dropping blocks wherever its buffer happens to 
+//                  be full.  See OverloadController.
+// ----------------------------------------------------------------------------
+void Spectrometer::setOverload(unsigned int uRunBlocks, unsigned int uMaxFactor) 
+{
+  if (m_pOverload) {
+    delete m_pOverload;
+  }
+
+  m_pOverload = new OverloadController(uRunBlocks, uMaxFactor);
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setMetricsFile() -- Write all metrics in the Prometheus text format to this
+//                     file after each switch cycle (e.g. for the node 
+//                     exporter's textfile collector)
+// ----------------------------------------------------------------------------
+void Spectrometer::setMetricsFile(const std::string& sFilePath) 
+{
+  m_sMetricsFile = sFilePath;
+
+  printf("Spectrometer: Writing metrics to %s after each cycle\n", sFilePath.c_str());
+}
+
+
+
+// ----------------------------------------------------------------------------
+// addChannelizerOutput() -- Adds a set of accumulators (one per switch 
+//                  position) for spectra from an extra channelizer with 
+//                  uNumChannels channels.  Extra channelizers must be added in
+//                  the same order as in the channelizer bank.  Returns the 
+//                  channelizer id the set will receive spectra from.  Each set
+//                  is written to its own .acq file with a "_pfb<id>" suffix.
+// ----------------------------------------------------------------------------
+unsigned int Spectrometer::addChannelizerOutput(unsigned long uNumChannels) 
+{
+  Accumulator* pAccums = new Accumulator[3];
+  for (unsigned int k=0; k<3; k++) {
+    pAccums[k].init( uNumChannels, 0.0, m_dBandwidth, 
+                     m_dChannelFactor, m_bSecondMoment );
+  }
+  
+  m_extraAccums.push_back(pAccums);
+
+  printf("Spectrometer: Accumulating spectra from channelizer %u with %lu channels\n", 
+    (unsigned int) m_extraAccums.size(), uNumChannels);
+
+  return m_extraAccums.size();
+}
+
+
+
 bool Spectrometer::writeToAcqFile() {
 
   std::string sFilePath = m_pController->getAcqFilePath(m_accumAntenna.getStartTime());
@@ -380,49 +996,210 @@ bool Spectrometer::writeToAcqFile() {
   // Write the .acq entry
   printf("Spectrometer: Writing accumulations to file: %s\n", sFilePath.c_str());
 
-  // If needed, start a new file and write the header
-  if (!is_file(sFilePath)) {
+  // Write the data (starting a new file with its header if needed)
+  bool bResult = writeAcqHeader(sFilePath, "") &&
+                 append_switch_cycle( sFilePath, 
+                                      m_accumAntenna, 
+                                      m_accumAmbientLoad, 
+                                      m_accumHotLoad );
+
+  // Write the accumulations from any extra channelizers to their own files
+  for (unsigned int n=0; n<m_extraAccums.size(); n++) {
+
+    std::stringstream ssPath;
+    ssPath << sFilePath.substr(0, sFilePath.rfind('.')) << "_pfb" << (n+1) << ".acq";
+
+    std::stringstream ssHeader;
+    ssHeader << "; Extra channelizer " << (n+1) << ": " 
+             << m_extraAccums[n][0].getDataLength() << " channels" << std::endl;
+
+    bResult = writeAcqHeader(ssPath.str(), ssHeader.str()) &&
+              append_switch_cycle( ssPath.str(), 
+                                   m_extraAccums[n][0], 
+                                   m_extraAccums[n][1], 
+                                   m_extraAccums[n][2] ) && bResult;
+  }
+
+  // Write input B and the cross power of the two inputs
+  if (m_pInputB) {
+
+    std::string sBasePath = sFilePath.substr(0, sFilePath.rfind('.'));
+
+    bResult = writeAcqHeader(sBasePath + "_b.acq", "; Input B\n") &&
+              append_switch_cycle( sBasePath + "_b.acq", 
+                                   m_pInputB[0], 
+                                   m_pInputB[1], 
+                                   m_pInputB[2] ) && bResult;
+
+    std::stringstream ss;
+    ss << "; Data: [int year, int doy, int hh, int mm, int ss, long ns, ";
+    ss << "unsigned int swpos, unsigned int nblk, unsigned int nspec, ";
+    ss << "ACCUM_DATA_TYPE auto_a[nspec], ACCUM_DATA_TYPE auto_b[nspec], ";
+    ss << "ACCUM_DATA_TYPE cross_real[nspec], ACCUM_DATA_TYPE cross_imag[nspec]]";
+    ss << std::endl << "; Cross: average of A x conj(B)";
+    ss << std::endl << "; sizeof(ACCUM_DATA_TYPE): " << sizeof(ACCUM_DATA_TYPE);
+    ss << std::endl;
+
+    bResult = writeSideFileHeader(sBasePath + ".xc", ss.str()) &&
+              append_switch_cycle_cross( sBasePath + ".xc", 
+                                         m_accumAntenna, 
+                                         m_accumAmbientLoad, 
+                                         m_accumHotLoad,
+                                         m_pInputB, 
+                                         m_pCross ) && bResult;
+  }
 
-    // Write the header
-    std::ofstream fs;
-    fs.open(sFilePath);
-    if (!fs.is_open()) {
-      printf("Spectrometer: Failed to write header to new .acq file.\n");
-      return false;
+  // Write the spectral kurtosis and variance to the binary sidecar
+  if (m_bSecondMoment) {
+
+    std::string sMomentPath = sFilePath.substr(0, sFilePath.rfind('.')) + ".sk";
+
+    std::stringstream ss;
+    ss << "; Data: [int year, int doy, int hh, int mm, int ss, long ns, ";
+    ss << "unsigned int swpos, unsigned int nblk, unsigned int nspec, ";
+    ss << "ACCUM_DATA_TYPE kurtosis[nspec], ACCUM_DATA_TYPE variance[nspec]]";
+    ss << std::endl << "; sizeof(ACCUM_DATA_TYPE): " << sizeof(ACCUM_DATA_TYPE);
+    ss << std::endl;
+
+    bResult = writeSideFileHeader(sMomentPath, ss.str()) &&
+              append_switch_cycle_moments( sMomentPath, 
+                                           m_accumAntenna, 
+                                           m_accumAmbientLoad, 
+                                           m_accumHotLoad ) && bResult;
+  }
+
+  // Write the weights and flag counts of each channel to the binary sidecar
+  if (m_pFlagger) {
+
+    std::string sWeightPath = sFilePath.substr(0, sFilePath.rfind('.')) + ".wt";
+
+    std::stringstream ss;
+    ss << "; Data: [int year, int doy, int hh, int mm, int ss, long ns, ";
+    ss << "unsigned int swpos, unsigned int nblk, unsigned int nspec, ";
+    ss << "ACCUM_DATA_TYPE weight[nspec], ACCUM_DATA_TYPE flagged[nspec]]";
+    ss << std::endl << "; sizeof(ACCUM_DATA_TYPE): " << sizeof(ACCUM_DATA_TYPE);
+    ss << std::endl;
+
+    bResult = writeSideFileHeader(sWeightPath, ss.str()) &&
+              append_switch_cycle_weights( sWeightPath, 
+                                           m_accumAntenna, 
+                                           m_accumAmbientLoad, 
+                                           m_accumHotLoad ) && bResult;
+  }
+
+  // Write each binned resolution to its own binary side stream
+  for (unsigned int n=0; n<m_accumAntenna.getNumBinned(); n++) {
+
+    const Accumulator* pBinned = m_accumAntenna.getBinned(n);
+
+    std::stringstream ssPath;
+    ssPath << sFilePath.substr(0, sFilePath.rfind('.')) << ".b" << pBinned->getId();
+
+    std::stringstream ss;
+    ss << "; Data: [int year, int doy, int hh, int mm, int ss, long ns, ";
+    ss << "float duration, unsigned int swpos, unsigned int index, ";
+    ss << "unsigned int nblk, unsigned int nspec, float average[nspec]]";
+    ss << std::endl << "; Binned: " << pBinned->getId() << " channels per bin, ";
+    ss << pBinned->getDataLength() << " bins from " << pBinned->getStartFreq();
+    ss << " to " << pBinned->getStopFreq() << " MHz";
+    ss << std::endl;
+
+    if (!writeSideFileHeader(ssPath.str(), ss.str())) {
+      bResult = false;
+      continue;
+    }
+
+    bResult = append_sub_accumulations(ssPath.str(), m_accumAntenna.getBinned(n), 0) && bResult;
+    bResult = append_sub_accumulations(ssPath.str(), m_accumAmbientLoad.getBinned(n), 1) && bResult;
+    bResult = append_sub_accumulations(ssPath.str(), m_accumHotLoad.getBinned(n), 2) && bResult;
+  }
+
+  // Write the sub-accumulations to their binary side stream
+  if (m_bSubAccumulation) {
+
+    std::string sSubPath = sFilePath.substr(0, sFilePath.rfind('.')) + ".sub";
+
+    std::stringstream ss;
+    ss << "; Data: [int year, int doy, int hh, int mm, int ss, long ns, ";
+    ss << "float duration, unsigned int swpos, unsigned int index, ";
+    ss << "unsigned int nblk, unsigned int nspec, float average[nspec]]";
+    ss << std::endl;
+
+    if (writeSideFileHeader(sSubPath, ss.str())) {
+      bResult = append_sub_accumulations(sSubPath, &m_accumAntenna, 0) && bResult;
+      bResult = append_sub_accumulations(sSubPath, &m_accumAmbientLoad, 1) && bResult;
+      bResult = append_sub_accumulations(sSubPath, &m_accumHotLoad, 2) && bResult;
+    } else {
+      bResult = false;
     }
-    fs << "; FASTSPEC v" << VERSION_MAJOR << "." 
-                         << VERSION_MINOR << "." 
-                         << VERSION_PATCH << std::endl;
-    fs << m_pController->getConfigStr();
-    fs.close();
   }
 
-  // Write the data
-  return append_switch_cycle( sFilePath, 
-                              m_accumAntenna, 
-                              m_accumAmbientLoad, 
-                              m_accumHotLoad );
+  return bResult;
 
 }
 
 
-// Handle output for live plotting if needed
-bool Spectrometer::handleLivePlot() {
 
-  if (!m_pController->plot()) {
+// ----------------------------------------------------------------------------
+// writeAcqHeader() -- Starts a new .acq (or accompanying) file if it doesn't
+//                     exist yet, with the version and configuration followed
+//                     by sExtra (complete lines, or empty).  Returns true if 
+//                     the file already exists.
+// ----------------------------------------------------------------------------
+bool Spectrometer::writeAcqHeader(const std::string& sFilePath, 
+                                  const std::string& sExtra) 
+{
+  if (is_file(sFilePath)) {
+    return true;
+  }
+
+  std::ofstream fs;
+  fs.open(sFilePath);
+  if (!fs.is_open()) {
+    printf("Spectrometer: Failed to write header to new file: %s\n", sFilePath.c_str());
     return false;
   }
 
-  // Write the temporary file for plotting
-  if ( !write_plot_file( m_pController->getPlotFilePath(), 
-                         m_accumAntenna, 
-                         m_accumAmbientLoad, 
-                         m_accumHotLoad,
-                         m_pController->getPlotBinLevel() ) ) {
+  fs << "; FASTSPEC v" << VERSION_MAJOR << "." 
+                       << VERSION_MINOR << "." 
+                       << VERSION_PATCH << std::endl;
+  fs << m_pController->getConfigStr();
+  fs << sExtra;
+  fs.close();
+
+  return true;
+
+}
+
+
+
+// ----------------------------------------------------------------------------
+// writeSideFileHeader() -- Starts a new binary file that accompanies the .acq
+//                          file if it doesn't exist yet.  The text header 
+//                          holds the configuration and a description of the 
+//                          binary records that follow it.
+// ----------------------------------------------------------------------------
+bool Spectrometer::writeSideFileHeader(const std::string& sFilePath, 
+                                       const std::string& sDataDescription) 
+{
+  return writeAcqHeader(sFilePath, sDataDescription + "; End header\n");
+}
+
+
+// Handle output for live plotting if needed
+bool Spectrometer::handleLivePlot(unsigned long uCycle) {
+
+  // Publish to the shared memory feed (just a copy of the spectra)
+  if (m_pLiveFeed) {
+    Accumulator* pAccums[3] = { &m_accumAntenna, &m_accumAmbientLoad, &m_accumHotLoad };
+    m_pLiveFeed->publish(pAccums, 3, uCycle);
+  }
+
+  // The viewer reads the feed itself, so only make sure it is running
+  if (!m_pController->plot() || !m_pLiveFeed) {
     return false;
   }
 
-  // Tell the plotter to refresh
   m_pController->updatePlotter();
   return true;
 }
@@ -435,45 +1212,60 @@ bool Spectrometer::handleLivePlot() {
 //                 any transferred data at the end of the transfer beyond the
 //                 last integer multiple of m_uNumFFT.  If an Channelizer buffer 
 //                 is not available for a given chunk of the transfer, it drops 
-//                 that chunk of data.  Returns total number of samples 
+//                 that chunk of data.  Each chunk is pushed with its sample
+//                 index, so the channelizer sees where chunks were dropped.
+//                 Chunks the overload controller skips are recorded as
+//                 skips rather than drops.  Returns total number of samples 
 //                 successfully processed into a Channelizer buffer.
 // ----------------------------------------------------------------------------
 unsigned long Spectrometer::onDigitizerData( SAMPLE_DATA_TYPE* pBuffer, 
                                              unsigned int uBufferLength,
                                              unsigned long uTransferredSoFar,
                                              double dScale,
-                                             double dOffset ) 
+                                             double dOffset,
+                                             unsigned long long uSampleIndex ) 
 {
   unsigned int uIndex = 0;
   unsigned int uAdded = 0;
+  unsigned int uSkipped = 0;
+  TraceSpan span("onDigitizerData");
+
+  // With two inputs, each chunk holds an FFT's worth of samples of both, 
+  // and the channelizer counts sample times rather than values
+  unsigned int uChunk = m_uNumFFT * m_uInputs;
   
   // Try to add to the dumper if we're actively dumping data (antenna only)  
   if (m_bDumpingThisCycle && (m_pSwitch->get() == 0)) { 
     if (!m_pDumper->push( (void*) pBuffer, uBufferLength*m_pDigitizer->bytesPerSample() )) {
-      printf("Dumper failed push\n");
+      Log::warn("Spectrometer: Dumper failed push\n");
     } 
   }
     
   // Loop over the transferred data and enter it into the channelizer buffer
-  while ( ((uIndex + m_uNumFFT) <= uBufferLength) 
-         && (uTransferredSoFar < m_uNumSamplesPerAccumulation)) {
+  while ( ((uIndex + uChunk) <= uBufferLength) 
+         && (uTransferredSoFar < m_uNumSamplesPerAccumulation * m_uInputs)) {
     
-    // Try to add to the channelizer buffer
-    if (m_pChannelizer->push(&(pBuffer[uIndex]), m_uNumFFT, dScale, dOffset)) { 
-      uTransferredSoFar += m_uNumFFT;
+    // Try to add to the channelizer buffer (unless this run is skipped)
+    if (m_pOverload && !m_pOverload->admit(m_pChannelizer, m_uNumFFT)) {
+      uSkipped++;
+    } else if (m_pChannelizer->push(&(pBuffer[uIndex]), uChunk, dScale, dOffset, 
+                                    (uSampleIndex + uIndex) / m_uInputs)) { 
+      uTransferredSoFar += uChunk;
       uAdded++;
     }  
         
     // Increment the index to the next chunk of transferred data
-    uIndex += m_uNumFFT;
+    uIndex += uChunk;
   }
 
-  // Keep a permanent record of how many samples were dropped
-  m_pCurrentAccum->addDrops(uBufferLength - uAdded * m_uNumFFT);
+  // Keep a permanent record of how many samples (of each input) were dropped
+  // or skipped
+  m_pCurrentAccum->addDrops((uBufferLength - (uAdded + uSkipped) * uChunk) / m_uInputs);
+  m_pCurrentAccum->addSkips(uSkipped * m_uNumFFT);
 
   // Return the total number of transferred samples that were successfully
   // entered in the FFTPool buffer for processing.
-  return uAdded * m_uNumFFT;
+  return uAdded * uChunk;
 
 } // onDigitizerData()
 
@@ -483,7 +1275,49 @@ unsigned long Spectrometer::onDigitizerData( SAMPLE_DATA_TYPE* pBuffer,
 // ----------------------------------------------------------------------------
 // onChannelizerData() -- Do something with a spectrum returned from the Channelizer
 // ----------------------------------------------------------------------------
-void Spectrometer::onChannelizerData(ChannelizerData* pData) 
+void Spectrometer::onChannelizerData(ChannelizerData<float>* pData) 
+{
+  receive(pData);
+}
+
+void Spectrometer::onChannelizerData(ChannelizerData<double>* pData) 
+{
+  receive(pData);
+}
+
+
+
+// ----------------------------------------------------------------------------
+// receive() -- Adds a spectrum of either precision to its accumulation
+// ----------------------------------------------------------------------------
+template<typename T>
+void Spectrometer::receive(ChannelizerData<T>* pData) 
 {  
-  m_pCurrentAccum->add(pData->pData, pData->uNumChannels, pData->dADCmin, pData->dADCmax);
-} // onChannelizerData()
+  TraceSpan span("accumulate");
+
+  if (pData->uId == 0) {
+    if (pData->pWeights) {
+      m_pCurrentAccum->addFlags(pData->pWeights, pData->uNumChannels);
+    }
+    if (pData->bSkipped) {
+      return;
+    }
+    m_pCurrentAccum->add(pData->pData, pData->pData2, pData->uNumChannels, 
+                         pData->dADCmin, pData->dADCmax, pData->pWeights);
+    for (unsigned int n=0; n<m_binnedFeeds.size(); n++) {
+      publishBinned(n);
+    }
+    if (m_pInputB && pData->pDataB) {
+      m_pInputB[m_uSwitchState].add( pData->pDataB, pData->uNumChannels, 
+                                      pData->dADCminB, pData->dADCmaxB );
+      m_pCross[m_uSwitchState].add( pData->pCross, 2*pData->uNumChannels, 
+                                    pData->dADCmin, pData->dADCmax );
+    }
+    if (m_pVoltageRing) {
+      m_pVoltageRing->write(pData, m_uSwitchState);
+    }
+  } else if (!pData->bSkipped && (pData->uId <= m_extraAccums.size())) {
+    m_extraAccums[pData->uId-1][m_uSwitchState].add( pData->pData, pData->pData2, 
+      pData->uNumChannels, pData->dADCmin, pData->dADCmax );
+  }
+} // receive()
@@ -2,14 +2,20 @@
 #define _SPECTROMETER_H_
 
 #include <string>
+#include <vector>
 #include <functional>
 #include "accumulator.h"
 #include "digitizer.h"
 #include "channelizer.h"
 #include "dumper.h"
+#include "flagger.h"
 #include "controller.h"
+#include "livefeed.h"
+#include "metrics.h"
+#include "overload.h"
 #include "switch.h"
 #include "timing.h"
+#include "voltagering.h"
 
 #ifndef SAMPLE_DATA_TYPE
   #error Aborted in spectrometer.h because SAMPLE_DATA_TYPE was not defined.
@@ -20,10 +26,31 @@
 // SPECTROMETER
 //
 // Uses PXBoard, Switch, and FFTPool objects to control and acquire data from
-// the EDGES system.
+// the EDGES system.  Answers status and spectrum requests from the 
+// controller's socket with the results of the most recent switch cycle.
+//
+// With two inputs (setInputs), each transfer holds both inputs interleaved
+// and the main channelizer also returns the power of input B and the cross
+// power (see PFB).  The main accumulators and .acq file are input A.  Input
+// B goes to a "_b.acq" file and the cross power to a binary .xc file.  The
+// samples per accumulation are per input.
+//
+// Coarser resolutions of the main spectra (addBinning) are binned from the
+// same spectra as they are accumulated, each with its own accumulation 
+// length, and written to binary .bN files (N channels per bin).  With the
+// live feed on, each of their accumulations is also published to a feed of
+// its own as soon as it completes.
+//
+// With RFI flagging (setFlagging), the main spectra arrive with a weight per
+// channel (see SpectrumFlagger).  In mask mode, each channel of the main 
+// accumulations, sub-accumulations and binned resolutions is scaled to its
+// average over the spectra it was kept in.  In both modes, the number of 
+// spectra each channel was kept in and flagged in (skipped spectra too) is
+// written to a binary .wt file with every accumulation.  The flagger is
+// told the switch position before each position's spectra.
 //
 // ---------------------------------------------------------------------------
-class Spectrometer : public DigitizerReceiver, ChannelizerReceiver {
+class Spectrometer : public DigitizerReceiver, ChannelizerReceiver, ControlReceiver {
 
   private:
 
@@ -33,10 +60,22 @@ class Spectrometer : public DigitizerReceiver, ChannelizerReceiver {
     Dumper*         m_pDumper;
     Switch*         m_pSwitch;
     Controller*     m_pController;    
+    LiveFeed*       m_pLiveFeed;
+    VoltageRing*    m_pVoltageRing;
+    OverloadController* m_pOverload;
+    SpectrumFlagger* m_pFlagger;                // Of the main spectra (NULL if off)
     Accumulator     m_accumAntenna;
     Accumulator     m_accumAmbientLoad;
     Accumulator     m_accumHotLoad;
     Accumulator*    m_pCurrentAccum;
+    std::vector<Accumulator*> m_extraAccums;    // 3 per extra channelizer
+    std::vector<LiveFeed*> m_binnedFeeds;       // One per binned resolution (see setLiveFeed)
+    std::vector<Accumulator*> m_binnedLatest;   // 3 per binned resolution, the latest at each position
+    std::vector<unsigned int> m_binnedPublished; // Accumulations published so far at this position
+    Accumulator*    m_pInputB;                  // 3 with two inputs (else NULL)
+    Accumulator*    m_pCross;                   // 3 with two inputs (else NULL)
+    unsigned int    m_uInputs;
+    unsigned int    m_uSwitchState;
     unsigned long   m_uNumFFT;
     unsigned long   m_uNumChannels;
     unsigned long   m_uNumSamplesPerAccumulation;
@@ -52,17 +91,37 @@ class Spectrometer : public DigitizerReceiver, ChannelizerReceiver {
     bool            m_bUseStopSeconds;
     bool            m_bUseStopTime;
     bool            m_bDumpingThisCycle;
+    bool            m_bSecondMoment;
+    bool            m_bSubAccumulation;
     unsigned long   m_uStopCycles;
     double          m_dStopSeconds;             // Seconds
     TimeKeeper      m_tkStopTime;               // UTC
+    pthread_mutex_t m_mutexStatus;
+    unsigned long   m_uNumCycles;
+    double          m_dDutyCycle;
+    double          m_dDropFraction;
+    double          m_dRunSeconds;
+    std::vector<ACCUM_DATA_TYPE> m_snapshot[3]; // Average spectra of last cycle
+    TimeKeeper      m_tkSnapshot;
+    MetricCounter*  m_pCyclesMetric;
+    MetricCounter*  m_pDroppedMetric;
+    MetricGauge*    m_pDutyCycleMetric;
+    MetricGauge*    m_pDropFractionMetric;
+    MetricHistogram* m_pWriteMetric;
+    std::string     m_sMetricsFile;
 
 
     // Private helper functions
     std::string getFileName();
     bool writeToAcqFile();
-    bool handleLivePlot();
+    bool writeAcqHeader(const std::string&, const std::string&);
+    bool writeSideFileHeader(const std::string&, const std::string&);
+    bool handleLivePlot(unsigned long);
+    void publishBinned(unsigned int);
     bool isStop(unsigned long, Timer&);
     bool isAbort();
+    template<typename T>
+    void receive(ChannelizerData<T>*);
 
   public:
 
@@ -78,10 +137,25 @@ class Spectrometer : public DigitizerReceiver, ChannelizerReceiver {
     void setStopCycles(unsigned long);
     void setStopSeconds(double);
     void setStopTime(const std::string&);
+    void setFrequencyRange(unsigned long, double, double, unsigned long);
+    void setChannelRange(unsigned long, unsigned long);
+    void setSecondMoment(bool);
+    void setSubAccumulation(double);
+    bool addBinning(unsigned int, double);
+    void setFlagging(SpectrumFlagger*, bool);
+    void setLiveFeed(LiveFeed*);
+    void setVoltageRing(VoltageRing*, unsigned int, unsigned int);
+    void setInputs(unsigned int);
+    void setOverload(unsigned int, unsigned int);
+    void setMetricsFile(const std::string&);
+    unsigned int addChannelizerOutput(unsigned long);
 
     // Callbacks
-    unsigned long onDigitizerData(SAMPLE_DATA_TYPE*, unsigned int, unsigned long, double, double);
-    void onChannelizerData(ChannelizerData*);
+    unsigned long onDigitizerData(SAMPLE_DATA_TYPE*, unsigned int, unsigned long, double, double, unsigned long long);
+    void onChannelizerData(ChannelizerData<float>*);
+    void onChannelizerData(ChannelizerData<double>*);
+    std::string onStatusRequest();
+    std::string onSpectrumRequest(unsigned int);
 
 };
 
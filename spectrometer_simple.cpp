@@ -1,8 +1,12 @@
 #include "spectrometer_simple.h"
 #include "timing.h"
+#include "trace.h"
+#include "log.h"
+#include "thread_policy.h"
 #include "utility.h"
 #include "version.h"
 #include <unistd.h> // usleep
+#include <sstream>  // stringstream
 
 #define SPEC_SLEEP_MICROSECONDS 5
 
@@ -27,7 +31,6 @@ SpectrometerSimple::SpectrometerSimple(unsigned long uNumChannels,
                                        unsigned long uNumSamplesPerAccumulation, 
                                        double dBandwidth,
                                        unsigned int uNumAccumulators,      
-                                       double dPlotIntervalSeconds,                               
                                        Digitizer* pDigitizer,
                                        Channelizer* pChannelizer,
                                        Controller* pController )
@@ -38,7 +41,6 @@ SpectrometerSimple::SpectrometerSimple(unsigned long uNumChannels,
   m_uNumSamplesPerAccumulation = uNumSamplesPerAccumulation;
   m_dBandwidth = dBandwidth;
   m_uNumAccumulators = uNumAccumulators;
-  m_dPlotIntervalSeconds = dPlotIntervalSeconds;
 
   // Derived configuration
   m_dChannelSize = m_dBandwidth / (double) m_uNumChannels; // MHz
@@ -58,11 +60,38 @@ SpectrometerSimple::SpectrometerSimple(unsigned long uNumChannels,
   m_bUseStopCycles = false;
   m_bUseStopSeconds = false;
   m_bUseStopTime = false;
+  m_bSecondMoment = false;
+  m_bSubAccumulation = false;
   m_uStopCycles = 0;
   m_dStopSeconds = 0;
 						
+  // Nothing to report until the first accumulation is written
+  pthread_mutex_init(&m_mutexStatus, NULL);
+  m_uNumCycles = 0;
+  m_dDutyCycle = 0;
+  m_dDropFraction = 0;
+  m_dRunSeconds = 0;
+
   // Remember the controller
   m_pController = pController;
+  m_pLiveFeed = NULL;
+  m_pVoltageRing = NULL;
+  m_pOverload = NULL;
+
+  // Metrics updated after each accumulation
+  m_pCyclesMetric = Metrics::counter("fastspec_spectrometer_cycles_total", 
+    "Accumulations written");
+  m_pDroppedMetric = Metrics::counter("fastspec_spectrometer_dropped_samples_total", 
+    "Samples dropped from accumulations");
+  m_pDutyCycleMetric = Metrics::gauge("fastspec_spectrometer_duty_cycle", 
+    "Fraction of the last accumulation spent accumulating");
+  m_pDropFractionMetric = Metrics::gauge("fastspec_spectrometer_drop_fraction", 
+    "Fraction of samples dropped in the last accumulation");
+  m_pWriteMetric = Metrics::histogram("fastspec_spectrometer_write_seconds", 
+    "Time to write the spectra of one accumulation to disk", 
+    MetricHistogram::exponential(1e-4, 2, 16));
+  m_pFreeAccumsMetric = Metrics::gauge("fastspec_spectrometer_free_accumulators", 
+    "Accumulators available after the last accumulation was written");
   
     // Assign this instance to the digitizer callback to receive samples.
   m_pDigitizer = pDigitizer;
@@ -120,6 +149,11 @@ SpectrometerSimple::~SpectrometerSimple()
 {
 	// Make sure everyone knows we're stopping
 	sendStop();
+
+  // Stop answering requests from the controller
+  if (m_pController) {
+    m_pController->setReceiver(NULL);
+  }
 	  
   // Disconnect from digitizer
   if (m_pDigitizer) {
@@ -135,6 +169,10 @@ SpectrometerSimple::~SpectrometerSimple()
     // Disconnect
     m_pChannelizer->setCallback(NULL);
   }
+
+  if (m_pOverload) {
+    delete m_pOverload;
+  }
    
   printf("Spectrometer: Maximum number of accumulators used: %d of %d\n", 
   m_uNumAccumulators - m_uNumMinFreeAccumulators, m_uNumAccumulators);
@@ -156,6 +194,7 @@ SpectrometerSimple::~SpectrometerSimple()
 
 	// Free thread
 	pthread_mutex_destroy(&m_mutex);
+	pthread_mutex_destroy(&m_mutexStatus);
 
 	
 } // destructor
@@ -179,6 +218,11 @@ void SpectrometerSimple::run()
   m_uNumSamplesSoFar = 0;  
   moveAllToEmpty();
   moveToReceive();
+
+  // Answer status and spectrum requests now that the setup is complete
+  if (m_pController) {
+    m_pController->setReceiver(this);
+  }
   
   TimeKeeper tk;
   tk.setNow();
@@ -198,34 +242,20 @@ void SpectrometerSimple::run()
 // ----------------------------------------------------------------------------
 // handleLivePlot() - Handle output for live plotting if needed
 // ----------------------------------------------------------------------------
-bool SpectrometerSimple::handleLivePlot(Accumulator* pAccum, Timer& plotTimer) {
+bool SpectrometerSimple::handleLivePlot(Accumulator* pAccum, unsigned long uCycle) {
 
-  // Should we be plotting?
-  if (!m_pController->plot()) {
-  
-    // If not, make sure the timer is stopped
-    plotTimer.reset();
-    return false;
+  // Publish every accumulation to the shared memory feed (just a copy)
+  if (m_pLiveFeed) {
+    m_pLiveFeed->publish(&pAccum, 1, uCycle);
   }
 
-  // Plot if the controller just told us to start or if we've passed the
-  // update interval
-  if (!plotTimer.running() || (plotTimer.toc() > m_dPlotIntervalSeconds)) {
-      
-    // Restart the plot timer
-    plotTimer.tic();
-    
-    // Write the temporary file for plotting
-    if (!write_plot_file( m_pController->getPlotFilePath(), 
-                          *pAccum, *pAccum, *pAccum,
-                          m_pController->getPlotBinLevel())) {
-      return false;
-    }
-    
-    // Tell the plotter to refresh
-    m_pController->updatePlotter();
+  // Should we be plotting?  The viewer reads the feed itself.
+  if (!m_pController->plot() || !m_pLiveFeed) {
+    return false;
   }
-  
+
+  // Make sure the viewer is running
+  m_pController->updatePlotter();
   return true;
 }
 
@@ -307,6 +337,257 @@ void SpectrometerSimple::setStopTime(const string& strDateTime)
 }
 
 
+
+// ----------------------------------------------------------------------------
+// setFrequencyRange() -- Configures the accumulators for a channelizer that 
+//                        covers only part of the band (e.g. a zoom DDC) with
+//                        uNumChannels channels between dStartFreq and 
+//                        dStopFreq (MHz).  uSamplesPerSpectrum is the number 
+//                        of digitizer samples consumed by each spectrum and
+//                        is the block length pushed to the channelizer.  Must
+//                        be called before setSecondMoment, setSubAccumulation
+//                        and run().
+// ----------------------------------------------------------------------------
+void SpectrometerSimple::setFrequencyRange( unsigned long uNumChannels, 
+                                            double dStartFreq, double dStopFreq,
+                                            unsigned long uSamplesPerSpectrum ) 
+{
+  m_uNumChannels = uNumChannels;
+  m_dStartFreq = dStartFreq;
+  m_dStopFreq = dStopFreq;
+  m_dChannelSize = (m_dStopFreq - m_dStartFreq) / (double) m_uNumChannels; // MHz
+  m_uNumFFT = uSamplesPerSpectrum;
+  m_uNumSpectraPerAccumulation = m_uNumSamplesPerAccumulation / m_uNumFFT;
+
+  pthread_mutex_lock(&m_mutex);
+  list<Accumulator*>::iterator it;
+  for (it = m_empty.begin(); it != m_empty.end(); it++) {
+    (*it)->init(m_uNumChannels, m_dStartFreq, m_dStopFreq, m_dChannelFactor, m_bSecondMoment);
+  }
+  pthread_mutex_unlock(&m_mutex);
+
+  printf("Spectrometer: Spectra have %lu channels from %.6g to %.6g MHz "
+         "(%.4g kHz per channel)\n", m_uNumChannels, m_dStartFreq, m_dStopFreq, 
+         m_dChannelSize * 1e3);
+	printf("Spectrometer: Number of spectra per accumulation: %lu\n", m_uNumSpectraPerAccumulation);
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setSecondMoment() -- Keep the sum of power squared in each accumulator so
+//                      that spectral kurtosis and variance are written after
+//                      each spectrum in the .ssp file.  Must be called before
+//                      run().
+// ----------------------------------------------------------------------------
+void SpectrometerSimple::setSecondMoment(bool bSecondMoment) 
+{
+  m_bSecondMoment = bSecondMoment;
+
+  pthread_mutex_lock(&m_mutex);
+  list<Accumulator*>::iterator it;
+  for (it = m_empty.begin(); it != m_empty.end(); it++) {
+    (*it)->init(m_uNumChannels, m_dStartFreq, m_dStopFreq, m_dChannelFactor, m_bSecondMoment);
+  }
+  pthread_mutex_unlock(&m_mutex);
+
+  if (m_bSecondMoment) {
+    printf("Spectrometer: Writing spectral kurtosis and variance with each spectrum\n");
+  }
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setSubAccumulation() -- Split each accumulation into sub-accumulations of 
+//                         approximately dSeconds each.  The sub-accumulations
+//                         are written to .sub files alongside the .ssp file.
+//                         Must be called before run().
+// ----------------------------------------------------------------------------
+void SpectrometerSimple::setSubAccumulation(double dSeconds) 
+{
+  unsigned int uSpectraPerSub = 0;
+  unsigned int uNumSubs = 0;
+
+  if (dSeconds > 0) {
+    uSpectraPerSub = (unsigned int) (dSeconds * 2.0 * 1e6 * m_dBandwidth / m_uNumFFT + 0.5);
+    uSpectraPerSub = (uSpectraPerSub < 1) ? 1 : uSpectraPerSub;
+    uNumSubs = (m_uNumSpectraPerAccumulation + uSpectraPerSub - 1) / uSpectraPerSub;
+  }
+
+  m_bSubAccumulation = (uNumSubs > 0);
+
+  pthread_mutex_lock(&m_mutex);
+  list<Accumulator*>::iterator it;
+  for (it = m_empty.begin(); it != m_empty.end(); it++) {
+    if (!(*it)->initSubs(uNumSubs, uSpectraPerSub)) {
+      m_bSubAccumulation = false;
+    }
+  }
+  pthread_mutex_unlock(&m_mutex);
+
+  if (m_bSubAccumulation) {
+    printf("Spectrometer: Writing %u sub-accumulations of %u spectra (%.3g seconds) "
+           "per accumulation to .sub files (%.02f MB)\n", uNumSubs, uSpectraPerSub, 
+           uSpectraPerSub * m_uNumFFT / (2.0 * 1e6 * m_dBandwidth),
+           1.0*m_uNumMinFreeAccumulators*uNumSubs*m_uNumChannels*sizeof(ACCUM_DATA_TYPE)/1e6);
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// onStatusRequest() -- Called by the controller (from its socket thread) to
+//                      describe the current state as "name: value" lines.
+// ----------------------------------------------------------------------------
+std::string SpectrometerSimple::onStatusRequest() 
+{
+  std::ostringstream ss;
+  unsigned int uFree = 0;
+
+  ChannelizerStatus chan;
+  chan.uBuffersUsed = 0;
+  chan.uBuffersTotal = 0;
+  chan.uLostSpectra = 0;
+  if (m_pChannelizer) {
+    m_pChannelizer->getStatus(chan);
+  }
+
+  pthread_mutex_lock(&m_mutex);
+  uFree = m_empty.size();
+  pthread_mutex_unlock(&m_mutex);
+
+  pthread_mutex_lock(&m_mutexStatus);
+  ss << "cycles: " << m_uNumCycles << "\n";
+  ss << "run_seconds: " << m_dRunSeconds << "\n";
+  ss << "duty_cycle: " << m_dDutyCycle << "\n";
+  ss << "drop_fraction: " << m_dDropFraction << "\n";
+  pthread_mutex_unlock(&m_mutexStatus);
+
+  ss << "accumulators_free: " << uFree << "\n";
+  ss << "accumulators_total: " << m_uNumAccumulators << "\n";
+  ss << "buffers_used: " << chan.uBuffersUsed << "\n";
+  ss << "buffers_total: " << chan.uBuffersTotal << "\n";
+  ss << "lost_spectra: " << chan.uLostSpectra << "\n";
+  ss << "thread_utilization:";
+  for (unsigned int i=0; i<chan.threadUtilization.size(); i++) {
+    ss << " " << chan.threadUtilization[i];
+  }
+  ss << "\n";
+
+  return ss.str();
+}
+
+
+
+// ----------------------------------------------------------------------------
+// onSpectrumRequest() -- Called by the controller (from its socket thread) 
+//                        for the average spectrum of the most recently 
+//                        written accumulation.  Each line is "freq p" with 
+//                        uBin channels averaged together.
+// ----------------------------------------------------------------------------
+std::string SpectrometerSimple::onSpectrumRequest(unsigned int uBin) 
+{
+  std::string sReply;
+  char line[64];
+
+  pthread_mutex_lock(&m_mutexStatus);
+
+  if (m_snapshot.empty()) {
+    pthread_mutex_unlock(&m_mutexStatus);
+    return "ERROR no spectrum yet\n";
+  }
+
+  unsigned int uLength = m_snapshot.size();
+  double dStep = (m_dStopFreq - m_dStartFreq) / uLength;
+
+  sReply = "OK\n";
+  sReply += "# start: " + m_tkSnapshot.getDateTimeString(5) + "\n";
+  sReply += "# freq p\n";
+
+  for (unsigned int i=0; i+uBin<=uLength; i+=uBin) {
+    double d = 0;
+    for (unsigned int j=i; j<i+uBin; j++) {
+      d += m_snapshot[j];
+    }
+    snprintf(line, sizeof(line), "%.6f %.6e\n", 
+      m_dStartFreq + dStep * (i + (uBin-1) / 2.0), d / uBin);
+    sReply += line;
+  }
+
+  pthread_mutex_unlock(&m_mutexStatus);
+
+  return sReply;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setLiveFeed() -- Publish each accumulation to the shared memory feed.  
+//                  Opens the feed with room for the configured number of 
+//                  channels, so must be called after setFrequencyRange() and
+//                  before run().
+// ----------------------------------------------------------------------------
+void SpectrometerSimple::setLiveFeed(LiveFeed* pLiveFeed) 
+{
+  m_pLiveFeed = NULL;
+
+  if (pLiveFeed && pLiveFeed->open(LIVEFEED_NAME, 1, m_uNumChannels)) {
+    m_pLiveFeed = pLiveFeed;
+  }
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setVoltageRing() -- Stream the complex spectra of the main channelizer to
+//                     a shared memory ring of uNumSlots slots.  The 
+//                     channelizer must pass them on with uBits per part (see
+//                     PFB::setVoltageOutput).  Must be called after 
+//                     setFrequencyRange().
+// ----------------------------------------------------------------------------
+void SpectrometerSimple::setVoltageRing(VoltageRing* pRing, unsigned int uNumSlots, unsigned int uBits) 
+{
+  m_pVoltageRing = NULL;
+
+  if (pRing && pRing->open(VOLTAGERING_NAME, uNumSlots, m_uNumChannels, uBits, 
+                           m_dStartFreq, m_dStopFreq)) {
+    m_pVoltageRing = pRing;
+  }
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setOverload() -- Skip whole runs of uRunBlocks blocks (up to uMaxFactor-1 
+//                  runs in uMaxFactor) when the channelizer falls behind, 
+//                  instead of dropping blocks wherever its buffer happens to 
+//                  be full.  See OverloadController.
+// ----------------------------------------------------------------------------
+void SpectrometerSimple::setOverload(unsigned int uRunBlocks, unsigned int uMaxFactor) 
+{
+  if (m_pOverload) {
+    delete m_pOverload;
+  }
+
+  m_pOverload = new OverloadController(uRunBlocks, uMaxFactor);
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setMetricsFile() -- Write all metrics in the Prometheus text format to this
+//                     file after each accumulation (e.g. for the node 
+//                     exporter's textfile collector)
+// ----------------------------------------------------------------------------
+void SpectrometerSimple::setMetricsFile(const std::string& sFilePath) 
+{
+  m_sMetricsFile = sFilePath;
+
+  printf("Spectrometer: Writing metrics to %s after each accumulation\n", sFilePath.c_str());
+}
+
+
+
 // ----------------------------------------------------------------------------
 // threadIsready
 // ----------------------------------------------------------------------------
@@ -325,7 +606,6 @@ void* SpectrometerSimple::threadLoop(void* pContext)
   Accumulator* pAccum = NULL;
   Timer totalRunTimer;
   Timer writeTimer;
-  Timer plotScheduleTimer;
   Timer plotFileTimer;
   unsigned long uCycle = 0;
   unsigned long uCycleDrops = 0;
@@ -336,10 +616,11 @@ void* SpectrometerSimple::threadLoop(void* pContext)
    
   // Report ready
   pSpec->threadIsReady();
+  Trace::setThreadName("writer");
+  ThreadPolicy::apply("writer", "writer");
 
   // Loop until a stop signal is received
   totalRunTimer.tic();
-  plotScheduleTimer.tic();
   printf("\n");      
   printf("----------------------------------------------------------------------\n");
   
@@ -352,6 +633,7 @@ void* SpectrometerSimple::threadLoop(void* pContext)
       // be backwards compatible with pxspec.  This limits adcmin and adcmax to 
       // +/- 0.5 rather than +/-1.0
       pAccum = pSpec->m_write.front();
+      pAccum->combineSubs();
       pAccum->setADCmin(pAccum->getADCmin()/2);
       pAccum->setADCmax(pAccum->getADCmax()/2);  
       
@@ -363,24 +645,56 @@ void* SpectrometerSimple::threadLoop(void* pContext)
        
       // Write to disk (creates new file/path if needed)
 			writeTimer.tic();
+			TraceSpan writeSpan("acq write");
 			pSpec->writeToFile(pAccum);
+			writeSpan.end();
 			writeTimer.toc();
 			
-			// Write live plot file needed
+			// Publish for live plotting
 			plotFileTimer.tic();
-			pSpec->handleLivePlot(pAccum, plotScheduleTimer);
+			pSpec->handleLivePlot(pAccum, uCycle);
 			plotFileTimer.toc();   
+
+      // Keep a copy of the results for status and spectrum requests
+      pthread_mutex_lock(&pSpec->m_mutexStatus);
+      pSpec->m_uNumCycles = uCycle;
+      pSpec->m_dDutyCycle = pSpec->m_dAccumulationTime / duration;
+      pSpec->m_dDropFraction = 1.0 * uCycleDrops / (pSpec->m_uNumSamplesPerAccumulation + uCycleDrops);
+      pSpec->m_dRunSeconds = totalRunTimer.toc();
+      pSpec->m_tkSnapshot = pAccum->getStartTime();
+      pSpec->m_snapshot.resize(pAccum->getDataLength());
+      pAccum->getCopyOfAverage(&(pSpec->m_snapshot[0]), pSpec->m_snapshot.size());
+      pthread_mutex_unlock(&pSpec->m_mutexStatus);
+
+      // Update the metrics and write them for the textfile collector
+      pSpec->m_pCyclesMetric->add();
+      pSpec->m_pDroppedMetric->add(uCycleDrops);
+      pSpec->m_pDutyCycleMetric->set(pSpec->m_dAccumulationTime / duration);
+      pSpec->m_pDropFractionMetric->set(1.0 * uCycleDrops / (pSpec->m_uNumSamplesPerAccumulation + uCycleDrops));
+      pSpec->m_pWriteMetric->observe(writeTimer.get());
+      pthread_mutex_lock(&pSpec->m_mutex);
+      pSpec->m_pFreeAccumsMetric->set(pSpec->m_empty.size());
+      pthread_mutex_unlock(&pSpec->m_mutex);
+      if (!pSpec->m_sMetricsFile.empty() && !Metrics::writeFile(pSpec->m_sMetricsFile)) {
+        printf("Spectrometer: Failed to write metrics to %s\n", pSpec->m_sMetricsFile.c_str());
+      }
         			
       // Update the console	
       printf("\rCycle: %lu at %s | Run: %6.3f h | " 
               CYN "Duty: %4.3f" RESET " | " 
               GRN "ADC: %6.3f/%6.3f" RESET 
-              " | Drops: %s%6.3f" RESET "    " HIDE, 
+              " | Drops: %s%6.3f" RESET, 
         uCycle, pAccum->getStartTime().getDateTimeString(5).c_str(),
         totalRunTimer.toc()/3600.0,
         pSpec->m_dAccumulationTime / duration,
         pAccum->getADCmin(), pAccum->getADCmax(),
         pColor, 1.0 * uCycleDrops / (pSpec->m_uNumSamplesPerAccumulation + uCycleDrops) );
+      if (pSpec->m_pOverload) {
+        printf(" | Skips: %6.3f (1 in %u)", 
+          1.0 * pAccum->getSkips() / (pSpec->m_uNumSamplesPerAccumulation + uCycleDrops + pAccum->getSkips()),
+          pSpec->m_pOverload->factor());
+      }
+      printf("    " HIDE);
 
       fflush(stdout);  // Make sure the line is printed
                 				
@@ -399,6 +713,10 @@ void* SpectrometerSimple::threadLoop(void* pContext)
   printf("Spectrometer: Total cycles: %lu\n", uCycle);
   printf("Spectrometer: Total run time: %.02f seconds (%.3g days)\n", totalRunTimer.toc(), totalRunTimer.toc()/3600.0/24); 
   printf( SHOW );  // Make the cursor visibile again (hidden in the update line)
+
+  // The console line is rewritten each cycle, so the transfer timing is only
+  // printed for the whole run
+  pSpec->m_pDigitizer->printTiming();
  
   pSpec->m_pDigitizer->stop();
    
@@ -553,13 +871,48 @@ bool SpectrometerSimple::writeToFile(Accumulator* pAccum) {
     double dStepFreq = (pAccum->getStopFreq() - 
       pAccum->getStartFreq()) / (double) pAccum->getDataLength();
     fs << ";--step_frequency: " << dStepFreq << " MHz" << std::endl;    
+    fs << ";--spectral_kurtosis: " << (pAccum->hasSecondMoment() ? 1 : 0) << std::endl;
     fs << ";+++END_DATA_HEADER" << std::endl;
     
     fs.close();    
   }
 
   // Write the data
-  return append_accumulation_simple( sFilePath,  pAccum );
+  bool bResult = append_accumulation_simple( sFilePath,  pAccum );
+
+  // Write the sub-accumulations to their binary side stream
+  if (m_bSubAccumulation) {
+
+    sFilePath.replace(sFilePath.length()-3, 3, "sub");
+
+    if (!is_file(sFilePath)) {
+
+      std::ofstream fs;
+      fs.open(sFilePath);
+      if (!fs.is_open()) {
+        printf("Spectrometer: Failed to write header to new .sub file.\n");
+        return false;
+      }
+
+      fs << "; SIMPLESPEC v" << VERSION_MAJOR << "." 
+                             << VERSION_MINOR << "." 
+                             << VERSION_PATCH << std::endl;
+      fs << m_pController->getConfigStr();
+      fs << ";+++BEGIN_DATA_HEADER" << std::endl;
+      fs << ";--record: int year, int doy, int hh, int mm, int ss, long ns, "
+            "float duration, unsigned int swpos, unsigned int index, "
+            "unsigned int nblk, unsigned int nspec, float average[nspec]" << std::endl;
+      fs << ";--num_channels: " << pAccum->getDataLength() << std::endl;  
+      fs << ";--start_frequency: " << pAccum->getStartFreq() << " MHz" << std::endl;
+      fs << ";--stop_frequency: " << pAccum->getStopFreq() << " MHz" << std::endl;
+      fs << ";+++END_DATA_HEADER" << std::endl;
+      fs.close();
+    }
+
+    bResult = append_sub_accumulations( sFilePath, pAccum, 0 ) && bResult;
+  }
+
+  return bResult;
 }
 
 
@@ -569,25 +922,34 @@ bool SpectrometerSimple::writeToFile(Accumulator* pAccum) {
 //                 any transferred data at the end of the transfer beyond the
 //                 last integer multiple of m_uNumFFT.  If an Channelizer buffer 
 //                 is not available for a given chunk of the transfer, it drops 
-//                 that chunk of data.  Returns total number of samples 
+//                 that chunk of data.  Each chunk is pushed with its sample
+//                 index, so the channelizer sees where chunks were dropped.
+//                 Chunks the overload controller skips are recorded as
+//                 skips rather than drops.  Returns total number of samples 
 //                 successfully processed into a Channelizer buffer.
 // ----------------------------------------------------------------------------
 unsigned long SpectrometerSimple::onDigitizerData( SAMPLE_DATA_TYPE* pBuffer, 
                                              unsigned int uBufferLength,
                                              unsigned long uTransferredSoFar,
                                              double dScale,
-                                             double dOffset ) 
+                                             double dOffset,
+                                             unsigned long long uSampleIndex ) 
 {
   unsigned int uIndex = 0;
   unsigned int uAdded = 0;
+  TraceSpan span("onDigitizerData");
     
   // printf("Spectrometer: OnDigitizerData\n");
   
   // Loop over the transferred data and enter it into the channelizer buffer
   while ( (uIndex + m_uNumFFT) <= uBufferLength ) {
                      
-    // Try to add to the channelizer buffer
-    if (m_pChannelizer->push(&(pBuffer[uIndex]), m_uNumFFT, dScale, dOffset)) {
+    // Try to add to the channelizer buffer (unless this run is skipped)
+    if (m_pOverload && !m_pOverload->admit(m_pChannelizer, m_uNumFFT)) {
+
+      m_receive.back()->addSkips(m_uNumFFT);
+
+    } else if (m_pChannelizer->push(&(pBuffer[uIndex]), m_uNumFFT, dScale, dOffset, uSampleIndex + uIndex)) {
      
 //printf("OnDigitizer... Added samples associated with accumulator %u\n", m_receive.back()->getId());
       
@@ -596,7 +958,7 @@ unsigned long SpectrometerSimple::onDigitizerData( SAMPLE_DATA_TYPE* pBuffer,
       
     }  else {
       
-      printf("Spectrometer::OnDigitizerData: Failed to push to channelizer!\n");
+      Log::warn("Spectrometer::OnDigitizerData: Failed to push to channelizer!\n");
       
       // Record the dropped samples (drops are recorded to the freshest
       // accummulator in the receive queue).  
@@ -620,9 +982,7 @@ unsigned long SpectrometerSimple::onDigitizerData( SAMPLE_DATA_TYPE* pBuffer,
         
       } else {        
       
-        printf("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n");
-        printf("Spectrometer::OnDigitizerData: Failed to get fresh accumulator!\n");   
-        printf("!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!\n");    
+        Log::error("Spectrometer::OnDigitizerData: Failed to get fresh accumulator!\n");   
       
       }
       
@@ -649,26 +1009,48 @@ unsigned long SpectrometerSimple::onDigitizerData( SAMPLE_DATA_TYPE* pBuffer,
 // onChannelizerData() -- Do something with a spectrum returned from the 
 //                        Channelizer
 // ----------------------------------------------------------------------------
-void SpectrometerSimple::onChannelizerData(ChannelizerData* pData) 
+void SpectrometerSimple::onChannelizerData(ChannelizerData<float>* pData) 
+{
+  receive(pData);
+}
+
+void SpectrometerSimple::onChannelizerData(ChannelizerData<double>* pData) 
+{
+  receive(pData);
+}
+
+
+
+// ----------------------------------------------------------------------------
+// receive() -- Adds a spectrum of either precision to the oldest accumulator
+// ----------------------------------------------------------------------------
+template<typename T>
+void SpectrometerSimple::receive(ChannelizerData<T>* pData) 
 {  
   // Add data to the oldest accumuator in the receive queue until we've received
   // enough specra to fill the accumulator, then move the accumlator to the
   // write queue.  We don't need to worry about getting a new accumulator for 
   // receiving because that happens based on how many samples we've received 
   // from the digitizer in onDigitizerData().
+  TraceSpan span("accumulate");
+
+  if (m_pVoltageRing && (pData->uId == 0)) {
+    m_pVoltageRing->write(pData, 0);
+  }
    
 	if (!m_receive.empty()) {
 	
 //	  printf("onChannelizer... Adding to accumulator %u\n", m_receive.front()->getId());
 	  
 	  if (m_receive.front()->add( pData->pData, 
+                                pData->pData2, 
                                 pData->uNumChannels, 
                                 pData->dADCmin, 
                                 pData->dADCmax ) >= m_uNumSpectraPerAccumulation ) {
 	    moveToWrite();
 	  }
 	}		  
-} // onChannelizerData()
+} // receive()
 
 
 
@@ -2,13 +2,18 @@
 #define _SPECTROMETER_SIMPLE_H_
 
 #include <string>
+#include <vector>
 #include <functional>
 #include "accumulator.h"
 #include "digitizer.h"
 #include "channelizer.h"
 #include "dumper.h"
 #include "controller.h"
+#include "livefeed.h"
+#include "metrics.h"
+#include "overload.h"
 #include "timing.h"
+#include "voltagering.h"
 
 #ifndef SAMPLE_DATA_TYPE
   #error Aborted in spectrometer.h because SAMPLE_DATA_TYPE was not defined.
@@ -19,10 +24,11 @@
 // SPECTROMETER_SIMPLE
 //
 // Uses PXBoard and FFTPool objects to control and acquire data from
-// the EDGES system.
+// the EDGES system.  Answers status and spectrum requests from the 
+// controller's socket with the most recently written accumulation.
 //
 // ---------------------------------------------------------------------------
-class SpectrometerSimple : public DigitizerReceiver, ChannelizerReceiver {
+class SpectrometerSimple : public DigitizerReceiver, ChannelizerReceiver, ControlReceiver {
 
   private:
 
@@ -30,6 +36,9 @@ class SpectrometerSimple : public DigitizerReceiver, ChannelizerReceiver {
     Digitizer*      m_pDigitizer;
     Channelizer*    m_pChannelizer;
     Controller*     m_pController;    
+    LiveFeed*       m_pLiveFeed;
+    VoltageRing*    m_pVoltageRing;
+    OverloadController* m_pOverload;
     
     pthread_t 					m_thread;
 		pthread_mutex_t   	m_mutex;    
@@ -55,14 +64,29 @@ class SpectrometerSimple : public DigitizerReceiver, ChannelizerReceiver {
     bool            m_bUseStopCycles;
     bool            m_bUseStopSeconds;
     bool            m_bUseStopTime;
+    bool            m_bSecondMoment;
+    bool            m_bSubAccumulation;
     unsigned long   m_uStopCycles;
     double          m_dStopSeconds;             // Seconds
-    double          m_dPlotIntervalSeconds;     // Seconds
     TimeKeeper      m_tkStopTime;               // UTC
+    pthread_mutex_t m_mutexStatus;
+    unsigned long   m_uNumCycles;
+    double          m_dDutyCycle;
+    double          m_dDropFraction;
+    double          m_dRunSeconds;
+    std::vector<ACCUM_DATA_TYPE> m_snapshot;    // Average of last accumulation
+    TimeKeeper      m_tkSnapshot;
+    MetricCounter*  m_pCyclesMetric;
+    MetricCounter*  m_pDroppedMetric;
+    MetricGauge*    m_pDutyCycleMetric;
+    MetricGauge*    m_pDropFractionMetric;
+    MetricHistogram* m_pWriteMetric;
+    std::string     m_sMetricsFile;
+    MetricGauge*    m_pFreeAccumsMetric;
 
     // Private helper functions
     std::string 		getFileName();
-    bool 						handleLivePlot(Accumulator*, Timer &);
+    bool 						handleLivePlot(Accumulator*, unsigned long);
     bool 						isStop(unsigned long, Timer&);
 		void 						threadIsReady();
     bool 						writeToFile(Accumulator*);
@@ -71,13 +95,15 @@ class SpectrometerSimple : public DigitizerReceiver, ChannelizerReceiver {
     Accumulator*		moveToEmpty();   
     Accumulator*  	moveToReceive();    
     Accumulator* 		moveToWrite();
+    template<typename T>
+    void            receive(ChannelizerData<T>*);
     
     
   public:
 
     // Constructor and destructor
     SpectrometerSimple( unsigned long, unsigned long, double, unsigned int, 
-                        double, Digitizer*, Channelizer*, Controller* );
+                        Digitizer*, Channelizer*, Controller* );
                         
     ~SpectrometerSimple();
 
@@ -88,11 +114,22 @@ class SpectrometerSimple : public DigitizerReceiver, ChannelizerReceiver {
     void setStopCycles(unsigned long);
     void setStopSeconds(double);
     void setStopTime(const std::string&);
+    void setFrequencyRange(unsigned long, double, double, unsigned long);
+    void setSecondMoment(bool);
+    void setSubAccumulation(double);
+    void setLiveFeed(LiveFeed*);
+    void setVoltageRing(VoltageRing*, unsigned int, unsigned int);
+    void setOverload(unsigned int, unsigned int);
+    void setMetricsFile(const std::string&);
 
     // Callbacks
     unsigned long   onDigitizerData( SAMPLE_DATA_TYPE*, unsigned int, 
-                                     unsigned long, double, double );
-    void            onChannelizerData(ChannelizerData*);
+                                     unsigned long, double, double,
+                                     unsigned long long );
+    void            onChannelizerData(ChannelizerData<float>*);
+    void            onChannelizerData(ChannelizerData<double>*);
+    std::string     onStatusRequest();
+    std::string     onSpectrumRequest(unsigned int);
     
     static void*    threadLoop(void*);
 
@@ -0,0 +1,462 @@
+#include <stdio.h>
+#include "streaming_digitizer.h"
+#include "timing.h"
+
+
+
+// ----------------------------------------------------------------------------
+// now -- Monotonic time in seconds for the transfer timestamps
+// ----------------------------------------------------------------------------
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// Constructor
+// ----------------------------------------------------------------------------
+StreamingDigitizer::StreamingDigitizer( double dAcquisitionRate,
+                                        unsigned long uSamplesPerAccumulation,
+                                        unsigned int uSamplesPerTransfer )
+{
+  m_uNumTransfers = STREAMING_DEFAULT_TRANSFERS;
+  m_uHead = 0;
+  m_uTail = 0;
+  m_uFilled = 0;
+  m_bFailed = false;
+  m_pMetrics = NULL;
+  m_bThread = false;
+  m_bStreaming = false;
+  m_bExit = false;
+
+  m_pReceiver = NULL;
+  m_bStop = false;
+  m_dScale = 0;
+  m_dOffset = 0;
+  m_uSamplesPerAccumulation = uSamplesPerAccumulation;
+  m_uSamplesPerTransfer = uSamplesPerTransfer;
+  m_uInputs = 1;
+
+  m_dTransferPeriod = (dAcquisitionRate > 0) ? uSamplesPerTransfer / (dAcquisitionRate * 1e6) : 0;
+  m_uOverruns = 0;
+  m_uSampleIndex = 0;
+  m_bStreamed = false;
+
+  pthread_mutex_init(&m_mutex, NULL);
+  pthread_mutex_init(&m_mutexTiming, NULL);
+  pthread_cond_init(&m_condFilled, NULL);
+  pthread_cond_init(&m_condFree, NULL);
+  pthread_cond_init(&m_condStream, NULL);
+}
+
+
+
+// ----------------------------------------------------------------------------
+// Destructor -- Derived classes free the ring when they disconnect.  The
+//               transfer thread is idle between acquire() calls, so it is
+//               safe to end it here.
+// ----------------------------------------------------------------------------
+StreamingDigitizer::~StreamingDigitizer()
+{
+  if (m_bThread) {
+    pthread_mutex_lock(&m_mutex);
+    m_bExit = true;
+    pthread_cond_broadcast(&m_condStream);
+    pthread_mutex_unlock(&m_mutex);
+    pthread_join(m_thread, NULL);
+  }
+
+  pthread_mutex_destroy(&m_mutex);
+  pthread_mutex_destroy(&m_mutexTiming);
+  pthread_cond_destroy(&m_condFilled);
+  pthread_cond_destroy(&m_condFree);
+  pthread_cond_destroy(&m_condStream);
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setTransferBuffers
+// ----------------------------------------------------------------------------
+void StreamingDigitizer::setTransferBuffers(unsigned int uNumTransfers)
+{
+  m_uNumTransfers = (uNumTransfers < 2) ? 2 : uNumTransfers;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setInputs
+// ----------------------------------------------------------------------------
+void StreamingDigitizer::setInputs(unsigned int uInputs)
+{
+  uInputs = (uInputs < 1) ? 1 : uInputs;
+
+  // The acquisition rate is per input
+  m_dTransferPeriod = m_dTransferPeriod * m_uInputs / uInputs;
+  m_uInputs = uInputs;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// allocateRing -- Allocates the transfer buffers.  Returns false (with the
+//                 ring freed) if any of them can't be allocated.
+// ----------------------------------------------------------------------------
+bool StreamingDigitizer::allocateRing()
+{
+  freeRing();
+
+  for (unsigned int i=0; i<m_uNumTransfers; i++) {
+    void* p = allocateTransfer();
+    if (p == NULL) {
+      printf("StreamingDigitizer: Failed to allocate transfer buffer %u of %u\n",
+        i+1, m_uNumTransfers);
+      freeRing();
+      return false;
+    }
+    m_ring.push_back(p);
+  }
+
+  m_started.assign(m_ring.size(), 0);
+  m_completed.assign(m_ring.size(), 0);
+
+  printf("StreamingDigitizer: Using a ring of %u transfer buffers\n", m_uNumTransfers);
+
+  return true;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// freeRing
+// ----------------------------------------------------------------------------
+void StreamingDigitizer::freeRing()
+{
+  for (unsigned int i=0; i<m_ring.size(); i++) {
+    freeTransfer(m_ring[i]);
+  }
+  m_ring.clear();
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setCallback() -- Specify the receiver to use when a transfer is received
+// ----------------------------------------------------------------------------
+void StreamingDigitizer::setCallback(DigitizerReceiver* pReceiver)
+{
+  m_pReceiver = pReceiver;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// stop -- Ends acquire() after the current transfer.  Filled transfers that
+//         haven't reached the receiver are discarded.
+// ----------------------------------------------------------------------------
+void StreamingDigitizer::stop()
+{
+  pthread_mutex_lock(&m_mutex);
+  m_bStop = true;
+  pthread_cond_broadcast(&m_condFilled);
+  pthread_cond_broadcast(&m_condFree);
+  pthread_mutex_unlock(&m_mutex);
+}
+
+
+
+// ----------------------------------------------------------------------------
+// printTiming -- Prints the percentiles of the transfer timing since the last
+//                call and clears it.  Safe to call while acquiring.
+// ----------------------------------------------------------------------------
+void StreamingDigitizer::printTiming()
+{
+  pthread_mutex_lock(&m_mutexTiming);
+
+  unsigned long uTransfers = m_callbackTime.count();
+  printf("Digitizer: Timing of %lu transfers (ms), period = %.3f ms\n",
+    uTransfers, m_dTransferPeriod * 1e3);
+
+  if (uTransfers > 0) {
+
+    LatencyHistogram* pHist[3] = { &m_transferTime, &m_callbackTime, &m_latencyTime };
+    const char* pNames[3] = { "transfer", "callback", "latency" };
+
+    printf("Digitizer:   %-10s %9s %9s %9s %9s %9s\n", "", "mean", "p50", "p99", "p99.9", "max");
+    for (unsigned int i=0; i<3; i++) {
+      printf("Digitizer:   %-10s %9.3f %9.3f %9.3f %9.3f %9.3f\n", pNames[i],
+        pHist[i]->mean() * 1e3, pHist[i]->percentile(0.5) * 1e3, pHist[i]->percentile(0.99) * 1e3,
+        pHist[i]->percentile(0.999) * 1e3, pHist[i]->max() * 1e3);
+    }
+
+    // The low end of the slack is what matters
+    printf("Digitizer:   %-10s %9s %9s %9s %9s %9s\n", "", "mean", "p50", "p1", "p0.1", "min");
+    printf("Digitizer:   %-10s %9.3f %9.3f %9.3f %9.3f %9.3f\n", "slack",
+      m_slackTime.mean() * 1e3, m_slackTime.percentile(0.5) * 1e3, m_slackTime.percentile(0.01) * 1e3,
+      m_slackTime.percentile(0.001) * 1e3, m_slackTime.min() * 1e3);
+
+    if (m_uOverruns > 0) {
+      printf("Digitizer: WARNING! %lu transfers (%.2f%%) took the receiver longer than the period\n",
+        m_uOverruns, 100.0 * m_uOverruns / uTransfers);
+    }
+  }
+
+  m_transferTime.reset();
+  m_callbackTime.reset();
+  m_latencyTime.reset();
+  m_slackTime.reset();
+  m_uOverruns = 0;
+
+  pthread_mutex_unlock(&m_mutexTiming);
+}
+
+
+
+// ----------------------------------------------------------------------------
+// acquire() - Transfer data from the board
+//
+//         Set m_uSamplesPerAccumulation = 0 for infinte loop.  Otherwise,
+//         transfers are are acquired and sent to the callback.  The callback
+//         should return the number of samples handled successfully.  This
+//         function will continue to deliver samples to the callback until the
+//         sum of all callbacks responses reach m_uSamplesPerAccumulation.
+//         The loop can be aborted by calling stop().  Returns false if the
+//         board failed (e.g. a FIFO overflow).
+//
+// ----------------------------------------------------------------------------
+bool StreamingDigitizer::acquire()
+{
+  unsigned long uNumSamples = 0;
+  unsigned long uAccepted = 0;
+  bool bComplete = false;
+  void* pTransfer = NULL;
+  DigitizerMetrics metrics;
+
+  // Reset the stop flag and the ring
+  m_bStop = false;
+  m_bFailed = false;
+  m_uHead = 0;
+  m_uTail = 0;
+  m_uFilled = 0;
+  m_pMetrics = &metrics;
+  metrics.onRing(0);
+  metrics.setPeriod(m_dTransferPeriod);
+
+  if (m_ring.size() < 2) {
+    printf("StreamingDigitizer: No transfer buffers at start of run.  Was connect() called?\n");
+    return false;
+  }
+
+  if (!startStream()) {
+    return false;
+  }
+
+  // Leave a gap after the previous stream
+  if (m_bStreamed) {
+    m_uSampleIndex += m_uSamplesPerTransfer;
+  }
+  m_bStreamed = true;
+
+  Trace::setThreadName("digitizer");
+  ThreadPolicy::apply("digitizer", "digitizer");
+
+  // The transfer thread keeps the DMA going while we call the receiver
+  if (!m_bThread) {
+    if (pthread_create(&m_thread, NULL, transferLoop, this) != 0) {
+      printf("StreamingDigitizer: Failed to create transfer thread\n");
+      endStream();
+      return false;
+    }
+    m_bThread = true;
+  }
+
+  pthread_mutex_lock(&m_mutex);
+  m_bStreaming = true;
+  pthread_cond_broadcast(&m_condStream);
+  pthread_mutex_unlock(&m_mutex);
+
+  // Pass the filled transfers to the receiver in order.  If the board fails,
+  // the transfers it already filled are passed on first.
+  while (true) {
+
+    pthread_mutex_lock(&m_mutex);
+    while (!m_bStop && !m_bFailed && (m_uFilled == 0)) {
+      pthread_cond_wait(&m_condFilled, &m_mutex);
+    }
+    pTransfer = (m_bStop || (m_uFilled == 0)) ? NULL : m_ring[m_uTail];
+    pthread_mutex_unlock(&m_mutex);
+
+    if (pTransfer == NULL) {
+      break;
+    }
+
+    double dCalled = now();
+    delayReceiver();
+    if (m_pReceiver) {
+      uAccepted = m_pReceiver->onDigitizerData( (SAMPLE_DATA_TYPE*) pTransfer,
+        m_uSamplesPerTransfer, uNumSamples, m_dScale, m_dOffset, m_uSampleIndex);
+    } else {
+      uAccepted = m_uSamplesPerTransfer;
+    }
+    double dReturned = now();
+    uNumSamples += uAccepted;
+    m_uSampleIndex += m_uSamplesPerTransfer;
+
+    // The transfer's timestamps are safe to read until it is returned
+    double dCallback = dReturned - dCalled;
+    double dLatency = dReturned - m_completed[m_uTail];
+    double dSlack = m_dTransferPeriod - dCallback;
+    metrics.onTransfer(m_uSamplesPerTransfer, uAccepted, dCallback);
+    metrics.onTiming(dLatency, dSlack);
+
+    pthread_mutex_lock(&m_mutexTiming);
+    m_transferTime.record(m_completed[m_uTail] - m_started[m_uTail]);
+    m_callbackTime.record(dCallback);
+    m_latencyTime.record(dLatency);
+    m_slackTime.record(dSlack);
+    if (dSlack < 0) {
+      m_uOverruns++;
+    }
+    pthread_mutex_unlock(&m_mutexTiming);
+
+    // Return the transfer to the ring
+    pthread_mutex_lock(&m_mutex);
+    m_uTail = (m_uTail + 1) % m_ring.size();
+    m_uFilled--;
+    metrics.onRing(m_uFilled);
+    pthread_cond_signal(&m_condFree);
+    pthread_mutex_unlock(&m_mutex);
+
+    // Check if we need to the stop the loop.  Only stop if we've reached the
+    // the number of desired samples.  If the accumulation size is zero, we
+    // will run continuously and only stop by an external trigger, never on
+    // our own.
+    if ((m_uSamplesPerAccumulation > 0) && (m_uSamplesPerAccumulation <= uNumSamples)) {
+      bComplete = true;
+      stop();
+    }
+  }
+
+  // Stop acquisition once the transfer thread is idle again
+  stop();
+  pthread_mutex_lock(&m_mutex);
+  while (m_bStreaming) {
+    pthread_cond_wait(&m_condStream, &m_mutex);
+  }
+  pthread_mutex_unlock(&m_mutex);
+  endStream();
+  m_pMetrics = NULL;
+
+  // A board that ends its stream after the last transfer we needed is fine
+  return bComplete || !m_bFailed;
+
+} // acquire()
+
+
+
+// ----------------------------------------------------------------------------
+// transferLoop -- Entry point of the transfer thread
+// ----------------------------------------------------------------------------
+void* StreamingDigitizer::transferLoop(void* pContext)
+{
+  ((StreamingDigitizer*) pContext)->transfer();
+  return NULL;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// transfer -- Body of the transfer thread.  Streams during each acquire()
+//             and sleeps in between until the destructor ends it.
+// ----------------------------------------------------------------------------
+void StreamingDigitizer::transfer()
+{
+  Trace::setThreadName("transfer");
+  ThreadPolicy::apply("transfer", "transfer");
+
+  pthread_mutex_lock(&m_mutex);
+  while (true) {
+
+    while (!m_bExit && !m_bStreaming) {
+      pthread_cond_wait(&m_condStream, &m_mutex);
+    }
+
+    if (m_bExit) {
+      break;
+    }
+
+    pthread_mutex_unlock(&m_mutex);
+    stream();
+    pthread_mutex_lock(&m_mutex);
+
+    m_bStreaming = false;
+    pthread_cond_broadcast(&m_condStream);
+  }
+  pthread_mutex_unlock(&m_mutex);
+}
+
+
+
+// ----------------------------------------------------------------------------
+// stream -- Fills the free transfers of the ring in order until stopped
+// ----------------------------------------------------------------------------
+void StreamingDigitizer::stream()
+{
+  void* pTransfer = NULL;
+  bool bComplete = false;
+  Timer timer;
+  double dStarted = 0;
+
+  while (!m_bStop) {
+
+    // Wait for a free transfer if the receiver has fallen behind by the
+    // whole ring (the board's FIFO is filling meanwhile)
+    pthread_mutex_lock(&m_mutex);
+    if (m_uFilled == m_ring.size()) {
+      m_pMetrics->onRingFull();
+      while (!m_bStop && (m_uFilled == m_ring.size())) {
+        pthread_cond_wait(&m_condFree, &m_mutex);
+      }
+    }
+    pTransfer = m_ring[m_uHead];
+    pthread_mutex_unlock(&m_mutex);
+
+    if (m_bStop) {
+      break;
+    }
+
+    // Start the asynchronous DMA transfer and wait for it to complete
+    dStarted = now();
+    bComplete = startTransfer(pTransfer);
+    if (bComplete) {
+      timer.tic();
+      TraceSpan waitSpan("digitizer wait");
+      bComplete = waitTransfer();
+      waitSpan.end();
+      m_pMetrics->onWait(timer.toc());
+    }
+
+    if (!bComplete) {
+      pthread_mutex_lock(&m_mutex);
+      m_bFailed = true;
+      pthread_cond_signal(&m_condFilled);
+      pthread_mutex_unlock(&m_mutex);
+      break;
+    }
+
+    // Post it to the receiver
+    m_started[m_uHead] = dStarted;
+    m_completed[m_uHead] = now();
+    pthread_mutex_lock(&m_mutex);
+    m_uHead = (m_uHead + 1) % m_ring.size();
+    m_uFilled++;
+    m_pMetrics->onRing(m_uFilled);
+    pthread_cond_signal(&m_condFilled);
+    pthread_mutex_unlock(&m_mutex);
+  }
+}
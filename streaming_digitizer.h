@@ -0,0 +1,160 @@
+#ifndef _STREAMING_DIGITIZER_H_
+#define _STREAMING_DIGITIZER_H_
+
+#include <vector>
+#include <pthread.h>
+#include "digitizer.h"
+#include "latency.h"
+
+// ---------------------------------------------------------------------------
+//
+// StreamingDigitizer
+//
+// Acquisition loop shared by the digitizer classes that stream transfers
+// into DMA buffers.  Instead of alternating between two buffers and calling
+// the receiver between transfers, the buffers form a ring of
+// setTransferBuffers() transfers:
+//
+//   - A transfer thread (role "transfer") only starts each DMA transfer into
+//     the next free buffer of the ring, waits for it to complete, and posts
+//     it as filled.  It is created by the first acquire() and sleeps between
+//     acquire() calls.
+//   - The thread that called acquire() passes the filled buffers to the
+//     receiver in order and returns them to the ring.
+//
+// A hiccup in the receiver then only fills the ring.  The board's FIFO only
+// overflows if the receiver falls behind by the whole ring.  If the ring is
+// full, the transfer thread waits for a free buffer, which is counted in
+// fastspec_digitizer_ring_full_total.  The number of filled buffers and its
+// high-water mark are published in fastspec_digitizer_ring_transfers and
+// fastspec_digitizer_ring_transfers_max.
+//
+// The receiver gets the sample index of each transfer's first sample.  Each
+// acquire() starts one transfer after the previous one ended, so samples on
+// either side of a restart are never taken as contiguous.
+//
+// Each transfer is timestamped when it is started, when it completes, and
+// when the receiver returns from it.  Per-transfer histograms of the DMA
+// time, the receiver's time, the latency from completion to the receiver's
+// return, and the slack (the transfer period minus the receiver's time) are
+// kept until printTiming() prints their percentiles and clears them.  The
+// latency and slack also go to the fastspec_digitizer_latency_seconds and
+// fastspec_digitizer_slack_seconds metrics, and transfers with no slack
+// left are counted in fastspec_digitizer_overruns_total.  Their negative
+// slack is recorded too, so it pulls down the low slack percentiles.  A receiver that
+// regularly overruns will eventually fill the ring however deep it is.
+//
+// Derived classes set up the board in connect() and call allocateRing()
+// once the transfer size is known (and freeRing() in disconnect()).  They
+// implement the board specific steps:
+//
+//   allocateTransfer()   Returns one DMA buffer (or NULL)
+//   freeTransfer()       Frees one
+//   startStream()        Arms the board
+//   startTransfer()      Starts an asynchronous transfer into a buffer
+//   waitTransfer()       Blocks until it completes.  Returns false on an
+//                        error such as a FIFO overflow.
+//   endStream()          Stops the board
+//
+// and may override delayReceiver(), which is called just before each
+// transfer is passed to the receiver (PXSim injects jitter and stalls
+// there).
+//
+// ---------------------------------------------------------------------------
+
+#define STREAMING_DEFAULT_TRANSFERS   2
+
+class StreamingDigitizer : public Digitizer {
+
+  private:
+
+    // Ring of transfers
+    std::vector<void*>          m_ring;
+    unsigned int                m_uNumTransfers;
+    unsigned int                m_uHead;          // Next to fill
+    unsigned int                m_uTail;          // Next to pass on
+    unsigned int                m_uFilled;
+    bool                        m_bFailed;        // No more transfers coming
+    pthread_mutex_t             m_mutex;
+    pthread_cond_t              m_condFilled;
+    pthread_cond_t              m_condFree;
+    DigitizerMetrics*           m_pMetrics;       // During acquire()
+
+    // Transfer thread, started by the first acquire() and kept until the
+    // destructor
+    pthread_t                   m_thread;
+    bool                        m_bThread;
+    bool                        m_bStreaming;     // Transfer thread is filling the ring
+    bool                        m_bExit;
+    pthread_cond_t              m_condStream;
+
+    static void*                transferLoop(void*);
+    void                        transfer();
+    void                        stream();
+
+    // Transfer timing, written by the transfer thread for each transfer in
+    // the ring and kept per transfer until printTiming()
+    double                      m_dTransferPeriod;  // seconds
+    std::vector<double>         m_started;
+    std::vector<double>         m_completed;
+    pthread_mutex_t             m_mutexTiming;
+    LatencyHistogram            m_transferTime;
+    LatencyHistogram            m_callbackTime;
+    LatencyHistogram            m_latencyTime;
+    LatencyHistogram            m_slackTime;
+    unsigned long               m_uOverruns;
+
+    // Sample index of the next transfer
+    unsigned long long          m_uSampleIndex;
+    bool                        m_bStreamed;
+
+  protected:
+
+    // Shared with derived classes
+    DigitizerReceiver*          m_pReceiver;
+    volatile bool               m_bStop;
+    double                      m_dScale;
+    double                      m_dOffset;
+    unsigned long               m_uSamplesPerAccumulation;
+    unsigned int                m_uSamplesPerTransfer;    // Passed to the receiver
+    unsigned int                m_uInputs;                // Interleaved in each transfer
+
+    bool                        allocateRing();
+    void                        freeRing();
+
+    // Number of inputs interleaved in each transfer (see Digitizer::inputs).
+    // Each transfer then spans fewer sample times.  Must be set before
+    // connect().
+    void                        setInputs(unsigned int);
+
+    // Board specific steps
+    virtual void*               allocateTransfer() = 0;
+    virtual void                freeTransfer(void*) = 0;
+    virtual bool                startStream() = 0;
+    virtual bool                startTransfer(void*) = 0;
+    virtual bool                waitTransfer() = 0;
+    virtual void                endStream() = 0;
+    virtual void                delayReceiver() {}
+
+  public:
+
+    // Constructor and destructor
+    StreamingDigitizer(double, unsigned long, unsigned int);
+    virtual ~StreamingDigitizer();
+
+    // Number of transfer buffers in the ring (at least 2).  Must be set
+    // before connect().
+    void                        setTransferBuffers(unsigned int);
+
+    // Interface
+    bool                        acquire();
+    void                        setCallback(DigitizerReceiver*);
+    void                        stop();
+    void                        printTiming();
+
+    double                      scale() { return m_dScale; }
+    double                      offset() { return m_dOffset; }
+    unsigned int                inputs() { return m_uInputs; }
+};
+
+#endif // _STREAMING_DIGITIZER_H_
@@ -0,0 +1,234 @@
+#include "thread_policy.h"
+#include <stdio.h>
+#include <stdlib.h>       // strtol
+#include <string.h>       // strerror
+#include <errno.h>
+#include <sched.h>        // cpu_set_t, SCHED_FIFO
+#include <unistd.h>       // sysconf, syscall
+#include <sys/mman.h>     // mlockall
+#include <sys/syscall.h>  // SYS_gettid
+
+using namespace std;
+
+pthread_mutex_t               ThreadPolicy::s_mutex = PTHREAD_MUTEX_INITIALIZER;
+std::vector<ThreadPolicy::Role> ThreadPolicy::s_roles;
+__thread bool                 ThreadPolicy::t_bApplied = false;
+
+
+
+// ----------------------------------------------------------------------------
+// parse() -- Converts a CPU list like "0,2,4-7" to CPU numbers
+// ----------------------------------------------------------------------------
+bool ThreadPolicy::parse(const string& sCPUs, vector<int>& cpus)
+{
+  const char* p = sCPUs.c_str();
+  char* pEnd = NULL;
+
+  cpus.clear();
+
+  while (*p) {
+
+    if ((*p == ',') || (*p == ' ')) {
+      p++;
+      continue;
+    }
+
+    long iFirst = strtol(p, &pEnd, 10);
+    if (pEnd == p) {
+      return false;
+    }
+
+    long iLast = iFirst;
+    p = pEnd;
+    if (*p == '-') {
+      p++;
+      iLast = strtol(p, &pEnd, 10);
+      if (pEnd == p) {
+        return false;
+      }
+      p = pEnd;
+    }
+
+    if ((iFirst < 0) || (iLast < iFirst) || (iLast >= CPU_SETSIZE)) {
+      return false;
+    }
+
+    for (long i=iFirst; i<=iLast; i++) {
+      cpus.push_back((int) i);
+    }
+  }
+
+  return true;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// set()
+// ----------------------------------------------------------------------------
+bool ThreadPolicy::set(const string& sRole, const string& sCPUs, int iPriority)
+{
+  Role role;
+  role.sRole = sRole;
+  role.sCPUs = sCPUs;
+  role.iPriority = iPriority;
+
+  if (!parse(sCPUs, role.cpus)) {
+    printf("ThreadPolicy: Invalid CPU list '%s' for %s threads\n", sCPUs.c_str(), sRole.c_str());
+    return false;
+  }
+
+  if ((iPriority < 0) || (iPriority > 99)) {
+    printf("ThreadPolicy: Invalid priority %d for %s threads (use 0 to 99)\n", iPriority, sRole.c_str());
+    return false;
+  }
+
+  long iNumCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+  for (unsigned int i=0; i<role.cpus.size(); i++) {
+    if (role.cpus[i] >= iNumCPUs) {
+      printf("ThreadPolicy: WARNING! CPU %d for %s threads is not online (%ld CPUs)\n",
+        role.cpus[i], sRole.c_str(), iNumCPUs);
+    }
+  }
+
+  pthread_mutex_lock(&s_mutex);
+  unsigned int i = 0;
+  while ((i < s_roles.size()) && (s_roles[i].sRole != sRole)) {
+    i++;
+  }
+  if (i < s_roles.size()) {
+    s_roles[i] = role;
+  } else {
+    s_roles.push_back(role);
+  }
+  pthread_mutex_unlock(&s_mutex);
+
+  return true;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// apply() -- Sets the affinity and scheduler of the calling thread and
+//            prints the result
+// ----------------------------------------------------------------------------
+bool ThreadPolicy::apply(const string& sRole, const string& sName)
+{
+  Role role;
+  bool bFound = false;
+  bool bReturn = true;
+  int iError;
+
+  if (t_bApplied) {
+    return true;
+  }
+  t_bApplied = true;
+
+  pthread_mutex_lock(&s_mutex);
+  for (unsigned int i=0; i<s_roles.size(); i++) {
+    if (s_roles[i].sRole == sRole) {
+      role = s_roles[i];
+      bFound = true;
+    }
+  }
+  pthread_mutex_unlock(&s_mutex);
+
+  if (!bFound) {
+    return true;
+  }
+
+  // CPU affinity
+  if (!role.cpus.empty()) {
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    for (unsigned int i=0; i<role.cpus.size(); i++) {
+      CPU_SET(role.cpus[i], &cpuset);
+    }
+    if ((iError = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset)) != 0) {
+      printf("ThreadPolicy: Failed to set CPUs %s for %s: %s\n", role.sCPUs.c_str(),
+        sName.c_str(), strerror(iError));
+      bReturn = false;
+    }
+  }
+
+  // Real-time scheduling
+  if (role.iPriority > 0) {
+    struct sched_param param;
+    param.sched_priority = role.iPriority;
+    if ((iError = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)) != 0) {
+      printf("ThreadPolicy: Failed to set SCHED_FIFO priority %d for %s: %s\n",
+        role.iPriority, sName.c_str(), strerror(iError));
+      bReturn = false;
+    }
+  }
+
+  // Report what we actually got
+  cpu_set_t actual;
+  string sActual;
+  int iPolicy = SCHED_OTHER;
+  struct sched_param param;
+  param.sched_priority = 0;
+
+  CPU_ZERO(&actual);
+  pthread_getaffinity_np(pthread_self(), sizeof(actual), &actual);
+  pthread_getschedparam(pthread_self(), &iPolicy, &param);
+  for (int i=0; i<CPU_SETSIZE; i++) {
+    if (CPU_ISSET(i, &actual)) {
+      int j = i;
+      while ((j+1 < CPU_SETSIZE) && CPU_ISSET(j+1, &actual)) {
+        j++;
+      }
+      sActual += (sActual.empty() ? "" : ",") + to_string(i) + ((j > i) ? "-" + to_string(j) : "");
+      i = j;
+    }
+  }
+
+  printf("ThreadPolicy: %-20s (tid %ld) on CPUs %s, %s priority %d\n", sName.c_str(),
+    (long) syscall(SYS_gettid), sActual.c_str(),
+    (iPolicy == SCHED_FIFO) ? "SCHED_FIFO" : (iPolicy == SCHED_RR) ? "SCHED_RR" : "SCHED_OTHER",
+    param.sched_priority);
+
+  return bReturn;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// lockMemory() -- Keeps the buffers from being paged out.  Future
+//                 allocations are locked too, so this should be called after
+//                 the large buffers are allocated if the process is not
+//                 privileged (they count against RLIMIT_MEMLOCK).
+// ----------------------------------------------------------------------------
+bool ThreadPolicy::lockMemory()
+{
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+    printf("ThreadPolicy: Failed to lock memory: %s\n", strerror(errno));
+    return false;
+  }
+
+  printf("ThreadPolicy: Locked all current and future memory pages\n");
+  return true;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// report()
+// ----------------------------------------------------------------------------
+void ThreadPolicy::report()
+{
+  printf("ThreadPolicy: %ld of %ld CPUs online\n", sysconf(_SC_NPROCESSORS_ONLN),
+    sysconf(_SC_NPROCESSORS_CONF));
+
+  pthread_mutex_lock(&s_mutex);
+  for (unsigned int i=0; i<s_roles.size(); i++) {
+    printf("ThreadPolicy: %-12s CPUs %-12s %s", s_roles[i].sRole.c_str(),
+      s_roles[i].sCPUs.empty() ? "(any)" : s_roles[i].sCPUs.c_str(),
+      (s_roles[i].iPriority > 0) ? "SCHED_FIFO" : "SCHED_OTHER");
+    if (s_roles[i].iPriority > 0) {
+      printf(" priority %d", s_roles[i].iPriority);
+    }
+    printf("\n");
+  }
+  pthread_mutex_unlock(&s_mutex);
+}
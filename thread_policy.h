@@ -0,0 +1,70 @@
+#ifndef _THREAD_POLICY_H_
+#define _THREAD_POLICY_H_
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+// ---------------------------------------------------------------------------
+//
+// THREAD POLICY
+//
+// CPU affinity and scheduling for the threads of the pipeline, configured by
+// role before the threads start:
+//
+//   digitizer     The acquisition loop (and the spectrometer's main loop,
+//                 which runs in the same thread)
+//   transfer      Digitizer DMA transfer thread (see StreamingDigitizer)
+//   channelizer   PFB and DDC worker threads
+//   dumper        Raw data dump writer
+//   writer        SIMPLESPEC accumulation writer
+//
+// Each thread calls apply() with its role when it starts (later calls from
+// the same thread are ignored).  A role with no CPUs configured may run on
+// any CPU, and a priority of 0 keeps the default (SCHED_OTHER) scheduler.
+// A priority from 1 to 99 selects SCHED_FIFO.
+// Failures (e.g. without privilege) are reported and the thread carries on
+// with the default policy.
+//
+// CPU lists use the same format as taskset and /sys, e.g. "2", "4-7", or
+// "0,2,8-15".
+//
+// ---------------------------------------------------------------------------
+
+class ThreadPolicy {
+
+  public:
+
+    // Set the CPUs and priority of a role.  Returns false if the CPU list
+    // can't be parsed or the priority is out of range.
+    static bool   set(const std::string& sRole, const std::string& sCPUs, int iPriority);
+
+    // Apply the policy of sRole to the calling thread and report it under
+    // the name sName
+    static bool   apply(const std::string& sRole, const std::string& sName);
+
+    // Lock all current and future pages of the process in memory
+    static bool   lockMemory();
+
+    // Print the configured roles and the CPUs of this machine
+    static void   report();
+
+    // Converts a CPU list to CPU numbers.  Returns false if it can't be
+    // parsed.
+    static bool   parse(const std::string&, std::vector<int>&);
+
+  private:
+
+    struct Role {
+      std::string       sRole;
+      std::string       sCPUs;
+      std::vector<int>  cpus;
+      int               iPriority;
+    };
+
+    static pthread_mutex_t      s_mutex;
+    static std::vector<Role>    s_roles;
+    static __thread bool        t_bApplied;
+};
+
+#endif // _THREAD_POLICY_H_
@@ -142,7 +142,11 @@ class TimeKeeper {
 
     double set(double dSecondsSince1970) { 
 
+      // The nanoseconds must follow too, or ns() and the time strings keep
+      // those of the previous time (sub-accumulation times, set from 
+      // fractional seconds, are written with their nanoseconds)
       m_dSecondsSince1970 = dSecondsSince1970;
+      m_iNanoSeconds = (long) ((dSecondsSince1970 - floor(dSecondsSince1970)) * 1e9);
       getDateTimeFromSecondsSince1970(dSecondsSince1970, &m_iYear, &m_iDayOfYear, &m_iHour, &m_iMinutes, &m_iSeconds);
 
       return dSecondsSince1970;
@@ -0,0 +1,159 @@
+#include "trace.h"
+#include <stdio.h>
+#include <string.h>         // strncpy
+#include <new>              // nothrow
+#include <unistd.h>         // getpid, syscall
+#include <sys/syscall.h>    // SYS_gettid
+
+using namespace std;
+
+std::atomic<bool>         Trace::s_bEnabled(false);
+pthread_mutex_t           Trace::s_mutex = PTHREAD_MUTEX_INITIALIZER;
+std::vector<TraceRing*>   Trace::s_rings;
+__thread TraceRing*       Trace::t_pRing = NULL;
+__thread char             Trace::t_sName[32] = "";
+
+
+
+// ----------------------------------------------------------------------------
+// enable()
+// ----------------------------------------------------------------------------
+void Trace::enable(bool bEnable)
+{
+  s_bEnabled.store(bEnable, std::memory_order_relaxed);
+  printf("Trace: Tracing %s\n", bEnable ? "on" : "off");
+}
+
+
+
+// ----------------------------------------------------------------------------
+// setThreadName() -- Applied now if the thread already has a ring, otherwise
+//                    when the ring is created
+// ----------------------------------------------------------------------------
+void Trace::setThreadName(const string& sName)
+{
+  strncpy(t_sName, sName.c_str(), sizeof(t_sName) - 1);
+  t_sName[sizeof(t_sName) - 1] = '\0';
+
+  if (t_pRing) {
+    pthread_mutex_lock(&s_mutex);
+    t_pRing->sThreadName = t_sName;
+    pthread_mutex_unlock(&s_mutex);
+  }
+}
+
+
+
+// ----------------------------------------------------------------------------
+// createRing() -- Allocates and registers the calling thread's ring.  Returns
+//                 NULL if the allocation fails.
+// ----------------------------------------------------------------------------
+TraceRing* Trace::createRing()
+{
+  TraceRing* pRing = new (std::nothrow) TraceRing();
+  if (!pRing) {
+    return NULL;
+  }
+
+  pRing->uThreadId = (unsigned int) syscall(SYS_gettid);
+  pRing->sThreadName = t_sName[0] ? t_sName : "thread " + to_string(pRing->uThreadId);
+  pRing->uHead.store(0);
+
+  pthread_mutex_lock(&s_mutex);
+  s_rings.push_back(pRing);
+  pthread_mutex_unlock(&s_mutex);
+
+  t_pRing = pRing;
+  return pRing;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// writeJSON() -- Writes the Chrome trace event format ("X" complete events
+//                with microsecond timestamps) for all rings.  Rings are read
+//                while their threads keep writing, so any event that may
+//                have been overwritten during the copy is dropped.
+// ----------------------------------------------------------------------------
+long Trace::writeJSON(const string& sFilePath)
+{
+  vector<TraceRing*> rings;
+  vector<string> names;
+  vector< vector<TraceEvent> > events;
+  uint64_t uOrigin = 0;
+  long iCount = 0;
+
+  pthread_mutex_lock(&s_mutex);
+  rings = s_rings;
+  for (unsigned int r=0; r<rings.size(); r++) {
+    names.push_back(rings[r]->sThreadName);
+  }
+  pthread_mutex_unlock(&s_mutex);
+
+  // Copy the events of each ring
+  events.resize(rings.size());
+  for (unsigned int r=0; r<rings.size(); r++) {
+
+    TraceRing* pRing = rings[r];
+    uint64_t uHead = pRing->uHead.load(std::memory_order_acquire);
+    uint64_t uFirst = (uHead > TRACE_RING_EVENTS) ? uHead - TRACE_RING_EVENTS : 0;
+
+    vector<TraceEvent> copy;
+    copy.reserve(uHead - uFirst);
+    for (uint64_t i=uFirst; i<uHead; i++) {
+      copy.push_back(pRing->events[i % TRACE_RING_EVENTS]);
+    }
+
+    // The writer may have overwritten events up to (and be writing) the
+    // slot after its current head
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t uNewHead = pRing->uHead.load(std::memory_order_relaxed);
+    uint64_t uValid = (uNewHead + 1 > TRACE_RING_EVENTS) ? uNewHead + 1 - TRACE_RING_EVENTS : 0;
+
+    for (uint64_t i=uFirst; i<uHead; i++) {
+      if (i >= uValid) {
+        const TraceEvent& e = copy[i - uFirst];
+        events[r].push_back(e);
+        uOrigin = ((uOrigin == 0) || (e.uStart < uOrigin)) ? e.uStart : uOrigin;
+      }
+    }
+  }
+
+  FILE* pFile = fopen(sFilePath.c_str(), "w");
+  if (!pFile) {
+    printf("Trace: Failed to open file %s\n", sFilePath.c_str());
+    return -1;
+  }
+
+  unsigned int uPid = (unsigned int) getpid();
+  const char* sSep = "";
+
+  fprintf(pFile, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+  for (unsigned int r=0; r<rings.size(); r++) {
+
+    fprintf(pFile, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,"
+      "\"args\":{\"name\":\"%s\"}}", sSep, uPid, rings[r]->uThreadId, names[r].c_str());
+    sSep = ",\n";
+
+    for (unsigned int i=0; i<events[r].size(); i++) {
+      const TraceEvent& e = events[r][i];
+      fprintf(pFile, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%u,\"tid\":%u,"
+        "\"ts\":%.3f,\"dur\":%.3f}", e.sName, uPid, rings[r]->uThreadId,
+        (e.uStart - uOrigin) / 1e3, (e.uEnd - e.uStart) / 1e3);
+      iCount++;
+    }
+  }
+
+  fprintf(pFile, "\n]}\n");
+
+  if (fclose(pFile) != 0) {
+    printf("Trace: Failed to write file %s\n", sFilePath.c_str());
+    return -1;
+  }
+
+  printf("Trace: Wrote %ld events from %u threads to %s\n", iCount,
+    (unsigned int) rings.size(), sFilePath.c_str());
+
+  return iCount;
+}
@@ -0,0 +1,139 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+// ---------------------------------------------------------------------------
+//
+// TRACE
+//
+// Records timed spans (e.g. "fft", "buffer push") from any thread so that
+// the timeline of the pipeline can be viewed in chrome://tracing or
+// https://ui.perfetto.dev.  Tracing is always compiled in and is switched on
+// and off at run time.  When off, a span costs one relaxed load.
+//
+// Each thread writes to its own ring of the most recent TRACE_RING_EVENTS
+// spans, so recording never takes a lock.  Rings are created the first time
+// a thread records a span while tracing is on and live until the process
+// exits.  Timestamps are CLOCK_MONOTONIC_RAW nanoseconds.
+//
+//   {
+//     TraceSpan span("fft");
+//     ...
+//   }
+//
+// or, for back-to-back spans in hot loops, share the timestamps:
+//
+//   uint64_t t0 = Trace::now();
+//   ...
+//   uint64_t t1 = Trace::now();
+//   Trace::record("taps", t0, t1);
+//
+// ---------------------------------------------------------------------------
+
+#define TRACE_RING_EVENTS     65536
+#define TRACE_FILE            "/tmp/fastspec_trace.json"
+
+struct TraceEvent {
+  const char*   sName;          // Must be a string literal (not copied)
+  uint64_t      uStart;         // ns
+  uint64_t      uEnd;           // ns
+};
+
+
+// ---------------------------------------------------------------------------
+// TraceRing -- Events of one thread.  Single writer, any number of readers.
+// ---------------------------------------------------------------------------
+struct TraceRing {
+  std::string             sThreadName;
+  unsigned int            uThreadId;
+  std::atomic<uint64_t>   uHead;          // Total events ever written
+  TraceEvent              events[TRACE_RING_EVENTS];
+};
+
+
+// ---------------------------------------------------------------------------
+// Trace -- Global switch and export
+// ---------------------------------------------------------------------------
+class Trace {
+
+  public:
+
+    // Turn recording on or off
+    static void         enable(bool);
+    static bool         enabled() { return s_bEnabled.load(std::memory_order_relaxed); }
+
+    // Current time in ns
+    static uint64_t     now() {
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+      return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+
+    // Record a span for the calling thread (ignored if tracing is off)
+    static void         record(const char* sName, uint64_t uStart, uint64_t uEnd) {
+      if (enabled()) {
+        TraceRing* pRing = ring();
+        if (pRing) {
+          uint64_t uHead = pRing->uHead.load(std::memory_order_relaxed);
+          TraceEvent& e = pRing->events[uHead % TRACE_RING_EVENTS];
+          e.sName = sName;
+          e.uStart = uStart;
+          e.uEnd = uEnd;
+          pRing->uHead.store(uHead + 1, std::memory_order_release);
+        }
+      }
+    }
+
+    // Name the calling thread in the exported trace
+    static void         setThreadName(const std::string&);
+
+    // Write the events of all threads as Chrome trace JSON.  Returns the
+    // number of events written or -1 on failure.
+    static long         writeJSON(const std::string&);
+
+  private:
+
+    static std::atomic<bool>          s_bEnabled;
+    static pthread_mutex_t            s_mutex;
+    static std::vector<TraceRing*>    s_rings;
+    static __thread TraceRing*        t_pRing;
+    static __thread char              t_sName[32];
+
+    static TraceRing*   ring() { return t_pRing ? t_pRing : createRing(); }
+    static TraceRing*   createRing();
+};
+
+
+// ---------------------------------------------------------------------------
+// TraceSpan -- Records a span from construction to destruction (or end())
+// ---------------------------------------------------------------------------
+class TraceSpan {
+
+  private:
+
+    const char*   m_sName;
+    uint64_t      m_uStart;
+
+  public:
+
+    TraceSpan(const char* sName) : m_sName(sName) {
+      m_uStart = Trace::enabled() ? Trace::now() : 0;
+    }
+
+    ~TraceSpan() { end(); }
+
+    void end() {
+      if (m_uStart) {
+        Trace::record(m_sName, m_uStart, Trace::now());
+        m_uStart = 0;
+      }
+    }
+};
+
+#endif // _TRACE_H_
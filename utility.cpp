@@ -134,85 +134,6 @@ string construct_filepath_base(const string& sDataDir,
 }
 
 
-// ----------------------------------------------------------------------------
-// write_for_plot() -- Writes all three spectra from full switch cycle to 
-//                         a text file.  
-// ----------------------------------------------------------------------------
-bool write_plot_file( const string& sFilePath,
-                      Accumulator& acc0, 
-                      Accumulator& acc1, 
-                      Accumulator& acc2, 
-                      unsigned int uBin )
-{
-
-  FILE* file;
-  ACCUM_DATA_TYPE* p0 = acc0.getSum();
-  ACCUM_DATA_TYPE* p1 = acc1.getSum();
-  ACCUM_DATA_TYPE* p2 = acc2.getSum();
-  ACCUM_DATA_TYPE d0;
-  ACCUM_DATA_TYPE d1;
-  ACCUM_DATA_TYPE d2;
-  double f;
-  unsigned int count = 0;  
-
-  double fstart = acc0.getStartFreq();
-  double fstop = acc0.getStopFreq();
-  double flength = (double) acc0.getDataLength();
-  double df = (fstop-fstart) / flength;
-  double accums = (double) acc0.getNumAccums();
-  double ta = 0;
-
-  if ((file = fopen (sFilePath.c_str(), "w")) == NULL) {
-    printf ("Error writing to plot file.  Cannot write to: %s\n", sFilePath.c_str());
-    return false;
-  }
-
-  // Loop over the spectrum and calculate and write the desired outputs
-  // Col 1: frequency [MHz]
-  // Col 2: 10*log10(p0)
-  // Col 3: 10*log10(p1)
-  // Col 4: 10*log10(p2)
-  // Col 5: ta = 400*(p0-p1)/(p2-p1) + 300
-  for (unsigned int i = 0; i<acc0.getDataLength(); i++) {
-
-    // Bin together uBin values
-    if (count == 0) {
-      f = fstart+df*i;
-      d0 = p0[i];
-      d1 = p1[i];
-      d2 = p2[i];
-    } else if (count < uBin) {
-      d0 += p0[i];
-      d1 += p1[i];
-      d2 += p2[i];
-      f += fstart+df*i;
-    }
-
-    count++;
-
-    // Store the binned values
-    if (count == uBin) {
-
-      count = 0;
-      d0 = d0/uBin;
-      d1 = d1/uBin;
-      d2 = d2/uBin;
-      f = f/uBin;
-  
-      ta = 400.0*(d0-d1)/(d2-d1)+300.0;
-
-      fprintf(file, "%12g %12g %12g %12g %12g\n", 
-        f, 10.0*log10(d0/accums), 10.0*log10(d1/accums), 10.0*log10(d2/accums), ta);
-    }
-  }
-
-  fclose(file);
-  return true;
-}
-
-
-
-
 // ----------------------------------------------------------------------------
 // append_accumulation_simple() -- Writes all three spectra from full switch cycle to 
 //                         ACQ file.  
@@ -276,11 +197,357 @@ bool append_accumulation_simple( const string& sFilePath, Accumulator* pAccum  )
   fwrite(&uit, sizeof(uit), 1, file);
 
   fwrite(pAccum->getSum(), sizeof(ACCUM_DATA_TYPE), pAccum->getDataLength(), file);
+
+  // Spectral kurtosis and variance follow the spectrum if they are kept
+  if (pAccum->hasSecondMoment()) {
+    bResult = append_moments(file, pAccum);
+  }
+  
+  fclose(file);
+  
+  return bResult;
+
+}
+
+
+
+// ----------------------------------------------------------------------------
+// append_moments() -- Writes the spectral kurtosis and then the variance of
+//                     each channel to an open binary file.  Both are written
+//                     as ACCUM_DATA_TYPE arrays of length getDataLength().
+// ----------------------------------------------------------------------------
+bool append_moments( FILE* file, const Accumulator* pAccum )
+{
+  unsigned int uLength = pAccum->getDataLength();
+  bool bResult = false;
+
+  ACCUM_DATA_TYPE* pTemp = (ACCUM_DATA_TYPE*) malloc(uLength * sizeof(ACCUM_DATA_TYPE));
+  if (pTemp == NULL) {
+    printf ("Error writing moments.  Failed to allocate memory.\n");
+    return false;
+  }
+
+  if (pAccum->getCopyOfKurtosis(pTemp, uLength)) {
+    bResult = (fwrite(pTemp, sizeof(ACCUM_DATA_TYPE), uLength, file) == uLength);
+  }
+
+  if (bResult && pAccum->getCopyOfVariance(pTemp, uLength)) {
+    bResult = (fwrite(pTemp, sizeof(ACCUM_DATA_TYPE), uLength, file) == uLength);
+  }
+
+  free(pTemp);
+
+  return bResult;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// append_switch_cycle_moments() -- Writes the spectral kurtosis and variance
+//                         for all three spectra from a full switch cycle to
+//                         the binary sidecar of an ACQ file.  Each record is:
+//
+//                         year, doy, hh, mm, ss (int), ns (long), 
+//                         swpos, nblk, nspec (unsigned int),
+//                         kurtosis[nspec], variance[nspec] (ACCUM_DATA_TYPE)
+// ----------------------------------------------------------------------------
+bool append_switch_cycle_moments( const string& sFilePath,
+                                  Accumulator& acc0, 
+                                  Accumulator& acc1, 
+                                  Accumulator& acc2 )
+{
+  Accumulator* pAccum = NULL;
+  TimeKeeper startTime = acc0.getStartTime();
+  bool bResult = true;
+
+  if (!is_file(sFilePath.c_str())) {
+    printf ("Error appending to file.  File not found: %s\n", sFilePath.c_str());
+    return false;
+  }
   
+  FILE *file = NULL;
+  if ((file = fopen (sFilePath.c_str(), "a")) == NULL) {
+    printf ("Error appending to file.  Cannot write to: %s\n", sFilePath.c_str());
+    return false;
+  }
+
+  int it = 0;
+  long lt = 0;
+  unsigned int uit = 0;
+
+  for (unsigned int i=0; i<3; i++) {
+
+    switch (i)
+    {
+    case 0:
+      pAccum = &acc0;
+      break;
+    case 1:
+      pAccum = &acc1;
+      break;
+    case 2:
+      pAccum = &acc2;
+      break;
+    }
+
+    it = startTime.year();
+    fwrite(&it, sizeof(it), 1, file);
+    it = startTime.doy();
+    fwrite(&it, sizeof(it), 1, file);
+    it = startTime.hh();
+    fwrite(&it, sizeof(it), 1, file);
+    it = startTime.mm();
+    fwrite(&it, sizeof(it), 1, file);
+    it = startTime.ss();
+    fwrite(&it, sizeof(it), 1, file);
+    lt = startTime.ns();
+    fwrite(&lt, sizeof(lt), 1, file);
+
+    fwrite(&i, sizeof(i), 1, file);
+    uit = pAccum->getNumAccums();
+    fwrite(&uit, sizeof(uit), 1, file);
+    uit = pAccum->getDataLength();
+    fwrite(&uit, sizeof(uit), 1, file);
+
+    bResult = bResult && append_moments(file, pAccum);
+  }
+
   fclose(file);
+
+  return bResult;
+}
+
+
+
+
+
+
+// ----------------------------------------------------------------------------
+// append_weights() -- Writes the sum of the weights of each channel (the 
+//                     number of spectra it was kept in by RFI flagging, 
+//                     all of the accumulated spectra if weights weren't 
+//                     kept), then the number of spectra it was flagged in
+// ----------------------------------------------------------------------------
+bool append_weights( FILE* file, const Accumulator* pAccum )
+{
+  unsigned int uLength = pAccum->getDataLength();
+  bool bResult = false;
+
+  ACCUM_DATA_TYPE* pTemp = (ACCUM_DATA_TYPE*) malloc(uLength * sizeof(ACCUM_DATA_TYPE));
+  if (pTemp == NULL) {
+    printf ("Error writing weights.  Failed to allocate memory.\n");
+    return false;
+  }
+
+  if (!pAccum->hasWeights()) {
+    for (unsigned int i=0; i<uLength; i++) {
+      pTemp[i] = pAccum->getNumAccums();
+    }
+    bResult = true;
+  } else {
+    bResult = pAccum->getCopyOfWeights(pTemp, uLength);
+  }
+
+  bResult = bResult && (fwrite(pTemp, sizeof(ACCUM_DATA_TYPE), uLength, file) == uLength);
+
+  if (bResult && pAccum->getCopyOfFlags(pTemp, uLength)) {
+    bResult = (fwrite(pTemp, sizeof(ACCUM_DATA_TYPE), uLength, file) == uLength);
+  } else {
+    bResult = false;
+  }
+
+  free(pTemp);
+
+  return bResult;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// append_switch_cycle_weights() -- Writes the sum of the RFI flagging weights
+//                         for all three spectra from a full switch cycle to
+//                         the binary sidecar of an ACQ file.  Each record is:
+//
+//                         year, doy, hh, mm, ss (int), ns (long), 
+//                         swpos, nblk, nspec (unsigned int),
+//                         weight[nspec], flagged[nspec] (ACCUM_DATA_TYPE)
+// ----------------------------------------------------------------------------
+bool append_switch_cycle_weights( const string& sFilePath,
+                                  Accumulator& acc0, 
+                                  Accumulator& acc1, 
+                                  Accumulator& acc2 )
+{
+  Accumulator* pAccum = NULL;
+  TimeKeeper startTime = acc0.getStartTime();
+  bool bResult = true;
+
+  if (!is_file(sFilePath.c_str())) {
+    printf ("Error appending to file.  File not found: %s\n", sFilePath.c_str());
+    return false;
+  }
   
+  FILE *file = NULL;
+  if ((file = fopen (sFilePath.c_str(), "a")) == NULL) {
+    printf ("Error appending to file.  Cannot write to: %s\n", sFilePath.c_str());
+    return false;
+  }
+
+  int it = 0;
+  long lt = 0;
+  unsigned int uit = 0;
+
+  for (unsigned int i=0; i<3; i++) {
+
+    switch (i)
+    {
+    case 0:
+      pAccum = &acc0;
+      break;
+    case 1:
+      pAccum = &acc1;
+      break;
+    case 2:
+      pAccum = &acc2;
+      break;
+    }
+
+    it = startTime.year();
+    fwrite(&it, sizeof(it), 1, file);
+    it = startTime.doy();
+    fwrite(&it, sizeof(it), 1, file);
+    it = startTime.hh();
+    fwrite(&it, sizeof(it), 1, file);
+    it = startTime.mm();
+    fwrite(&it, sizeof(it), 1, file);
+    it = startTime.ss();
+    fwrite(&it, sizeof(it), 1, file);
+    lt = startTime.ns();
+    fwrite(&lt, sizeof(lt), 1, file);
+
+    fwrite(&i, sizeof(i), 1, file);
+    uit = pAccum->getNumAccums();
+    fwrite(&uit, sizeof(uit), 1, file);
+    uit = pAccum->getDataLength();
+    fwrite(&uit, sizeof(uit), 1, file);
+
+    bResult = bResult && append_weights(file, pAccum);
+  }
+
+  fclose(file);
+
   return bResult;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// append_cross() -- Writes the average power of inputs A and B, then the 
+//                   real and imaginary parts of their average cross power,
+//                   to an open binary file.  The cross accumulator holds the
+//                   real parts followed by the imaginary parts, so each of
+//                   the four is an ACCUM_DATA_TYPE array of the length of A.
+// ----------------------------------------------------------------------------
+bool append_cross( FILE* file, const Accumulator* pAccumA, 
+                   const Accumulator* pAccumB, const Accumulator* pCross )
+{
+  unsigned int uLength = pAccumA->getDataLength();
+  bool bResult = false;
+
+  if ((pAccumB->getDataLength() != uLength) || (pCross->getDataLength() != 2*uLength)) {
+    printf ("Error writing cross power.  Spectra have different lengths.\n");
+    return false;
+  }
+
+  ACCUM_DATA_TYPE* pTemp = (ACCUM_DATA_TYPE*) malloc(2 * uLength * sizeof(ACCUM_DATA_TYPE));
+  if (pTemp == NULL) {
+    printf ("Error writing cross power.  Failed to allocate memory.\n");
+    return false;
+  }
+
+  if (pAccumA->getCopyOfAverage(pTemp, uLength)) {
+    bResult = (fwrite(pTemp, sizeof(ACCUM_DATA_TYPE), uLength, file) == uLength);
+  }
+
+  if (bResult && pAccumB->getCopyOfAverage(pTemp, uLength)) {
+    bResult = (fwrite(pTemp, sizeof(ACCUM_DATA_TYPE), uLength, file) == uLength);
+  }
+
+  if (bResult && pCross->getCopyOfAverage(pTemp, 2*uLength)) {
+    bResult = (fwrite(pTemp, sizeof(ACCUM_DATA_TYPE), 2*uLength, file) == 2*uLength);
+  }
+
+  free(pTemp);
+
+  return bResult;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// append_switch_cycle_cross() -- Writes the auto and cross power of two 
+//                         inputs for all three switch positions to the 
+//                         binary sidecar of an ACQ file.  acc0 to acc2 are
+//                         input A and pAccumB and pCross hold one 
+//                         accumulator per switch position.  Each record is:
+//
+//                         year, doy, hh, mm, ss (int), ns (long), 
+//                         swpos, nblk, nspec (unsigned int),
+//                         auto_a[nspec], auto_b[nspec], cross_real[nspec],
+//                         cross_imag[nspec] (ACCUM_DATA_TYPE)
+// ----------------------------------------------------------------------------
+bool append_switch_cycle_cross( const string& sFilePath,
+                                Accumulator& acc0, 
+                                Accumulator& acc1, 
+                                Accumulator& acc2,
+                                const Accumulator* pAccumB,
+                                const Accumulator* pCross )
+{
+  Accumulator* pAccums[3] = { &acc0, &acc1, &acc2 };
+  TimeKeeper startTime = acc0.getStartTime();
+  bool bResult = true;
+
+  if (!is_file(sFilePath.c_str())) {
+    printf ("Error appending to file.  File not found: %s\n", sFilePath.c_str());
+    return false;
+  }
+  
+  FILE *file = NULL;
+  if ((file = fopen (sFilePath.c_str(), "a")) == NULL) {
+    printf ("Error appending to file.  Cannot write to: %s\n", sFilePath.c_str());
+    return false;
+  }
 
+  int it = 0;
+  long lt = 0;
+  unsigned int uit = 0;
+
+  for (unsigned int i=0; i<3; i++) {
+
+    it = startTime.year();
+    fwrite(&it, sizeof(it), 1, file);
+    it = startTime.doy();
+    fwrite(&it, sizeof(it), 1, file);
+    it = startTime.hh();
+    fwrite(&it, sizeof(it), 1, file);
+    it = startTime.mm();
+    fwrite(&it, sizeof(it), 1, file);
+    it = startTime.ss();
+    fwrite(&it, sizeof(it), 1, file);
+    lt = startTime.ns();
+    fwrite(&lt, sizeof(lt), 1, file);
+
+    fwrite(&i, sizeof(i), 1, file);
+    uit = pCross[i].getNumAccums();
+    fwrite(&uit, sizeof(uit), 1, file);
+    uit = pAccums[i]->getDataLength();
+    fwrite(&uit, sizeof(uit), 1, file);
+
+    bResult = bResult && append_cross(file, pAccums[i], &pAccumB[i], &pCross[i]);
+  }
+
+  fclose(file);
+
+  return bResult;
 }
 
 
@@ -335,7 +602,8 @@ bool append_switch_cycle( const string& sFilePath,
           / (double) pAccum->getDataLength();  // kHz
 
     bResult = bResult && append_switch_pos(sFilePath.c_str(), 
-                pAccum->getSum(), pAccum->getDataLength(), i, 
+                pAccum->getSum(), pAccum->getDataLength(), 
+                pAccum->getFirstChannel(), pAccum->getTotalChannels(), i, 
                 startTime.year(), startTime.doy(), 
                 startTime.hh(), startTime.mm(), startTime.ss(),
                 pAccum->getStartFreq(), pAccum->getStopFreq(), 
@@ -372,10 +640,20 @@ bool append_switch_cycle( const string& sFilePath,
 //           factor proportional to the number of samples per accumualtion, 
 //           then converted to dB, then have an offset subtracted, then are
 //           multiplied by 10^5 before being converted to integer for encoding. 
+//        4) If only a range of channels is written, uFirstChannel is the 
+//           channelizer index of the first one and uTotalChannels is the 
+//           number of channels in the full channelizer output.  The 
+//           normalization and the -199 flag on the lowest 10 channels are 
+//           based on the full output so the values match a full spectrum.
+//        5) The -199 flag marks the channels next to DC, so it is only 
+//           applied when the full output starts at 0 MHz (not in zoom mode,
+//           where the lowest channels are in the band).
 // ----------------------------------------------------------------------------
 bool append_switch_pos( const char* pchFilename, 
                         const ACCUM_DATA_TYPE* pSpectrum, 
                         unsigned int uLength, 
+                        unsigned int uFirstChannel,
+                        unsigned int uTotalChannels,
                         unsigned int uSwitch, 
                         unsigned int year, unsigned int doy, 
                         unsigned int hh, unsigned int mm, 
@@ -423,7 +701,7 @@ bool append_switch_pos( const char* pchFilename,
   // original acq file: fprintf (file, "# swpos %d resolution %8.3f adcmax %8.5f adcmin %8.5f temp %2.0f C nblk %d nspec %d\n",
   //          uSwitch, dEffectiveChannelSize, dADCmax, dADCmin, dTemp, uNumAccums, uLength);
   fprintf (file, "# swpos %d data_drops %8lu adcmax %8.5f adcmin %8.5f temp %2.0f C nblk %d nspec %d\n",
-            uSwitch, uDrops / uLength / 2, dADCmax, dADCmin, dTemp, uNumAccums, uLength);
+            uSwitch, uDrops / uTotalChannels / 2, dADCmax, dADCmin, dTemp, uNumAccums, uLength);
 
   // Write the spectrum preamble to the file
   fprintf (file, "%4d:%03d:%02d:%02d:%02d %1d %8.3f %8.6f %8.3f %4.1f spectrum ",
@@ -433,14 +711,18 @@ bool append_switch_pos( const char* pchFilename,
   // From pxspec: output_spec = 10.0 * log10( data[i] / (nblk*nspec*2.0) ) - 38.3;
   double dOut = 0;
 
+  // Channels below this are flagged (only if the full output starts at DC)
+  double dFullStart = dStartFreq - uFirstChannel * dStepFreq;
+  unsigned int uFlagged = (fabs(dFullStart) < 0.5 * dStepFreq) ? 10 : 0;
+
   // Encode and write the spectrum to the file
   for (i=0; i<uLength; i++) {
 
     // Convert to the values saved by the pxspec code to be backwards compatible
-    if (i<10) {
+    if (uFirstChannel+i<uFlagged) {
       dOut = -199;
     } else {
-      dOut = 10.0 * log10( pSpectrum[i] / ((double)uNumAccums*(double)uLength*(double)2.0) ) - 38.3;
+      dOut = 10.0 * log10( pSpectrum[i] / ((double)uNumAccums*(double)uTotalChannels*(double)2.0) ) - 38.3;
     }
 
     //if (i==12000) { printf("%8.6f\n", dOut); }
@@ -469,3 +751,89 @@ bool append_switch_pos( const char* pchFilename,
 
 } // write_to_acq
 
+
+
+// ----------------------------------------------------------------------------
+// append_sub_accumulations() -- Writes the sub-accumulations of an accumulator
+//                         to a binary side stream.  Spectra are averaged and
+//                         stored as 4-byte floats to keep the file compact.  
+//                         Each record is:
+//
+//                         year, doy, hh, mm, ss (int), ns (long), 
+//                         duration (float, seconds),
+//                         swpos, index, nblk, nspec (unsigned int),
+//                         average[nspec] (float)
+// ----------------------------------------------------------------------------
+bool append_sub_accumulations( const string& sFilePath,
+                               const Accumulator* pAccum,
+                               unsigned int uSwitchPosition )
+{
+  unsigned int uLength = pAccum->getDataLength();
+  bool bResult = true;
+
+  if (!is_file(sFilePath.c_str())) {
+    printf ("Error appending to file.  File not found: %s\n", sFilePath.c_str());
+    return false;
+  }
+  
+  FILE *file = NULL;
+  if ((file = fopen (sFilePath.c_str(), "a")) == NULL) {
+    printf ("Error appending to file.  Cannot write to: %s\n", sFilePath.c_str());
+    return false;
+  }
+
+  ACCUM_DATA_TYPE* pTemp = (ACCUM_DATA_TYPE*) malloc(uLength * sizeof(ACCUM_DATA_TYPE));
+  float* pOut = (float*) malloc(uLength * sizeof(float));
+  if ((pTemp == NULL) || (pOut == NULL)) {
+    printf ("Error writing sub-accumulations.  Failed to allocate memory.\n");
+    free(pTemp);
+    free(pOut);
+    fclose(file);
+    return false;
+  }
+
+  TimeKeeper startTime;
+  int it = 0;
+  long lt = 0;
+  unsigned int uit = 0;
+  float ft = 0;
+
+  for (unsigned int i=0; i<pAccum->getNumSubs(); i++) {
+
+    startTime = pAccum->getSubStartTime(i);
+
+    it = startTime.year();
+    fwrite(&it, sizeof(it), 1, file);
+    it = startTime.doy();
+    fwrite(&it, sizeof(it), 1, file);
+    it = startTime.hh();
+    fwrite(&it, sizeof(it), 1, file);
+    it = startTime.mm();
+    fwrite(&it, sizeof(it), 1, file);
+    it = startTime.ss();
+    fwrite(&it, sizeof(it), 1, file);
+    lt = startTime.ns();
+    fwrite(&lt, sizeof(lt), 1, file);
+    ft = pAccum->getSubStopTime(i) - startTime;
+    fwrite(&ft, sizeof(ft), 1, file);
+
+    fwrite(&uSwitchPosition, sizeof(uSwitchPosition), 1, file);
+    fwrite(&i, sizeof(i), 1, file);
+    uit = pAccum->getSubNumAccums(i);
+    fwrite(&uit, sizeof(uit), 1, file);
+    fwrite(&uLength, sizeof(uLength), 1, file);
+
+    pAccum->getCopyOfSubAverage(i, pTemp, uLength);
+    for (unsigned int n=0; n<uLength; n++) {
+      pOut[n] = (float) pTemp[n];
+    }
+
+    bResult = bResult && (fwrite(pOut, sizeof(float), uLength, file) == uLength);
+  }
+
+  free(pTemp);
+  free(pOut);
+  fclose(file);
+
+  return bResult;
+}
@@ -58,13 +58,31 @@ bool append_switch_cycle( const std::string&, Accumulator&, Accumulator&,
                           
 bool append_accumulation_simple( const std::string&, Accumulator* );
 
+bool append_moments( FILE*, const Accumulator* );
+
+bool append_switch_cycle_moments( const std::string&, Accumulator&, 
+                                  Accumulator&, Accumulator& );
+
+bool append_weights( FILE*, const Accumulator* );
+
+bool append_switch_cycle_weights( const std::string&, Accumulator&, 
+                                  Accumulator&, Accumulator& );
+
+bool append_cross( FILE*, const Accumulator*, const Accumulator*, 
+                   const Accumulator* );
+
+bool append_switch_cycle_cross( const std::string&, Accumulator&, 
+                                Accumulator&, Accumulator&, 
+                                const Accumulator*, const Accumulator* );
+
+bool append_sub_accumulations( const std::string&, const Accumulator*, 
+                               unsigned int );
+
 bool append_switch_pos( const char*, const ACCUM_DATA_TYPE*, unsigned int,  
                         unsigned int, unsigned int, unsigned int, unsigned int, 
-                        unsigned int, unsigned int, double, double, double,  
-                        unsigned int, double, double, double, unsigned long);
-
-bool write_plot_file( const std::string&, Accumulator&, Accumulator&, 
-                      Accumulator&, unsigned int );
+                        unsigned int, unsigned int, unsigned int, unsigned int, 
+                        double, double, double, unsigned int, double, double, 
+                        double, unsigned long);
 
 
 // ----------------------------------------------------------------------------
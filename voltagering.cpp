@@ -0,0 +1,325 @@
+#include "voltagering.h"
+#include <stdio.h>
+#include <string.h>     // memcpy
+#include <fcntl.h>      // O_* constants
+#include <unistd.h>     // ftruncate
+#include <sys/mman.h>   // shm_open, mmap
+#include <sys/stat.h>   // fstat
+#include <sched.h>      // sched_yield
+
+using namespace std;
+
+
+// ----------------------------------------------------------------------------
+// Constructor
+// ----------------------------------------------------------------------------
+VoltageRing::VoltageRing()
+{
+  m_pHeader = NULL;
+  m_pGains = NULL;
+  m_pSlots = NULL;
+  m_uSize = 0;
+  m_uValueBytes = 0;
+  m_uNext = 0;
+  m_iGains = 0;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// Destructor
+// ----------------------------------------------------------------------------
+VoltageRing::~VoltageRing()
+{
+  close();
+}
+
+
+
+// ----------------------------------------------------------------------------
+// open() -- Creates (or replaces) the shared memory segment
+// ----------------------------------------------------------------------------
+bool VoltageRing::open(const string& sName, unsigned int uNumSlots,
+                       unsigned int uNumChannels, unsigned int uBits,
+                       double dStartFreq, double dStopFreq)
+{
+  close();
+
+  if ((uNumSlots == 0) || (uNumChannels == 0) ||
+      ((uBits != 8) && (uBits != 16) && (uBits != 32) && (uBits != 64))) {
+    printf("VoltageRing: Invalid size (%u slots of %u channels with %u bits)\n",
+      uNumSlots, uNumChannels, uBits);
+    return false;
+  }
+
+  // Keep each slot on its own cache lines
+  m_uValueBytes = (size_t) uNumChannels * 2 * uBits / 8;
+  size_t uSlotBytes = ((sizeof(VoltageRingSlot) + m_uValueBytes + 63) / 64) * 64;
+  size_t uGainBytes = ((uNumChannels * sizeof(float) + 63) / 64) * 64;
+  size_t uHeaderBytes = ((sizeof(VoltageRingHeader) + 63) / 64) * 64;
+
+  // Start fresh so that readers of a previous instance's segment are not
+  // confused by a change in size
+  shm_unlink(sName.c_str());
+
+  int fd = shm_open(sName.c_str(), O_CREAT | O_RDWR, 0644);
+  if (fd < 0) {
+    printf("VoltageRing: Failed to create shared memory segment %s\n", sName.c_str());
+    return false;
+  }
+
+  m_uSize = uHeaderBytes + uGainBytes + (size_t) uNumSlots * uSlotBytes;
+
+  if (ftruncate(fd, m_uSize) != 0) {
+    printf("VoltageRing: Failed to size shared memory segment %s\n", sName.c_str());
+    ::close(fd);
+    shm_unlink(sName.c_str());
+    return false;
+  }
+
+  void* pMap = mmap(NULL, m_uSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+
+  if (pMap == MAP_FAILED) {
+    printf("VoltageRing: Failed to map shared memory segment %s\n", sName.c_str());
+    shm_unlink(sName.c_str());
+    return false;
+  }
+
+  m_sName = sName;
+  m_pHeader = (VoltageRingHeader*) pMap;
+  m_pGains = (float*) ((char*) pMap + uHeaderBytes);
+  m_pSlots = (char*) pMap + uHeaderBytes + uGainBytes;
+  m_uNext = 0;
+  m_iGains = 0;
+
+  memset(pMap, 0, m_uSize);
+  m_pHeader->uVersion = VOLTAGERING_VERSION;
+  m_pHeader->uNumSlots = uNumSlots;
+  m_pHeader->uSlotBytes = (uint32_t) uSlotBytes;
+  m_pHeader->uNumChannels = uNumChannels;
+  m_pHeader->uBitsPerValue = uBits;
+  m_pHeader->dStartFreq = dStartFreq;
+  m_pHeader->dStopFreq = dStopFreq;
+  for (unsigned int i=0; i<uNumChannels; i++) {
+    m_pGains[i] = 1;
+  }
+
+  // Set the magic number last so readers don't use a partial header
+  __atomic_store_n(&(m_pHeader->uMagic), VOLTAGERING_MAGIC, __ATOMIC_RELEASE);
+
+  printf("VoltageRing: Streaming complex spectra to /dev/shm%s (%u slots, %.02f MB)\n",
+    sName.c_str(), uNumSlots, m_uSize / 1e6);
+
+  return true;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// close() -- Unmaps and removes the segment
+// ----------------------------------------------------------------------------
+void VoltageRing::close()
+{
+  if (m_pHeader) {
+    munmap(m_pHeader, m_uSize);
+    shm_unlink(m_sName.c_str());
+  }
+
+  m_pHeader = NULL;
+  m_pGains = NULL;
+  m_pSlots = NULL;
+  m_uSize = 0;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// write() -- Copies the complex spectrum into the next slot, tagged with the
+//            switch state
+// ----------------------------------------------------------------------------
+template<typename T>
+bool VoltageRing::write(ChannelizerData<T>* pData, unsigned int uSwitchState)
+{
+  if (!m_pHeader || !pData->pVoltage ||
+      (pData->uVoltageBits != m_pHeader->uBitsPerValue) ||
+      (pData->uNumChannels != m_pHeader->uNumChannels)) {
+    return false;
+  }
+
+  // The gains don't change, so only the first writer copies them
+  if (pData->pVoltageGains && (__atomic_exchange_n(&m_iGains, 1, __ATOMIC_RELAXED) == 0)) {
+    memcpy(m_pGains, pData->pVoltageGains, m_pHeader->uNumChannels * sizeof(float));
+  }
+
+  // Claim the next slot
+  uint64_t n = __atomic_fetch_add(&m_uNext, 1, __ATOMIC_RELAXED);
+  VoltageRingSlot* pSlot = (VoltageRingSlot*) (m_pSlots + (n % m_pHeader->uNumSlots) * m_pHeader->uSlotBytes);
+
+  // Mark the slot as being written, once the spectrum before it in the slot
+  // (n - uNumSlots) is complete.  With a ring no deeper than the number of
+  // writers, two of them could otherwise write the same slot at once and 
+  // a reader could take the mix as valid.
+  uint64_t uPrevious = (n >= m_pHeader->uNumSlots) ? 2*(n - m_pHeader->uNumSlots) + 2 : 0;
+  uint64_t uExpected = uPrevious;
+  while (!__atomic_compare_exchange_n(&(pSlot->uSequence), &uExpected, 2*n + 1, false,
+                                      __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+    uExpected = uPrevious;
+    sched_yield();
+  }
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_fetch_add(&(m_pHeader->uHead), 1, __ATOMIC_RELAXED);
+
+  pSlot->uSample = pData->uSample;
+  pSlot->uId = pData->uId;
+  pSlot->uSwitchState = uSwitchState;
+  pSlot->dADCmin = pData->dADCmin;
+  pSlot->dADCmax = pData->dADCmax;
+  memcpy((char*) pSlot + sizeof(VoltageRingSlot), pData->pVoltage, m_uValueBytes);
+
+  // Mark the slot as complete
+  __atomic_store_n(&(pSlot->uSequence), 2*n + 2, __ATOMIC_RELEASE);
+
+  return true;
+}
+
+template bool VoltageRing::write(ChannelizerData<float>*, unsigned int);
+template bool VoltageRing::write(ChannelizerData<double>*, unsigned int);
+
+
+
+// ----------------------------------------------------------------------------
+// VoltageRingReader constructor
+// ----------------------------------------------------------------------------
+VoltageRingReader::VoltageRingReader()
+{
+  m_pHeader = NULL;
+  m_uSize = 0;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// VoltageRingReader destructor
+// ----------------------------------------------------------------------------
+VoltageRingReader::~VoltageRingReader()
+{
+  close();
+}
+
+
+
+// ----------------------------------------------------------------------------
+// open() -- Maps an existing segment read-only
+// ----------------------------------------------------------------------------
+bool VoltageRingReader::open(const string& sName)
+{
+  struct stat st;
+
+  close();
+
+  int fd = shm_open(sName.c_str(), O_RDONLY, 0);
+  if (fd < 0) {
+    return false;
+  }
+
+  if ((fstat(fd, &st) != 0) || ((size_t) st.st_size < sizeof(VoltageRingHeader))) {
+    ::close(fd);
+    return false;
+  }
+
+  void* pMap = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+
+  if (pMap == MAP_FAILED) {
+    return false;
+  }
+
+  m_sName = sName;
+  m_pHeader = (VoltageRingHeader*) pMap;
+  m_uSize = st.st_size;
+
+  if ((__atomic_load_n(&(m_pHeader->uMagic), __ATOMIC_ACQUIRE) != VOLTAGERING_MAGIC) ||
+      (m_pHeader->uVersion != VOLTAGERING_VERSION)) {
+    close();
+    return false;
+  }
+
+  return true;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// close()
+// ----------------------------------------------------------------------------
+void VoltageRingReader::close()
+{
+  if (m_pHeader) {
+    munmap(m_pHeader, m_uSize);
+  }
+
+  m_pHeader = NULL;
+  m_uSize = 0;
+}
+
+
+
+// ----------------------------------------------------------------------------
+// head()
+// ----------------------------------------------------------------------------
+uint64_t VoltageRingReader::head() const
+{
+  if (!m_pHeader) {
+    return 0;
+  }
+
+  return __atomic_load_n(&(m_pHeader->uHead), __ATOMIC_ACQUIRE);
+}
+
+
+
+// ----------------------------------------------------------------------------
+// gains()
+// ----------------------------------------------------------------------------
+void VoltageRingReader::gains(vector<float>& gains) const
+{
+  gains.clear();
+
+  if (m_pHeader) {
+    size_t uHeaderBytes = ((sizeof(VoltageRingHeader) + 63) / 64) * 64;
+    const float* pGains = (const float*) ((const char*) m_pHeader + uHeaderBytes);
+    gains.assign(pGains, pGains + m_pHeader->uNumChannels);
+  }
+}
+
+
+
+// ----------------------------------------------------------------------------
+// read() -- Copies spectrum n and its slot header
+// ----------------------------------------------------------------------------
+bool VoltageRingReader::read(uint64_t n, VoltageRingSlot& slot, vector<uint8_t>& values) const
+{
+  if (!m_pHeader) {
+    return false;
+  }
+
+  size_t uHeaderBytes = ((sizeof(VoltageRingHeader) + 63) / 64) * 64;
+  size_t uGainBytes = ((m_pHeader->uNumChannels * sizeof(float) + 63) / 64) * 64;
+  size_t uValueBytes = (size_t) m_pHeader->uNumChannels * 2 * m_pHeader->uBitsPerValue / 8;
+  const char* pSlot = (const char*) m_pHeader + uHeaderBytes + uGainBytes +
+                      (n % m_pHeader->uNumSlots) * m_pHeader->uSlotBytes;
+  const uint64_t* pSequence = (const uint64_t*) pSlot;
+
+  if (__atomic_load_n(pSequence, __ATOMIC_ACQUIRE) != 2*n + 2) {
+    return false;
+  }
+
+  memcpy(&slot, pSlot, sizeof(VoltageRingSlot));
+  values.resize(uValueBytes);
+  memcpy(values.data(), pSlot + sizeof(VoltageRingSlot), uValueBytes);
+
+  // Only keep the copy if the slot wasn't reused while we read it
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return (__atomic_load_n(pSequence, __ATOMIC_RELAXED) == 2*n + 2);
+}
@@ -0,0 +1,132 @@
+#ifndef _VOLTAGERING_H_
+#define _VOLTAGERING_H_
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "channelizer.h"
+
+// ---------------------------------------------------------------------------
+//
+// VOLTAGERING
+//
+// Streams the complex spectra of a channelizer (see PFB::setVoltageOutput)
+// to a POSIX shared memory ring (/dev/shm/fastspec_voltage) so that another
+// process can correlate or average them coherently without re-channelizing
+// raw dumps.  The segment begins with a VoltageRingHeader, followed by the
+// gain of each channel (uNumChannels floats, 1 for floating point values)
+// and uNumSlots slots.  Each slot is a VoltageRingSlot followed by
+// uNumChannels complex values of uBitsPerValue bits per part, real first.
+// The values of integer spectra divided by the gains are the voltages.
+//
+// Spectrum n (counting from 0) goes to slot n % uNumSlots, and uHead is the
+// number of spectra started.  Each slot has its own sequence lock: the
+// writer sets uSequence to 2n+1 before writing spectrum n and to 2n+2 when
+// done, so a reader copies the slot and keeps the copy only if uSequence
+// was 2n+2 before and after.  A writer waits for the slot's previous 
+// spectrum (2(n-uNumSlots)+2) to be complete before claiming it, so two
+// writers never share a slot.  The writer never waits for readers, so a
+// reader that falls more than uNumSlots spectra behind loses the oldest.
+// Spectra from different threads are written concurrently to different
+// slots, so readers should order them by uSample.
+//
+// ---------------------------------------------------------------------------
+
+#define VOLTAGERING_NAME          "/fastspec_voltage"
+#define VOLTAGERING_MAGIC         0x46535652    // "RVSF"
+#define VOLTAGERING_VERSION       1
+
+struct VoltageRingHeader {
+  uint32_t  uMagic;
+  uint32_t  uVersion;
+  uint64_t  uHead;                          // Spectra started so far
+  uint32_t  uNumSlots;
+  uint32_t  uSlotBytes;                     // Slot header and values
+  uint32_t  uNumChannels;
+  uint32_t  uBitsPerValue;                  // Per real or imaginary part
+  double    dStartFreq;                     // MHz
+  double    dStopFreq;                      // MHz
+};
+
+struct VoltageRingSlot {
+  uint64_t  uSequence;                      // Odd while being written
+  uint64_t  uSample;                        // First input sample of the frame
+  uint32_t  uId;                            // Channelizer
+  uint32_t  uSwitchState;
+  double    dADCmin;
+  double    dADCmax;
+};
+
+
+// ---------------------------------------------------------------------------
+// VoltageRing -- Writer side, owned by the spectrometer
+// ---------------------------------------------------------------------------
+class VoltageRing {
+
+  private:
+
+    std::string       m_sName;
+    VoltageRingHeader* m_pHeader;
+    float*            m_pGains;
+    char*             m_pSlots;
+    size_t            m_uSize;
+    size_t            m_uValueBytes;        // Per slot
+    uint64_t          m_uNext;              // Next spectrum (atomic)
+    int               m_iGains;             // Gains written (atomic)
+
+  public:
+
+    // Constructor and destructor
+    VoltageRing();
+    ~VoltageRing();
+
+    // Create the ring with uNumSlots slots of uNumChannels channels with
+    // uBits per part, for the given frequency range (MHz)
+    bool    open(const std::string&, unsigned int, unsigned int, unsigned int,
+                 double, double);
+    void    close();
+    bool    isOpen() const { return (m_pHeader != NULL); }
+
+    // Copy a complex spectrum into the next slot.  Returns false if the
+    // spectrum has no complex values or doesn't match the ring.  Can be
+    // called from several threads at once.
+    template<typename T>
+    bool    write(ChannelizerData<T>*, unsigned int);
+};
+
+
+// ---------------------------------------------------------------------------
+// VoltageRingReader -- Reader side, used by consumers
+// ---------------------------------------------------------------------------
+class VoltageRingReader {
+
+  private:
+
+    std::string       m_sName;
+    VoltageRingHeader* m_pHeader;
+    size_t            m_uSize;
+
+  public:
+
+    // Constructor and destructor
+    VoltageRingReader();
+    ~VoltageRingReader();
+
+    bool    open(const std::string&);
+    void    close();
+    bool    isOpen() const { return (m_pHeader != NULL); }
+
+    const VoltageRingHeader* header() const { return m_pHeader; }
+
+    // Number of spectra started so far (the next to read is at most this)
+    uint64_t  head() const;
+
+    // Gain of each channel
+    void    gains(std::vector<float>&) const;
+
+    // Consistent copy of spectrum n.  Returns false if it hasn't been
+    // written yet or has already been overwritten.
+    bool    read(uint64_t, VoltageRingSlot&, std::vector<uint8_t>&) const;
+};
+
+#endif // _VOLTAGERING_H_